@@ -0,0 +1,152 @@
+// Files per second of `vm --batch` with each reader against one vm process per file, the loop a
+// nightly job runs today. Writes --count generated programs to a temporary directory and runs the
+// vm binary next to this benchmark.
+//
+// Usage: bench_batch [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+
+#include "bench.h"
+
+enum {
+    // NOTE: Process startup dominates, a sample of the files gives a stable rate
+    PerProcessFiles = 500,
+};
+
+extern char **environ;
+
+typedef struct workload {
+    char Vm[PATH_MAX];
+    char List[PATH_MAX];
+    char **Paths;
+    size_t Count;
+    char *Reader;
+} workload;
+
+static bool runVm(char **Args) {
+    posix_spawn_file_actions_t Actions;
+    posix_spawn_file_actions_init(&Actions);
+    posix_spawn_file_actions_addopen(&Actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&Actions, 2, "/dev/null", O_WRONLY, 0);
+
+    pid_t Child;
+    int Status;
+    if(posix_spawn(&Child, Args[0], &Actions, 0, Args, environ) != 0 || waitpid(Child, &Status, 0) != Child) {
+        fatalError("Could not run %s", Args[0]);
+    }
+    posix_spawn_file_actions_destroy(&Actions);
+    return WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+}
+
+static void perProcessBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        char *Args[] = {Work->Vm, Work->Paths[Index], "3", "5", 0};
+        runVm(Args);
+    }
+}
+
+static void batchBody(void *Data) {
+    workload *Work = Data;
+    char *Args[] = {Work->Vm, "--reader", Work->Reader, "--batch", Work->List, "3", "5", 0};
+    runVm(Args);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static workload Work;
+    char *Slash = strrchr(ArgVal[0], '/');
+    snprintf(Work.Vm, sizeof(Work.Vm), "%.*svm", Slash ? (int)(Slash - ArgVal[0] + 1) : 0, ArgVal[0]);
+    if(access(Work.Vm, X_OK) != 0) {
+        printf("%s not found, skipped\n", Work.Vm);
+        return 0;
+    }
+
+    char Dir[] = "/tmp/bench_batch.XXXXXX";
+    if(!mkdtemp(Dir)) {
+        fatalError("Could not create a temporary directory");
+    }
+
+    snprintf(Work.List, sizeof(Work.List), "%s/list", Dir);
+    FILE *List = fopen(Work.List, "w");
+    size_t Bytes = 0;
+    for(int Index = 0; Index < Options.Count; ++Index) {
+        char *Source = 0;
+        generateNode(&Source, &Options, Options.Size, 0, 0);
+        bufPush(Source, 0);
+
+        size_t CodeSize;
+        uint8_t *Code = generateCode(parseSource(Source), &CodeSize);
+        char Path[PATH_MAX];
+        snprintf(Path, sizeof(Path), "%s/%06d.bin", Dir, Index);
+        FILE *File = fopen(Path, "wb");
+        if(!File || fwrite(Code, 1, CodeSize, File) != CodeSize || fclose(File) != 0) {
+            fatalError("Could not write %s", Path);
+        }
+        fprintf(List, "%s\n", Path);
+        bufPush(Work.Paths, strdup(Path));
+        Bytes += CodeSize;
+
+        bufFree(Code);
+        bufFree(Source);
+    }
+    fclose(List);
+
+    printf("%d files, %zu bytecode bytes\n", Options.Count, Bytes);
+
+    Work.Count = min((size_t)PerProcessFiles, bufLength(Work.Paths));
+    benchMeasure(&Options, "per-process", "ns/file", perProcessBody, &Work, Work.Count, 0);
+    double PerProcess = Results[ResultCount - 1].Median;
+    printf("%20s %10.0f files/s\n", "", 1e9/PerProcess);
+
+    static char *Readers[] = {"uring", "threads"};
+    static char Names[2][32];
+    for(int Reader = 0; Reader < (int)arrayCount(Readers); ++Reader) {
+        Work.Reader = Readers[Reader];
+        char *Probe[] = {Work.Vm, "--reader", Work.Reader, "--batch", "/dev/null", 0};
+        if(!runVm(Probe)) {
+            printf("batch %s unavailable, skipped\n", Work.Reader);
+            continue;
+        }
+        snprintf(Names[Reader], sizeof(Names[Reader]), "batch %s", Readers[Reader]);
+        benchMeasure(&Options, Names[Reader], "ns/file", batchBody, &Work, Options.Count, Bytes);
+        double Median = Results[ResultCount - 1].Median;
+        printf("%20s %10.0f files/s, %.1fx the per-process loop\n", "", 1e9/Median, PerProcess/Median);
+    }
+
+    benchWriteJson(&Options, "batch");
+
+    for(size_t Index = 0; Index < bufLength(Work.Paths); ++Index) {
+        unlink(Work.Paths[Index]);
+        free(Work.Paths[Index]);
+    }
+    bufFree(Work.Paths);
+    unlink(Work.List);
+    rmdir(Dir);
+    return 0;
+}
@@ -0,0 +1,18 @@
+// Helpers shared by the benchmarks, included after the Common/ sources they need.
+
+#include "harness.h"
+
+static arena BenchArena;
+
+static expression *parseSource(char *Source) {
+    lexer Lexer = {};
+    return parseExpression(&Lexer, &BenchArena, Source);
+}
+
+static uint8_t *generateCode(expression *Ast, size_t *CodeSize) {
+    uint8_t *Code = 0;
+    printBinary(&Code, Ast);
+    bufPush(Code, HALT);
+    *CodeSize = bufLength(Code);
+    return Code;
+}
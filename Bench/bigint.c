@@ -0,0 +1,198 @@
+// Arbitrary precision arithmetic on large operands: schoolbook against Karatsuba multiplication
+// per operand size, exponentiation by squaring against repeated multiplication, word-at-a-time
+// shifts and bitwise operators, and executeBigVm() on a program building big masks and powers.
+// Karatsuba results are checked against schoolbook ones.
+//
+// Usage: bench_bigint [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <vm.c>
+#include <bigint.c>
+#include <bigvm.c>
+
+#include "bench.h"
+
+enum {
+    // NOTE: Operations per timed run, fewer for the large sizes
+    MulWork = 1<<24,
+    PowExponent = 1<<14,
+    BitwiseLimbs = 1<<16,
+    BitwiseRuns = 64,
+};
+
+static size_t MulSizes[] = {8, 16, 32, 48, 64, 128, 512, 2048, 4096};
+
+typedef struct workload {
+    arena Arena;
+    bigint A, B;
+    size_t Runs;
+    bigint Result;
+
+    uint8_t *Code;
+    bigint Params[MaxParamCount];
+} workload;
+
+static bigint randomBigint(arena *Arena, size_t Count) {
+    bigint Value = bigAlloc(Arena, Count);
+    for(size_t Index = 0; Index < Count; ++Index) {
+        Value.Limbs[Index] = (uint64_t)randomU32() << 32 | randomU32();
+    }
+    Value.Limbs[Count - 1] |= 1;
+    return bigTrim(Value);
+}
+
+static void mulBody(void *Data) {
+    workload *Work = Data;
+    big_error Error = BigError_None;
+    for(size_t Run = 0; Run < Work->Runs; ++Run) {
+        arenaFree(&Work->Arena);
+        Work->Result = bigMul(&Work->Arena, Work->A, Work->B, &Error);
+    }
+}
+
+static void powBody(void *Data) {
+    workload *Work = Data;
+    big_error Error = BigError_None;
+    arenaFree(&Work->Arena);
+    Work->Result = bigPow(&Work->Arena, Work->A, Work->B, &Error);
+}
+
+// NOTE: What exponentiation would cost without squaring, one multiplication by the base per unit
+static void repeatedMulBody(void *Data) {
+    workload *Work = Data;
+    big_error Error = BigError_None;
+    arenaFree(&Work->Arena);
+    bigint Result = bigFromU64(&Work->Arena, 1);
+    for(size_t Run = 0; Run < Work->Runs; ++Run) {
+        Result = bigMul(&Work->Arena, Result, Work->A, &Error);
+    }
+    Work->Result = Result;
+}
+
+static void shiftBody(void *Data) {
+    workload *Work = Data;
+    big_error Error = BigError_None;
+    for(size_t Run = 0; Run < Work->Runs; ++Run) {
+        arenaFree(&Work->Arena);
+        bigint Left = bigShiftLeft(&Work->Arena, Work->A, 12345, &Error);
+        Work->Result = bigShiftRight(&Work->Arena, Left, 6789);
+    }
+}
+
+static void bitwiseBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Run = 0; Run < Work->Runs; ++Run) {
+        arenaFree(&Work->Arena);
+        bigint And = bigBitwise(&Work->Arena, Big_And, Work->A, Work->B);
+        bigint Or = bigBitwise(&Work->Arena, Big_Or, And, Work->B);
+        Work->Result = bigBitwise(&Work->Arena, Big_Xor, Or, Work->A);
+    }
+}
+
+static void vmBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Run = 0; Run < Work->Runs; ++Run) {
+        arenaFree(&Work->Arena);
+        Work->Result = executeBigVm(&Work->Arena, Work->Code, Work->Params);
+    }
+}
+
+static bool bigEqual(bigint A, bigint B) {
+    return A.Negative == B.Negative && bigCompareMagnitude(A.Limbs, A.Count, B.Limbs, B.Count) == 0;
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+    static workload Work;
+    arena Operands = {};
+
+    static char Names[64][32];
+    int NameCount = 0;
+
+    for(int Size = 0; Size < (int)arrayCount(MulSizes); ++Size) {
+        size_t Count = MulSizes[Size];
+        Work.A = randomBigint(&Operands, Count);
+        Work.B = randomBigint(&Operands, Count);
+        Work.Runs = max(MulWork/(Count*Count), (size_t)1);
+
+        BigKaratsubaLimbs = SIZE_MAX;
+        snprintf(Names[NameCount], sizeof(Names[NameCount]), "schoolbook %zu", Count);
+        benchMeasure(&Options, Names[NameCount++], "ns/mul", mulBody, &Work, Work.Runs, 0);
+        double Schoolbook = Results[ResultCount - 1].Median;
+
+        arena Expected = {};
+        big_error Error = BigError_None;
+        bigint Product = bigMul(&Expected, Work.A, Work.B, &Error);
+
+        BigKaratsubaLimbs = BigKaratsubaDefault;
+        snprintf(Names[NameCount], sizeof(Names[NameCount]), "karatsuba %zu", Count);
+        benchMeasure(&Options, Names[NameCount++], "ns/mul", mulBody, &Work, Work.Runs, 0);
+        printf("%20s %10.2fx schoolbook\n", "", Schoolbook/Results[ResultCount - 1].Median);
+
+        if(!bigEqual(Work.Result, Product)) {
+            fatalError("Karatsuba and schoolbook disagree at %zu limbs", Count);
+        }
+        arenaFree(&Expected);
+    }
+
+    // NOTE: 3 ** 2^14 has about 410 limbs
+    Work.A = bigFromU64(&Operands, 3);
+    Work.B = bigFromU64(&Operands, PowExponent);
+    benchMeasure(&Options, "pow squaring", "ns/pow", powBody, &Work, 1, 0);
+    double Squaring = Results[ResultCount - 1].Median;
+    bigint Power = Work.Result;
+    arena Kept = Work.Arena;
+    Work.Arena = (arena){};
+
+    Work.Runs = PowExponent;
+    benchMeasure(&Options, "pow repeated mul", "ns/pow", repeatedMulBody, &Work, 1, 0);
+    printf("%20s %10.2fx repeated multiplication\n", "", Results[ResultCount - 1].Median/Squaring);
+    if(!bigEqual(Work.Result, Power)) {
+        fatalError("Exponentiation by squaring is wrong");
+    }
+    arenaFree(&Kept);
+
+    // NOTE: A negative operand exercises the two's complement conversion of every limb
+    Work.A = randomBigint(&Operands, BitwiseLimbs);
+    Work.B = bigNegate(randomBigint(&Operands, BitwiseLimbs));
+    Work.Runs = BitwiseRuns;
+    double Bytes = (double)BitwiseRuns*BitwiseLimbs*sizeof(uint64_t);
+    benchMeasure(&Options, "shift", "ns/limb", shiftBody, &Work, (double)BitwiseRuns*BitwiseLimbs, Bytes);
+    benchMeasure(&Options, "and or xor", "ns/limb", bitwiseBody, &Work, (double)BitwiseRuns*BitwiseLimbs, Bytes);
+
+    char *Source = "((($0 << 4096) - 1) & ~($1 ** 64) ^ ($0 * $1) ** 16) % ($1 | 1 << 1000) + ($0 >> 77)";
+    Work.Code = 0;
+    printBinaryBig(&Work.Code, parseSource(Source), Source);
+    bufPush(Work.Code, HALT);
+    Work.Params[0] = randomBigint(&Operands, 16);
+    Work.Params[1] = bigNegate(randomBigint(&Operands, 24));
+    Work.Runs = 256;
+    printf("%s\n", Source);
+    benchMeasure(&Options, "executeBigVm", "ns/run", vmBody, &Work, Work.Runs, 0);
+
+    benchWriteJson(&Options, "bigint");
+
+    bufFree(Work.Code);
+    arenaFree(&Work.Arena);
+    arenaFree(&Operands);
+    return 0;
+}
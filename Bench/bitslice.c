@@ -0,0 +1,117 @@
+// Throughput of the bit-sliced evaluator against the VM batch path, over --count random inputs to
+// a few pure-bitwise expressions. Both widths have to agree with the VM on every input.
+//
+// Usage: bench_bitslice [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <vm.c>
+#include <bitslice.c>
+
+#include "bench.h"
+
+static struct {
+    char *Name;
+    char *Source;
+} Sources[] = {
+    {"mix", "($0 & $1) ^ (~$2 | ($0 >> 3)) ^ ($1 << 5) | ($2 & 0xF0F0F0F0)"},
+    {"masks", "(($0 ^ $1) & 0x55555555) | (($0 << 1) & ~$1 & 0xAAAAAAAA) ^ ($2 >> 7)"},
+    {"select", "$0 < $1 ? $2 & 0xFFFF : $0 == $2 ? ~$1 : $1 ^ $2"},
+};
+
+typedef struct workload {
+    bitslice_program *Prog;
+    uint8_t *Code;
+    int32_t *Params;
+    int ParamStride;
+    int32_t *Results;
+    size_t Count;
+    int Words;
+} workload;
+
+static void vmBody(void *Data) {
+    workload *Work = Data;
+    executeVmBatch(Work->Code, Work->Params, Work->ParamStride, Work->Results, Work->Count);
+}
+
+static void bitsliceBody(void *Data) {
+    workload *Work = Data;
+    bitsliceRunWidth(Work->Prog, Work->Params, Work->ParamStride, Work->Results, Work->Count, Work->Words);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    workload Work = {.ParamStride = 3, .Count = Options.Count};
+    Work.Params = xMalloc(Work.Count*Work.ParamStride*sizeof(int32_t));
+    Work.Results = xMalloc(Work.Count*sizeof(int32_t));
+    int32_t *Expected = xMalloc(Work.Count*sizeof(int32_t));
+    for(size_t Index = 0; Index < Work.Count*Work.ParamStride; ++Index) {
+        Work.Params[Index] = randomU32();
+    }
+
+    static char Names[arrayCount(Sources)][3][32];
+    for(int Source = 0; Source < (int)arrayCount(Sources); ++Source) {
+        char *Name = Sources[Source].Name;
+        expression *Ast = parseSource(Sources[Source].Source);
+        Work.Prog = bitsliceCompile(Ast);
+        if(!Work.Prog) {
+            fatalError("%s is not eligible for bit slicing", Name);
+        }
+        size_t CodeSize;
+        Work.Code = generateCode(Ast, &CodeSize);
+        printf("%s: %s, %zu bytes, %zu slice ops\n", Name, Sources[Source].Source, CodeSize, bufLength(Work.Prog->Ops));
+
+        snprintf(Names[Source][0], sizeof(Names[Source][0]), "%s vm batch", Name);
+        benchMeasure(&Options, Names[Source][0], "ns/input", vmBody, &Work, Work.Count, 0);
+        double Baseline = Results[ResultCount - 1].Median;
+        memcpy(Expected, Work.Results, Work.Count*sizeof(int32_t));
+
+        for(int Width = 0; Width < 2; ++Width) {
+            Work.Words = Width ? 4 : 1;
+            if(Width && !bitsliceHasAvx2()) {
+                break;
+            }
+
+            snprintf(Names[Source][1 + Width], sizeof(Names[Source][1 + Width]), "%s bitslice x%d", Name,
+                     64*Work.Words);
+            benchMeasure(&Options, Names[Source][1 + Width], "ns/input", bitsliceBody, &Work, Work.Count, 0);
+            printf("%20s %10.2fx faster than the VM\n", "", Baseline/Results[ResultCount - 1].Median);
+            for(size_t Index = 0; Index < Work.Count; ++Index) {
+                if(Work.Results[Index] != Expected[Index]) {
+                    fatalError("%d-lane mismatch at input %zu: %d != %d", 64*Work.Words, Index,
+                               Work.Results[Index], Expected[Index]);
+                }
+            }
+        }
+
+        bitsliceFree(Work.Prog);
+        bufFree(Work.Code);
+        arenaFree(&BenchArena);
+    }
+
+    benchWriteJson(&Options, "bitslice");
+
+    free(Work.Params);
+    free(Work.Results);
+    free(Expected);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Compares two benchmark runs and flags regressions.
+
+Usage: compare.py OLD NEW [--threshold PERCENT]
+
+OLD and NEW are JSON files written by the benchmarks, or directories of them such as the
+results of two `make bench BENCH_RESULTS=DIR` runs. Results are matched by benchmark and name.
+All values are times per unit of work, so a larger median is slower. Exits with status 1 when
+any result got slower by more than the threshold.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+
+def load(path):
+    paths = [path]
+    if os.path.isdir(path):
+        paths = sorted(os.path.join(path, name) for name in os.listdir(path) if name.endswith(".json"))
+
+    results = {}
+    for file in paths:
+        with open(file) as handle:
+            run = json.load(handle)
+        for result in run["results"]:
+            results[(run["benchmark"], result["name"])] = result
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flag regressions between two benchmark runs.")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=5.0, help="percent slowdown to flag (default 5)")
+    args = parser.parse_args()
+
+    old, new = load(args.old), load(args.new)
+    regressions = 0
+
+    print(f"{'benchmark':<32} {'old':>12} {'new':>12} {'change':>9}")
+    for key in sorted(old.keys() & new.keys()):
+        before, after = old[key], new[key]
+        change = (after["median"] / before["median"] - 1) * 100 if before["median"] else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  improved"
+
+        name = f"{key[0]}/{key[1]}"
+        unit = after["unit"]
+        print(f"{name:<32} {before['median']:>12.2f} {after['median']:>12.2f} {change:>+8.1f}%  {unit}{flag}")
+
+    for key in sorted(old.keys() ^ new.keys()):
+        print(f"{key[0]}/{key[1]:<32} only in {'old' if key in old else 'new'} run")
+
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,110 @@
+// compiler --batch throughput over --count generated expressions, with 1, 2, 4... threads up to
+// twice the CPU count. Every module has to be byte for byte the one compiled by a single thread.
+//
+// Usage: bench_compile_batch [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <specialize.c>
+#include <generator.c>
+#include <vm.c>
+#include <peephole.c>
+#include <compile.c>
+#include <threadpool.c>
+#include <module.c>
+
+#include "../Compiler/batch.c"
+
+#include "harness.h"
+
+typedef struct workload {
+    char **Lines;
+    size_t LineCount;
+    thread_pool *Pool;
+    uint8_t *Module;
+} workload;
+
+static void compileBody(void *Data) {
+    workload *Work = Data;
+    batch_error *Errors = 0;
+    bufHeader_(Work->Module)->Length = 0;
+    batchCompile(Work->Pool, Work->Lines, Work->LineCount, LutDefaultBits, 0, &Work->Module, &Errors);
+    if(bufLength(Errors)) {
+        fatalError("Line %zu did not compile", Errors[0].Line);
+    }
+    bufFree(Errors);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+    corpus Corpus = generateCorpus(&Options);
+
+    workload Work = {.LineCount = Corpus.Count};
+    for(size_t Index = 0; Index < Corpus.Count; ++Index) {
+        bufPush(Work.Lines, Corpus.Text + Corpus.Starts[Index]);
+    }
+    bufPush(Work.Module, 0);
+
+    long CpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%zu expressions, %zu bytes, %ld cpus\n", Corpus.Count, Corpus.Bytes, CpuCount);
+
+    uint8_t *Expected = 0;
+    double Single = 0;
+    static char Names[8][32];
+    for(int Threads = 1, Run = 0; Run < (int)arrayCount(Names) && Threads <= max(CpuCount, 2)*2; Threads *= 2, ++Run) {
+        thread_pool Pool;
+        threadPoolInit(&Pool, Threads);
+        Work.Pool = &Pool;
+
+        snprintf(Names[Run], sizeof(Names[Run]), "batch x%d", Threads);
+        benchMeasure(&Options, Names[Run], "ns/expr", compileBody, &Work, Corpus.Count, Corpus.Bytes);
+        if(!Expected) {
+            Single = Results[ResultCount - 1].Median;
+            for(size_t Index = 0; Index < bufLength(Work.Module); ++Index) {
+                bufPush(Expected, Work.Module[Index]);
+            }
+        } else {
+            printf("%20s %10.2fx speedup over one thread\n", "", Single/Results[ResultCount - 1].Median);
+            if(bufLength(Expected) != bufLength(Work.Module) ||
+               memcmp(Expected, Work.Module, bufLength(Expected)) != 0)
+            {
+                fatalError("The module compiled by %d threads differs from the single threaded one", Threads);
+            }
+        }
+
+        threadPoolFree(&Pool);
+    }
+
+    benchWriteJson(&Options, "compile_batch");
+
+    bufFree(Expected);
+    bufFree(Work.Module);
+    bufFree(Work.Lines);
+    corpusFree(&Corpus);
+    return 0;
+}
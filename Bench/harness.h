@@ -0,0 +1,357 @@
+// Timing, seeded workload generation and result reporting shared by all benchmarks. Needs
+// common.c, stretchy.c, lexer.c and an operator Table, either the parser's or the interpreter's.
+//
+// Results are printed as a table and, when --json FILE or the BENCH_JSON environment variable is
+// given, written as JSON for Bench/compare.py.
+
+enum {
+    Repetitions = 5,
+    MaxRepetitions = 64,
+    MaxResults = 64,
+    MaxGeneratorOps = 64,
+};
+
+static double nowSeconds(void) {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return Time.tv_sec + Time.tv_nsec*1e-9;
+}
+
+static uint64_t RandomState = 0x9E3779B97F4A7C15;
+static uint32_t randomU32(void) {
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (uint32_t)RandomState;
+}
+
+static void randomSeed(uint64_t Seed) {
+    RandomState = Seed ? Seed : 0x9E3779B97F4A7C15;
+}
+
+typedef struct bench_options {
+    uint64_t Seed;
+    int Count;
+    int Repetitions;
+    char *JsonPath;
+
+    // NOTE: Expression generator
+    int Size;
+    int MaxDepth;
+    int ParamCount;
+    int Radix;
+    char *Operators;
+    token_type Ops[MaxGeneratorOps];
+    int OpCount;
+} bench_options;
+
+typedef struct bench_result {
+    char *Name;
+    char *Unit;
+    double Median;
+    double Best;
+    double MegabytesPerSecond;
+} bench_result;
+
+static bench_result Results[MaxResults];
+static int ResultCount;
+
+static struct {
+    char *Name;
+    token_type Type;
+} GeneratorOps[] = {
+    {"+", Token_Add}, {"-", Token_Subtract}, {"|", Token_BitOr}, {"^", Token_BitXor},
+    {"*", Token_Multiply}, {"/", Token_Divide}, {"%", Token_Mod}, {"<<", Token_LShift},
+    {">>", Token_RShift}, {"&", Token_BitAnd}, {"**", Token_Power},
+    {"~", Token_BitNot}, {"neg", Token_UnaryMinus},
+    {"<", Token_Less}, {"<=", Token_LessEqual}, {"==", Token_Equal}, {"!=", Token_NotEqual},
+    {"?:", Token_Question},
+};
+
+static void benchUsage(char *Program) {
+    fprintf(stderr, "Usage: %s [OPTION...]\n", Program);
+    fprintf(stderr, "  --seed N       Random seed of the generated workload\n");
+    fprintf(stderr, "  --count N      Number of generated expressions\n");
+    fprintf(stderr, "  --size N       Operators per expression\n");
+    fprintf(stderr, "  --depth N      Maximum nesting depth\n");
+    fprintf(stderr, "  --params N     Parameters $0..$(N-1) leaves may reference, 0 for literals only\n");
+    fprintf(stderr, "  --radix R      Literal radix 2, 8, 10 or 16, 0 mixes all of them\n");
+    fprintf(stderr, "  --ops \"OP...\"  Operator mix, repeat an operator to make it more likely\n");
+    fprintf(stderr, "                 (+ - | ^ * / %% << >> & ** ~ neg < <= == != ?:)\n");
+    fprintf(stderr, "  --reps N       Timed repetitions after one warmup run\n");
+    fprintf(stderr, "  --json FILE    Also write the results as JSON (default: $BENCH_JSON)\n");
+    exit(1);
+}
+
+static void benchParseOperators(bench_options *Options, char *Program) {
+    char *Spec = Options->Operators;
+    Options->OpCount = 0;
+
+    while(*Spec) {
+        size_t Length = strcspn(Spec, " ,");
+        bool Found = false;
+        for(int Op = 0; Length && Op < (int)arrayCount(GeneratorOps); ++Op) {
+            if(strlen(GeneratorOps[Op].Name) == Length && strncmp(GeneratorOps[Op].Name, Spec, Length) == 0) {
+                if(Options->OpCount == MaxGeneratorOps) {
+                    benchUsage(Program);
+                }
+                Options->Ops[Options->OpCount++] = GeneratorOps[Op].Type;
+                Found = true;
+            }
+        }
+        if(Length && !Found) {
+            benchUsage(Program);
+        }
+
+        Spec += Length;
+        Spec += *Spec != 0;
+    }
+
+    if(!Options->OpCount) {
+        benchUsage(Program);
+    }
+}
+
+static bench_options benchParseOptions(int ArgCount, char *ArgVal[]) {
+    bench_options Options = {
+        .Seed = 1,
+        .Count = 20000,
+        .Repetitions = Repetitions,
+        .JsonPath = getenv("BENCH_JSON"),
+        .Size = 16,
+        .MaxDepth = 12,
+        .ParamCount = 4,
+        .Radix = 0,
+        .Operators = "+ + - | ^ * & << >> / % ~ neg",
+    };
+
+    for(int Index = 1; Index < ArgCount; ++Index) {
+        char *Arg = ArgVal[Index];
+        if(Index + 1 == ArgCount) {
+            benchUsage(ArgVal[0]);
+        }
+
+        char *Value = ArgVal[++Index];
+        if(strcmp(Arg, "--seed") == 0)        { Options.Seed = strtoull(Value, 0, 0); }
+        else if(strcmp(Arg, "--count") == 0)  { Options.Count = atoi(Value); }
+        else if(strcmp(Arg, "--size") == 0)   { Options.Size = atoi(Value); }
+        else if(strcmp(Arg, "--depth") == 0)  { Options.MaxDepth = atoi(Value); }
+        else if(strcmp(Arg, "--params") == 0) { Options.ParamCount = atoi(Value); }
+        else if(strcmp(Arg, "--radix") == 0)  { Options.Radix = atoi(Value); }
+        else if(strcmp(Arg, "--ops") == 0)    { Options.Operators = Value; }
+        else if(strcmp(Arg, "--reps") == 0)   { Options.Repetitions = atoi(Value); }
+        else if(strcmp(Arg, "--json") == 0)   { Options.JsonPath = Value; }
+        else {
+            benchUsage(ArgVal[0]);
+        }
+    }
+
+    bool ValidRadix = Options.Radix == 0 || Options.Radix == 2 || Options.Radix == 8 ||
+                      Options.Radix == 10 || Options.Radix == 16;
+    if(Options.Count <= 0 || Options.Size < 0 || Options.MaxDepth < 0 || !ValidRadix ||
+       Options.ParamCount < 0 || Options.ParamCount > MaxParamCount ||
+       Options.Repetitions <= 0 || Options.Repetitions > MaxRepetitions)
+    {
+        benchUsage(ArgVal[0]);
+    }
+
+    benchParseOperators(&Options, ArgVal[0]);
+    randomSeed(Options.Seed);
+    return Options;
+}
+
+static void appendText(char **Out, char *Text, size_t Length) {
+    if(!Length) {
+        return;
+    }
+    bufFit(*Out, bufLength(*Out) + Length);
+    memcpy(*Out + bufLength(*Out), Text, Length);
+    bufHeader_(*Out)->Length += Length;
+}
+
+static void generateLiteral(char **Out, bench_options *Options, uint32_t Value) {
+    static int Radixes[] = {2, 8, 10, 16};
+    int Radix = Options->Radix ? Options->Radix : Radixes[randomU32() % arrayCount(Radixes)];
+
+    char Digits[40];
+    char *End = Digits + sizeof(Digits), *At = End;
+    do {
+        *--At = "0123456789ABCDEF"[Value % Radix];
+        Value /= Radix;
+    } while(Value);
+
+    char *Prefix = Radix == 2 ? "0b" : Radix == 16 ? "0x" : (Radix == 8 && *At != '0') ? "0" : "";
+    appendText(Out, Prefix, strlen(Prefix));
+    appendText(Out, At, End - At);
+}
+
+static void generateLeaf(char **Out, bench_options *Options) {
+    if(Options->ParamCount && randomU32() % 2) {
+        char Param[16];
+        int Length = sprintf(Param, "$%u", randomU32() % Options->ParamCount);
+        appendText(Out, Param, Length);
+    } else {
+        uint32_t Random = randomU32();
+        generateLiteral(Out, Options, (Random & 1) ? randomU32() : (Random >> 1) % 256);
+    }
+}
+
+// NOTE: Emits a random expression with OpCount operators. A child is only parenthesized where
+// the grammar needs it, when its operator binds less tightly than MinPrecedence. Divisors, shift
+// amounts and exponents are small literals, so generated expressions never trap.
+static void generateNode(char **Out, bench_options *Options, int OpCount, int Depth, int MinPrecedence) {
+    if(OpCount == 0 || Depth >= Options->MaxDepth) {
+        generateLeaf(Out, Options);
+        return;
+    }
+
+    token_type Type = Options->Ops[randomU32() % Options->OpCount];
+    operator *Op = Table + Type;
+    bool Parens = Op->Precedence < MinPrecedence;
+    if(Parens) {
+        bufPush(*Out, '(');
+    }
+
+    if(Op->Kind == Operator_Unary) {
+        bufPush(*Out, Type == Token_BitNot ? '~' : '-');
+        generateNode(Out, Options, OpCount - 1, Depth + 1, Op->Precedence);
+    } else if(Op->Kind == Operator_Select) {
+        int CondOps = randomU32() % OpCount;
+        int ThenOps = randomU32() % (OpCount - CondOps);
+        generateNode(Out, Options, CondOps, Depth + 1, Op->Precedence + 1);
+        appendText(Out, " ? ", 3);
+        generateNode(Out, Options, ThenOps, Depth + 1, 0);
+        appendText(Out, " : ", 3);
+        generateNode(Out, Options, OpCount - 1 - CondOps - ThenOps, Depth + 1, Op->Precedence);
+    } else {
+        int LhsPrecedence = Op->Precedence + (Op->Associativity == Assoc_Right);
+        int RhsPrecedence = Op->Precedence + (Op->Associativity == Assoc_Left);
+
+        char *Name = 0;
+        for(int Index = 0; Index < (int)arrayCount(GeneratorOps); ++Index) {
+            if(GeneratorOps[Index].Type == Type) {
+                Name = GeneratorOps[Index].Name;
+            }
+        }
+
+        if(Type == Token_Divide || Type == Token_Mod || Type == Token_LShift ||
+           Type == Token_RShift || Type == Token_Power)
+        {
+            uint32_t Limit = Type == Token_Power ? 4 : Type == Token_LShift || Type == Token_RShift ? 32 : 255;
+            generateNode(Out, Options, OpCount - 1, Depth + 1, LhsPrecedence);
+            bufPush(*Out, ' ');
+            appendText(Out, Name, strlen(Name));
+            bufPush(*Out, ' ');
+            generateLiteral(Out, Options, randomU32() % Limit + (Limit == 255));
+        } else {
+            int LhsOps = randomU32() % OpCount;
+            generateNode(Out, Options, LhsOps, Depth + 1, LhsPrecedence);
+            bufPush(*Out, ' ');
+            appendText(Out, Name, strlen(Name));
+            bufPush(*Out, ' ');
+            generateNode(Out, Options, OpCount - 1 - LhsOps, Depth + 1, RhsPrecedence);
+        }
+    }
+
+    if(Parens) {
+        bufPush(*Out, ')');
+    }
+}
+
+// NOTE: Count NUL-terminated expressions stored back to back
+typedef struct corpus {
+    char *Text;
+    size_t *Starts;
+    size_t Count;
+    size_t Bytes;
+    size_t Tokens;
+} corpus;
+
+static corpus generateCorpus(bench_options *Options) {
+    corpus Corpus = {};
+    for(int Index = 0; Index < Options->Count; ++Index) {
+        bufPush(Corpus.Starts, bufLength(Corpus.Text));
+        generateNode(&Corpus.Text, Options, Options->Size, 0, 0);
+        bufPush(Corpus.Text, 0);
+    }
+
+    Corpus.Count = bufLength(Corpus.Starts);
+    Corpus.Bytes = bufLength(Corpus.Text) - Corpus.Count;
+
+    lexer Lexer = {};
+    for(size_t Index = 0; Index < Corpus.Count; ++Index) {
+        for(lexerInit(&Lexer, Corpus.Text + Corpus.Starts[Index]); Lexer.Token.Type != Token_EOF; nextToken(&Lexer)) {
+            ++Corpus.Tokens;
+        }
+    }
+
+    return Corpus;
+}
+
+static void corpusFree(corpus *Corpus) {
+    bufFree(Corpus->Text);
+    bufFree(Corpus->Starts);
+}
+
+static int compareDoubles(const void *A, const void *B) {
+    double Lhs = *(double *)A, Rhs = *(double *)B;
+    return (Lhs > Rhs) - (Lhs < Rhs);
+}
+
+// NOTE: Runs Body once to warm caches and branch predictors, then times it Repetitions times.
+// Reported values are nanoseconds per unit of work, Bytes is the input size for MB/s or 0.
+static void benchMeasure(bench_options *Options, char *Name, char *Unit, void (*Body)(void *), void *Data,
+                         double Units, double Bytes)
+{
+    assert(ResultCount < MaxResults);
+
+    Body(Data);
+
+    double Times[MaxRepetitions];
+    for(int Rep = 0; Rep < Options->Repetitions; ++Rep) {
+        double Start = nowSeconds();
+        Body(Data);
+        Times[Rep] = nowSeconds() - Start;
+    }
+    qsort(Times, Options->Repetitions, sizeof(double), compareDoubles);
+
+    bench_result *Result = Results + ResultCount++;
+    double Median = Times[Options->Repetitions/2];
+    Result->Name = Name;
+    Result->Unit = Unit;
+    Result->Median = Median/Units*1e9;
+    Result->Best = Times[0]/Units*1e9;
+    Result->MegabytesPerSecond = Bytes ? Bytes/Median*1e-6 : 0;
+
+    printf("%-20s %10.2f %-10s (best %8.2f)", Name, Result->Median, Unit, Result->Best);
+    if(Bytes) {
+        printf(" %10.1f MB/s", Result->MegabytesPerSecond);
+    }
+    printf("\n");
+}
+
+static void benchWriteJson(bench_options *Options, char *Benchmark) {
+    if(!Options->JsonPath) {
+        return;
+    }
+
+    FILE *File = fopen(Options->JsonPath, "w");
+    if(!File) {
+        fatalError("Could not open %s for writing.", Options->JsonPath);
+    }
+
+    fprintf(File, "{\n  \"benchmark\": \"%s\",\n", Benchmark);
+    fprintf(File, "  \"options\": {\"seed\": %llu, \"count\": %d, \"size\": %d, \"depth\": %d, "
+            "\"params\": %d, \"radix\": %d, \"ops\": \"%s\", \"repetitions\": %d},\n",
+            (unsigned long long)Options->Seed, Options->Count, Options->Size, Options->MaxDepth,
+            Options->ParamCount, Options->Radix, Options->Operators, Options->Repetitions);
+    fprintf(File, "  \"results\": [\n");
+    for(int Index = 0; Index < ResultCount; ++Index) {
+        bench_result *Result = Results + Index;
+        fprintf(File, "    {\"name\": \"%s\", \"unit\": \"%s\", \"median\": %.4f, \"best\": %.4f, \"mb_per_s\": %.2f}%s\n",
+                Result->Name, Result->Unit, Result->Median, Result->Best, Result->MegabytesPerSecond,
+                Index + 1 < ResultCount ? "," : "");
+    }
+    fprintf(File, "  ]\n}\n");
+    fclose(File);
+}
@@ -0,0 +1,214 @@
+// Hand-written bit manipulation idioms against the builtins they spell: each idiom is compiled as
+// written, as written with idiomRewrite(), and as the builtin, then run over --count inputs. All
+// three have to agree on every input, and the rewrite has to recognize every idiom. The bits.c
+// helpers are checked against plain bit loops on the same inputs first.
+//
+// Usage: bench_idiom [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <vm.c>
+
+#include "bench.h"
+
+// NOTE: Steps are spelled like the templates in idiom.c, $0 is the previous step
+static struct {
+    char *Name;
+    char *Builtin;
+    char *Steps[12];
+} Idioms[] = {
+    {"popcount swar", "popcount($0)", {
+        "$0 - (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 + ($0 >> 4)) & 0x0F0F0F0F",
+        "($0 * 0x01010101) >> 24",
+    }},
+    {"popcount tree", "popcount($0)", {
+        "($0 & 0x55555555) + (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 & 0x0F0F0F0F) + (($0 >> 4) & 0x0F0F0F0F)",
+        "($0 & 0x00FF00FF) + (($0 >> 8) & 0x00FF00FF)",
+        "($0 & 0x0000FFFF) + (($0 >> 16) & 0x0000FFFF)",
+    }},
+    {"clz smear", "clz($0)", {
+        "$0 | ($0 >> 1)", "$0 | ($0 >> 2)", "$0 | ($0 >> 4)", "$0 | ($0 >> 8)", "$0 | ($0 >> 16)",
+        "~$0",
+        "$0 - (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 + ($0 >> 4)) & 0x0F0F0F0F",
+        "($0 * 0x01010101) >> 24",
+    }},
+    {"ctz", "ctz($0)", {
+        "($0 & -$0) - 1",
+        "$0 - (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 + ($0 >> 4)) & 0x0F0F0F0F",
+        "($0 * 0x01010101) >> 24",
+    }},
+    {"rotl", "rotl($0, 13)", {"($0 << 13) | (($0 >> 19) & 0x1FFF)"}},
+    {"bswap", "bswap($0)", {
+        "(($0 >> 24) & 0xFF) | (($0 >> 8) & 0xFF00) | (($0 << 8) & 0xFF0000) | ($0 << 24)",
+    }},
+    {"bit sum", "popcount($0 & 0xFF)", {
+        "($0 & 1) + (($0 >> 1) & 1) + (($0 >> 2) & 1) + (($0 >> 3) & 1) + "
+        "(($0 >> 4) & 1) + (($0 >> 5) & 1) + (($0 >> 6) & 1) + (($0 >> 7) & 1)",
+    }},
+    {"nibble gather", "pext($0, 0xF0F0)", {"(($0 >> 4) & 0xF) | (($0 >> 8) & 0xF0)"}},
+};
+
+typedef struct workload {
+    int Count;
+    int32_t *Inputs;
+    int32_t *Results;
+    uint8_t *Code;
+} workload;
+
+static void runBody(void *Data) {
+    workload *Work = Data;
+    int32_t Params[MaxParamCount] = {};
+    for(int Index = 0; Index < Work->Count; ++Index) {
+        Params[0] = Work->Inputs[Index];
+        Work->Results[Index] = executeVm(Work->Code, Params);
+    }
+}
+
+// NOTE: Replaces every $0 of each step with the previous one, parenthesized
+static char *expandSteps(char **Steps) {
+    char *Previous = 0;
+    bufPush(Previous, '$');
+    bufPush(Previous, '0');
+    for(int Step = 0; Steps[Step]; ++Step) {
+        char *Expanded = 0;
+        for(char *At = Steps[Step]; *At; ++At) {
+            if(At[0] == '$' && At[1] == '0' && Step > 0) {
+                bufPush(Expanded, '(');
+                appendText(&Expanded, Previous, bufLength(Previous));
+                bufPush(Expanded, ')');
+                ++At;
+            } else {
+                bufPush(Expanded, *At);
+            }
+        }
+        bufFree(Previous);
+        Previous = Expanded;
+    }
+    bufPush(Previous, 0);
+    return Previous;
+}
+
+static uint8_t *compileIdiom(char *Source, bool Rewrite, size_t *Nodes) {
+    expression *Ast = parseSource(Source);
+    if(Rewrite) {
+        idiomRewrite(&BenchArena, &Ast);
+    }
+    *Nodes = idiomCount(Ast);
+    lutCompile(&BenchArena, &Ast, LutDefaultBits);
+    size_t Size;
+    return generateCode(Ast, &Size);
+}
+
+static void checkBits(int32_t *Inputs, int Count) {
+    for(int Index = 0; Index + 1 < Count; ++Index) {
+        uint32_t Value = Inputs[Index], Mask = Inputs[Index + 1];
+        uint32_t Popcount = 0, Clz = 32, Ctz = 32, Pdep = 0, Pext = 0;
+        int Next = 0;
+        for(int Bit = 0; Bit < 32; ++Bit) {
+            if(Value & (1u << Bit)) {
+                ++Popcount;
+                Clz = 31 - Bit;
+                Ctz = min(Ctz, (uint32_t)Bit);
+            }
+            if(Mask & (1u << Bit)) {
+                Pdep |= ((Value >> Next) & 1) << Bit;
+                Pext |= ((Value >> Bit) & 1) << Next;
+                ++Next;
+            }
+        }
+        uint32_t Bswap = (Value >> 24) | ((Value >> 8) & 0xFF00) | ((Value << 8) & 0xFF0000) | (Value << 24);
+        uint32_t Rotl = (uint32_t)((((uint64_t)Value << 32 | Value) << (Mask % 32)) >> 32);
+
+        if(bitPopcount(Value) != Popcount || bitClz(Value) != Clz || bitCtz(Value) != Ctz ||
+           bitBswap(Value) != Bswap || bitRotl(Value, Mask) != Rotl || bitRotr(Rotl, Mask) != Value ||
+           bitPdep(Value, Mask) != Pdep || bitPext(Value, Mask) != Pext)
+        {
+            fatalError("bits.c disagrees with the reference for 0x%08X, 0x%08X", Value, Mask);
+        }
+    }
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static int32_t Corners[] = {0, 1, -1, INT32_MIN, INT32_MAX, 0x80000001, 0x00010000, 0x7FFF8000};
+    workload Work = {.Count = Options.Count + arrayCount(Corners)};
+    Work.Inputs = xMalloc(Work.Count*sizeof(int32_t));
+    Work.Results = xMalloc(Work.Count*sizeof(int32_t));
+    int32_t *Expected = xMalloc(Work.Count*sizeof(int32_t));
+    for(int Index = 0; Index < Work.Count; ++Index) {
+        Work.Inputs[Index] = Index < (int)arrayCount(Corners) ? Corners[Index] : (int32_t)randomU32();
+    }
+    checkBits(Work.Inputs, Work.Count);
+
+    printf("%-16s %10s %10s\n", "idiom", "nodes", "rewritten");
+    for(int Idiom = 0; Idiom < (int)arrayCount(Idioms); ++Idiom) {
+        char *Source = expandSteps(Idioms[Idiom].Steps);
+        size_t HandNodes, RewrittenNodes, BuiltinNodes;
+        uint8_t *Programs[] = {
+            compileIdiom(Idioms[Idiom].Builtin, false, &BuiltinNodes),
+            compileIdiom(Source, false, &HandNodes),
+            compileIdiom(Source, true, &RewrittenNodes),
+        };
+        printf("%-16s %10zu %10zu\n", Idioms[Idiom].Name, HandNodes, RewrittenNodes);
+        if(RewrittenNodes > BuiltinNodes) {
+            fatalError("%s was not rewritten: %s", Idioms[Idiom].Name, Source);
+        }
+
+        static char *Kinds[] = {"builtin", "hand-written", "rewritten"};
+        for(int Kind = 0; Kind < (int)arrayCount(Programs); ++Kind) {
+            char Name[64];
+            snprintf(Name, sizeof(Name), "%s %s", Idioms[Idiom].Name, Kinds[Kind]);
+            Work.Code = Programs[Kind];
+            benchMeasure(&Options, strdup(Name), "ns/eval", runBody, &Work, Work.Count, 0);
+
+            for(int Index = 0; Index < Work.Count; ++Index) {
+                if(Kind == 0) {
+                    Expected[Index] = Work.Results[Index];
+                } else if(Work.Results[Index] != Expected[Index]) {
+                    fatalError("%s gave %d instead of %d for $0 = %d", Name, Work.Results[Index],
+                               Expected[Index], Work.Inputs[Index]);
+                }
+            }
+            bufFree(Programs[Kind]);
+        }
+        bufFree(Source);
+    }
+
+    benchWriteJson(&Options, "idiom");
+
+    free(Work.Inputs);
+    free(Work.Results);
+    free(Expected);
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Incremental recompilation against compiling again from scratch, on one large expression made of
+// --count parenthesized terms. Every edit replaces a parameter with a generated leaf, sometimes in
+// parentheses of its own. The first edits are checked against a full compile of the edited source.
+//
+// Usage: bench_incremental [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <incremental.c>
+
+#include "bench.h"
+
+enum {
+    EditsPerRun = 1000,
+    CheckedEdits = 200,
+};
+
+typedef struct workload {
+    bench_options *Options;
+    incremental State;
+    char *Leaf;
+    volatile uintptr_t Sink;
+} workload;
+
+// NOTE: Replaces a parameter at or after a random offset with a new leaf
+static void applyEdit(workload *Work) {
+    char *Source = Work->State.Source;
+    size_t Length = incrementalSourceLength(&Work->State);
+    char *At = strchr(Source + randomU32() % Length, '$');
+    if(!At) {
+        At = strchr(Source, '$');
+    }
+    if(!At) {
+        fatalError("No parameter left to edit");
+    }
+    char *End = At + 1;
+    while(*End >= '0' && *End <= '9') {
+        ++End;
+    }
+
+    // NOTE: Keep at least one parameter in the leaf, or they would run out
+    if(Work->Leaf) {
+        bufHeader_(Work->Leaf)->Length = 0;
+    }
+    bool Parens = randomU32() % 4 == 0;
+    if(Parens) {
+        bufPush(Work->Leaf, '(');
+    }
+    char Param[16];
+    appendText(&Work->Leaf, Param, sprintf(Param, "$%u", randomU32() % Work->Options->ParamCount));
+    if(randomU32() % 2) {
+        appendText(&Work->Leaf, " ^ ", 3);
+        generateLeaf(&Work->Leaf, Work->Options);
+    }
+    if(Parens) {
+        bufPush(Work->Leaf, ')');
+    }
+
+    if(!incrementalEdit(&Work->State, At - Source, End - At, Work->Leaf, bufLength(Work->Leaf))) {
+        fatalError("Edit at %zu failed: %s", (size_t)(At - Source), ErrorMessages[Work->State.Error]);
+    }
+}
+
+static void incrementalBody(void *Data) {
+    workload *Work = Data;
+    for(int Edit = 0; Edit < EditsPerRun; ++Edit) {
+        applyEdit(Work);
+    }
+}
+
+static void fullBody(void *Data) {
+    workload *Work = Data;
+    arena Arena = {};
+    lexer Lexer = {};
+    uint8_t *Code = 0;
+    printBinary(&Code, parseExpression(&Lexer, &Arena, Work->State.Source));
+    bufPush(Code, HALT);
+    Work->Sink = bufLength(Code);
+    bufFree(Code);
+    arenaFree(&Arena);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+    if(!Options.ParamCount) {
+        benchUsage(ArgVal[0]);
+    }
+
+    static workload Work;
+    Work.Options = &Options;
+    static char *Joins[] = {" + ", " - ", " | ", " ^ "};
+    char *Source = 0;
+    for(int Term = 0; Term < Options.Count; ++Term) {
+        if(Term) {
+            appendText(&Source, Joins[randomU32() % arrayCount(Joins)], 3);
+        }
+        bufPush(Source, '(');
+        generateNode(&Source, &Options, Options.Size, 0, 0);
+        appendText(&Source, " + $0)", 6);
+    }
+    if(!incrementalInit(&Work.State, Source, bufLength(Source))) {
+        fatalError("Generated source does not parse: %s", ErrorMessages[Work.State.Error]);
+    }
+    bufFree(Source);
+    printf("%d terms, %zu bytes, %zu bytes of code\n", Options.Count, incrementalSourceLength(&Work.State),
+           bufLength(Work.State.Code));
+
+    size_t Reparsed = 0;
+    for(int Edit = 0; Edit < CheckedEdits; ++Edit) {
+        applyEdit(&Work);
+        Reparsed += Work.State.Reparsed;
+
+        size_t Size;
+        uint8_t *Expected = generateCode(parseSource(Work.State.Source), &Size);
+        if(Size != bufLength(Work.State.Code) || memcmp(Expected, Work.State.Code, Size) != 0) {
+            fatalError("Edit %d gave different code than a full compile", Edit);
+        }
+        bufFree(Expected);
+        arenaFree(&BenchArena);
+    }
+    printf("%zu bytes reparsed per edit on average\n", Reparsed/CheckedEdits);
+
+    benchMeasure(&Options, "full compile", "ns/compile", fullBody, &Work, 1, incrementalSourceLength(&Work.State));
+    double Full = Results[ResultCount - 1].Median;
+    benchMeasure(&Options, "incremental edit", "ns/edit", incrementalBody, &Work, EditsPerRun, 0);
+    printf("%20s %10.0fx faster than a full compile\n", "", Full/Results[ResultCount - 1].Median);
+
+    benchWriteJson(&Options, "incremental");
+
+    bufFree(Work.Leaf);
+    incrementalFree(&Work.State);
+    return 0;
+}
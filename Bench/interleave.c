@@ -0,0 +1,151 @@
+// Programs per second of interleaved execution against sequential executeVm() calls, as the
+// bytecode working set grows past the L2 and L3 caches. Programs are visited in random order so
+// every one of them starts with a cold cache miss. Working sets go from 64KB to 64MB.
+//
+// Usage: bench_interleave [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <vm.c>
+
+#include "bench.h"
+
+enum {
+    ProgramOps = 8,
+    BenchParamCount = 4,
+    MinWorkingSet = 64 << 10,
+    MaxWorkingSet = 64 << 20,
+};
+
+typedef struct workload {
+    uint8_t **Programs;
+    size_t Count;
+    int32_t Params[BenchParamCount];
+    int32_t *Results;
+    int Width;
+} workload;
+
+static void sequentialBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        Work->Results[Index] = executeVm(Work->Programs[Index], Work->Params);
+    }
+}
+
+static void interleavedBody(void *Data) {
+    workload *Work = Data;
+    executeVmInterleaved(Work->Programs, Work->Params, Work->Results, Work->Count, Work->Width);
+}
+
+// NOTE: Random straight-line program that never traps, so only ops without undefined inputs
+static uint8_t *generateProgram(uint8_t *Out) {
+    static uint8_t BinaryOps[] = {ADD, SUB, MUL, OR, XOR, AND};
+    int Depth = 0;
+
+    for(int Op = 0; Op < ProgramOps || Depth > 1; ++Op) {
+        uint32_t Random = randomU32();
+        if(Depth < 2 || (Op < ProgramOps && Random % 3 == 0)) {
+            if(Random & 0x100) {
+                *Out++ = ARG;
+                *Out++ = (Random >> 9) % BenchParamCount;
+            } else {
+                *Out++ = LIT;
+                for(int Byte = 0; Byte < 4; ++Byte) {
+                    *Out++ = randomU32();
+                }
+            }
+            ++Depth;
+        } else if(Random % 7 == 0) {
+            *Out++ = (Random & 0x100) ? NOT : SYM;
+        } else {
+            *Out++ = BinaryOps[(Random >> 9) % arrayCount(BinaryOps)];
+            --Depth;
+        }
+    }
+
+    *Out++ = HALT;
+    return Out;
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+    int Widths[] = {4, 8, 16};
+    workload Work = {};
+    for(int Param = 0; Param < BenchParamCount; ++Param) {
+        Work.Params[Param] = randomU32();
+    }
+
+    static char Names[8][1 + arrayCount(Widths)][32];
+    int Set = 0;
+    for(size_t Bytes = MinWorkingSet; Bytes <= MaxWorkingSet; Bytes *= 4, ++Set) {
+        assert(Set < (int)arrayCount(Names));
+        uint8_t *Module = xMalloc(Bytes + 1024);
+        uint8_t **Programs = 0;
+        size_t Count = 0;
+        for(uint8_t *At = Module; At < Module + Bytes; ++Count) {
+            if((Count & (Count - 1)) == 0) {
+                Programs = xRealloc(Programs, max(Count*2, 1)*sizeof(*Programs));
+            }
+            Programs[Count] = At;
+            At = generateProgram(At);
+        }
+
+        for(size_t Index = Count - 1; Index > 0; --Index) {
+            size_t Other = randomU32() % (Index + 1);
+            uint8_t *Swap = Programs[Index];
+            Programs[Index] = Programs[Other];
+            Programs[Other] = Swap;
+        }
+
+        int32_t *Expected = xMalloc(Count*sizeof(int32_t));
+        Work.Programs = Programs;
+        Work.Count = Count;
+        Work.Results = xMalloc(Count*sizeof(int32_t));
+        printf("%zuKB, %zu programs\n", Bytes >> 10, Count);
+
+        snprintf(Names[Set][0], sizeof(Names[Set][0]), "%zuKB sequential", Bytes >> 10);
+        benchMeasure(&Options, Names[Set][0], "ns/prog", sequentialBody, &Work, Count, Bytes);
+        double Sequential = Results[ResultCount - 1].Median;
+        memcpy(Expected, Work.Results, Count*sizeof(int32_t));
+
+        for(int Width = 0; Width < (int)arrayCount(Widths); ++Width) {
+            Work.Width = Widths[Width];
+            snprintf(Names[Set][1 + Width], sizeof(Names[Set][1 + Width]), "%zuKB interleave x%d", Bytes >> 10,
+                     Work.Width);
+            benchMeasure(&Options, Names[Set][1 + Width], "ns/prog", interleavedBody, &Work, Count, Bytes);
+            printf("%20s %10.2fx faster than sequential\n", "", Sequential/Results[ResultCount - 1].Median);
+
+            for(size_t Index = 0; Index < Count; ++Index) {
+                if(Work.Results[Index] != Expected[Index]) {
+                    fatalError("Mismatch in program %zu: %d != %d", Index, Work.Results[Index], Expected[Index]);
+                }
+            }
+        }
+
+        free(Expected);
+        free(Work.Results);
+        free(Programs);
+        free(Module);
+    }
+
+    benchWriteJson(&Options, "interleave");
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Throughput of the interpreter's evaluate(), which parses and evaluates in a single pass, on the
+// same seeded random workload as bench_micro.
+//
+// Usage: bench_interpreter [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// NOTE: The interpreter is a single translation unit, its main() is renamed out of the way
+#define main interpreterMain
+#include "../Interpreter/main.c"
+#undef main
+
+#include "harness.h"
+
+typedef struct workload {
+    corpus Corpus;
+    volatile int64_t Sink;
+} workload;
+
+static void evaluateBody(void *Data) {
+    workload *Work = Data;
+    lexer Lexer = {};
+    int64_t Sum = 0;
+    for(size_t Index = 0; Index < Work->Corpus.Count; ++Index) {
+        lexerInit(&Lexer, Work->Corpus.Text + Work->Corpus.Starts[Index]);
+        Sum += evaluate(&Lexer, 0);
+    }
+    Work->Sink = Sum;
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static workload Work;
+    Work.Corpus = generateCorpus(&Options);
+    for(int Param = 0; Param < MaxParamCount; ++Param) {
+        Params[Param] = (int32_t)randomU32();
+    }
+
+    printf("%zu expressions, %zu bytes, %zu tokens\n", Work.Corpus.Count, Work.Corpus.Bytes, Work.Corpus.Tokens);
+
+    benchMeasure(&Options, "evaluate", "ns/token", evaluateBody, &Work, Work.Corpus.Tokens, Work.Corpus.Bytes);
+
+    benchWriteJson(&Options, "interpreter");
+    corpusFree(&Work.Corpus);
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Table lookup against full evaluation for expressions with a small input domain, over --count
+// random inputs. Both have to agree on every input.
+//
+// Usage: bench_lut [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <vm.c>
+
+#include "bench.h"
+
+static struct {
+    char *Name;
+    char *Source;
+} Sources[] = {
+    {"nibble", "(($0 >> 4) & 0xF) * 3 + ($1 & 3) ** 2"},
+    {"byte hash", "(($0 & 0xFF) * 0x9E37 ^ ($0 & 0xFF) >> 3) % 251"},
+    {"cubes", "(($0 & 0x3F) ** 3 - ($1 & 0x3F) * 17) / 5 + ($0 & 0x3F) % 9"},
+    {"spread", "((($0 & 0x0F0F) * 31) ^ (($0 & 0x0F0F) << 7)) % 1021 + (($0 & 0x0F0F) >> 2) * 3"},
+};
+
+typedef struct workload {
+    uint8_t *Code;
+    int32_t *Params;
+    int ParamStride;
+    int32_t *Results;
+    size_t Count;
+} workload;
+
+static void runBody(void *Data) {
+    workload *Work = Data;
+    executeVmBatch(Work->Code, Work->Params, Work->ParamStride, Work->Results, Work->Count);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    workload Work = {.ParamStride = 2, .Count = Options.Count};
+    Work.Params = xMalloc(Work.Count*Work.ParamStride*sizeof(int32_t));
+    Work.Results = xMalloc(Work.Count*sizeof(int32_t));
+    int32_t *Expected = xMalloc(Work.Count*sizeof(int32_t));
+    for(size_t Index = 0; Index < Work.Count*Work.ParamStride; ++Index) {
+        Work.Params[Index] = randomU32();
+    }
+
+    static char Names[arrayCount(Sources)][2][32];
+    for(int Source = 0; Source < (int)arrayCount(Sources); ++Source) {
+        char *Name = Sources[Source].Name;
+        size_t FullSize, LutSize;
+        uint8_t *Full = generateCode(parseSource(Sources[Source].Source), &FullSize);
+        expression *Ast = parseSource(Sources[Source].Source);
+        lutCompile(&BenchArena, &Ast, MaxLutBits);
+        uint8_t *Lut = generateCode(Ast, &LutSize);
+        printf("%s: %s, %zu bytes, %zu with tables%s\n", Name, Sources[Source].Source, FullSize, LutSize,
+               Ast->Type == Expression_Lut ? "" : " (not converted)");
+
+        snprintf(Names[Source][0], sizeof(Names[Source][0]), "%s full", Name);
+        Work.Code = Full;
+        benchMeasure(&Options, Names[Source][0], "ns/eval", runBody, &Work, Work.Count, 0);
+        double Baseline = Results[ResultCount - 1].Median;
+        memcpy(Expected, Work.Results, Work.Count*sizeof(int32_t));
+
+        snprintf(Names[Source][1], sizeof(Names[Source][1]), "%s lut", Name);
+        Work.Code = Lut;
+        benchMeasure(&Options, Names[Source][1], "ns/eval", runBody, &Work, Work.Count, 0);
+        printf("%20s %10.2fx faster than full evaluation\n", "", Baseline/Results[ResultCount - 1].Median);
+        for(size_t Index = 0; Index < Work.Count; ++Index) {
+            if(Work.Results[Index] != Expected[Index]) {
+                fatalError("%s mismatch at input %zu: %d != %d", Name, Index, Work.Results[Index], Expected[Index]);
+            }
+        }
+
+        bufFree(Full);
+        bufFree(Lut);
+        arenaFree(&BenchArena);
+    }
+
+    benchWriteJson(&Options, "lut");
+
+    free(Work.Params);
+    free(Work.Results);
+    free(Expected);
+    return 0;
+}
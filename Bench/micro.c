@@ -0,0 +1,138 @@
+// Micro-benchmarks of the compilation pipeline and the VM on a seeded random workload: lexing,
+// parsing, bytecode emission and execution, each reported per token or per operation.
+//
+// Usage: bench_micro [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <vm.c>
+
+#include "bench.h"
+
+typedef struct workload {
+    corpus Corpus;
+    arena Arena;
+    expression **Asts;
+    uint8_t **Programs;
+    uint8_t *Code;
+    int32_t Params[MaxParamCount];
+    size_t Nodes;
+    size_t CodeBytes;
+    volatile uint64_t Sink;
+} workload;
+
+static size_t expressionNodeCount(expression *Node) {
+    switch(Node->Type) {
+        case Expression_Unary:  return 1 + expressionNodeCount(Node->Unary.Expr);
+        case Expression_Binary: return 1 + expressionNodeCount(Node->Binary.Lhs) + expressionNodeCount(Node->Binary.Rhs);
+        default:                return 1;
+    }
+}
+
+static void lexBody(void *Data) {
+    workload *Work = Data;
+    lexer Lexer = {};
+    uint64_t Tokens = 0;
+    for(size_t Index = 0; Index < Work->Corpus.Count; ++Index) {
+        for(lexerInit(&Lexer, Work->Corpus.Text + Work->Corpus.Starts[Index]); Lexer.Token.Type != Token_EOF; nextToken(&Lexer)) {
+            ++Tokens;
+        }
+    }
+    Work->Sink = Tokens;
+}
+
+static void parseBody(void *Data) {
+    workload *Work = Data;
+    arena Arena = {};
+    lexer Lexer = {};
+    for(size_t Index = 0; Index < Work->Corpus.Count; ++Index) {
+        Work->Sink = (uintptr_t)parseExpression(&Lexer, &Arena, Work->Corpus.Text + Work->Corpus.Starts[Index]);
+    }
+    arenaFree(&Arena);
+}
+
+static void emitBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Corpus.Count; ++Index) {
+        if(Work->Code) {
+            bufHeader_(Work->Code)->Length = 0;
+        }
+        printBinary(&Work->Code, Work->Asts[Index]);
+    }
+    Work->Sink = bufLength(Work->Code);
+}
+
+static void executeBody(void *Data) {
+    workload *Work = Data;
+    int64_t Sum = 0;
+    for(size_t Index = 0; Index < Work->Corpus.Count; ++Index) {
+        Sum += executeVm(Work->Programs[Index], Work->Params);
+    }
+    Work->Sink = Sum;
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static workload Work;
+    Work.Corpus = generateCorpus(&Options);
+    for(int Param = 0; Param < MaxParamCount; ++Param) {
+        Work.Params[Param] = randomU32();
+    }
+
+    Work.Asts = xMalloc(Work.Corpus.Count*sizeof(expression *));
+    Work.Programs = xMalloc(Work.Corpus.Count*sizeof(uint8_t *));
+    for(size_t Index = 0; Index < Work.Corpus.Count; ++Index) {
+        lexer Lexer = {};
+        Work.Asts[Index] = parseExpression(&Lexer, &Work.Arena, Work.Corpus.Text + Work.Corpus.Starts[Index]);
+        Work.Programs[Index] = generateCode(Work.Asts[Index], &Work.CodeBytes);
+        Work.Nodes += expressionNodeCount(Work.Asts[Index]);
+    }
+
+    Work.CodeBytes = 0;
+    for(size_t Index = 0; Index < Work.Corpus.Count; ++Index) {
+        Work.CodeBytes += bufLength(Work.Programs[Index]);
+    }
+
+    printf("%zu expressions, %zu bytes, %zu tokens, %zu nodes, %zu bytecode bytes\n",
+           Work.Corpus.Count, Work.Corpus.Bytes, Work.Corpus.Tokens, Work.Nodes, Work.CodeBytes);
+
+    // NOTE: Every node becomes one instruction, plus the HALT of each program
+    double Instructions = Work.Nodes + Work.Corpus.Count;
+
+    benchMeasure(&Options, "nextToken", "ns/token", lexBody, &Work, Work.Corpus.Tokens, Work.Corpus.Bytes);
+    benchMeasure(&Options, "parse", "ns/token", parseBody, &Work, Work.Corpus.Tokens, Work.Corpus.Bytes);
+    benchMeasure(&Options, "printBinary", "ns/op", emitBody, &Work, Work.Nodes, Work.CodeBytes);
+    benchMeasure(&Options, "executeVm", "ns/op", executeBody, &Work, Instructions, Work.CodeBytes);
+
+    benchWriteJson(&Options, "micro");
+
+    for(size_t Index = 0; Index < Work.Corpus.Count; ++Index) {
+        bufFree(Work.Programs[Index]);
+    }
+    free(Work.Programs);
+    free(Work.Asts);
+    bufFree(Work.Code);
+    arenaFree(&Work.Arena);
+    corpusFree(&Work.Corpus);
+
+    return 0;
+}
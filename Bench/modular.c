@@ -0,0 +1,263 @@
+// Modular evaluation with --mod against the same expressions written with % around every
+// subterm: --count generated expressions of + - * and small powers of parameters, each in both
+// spellings. The hand-written form only stays exact in int32_t for a modulus below 2^15.5, so it
+// runs modulo ModSmall. The --mod form also runs modulo ModLarge, where no % spelling exists.
+// Results are checked against a reference tree walk with 64-bit %.
+//
+// Usage: bench_modular [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <vm.c>
+#include <montgomery.c>
+#include <modvm.c>
+#include <modcompile.c>
+
+#include "bench.h"
+
+enum {
+    // NOTE: Largest prime whose squared residues stay below 2^31
+    ModSmall = 46337,
+    // NOTE: Largest 32-bit prime, its REDC needs the full 64 bits
+    ModLarge = 4294967291u,
+    ParamSets = 4,
+    MaxPowExponent = 8,
+};
+
+typedef struct workload {
+    size_t Count;
+    uint8_t **Code;
+    montgomery *Mont;
+    int32_t (*Params)[MaxParamCount];
+    int32_t *Results;
+} workload;
+
+static void appendFormat(char **Out, char *Fmt, ...) {
+    char Text[64];
+    va_list Args;
+    va_start(Args, Fmt);
+    int Length = vsnprintf(Text, sizeof(Text), Fmt, Args);
+    va_end(Args);
+    appendText(Out, Text, Length);
+}
+
+// NOTE: Appends the same expression spelled for --mod to Mod and with % around every subterm to
+// Percent. A power of a parameter is spelled as repeated multiplication in Percent.
+static void generateModular(char **Mod, char **Percent, bench_options *Options, int OpCount) {
+    if(OpCount == 0) {
+        int Param = Options->ParamCount ? randomU32() % Options->ParamCount : 0;
+        uint32_t Kind = randomU32() % 4;
+        if(Kind == 0 || !Options->ParamCount) {
+            uint32_t Value = randomU32() % ModSmall;
+            appendFormat(Mod, "%u", Value);
+            appendFormat(Percent, "%u", Value);
+        } else if(Kind == 1) {
+            int Exponent = 2 + randomU32() % (MaxPowExponent - 1);
+            appendFormat(Mod, "$%d ** %d", Param, Exponent);
+            for(int Step = 1; Step < Exponent; ++Step) {
+                appendFormat(Percent, "(");
+            }
+            appendFormat(Percent, "$%d", Param);
+            for(int Step = 1; Step < Exponent; ++Step) {
+                appendFormat(Percent, " * $%d %% %d)", Param, ModSmall);
+            }
+        } else {
+            appendFormat(Mod, "$%d", Param);
+            appendFormat(Percent, "$%d", Param);
+        }
+        return;
+    }
+
+    static char *Ops[] = {"+", "-", "*", "*"};
+    char *Op = Ops[randomU32() % arrayCount(Ops)];
+    int Left = randomU32() % OpCount;
+
+    appendFormat(Mod, "(");
+    appendFormat(Percent, "((");
+    generateModular(Mod, Percent, Options, Left);
+    appendFormat(Mod, " %s ", Op);
+    appendFormat(Percent, " %s ", Op);
+    generateModular(Mod, Percent, Options, OpCount - 1 - Left);
+    appendFormat(Mod, ")");
+    appendFormat(Percent, ") %% %d)", ModSmall);
+}
+
+static uint64_t referenceModular(expression *Node, uint64_t Modulus, int32_t *Params) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            return Node->IntValue % Modulus;
+        } break;
+
+        case Expression_Param: {
+            int64_t Value = Params[Node->IntValue] % (int64_t)Modulus;
+            return Value < 0 ? Value + Modulus : (uint64_t)Value;
+        } break;
+
+        case Expression_Binary: {
+            uint64_t Lhs = referenceModular(Node->Binary.Lhs, Modulus, Params);
+            if(Node->Binary.Op == Token_Power) {
+                uint64_t Result = 1;
+                for(uint32_t Step = 0; Step < Node->Binary.Rhs->IntValue; ++Step) {
+                    Result = Result*Lhs % Modulus;
+                }
+                return Result;
+            }
+
+            uint64_t Rhs = referenceModular(Node->Binary.Rhs, Modulus, Params);
+            switch(Node->Binary.Op) {
+                case Token_Add:      { return (Lhs + Rhs) % Modulus; } break;
+                case Token_Subtract: { return (Lhs + Modulus - Rhs) % Modulus; } break;
+                case Token_Multiply: { return Lhs*Rhs % Modulus; } break;
+                InvalidDefaultCase;
+            }
+        } break;
+
+        InvalidDefaultCase;
+    }
+
+    return 0;
+}
+
+static void percentBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        for(int Set = 0; Set < ParamSets; ++Set) {
+            Work->Results[Index*ParamSets + Set] = executeVm(Work->Code[Index], Work->Params[Set]);
+        }
+    }
+}
+
+static void montgomeryBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        for(int Set = 0; Set < ParamSets; ++Set) {
+            Work->Results[Index*ParamSets + Set] = executeModVm(Work->Mont, Work->Code[Index], Work->Params[Set]);
+        }
+    }
+}
+
+static uint8_t *compileModular(char *Source, montgomery *Mont) {
+    uint8_t *Code = 0;
+    modCompile(&Code, &BenchArena, Mont, Source, parseSource(Source));
+    bufPush(Code, HALT);
+    return Code;
+}
+
+static void checkResults(workload *Work, char **Sources, uint64_t Modulus, char *Name) {
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        expression *Ast = parseSource(Sources[Index]);
+        for(int Set = 0; Set < ParamSets; ++Set) {
+            uint64_t Expected = referenceModular(Ast, Modulus, Work->Params[Set]);
+            int64_t Result = Work->Results[Index*ParamSets + Set];
+            if(Modulus == ModSmall) {
+                Result = (Result % ModSmall + ModSmall) % ModSmall;
+            } else {
+                Result = (uint32_t)Result;
+            }
+            if((uint64_t)Result != Expected) {
+                fatalError("%s gave %lld instead of %llu for %s", Name, (long long)Result,
+                           (unsigned long long)Expected, Sources[Index]);
+            }
+        }
+    }
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static workload Work;
+    Work.Count = Options.Count;
+    Work.Code = xMalloc(Work.Count*sizeof(uint8_t *));
+    Work.Results = xMalloc(Work.Count*ParamSets*sizeof(int32_t));
+    Work.Params = xMalloc(ParamSets*sizeof(*Work.Params));
+    for(int Set = 0; Set < ParamSets; ++Set) {
+        for(int Param = 0; Param < MaxParamCount; ++Param) {
+            Work.Params[Set][Param] = randomU32() % ModSmall;
+        }
+    }
+
+    char **ModSources = xMalloc(Work.Count*sizeof(char *));
+    char **PercentSources = xMalloc(Work.Count*sizeof(char *));
+    size_t ModBytes = 0, PercentBytes = 0;
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        ModSources[Index] = PercentSources[Index] = 0;
+        generateModular(ModSources + Index, PercentSources + Index, &Options, Options.Size);
+        bufPush(ModSources[Index], 0);
+        bufPush(PercentSources[Index], 0);
+    }
+
+    printf("%s\n%s\n", ModSources[0], PercentSources[0]);
+
+    // NOTE: The % spelling is compiled like the compiler does by default
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        expression *Ast = parseSource(PercentSources[Index]);
+        lutCompile(&BenchArena, &Ast, LutDefaultBits);
+        Work.Code[Index] = 0;
+        printBinary(Work.Code + Index, Ast);
+        bufPush(Work.Code[Index], HALT);
+        PercentBytes += bufLength(Work.Code[Index]);
+    }
+    double Evaluations = (double)Work.Count*ParamSets;
+    benchMeasure(&Options, "percent", "ns/eval", percentBody, &Work, Evaluations, 0);
+    double Percent = Results[ResultCount - 1].Median;
+    checkResults(&Work, ModSources, ModSmall, "percent");
+
+    static struct {
+        char *Name;
+        uint32_t Modulus;
+    } Moduli[] = {
+        {"montgomery small", ModSmall},
+        {"montgomery large", ModLarge},
+    };
+
+    for(int Modulus = 0; Modulus < (int)arrayCount(Moduli); ++Modulus) {
+        montgomery Mont;
+        montInit(&Mont, Moduli[Modulus].Modulus);
+        Work.Mont = &Mont;
+        ModBytes = 0;
+        for(size_t Index = 0; Index < Work.Count; ++Index) {
+            bufFree(Work.Code[Index]);
+            Work.Code[Index] = compileModular(ModSources[Index], &Mont);
+            ModBytes += bufLength(Work.Code[Index]);
+        }
+
+        benchMeasure(&Options, Moduli[Modulus].Name, "ns/eval", montgomeryBody, &Work, Evaluations, 0);
+        printf("%20s %10.2fx percent\n", "", Percent/Results[ResultCount - 1].Median);
+        checkResults(&Work, ModSources, Moduli[Modulus].Modulus, Moduli[Modulus].Name);
+    }
+    printf("bytecode: %zu bytes with %%, %zu bytes with --mod\n", PercentBytes, ModBytes);
+
+    benchWriteJson(&Options, "modular");
+
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        bufFree(Work.Code[Index]);
+        bufFree(ModSources[Index]);
+        bufFree(PercentSources[Index]);
+    }
+    free(Work.Code);
+    free(Work.Results);
+    free(Work.Params);
+    free(ModSources);
+    free(PercentSources);
+    return 0;
+}
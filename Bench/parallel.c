@@ -0,0 +1,136 @@
+// Parallel against sequential evaluation of one large expression: a sum and difference of
+// --count generated terms, the shape of an expression with millions of terms. Every parallel
+// result is checked against expressionEvaluate() and executeVm().
+//
+// Usage: bench_parallel [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <vm.c>
+#include <threadpool.c>
+#include <parallel.c>
+
+#include "bench.h"
+
+typedef struct workload {
+    expression *Ast;
+    uint8_t *Code;
+    int32_t Params[MaxParamCount];
+    thread_pool *Pool;
+    int32_t Expected;
+    volatile int32_t Sink;
+} workload;
+
+static void sequentialBody(void *Data) {
+    workload *Work = Data;
+    bool Trapped = false;
+    Work->Sink = expressionEvaluate(Work->Ast, Work->Params, &Trapped);
+}
+
+static void vmBody(void *Data) {
+    workload *Work = Data;
+    Work->Sink = executeVm(Work->Code, Work->Params);
+}
+
+static void parallelBody(void *Data) {
+    workload *Work = Data;
+    bool Trapped = false;
+    Work->Sink = expressionEvaluateParallel(Work->Pool, Work->Ast, Work->Params, ParallelDefaultGrain, &Trapped);
+    if(Work->Sink != Work->Expected || Trapped) {
+        fatalError("Parallel evaluation gave %d, expected %d", Work->Sink, Work->Expected);
+    }
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    // NOTE: expressionEvaluate() and printBinary() recurse once per operator of the top level chain
+    struct rlimit Stack;
+    if(getrlimit(RLIMIT_STACK, &Stack) == 0 && Stack.rlim_cur != RLIM_INFINITY) {
+        Stack.rlim_cur = Stack.rlim_max;
+        setrlimit(RLIMIT_STACK, &Stack);
+    }
+
+    static workload Work;
+    char *Source = 0;
+    for(int Term = 0; Term < Options.Count; ++Term) {
+        if(Term) {
+            appendText(&Source, randomU32() % 2 ? " + (" : " - (", 4);
+        } else {
+            bufPush(Source, '(');
+        }
+        generateNode(&Source, &Options, Options.Size, 0, 0);
+        bufPush(Source, ')');
+    }
+    bufPush(Source, 0);
+
+    for(int Param = 0; Param < MaxParamCount; ++Param) {
+        Work.Params[Param] = randomU32();
+    }
+
+    arena Arena = {};
+    lexer Lexer = {};
+    Work.Ast = parseExpression(&Lexer, &Arena, Source);
+    size_t CodeSize;
+    Work.Code = generateCode(Work.Ast, &CodeSize);
+
+    bool Trapped = false;
+    Work.Expected = expressionEvaluate(Work.Ast, Work.Params, &Trapped);
+    if(Trapped || executeVm(Work.Code, Work.Params) != Work.Expected) {
+        fatalError("Sequential evaluators disagree");
+    }
+
+    long CpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%d terms, %zu bytes, %zu bytecode bytes, %ld cpus\n", Options.Count, bufLength(Source) - 1,
+           CodeSize, CpuCount);
+
+    // NOTE: Everything is reported per term
+    double Terms = Options.Count;
+    benchMeasure(&Options, "expressionEvaluate", "ns/term", sequentialBody, &Work, Terms, 0);
+    double Sequential = Results[ResultCount - 1].Median;
+    benchMeasure(&Options, "executeVm", "ns/term", vmBody, &Work, Terms, 0);
+
+    static char Names[8][32];
+    for(int Threads = 1, Run = 0; Run < (int)arrayCount(Names) && Threads <= max(CpuCount, 2)*2; Threads *= 2, ++Run) {
+        thread_pool Pool;
+        threadPoolInit(&Pool, Threads);
+        Work.Pool = &Pool;
+
+        snprintf(Names[Run], sizeof(Names[Run]), "parallel x%d", Threads);
+        benchMeasure(&Options, Names[Run], "ns/term", parallelBody, &Work, Terms, 0);
+        printf("%20s %10.2fx speedup over expressionEvaluate\n", "", Sequential/Results[ResultCount - 1].Median);
+
+        threadPoolFree(&Pool);
+    }
+
+    benchWriteJson(&Options, "parallel");
+
+    bufFree(Work.Code);
+    bufFree(Source);
+    arenaFree(&Arena);
+    return 0;
+}
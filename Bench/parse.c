@@ -0,0 +1,159 @@
+// Sequential against parallel parsing of one large expression, a chain of --count generated terms
+// joined by the lowest precedence operators. Every parallel tree is compared with the sequential
+// one, spans included.
+//
+// Usage: bench_parse [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <threadpool.c>
+#include <parallel.c>
+#include <frontend.c>
+
+#include "bench.h"
+
+typedef struct workload {
+    char *Source;
+    size_t Length;
+    size_t Tokens;
+    expression *Expected;
+    thread_pool *Pool;
+    volatile uintptr_t Sink;
+} workload;
+
+// NOTE: Iterative, the top level chain is as deep as it is long
+static bool expressionsEqual(expression *Lhs, expression *Rhs) {
+    expression **Pending = 0;
+    bufPush(Pending, Lhs);
+    bufPush(Pending, Rhs);
+
+    bool Equal = true;
+    while(Equal && bufLength(Pending)) {
+        expression *B = Pending[--bufHeader_(Pending)->Length];
+        expression *A = Pending[--bufHeader_(Pending)->Length];
+        Equal = A->Type == B->Type && A->Span.Start == B->Span.Start && A->Span.End == B->Span.End;
+        if(!Equal) {
+            break;
+        }
+
+        switch(A->Type) {
+            case Expression_Int:
+            case Expression_Param: {
+                Equal = A->IntValue == B->IntValue;
+            } break;
+
+            case Expression_Unary: {
+                Equal = A->Unary.Op == B->Unary.Op;
+                bufPush(Pending, A->Unary.Expr);
+                bufPush(Pending, B->Unary.Expr);
+            } break;
+
+            case Expression_Binary: {
+                Equal = A->Binary.Op == B->Binary.Op;
+                bufPush(Pending, A->Binary.Lhs);
+                bufPush(Pending, B->Binary.Lhs);
+                bufPush(Pending, A->Binary.Rhs);
+                bufPush(Pending, B->Binary.Rhs);
+            } break;
+
+            InvalidDefaultCase;
+        }
+    }
+
+    bufFree(Pending);
+    return Equal;
+}
+
+static void sequentialBody(void *Data) {
+    workload *Work = Data;
+    arena Arena = {};
+    lexer Lexer = {};
+    Work->Sink = (uintptr_t)parseExpression(&Lexer, &Arena, Work->Source);
+    arenaFree(&Arena);
+}
+
+static void parallelBody(void *Data) {
+    workload *Work = Data;
+    arena Arena = {};
+    lexer Lexer = {};
+    Work->Sink = (uintptr_t)parseExpressionParallel(Work->Pool, &Lexer, &Arena, Work->Source, Work->Length,
+                                                    FrontendDefaultGrain);
+    arenaFree(&Arena);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static workload Work;
+    static char *Joins[] = {" + ", " - ", " | ", " ^ "};
+    for(int Term = 0; Term < Options.Count; ++Term) {
+        if(Term) {
+            appendText(&Work.Source, Joins[randomU32() % arrayCount(Joins)], 3);
+        }
+        generateNode(&Work.Source, &Options, Options.Size, 0, 0);
+    }
+    Work.Length = bufLength(Work.Source);
+    bufPush(Work.Source, 0);
+    Work.Tokens = lexerCountTokens(Work.Source);
+
+    arena Arena = {};
+    lexer Lexer = {};
+    Work.Expected = parseExpression(&Lexer, &Arena, Work.Source);
+
+    long CpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%d terms, %zu bytes, %zu tokens, %ld cpus\n", Options.Count, Work.Length, Work.Tokens, CpuCount);
+
+    benchMeasure(&Options, "parseExpression", "ns/token", sequentialBody, &Work, Work.Tokens, Work.Length);
+    double Sequential = Results[ResultCount - 1].Median;
+
+    static char Names[8][32];
+    for(int Threads = 2, Run = 0; Run < (int)arrayCount(Names) && Threads <= max(CpuCount, 2)*2; Threads *= 2, ++Run) {
+        thread_pool Pool;
+        threadPoolInit(&Pool, Threads);
+        Work.Pool = &Pool;
+
+        lexer Lexer = {};
+        arena Check = {};
+        expression *Ast = parseExpressionParallel(&Pool, &Lexer, &Check, Work.Source, Work.Length, FrontendDefaultGrain);
+        if(!expressionsEqual(Ast, Work.Expected)) {
+            fatalError("Parallel parse differs from the sequential one");
+        }
+        arenaFree(&Check);
+
+        snprintf(Names[Run], sizeof(Names[Run]), "parallel x%d", Threads);
+        benchMeasure(&Options, Names[Run], "ns/token", parallelBody, &Work, Work.Tokens, Work.Length);
+        printf("%20s %10.2fx speedup over parseExpression\n", "", Sequential/Results[ResultCount - 1].Median);
+
+        threadPoolFree(&Pool);
+    }
+
+    benchWriteJson(&Options, "parse");
+
+    arenaFree(&Arena);
+    bufFree(Work.Source);
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Comparisons and selects against the arithmetic tricks formulas use instead of them: min, clamp
+// and a conditional mask, each written both ways and run by the VM over random inputs whose
+// comparisons go either way unpredictably. The select forms also run bit-sliced, where every lane
+// blends its own side. Inputs stay within 2^24, so the tricks cannot overflow and all forms of a
+// kernel have to agree.
+//
+// Usage: bench_select [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <vm.c>
+#include <bitslice.c>
+
+#include "bench.h"
+
+enum {
+    InputCount = 1<<16,
+    ParamStride = 3,
+};
+
+// NOTE: $0 is the value, $1 <= $2 the bounds or operands
+static struct {
+    char *Name;
+    char *Trick;
+    char *Select;
+} Kernels[] = {
+    {"min", "$1 + (($0 - $1) & (($0 - $1) >> 31))", "$0 < $1 ? $0 : $1"},
+    {"clamp",
+     "$2 + (($0 - (($0 - $1) & (($0 - $1) >> 31)) - $2) & (($0 - (($0 - $1) & (($0 - $1) >> 31)) - $2) >> 31))",
+     "$0 < $1 ? $1 : $2 < $0 ? $2 : $0"},
+    {"mask", "(($0 - $1) >> 31) & $2", "$0 < $1 ? $2 : 0"},
+};
+
+typedef struct workload {
+    uint8_t *Code;
+    bitslice_program *Slices;
+    int32_t *Params;
+    int32_t *Results;
+} workload;
+
+static void vmBody(void *Data) {
+    workload *Work = Data;
+    executeVmBatch(Work->Code, Work->Params, ParamStride, Work->Results, InputCount);
+}
+
+static void bitsliceBody(void *Data) {
+    workload *Work = Data;
+    bitsliceRun(Work->Slices, Work->Params, ParamStride, Work->Results, InputCount);
+}
+
+static void checkResults(char *Name, char *Form, int32_t *Results, int32_t *Expected) {
+    for(size_t Index = 0; Index < InputCount; ++Index) {
+        if(Results[Index] != Expected[Index]) {
+            fatalError("%s %s gave %d instead of %d for input %zu", Name, Form, Results[Index], Expected[Index], Index);
+        }
+    }
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    workload Work = {
+        .Params = xMalloc(InputCount*ParamStride*sizeof(int32_t)),
+        .Results = xMalloc(InputCount*sizeof(int32_t)),
+    };
+    int32_t *Expected = xMalloc(InputCount*sizeof(int32_t));
+    for(size_t Index = 0; Index < InputCount; ++Index) {
+        int32_t *Params = Work.Params + Index*ParamStride;
+        Params[0] = (int32_t)(randomU32() % (1u << 25)) - (1 << 24);
+        Params[1] = -(int32_t)(randomU32() % (1u << 24));
+        Params[2] = (int32_t)(randomU32() % (1u << 24));
+    }
+
+    static char Names[arrayCount(Kernels)][3][32];
+    for(int Kernel = 0; Kernel < (int)arrayCount(Kernels); ++Kernel) {
+        char *Name = Kernels[Kernel].Name;
+        size_t TrickSize, SelectSize;
+        uint8_t *Trick = generateCode(parseSource(Kernels[Kernel].Trick), &TrickSize);
+        expression *Select = parseSource(Kernels[Kernel].Select);
+        uint8_t *SelectCode = generateCode(Select, &SelectSize);
+        Work.Slices = bitsliceCompile(Select);
+        if(!Work.Slices) {
+            fatalError("%s select is not eligible for bit slicing", Name);
+        }
+        printf("%s: trick %zu bytes, select %zu bytes, %zu slice ops\n", Name, TrickSize, SelectSize,
+               bufLength(Work.Slices->Ops));
+
+        snprintf(Names[Kernel][0], sizeof(Names[Kernel][0]), "%s trick", Name);
+        Work.Code = Trick;
+        benchMeasure(&Options, Names[Kernel][0], "ns/run", vmBody, &Work, InputCount, 0);
+        double Baseline = Results[ResultCount - 1].Median;
+        memcpy(Expected, Work.Results, InputCount*sizeof(int32_t));
+
+        snprintf(Names[Kernel][1], sizeof(Names[Kernel][1]), "%s select", Name);
+        Work.Code = SelectCode;
+        benchMeasure(&Options, Names[Kernel][1], "ns/run", vmBody, &Work, InputCount, 0);
+        printf("%20s %10.2fx faster than the trick\n", "", Baseline/Results[ResultCount - 1].Median);
+        checkResults(Name, "select", Work.Results, Expected);
+
+        snprintf(Names[Kernel][2], sizeof(Names[Kernel][2]), "%s bitslice", Name);
+        benchMeasure(&Options, Names[Kernel][2], "ns/run", bitsliceBody, &Work, InputCount, 0);
+        printf("%20s %10.2fx faster than the trick\n", "", Baseline/Results[ResultCount - 1].Median);
+        checkResults(Name, "bitslice", Work.Results, Expected);
+
+        bitsliceFree(Work.Slices);
+        bufFree(Trick);
+        bufFree(SelectCode);
+        arenaFree(&BenchArena);
+    }
+
+    benchWriteJson(&Options, "select");
+
+    free(Work.Params);
+    free(Work.Results);
+    free(Expected);
+    return 0;
+}
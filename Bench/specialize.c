@@ -0,0 +1,146 @@
+// Generic programs against their specializations for fixed configuration parameters, through the
+// library API. Both have to agree on every input, errors included. Also times bw_specialize()
+// itself and a bw_specializer_get() that hits the cache.
+//
+// Usage: bench_specialize [OPTION...], see benchUsage() in harness.h
+
+#include <time.h>
+
+#include "../Library/bitwise.c"
+
+#include "harness.h"
+
+enum { MaxBindings = 4 };
+
+// NOTE: $0 and $1 change on every input, the bound parameters are configuration
+static struct {
+    char *Name;
+    char *Source;
+    int BindingCount;
+    bw_binding Bindings[MaxBindings];
+} Formulas[] = {
+    {"mask scale", "($0 & $2) * $3 + (($1 >> $4) & $5)", 4, {{2, 0xFF}, {3, 8}, {4, 4}, {5, 0xF}}},
+    {"dead terms", "$0 * $2 + $1 * $3 + ($0 & $1) * $4 + ($0 ^ $5)", 4, {{2, 1}, {3, 0}, {4, 16}, {5, 0}}},
+    {"blend", "(($0 ^ $2) & $3) | (($1 & ~$3) << $4)", 3, {{2, 0x5A5A}, {3, 0x0F0F}, {4, 0}}},
+    {"bucket", "($0 / ($2 + 1)) % $3 + popcount($1 & $4)", 3, {{2, 0}, {3, 1024}, {4, 0xFFFF}}},
+};
+
+typedef struct workload {
+    int Count;
+    int ParamStride;
+    int32_t *Params;
+    int32_t *Results;
+    bw_status *Statuses;
+    const bw_program *Program;
+
+    bw_specializer *Specializer;
+    bw_binding *Bindings;
+    int BindingCount;
+} workload;
+
+static void evalBody(void *Data) {
+    workload *Work = Data;
+    for(int Index = 0; Index < Work->Count; ++Index) {
+        Work->Statuses[Index] = bw_eval(Work->Program, Work->Params + Index*Work->ParamStride, Work->Results + Index);
+    }
+}
+
+static void specializeBody(void *Data) {
+    workload *Work = Data;
+    bw_program *Specialized;
+    if(bw_specialize(Work->Program, Work->Bindings, Work->BindingCount, &Specialized) != BW_OK) {
+        fatalError("Specialization failed");
+    }
+    bw_free(Specialized);
+}
+
+static void lookupBody(void *Data) {
+    workload *Work = Data;
+    for(int Index = 0; Index < Work->Count; ++Index) {
+        const bw_program *Specialized;
+        bw_specializer_get(Work->Specializer, Work->Bindings, Work->BindingCount, &Specialized);
+    }
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    workload Work = {.Count = Options.Count, .ParamStride = 8};
+    Work.Params = xMalloc(Work.Count*Work.ParamStride*sizeof(int32_t));
+    Work.Results = xMalloc(Work.Count*sizeof(int32_t));
+    Work.Statuses = xMalloc(Work.Count*sizeof(bw_status));
+    int32_t *Expected = xMalloc(Work.Count*sizeof(int32_t));
+    bw_status *ExpectedStatuses = xMalloc(Work.Count*sizeof(bw_status));
+
+    for(int Formula = 0; Formula < (int)arrayCount(Formulas); ++Formula) {
+        bw_program *Generic;
+        bw_error Error;
+        if(bw_compile(Formulas[Formula].Source, strlen(Formulas[Formula].Source), &Generic, &Error) != BW_OK) {
+            fatalError("%s: %s", Formulas[Formula].Name, Error.Message);
+        }
+
+        for(int Index = 0; Index < Work.Count; ++Index) {
+            int32_t *Params = Work.Params + Index*Work.ParamStride;
+            Params[0] = randomU32();
+            Params[1] = randomU32();
+            for(int Binding = 0; Binding < Formulas[Formula].BindingCount; ++Binding) {
+                Params[Formulas[Formula].Bindings[Binding].Param] = Formulas[Formula].Bindings[Binding].Value;
+            }
+        }
+
+        Work.Bindings = Formulas[Formula].Bindings;
+        Work.BindingCount = Formulas[Formula].BindingCount;
+        if(bw_specializer_new(Generic, 16, &Work.Specializer) != BW_OK) {
+            fatalError("Could not create the specializer");
+        }
+        const bw_program *Specialized;
+        if(bw_specializer_get(Work.Specializer, Work.Bindings, Work.BindingCount, &Specialized) != BW_OK) {
+            fatalError("%s: specialization failed", Formulas[Formula].Name);
+        }
+
+        printf("%s: %s\n", Formulas[Formula].Name, Formulas[Formula].Source);
+        const bw_program *Programs[] = {Generic, Specialized};
+        static char *Kinds[] = {"generic", "specialized"};
+        double Times[2];
+        for(int Kind = 0; Kind < 2; ++Kind) {
+            char Name[64];
+            snprintf(Name, sizeof(Name), "%s %s", Formulas[Formula].Name, Kinds[Kind]);
+            Work.Program = Programs[Kind];
+            benchMeasure(&Options, strdup(Name), "ns/eval", evalBody, &Work, Work.Count, 0);
+            Times[Kind] = Results[ResultCount - 1].Median;
+
+            for(int Index = 0; Index < Work.Count; ++Index) {
+                if(Kind == 0) {
+                    Expected[Index] = Work.Results[Index];
+                    ExpectedStatuses[Index] = Work.Statuses[Index];
+                } else if(Work.Statuses[Index] != ExpectedStatuses[Index] ||
+                          (Work.Statuses[Index] == BW_OK && Work.Results[Index] != Expected[Index]))
+                {
+                    fatalError("%s gave %d (%s) instead of %d (%s) for input %d", Name, Work.Results[Index],
+                               bw_status_message(Work.Statuses[Index]), Expected[Index],
+                               bw_status_message(ExpectedStatuses[Index]), Index);
+                }
+            }
+        }
+        printf("%-20s %10.2fx\n", "speedup", Times[0]/Times[1]);
+
+        char Name[64];
+        Work.Program = Generic;
+        snprintf(Name, sizeof(Name), "%s compile", Formulas[Formula].Name);
+        benchMeasure(&Options, strdup(Name), "ns/call", specializeBody, &Work, 1, 0);
+        snprintf(Name, sizeof(Name), "%s cache hit", Formulas[Formula].Name);
+        benchMeasure(&Options, strdup(Name), "ns/call", lookupBody, &Work, Work.Count, 0);
+
+        bw_specializer_free(Work.Specializer);
+        bw_free(Generic);
+    }
+
+    benchWriteJson(&Options, "specialize");
+
+    free(Work.Params);
+    free(Work.Results);
+    free(Work.Statuses);
+    free(Expected);
+    free(ExpectedStatuses);
+    return 0;
+}
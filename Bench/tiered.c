@@ -0,0 +1,207 @@
+// Tiered execution against fixed tiers on a daemon-like request stream: --count generated
+// expressions requested with a skewed popularity, so most are requested a handful of times and a
+// few thousands of times. Every policy must give the same result or error for every request.
+//
+// Usage: bench_tiered [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <specialize.c>
+#include <vm.c>
+#include <peephole.c>
+#include <compile.c>
+#include <tiered.c>
+
+#include "bench.h"
+
+enum {
+    RequestsPerExpression = 10,
+    // NOTE: Popularity is Count*u^Skew for uniform u, a larger skew makes the head hotter
+    PopularitySkew = 4,
+    // NOTE: Requests per expression for the steady state comparison, after promotion
+    SteadyRuns = 1<<12,
+    SteadyExpressions = 64,
+};
+
+typedef struct request {
+    uint32_t Expression;
+    int32_t Params[MaxParamCount];
+} request;
+
+typedef struct outcome {
+    int32_t Result;
+    vm_error Error;
+} outcome;
+
+typedef struct workload {
+    char **Sources;
+    expression **Asts;
+    size_t Count;
+    request *Requests;
+    size_t RequestCount;
+    size_t SteadyCount;
+
+    tier_config Config;
+    tiered_program *Programs;
+    outcome *Outcomes;
+    uint64_t TierRuns[Tier_Count];
+} workload;
+
+static void streamBody(void *Data) {
+    workload *Work = Data;
+    vm_context Context;
+
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        tieredInit(Work->Programs + Index, Work->Sources[Index], Work->Asts[Index]);
+    }
+
+    memset(Work->TierRuns, 0, sizeof(Work->TierRuns));
+    for(size_t Index = 0; Index < Work->RequestCount; ++Index) {
+        request *Request = Work->Requests + Index;
+        tiered_program *Program = Work->Programs + Request->Expression;
+        outcome *Outcome = Work->Outcomes + Index;
+        Outcome->Error = tieredRun(Program, &Work->Config, &Context, Request->Params, &Outcome->Result);
+        ++Work->TierRuns[Program->Tier];
+    }
+
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        tieredFree(Work->Programs + Index);
+    }
+}
+
+static void steadyBody(void *Data) {
+    workload *Work = Data;
+    vm_context Context;
+
+    volatile int32_t Sink;
+    for(size_t Index = 0; Index < Work->SteadyCount; ++Index) {
+        request *Request = Work->Requests + Index;
+        for(int Run = 0; Run < SteadyRuns; ++Run) {
+            int32_t Result;
+            tieredRun(Work->Programs + Index, &Work->Config, &Context, Request->Params, &Result);
+            Sink = Result;
+        }
+    }
+    (void)Sink;
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+
+    static workload Work;
+    Work.Count = Options.Count;
+    Work.Sources = xMalloc(Work.Count*sizeof(char *));
+    Work.Asts = xMalloc(Work.Count*sizeof(expression *));
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        char *Source = 0;
+        generateNode(&Source, &Options, Options.Size, 0, 0);
+        bufPush(Source, 0);
+        Work.Sources[Index] = Source;
+        Work.Asts[Index] = parseSource(Source);
+    }
+
+    Work.RequestCount = Work.Count*RequestsPerExpression;
+    Work.Requests = xMalloc(Work.RequestCount*sizeof(request));
+    for(size_t Index = 0; Index < Work.RequestCount; ++Index) {
+        double Uniform = randomU32()/4294967296.0;
+        Work.Requests[Index].Expression = (uint32_t)(Work.Count*pow(Uniform, PopularitySkew));
+        for(int Param = 0; Param < MaxParamCount; ++Param) {
+            Work.Requests[Index].Params[Param] = randomU32();
+        }
+    }
+
+    Work.Programs = xMalloc(Work.Count*sizeof(tiered_program));
+    Work.Outcomes = xMalloc(Work.RequestCount*sizeof(outcome));
+    outcome *Expected = xMalloc(Work.RequestCount*sizeof(outcome));
+
+    printf("%zu expressions, %zu requests\n", Work.Count, Work.RequestCount);
+
+    static struct {
+        char *Name;
+        tier_config Config;
+    } Policies[] = {
+        {"compile first", {0, UINT64_MAX}},
+        {"tree only", {UINT64_MAX, UINT64_MAX}},
+        {"tables first", {0, 0}},
+        {"tiered", {TierDefaultWarm, TierDefaultHot}},
+    };
+
+    double CompileFirst = 0;
+    for(int Policy = 0; Policy < (int)arrayCount(Policies); ++Policy) {
+        Work.Config = Policies[Policy].Config;
+        benchMeasure(&Options, Policies[Policy].Name, "ns/request", streamBody, &Work, Work.RequestCount, 0);
+        double Median = Results[ResultCount - 1].Median;
+        printf("%20s %10.2fx compile first, runs per tier:", "", (Policy ? CompileFirst : Median)/Median);
+        for(int Tier = 0; Tier < Tier_Count; ++Tier) {
+            printf(" %s %llu", TierNames[Tier], (unsigned long long)Work.TierRuns[Tier]);
+        }
+        printf("\n");
+
+        if(Policy == 0) {
+            CompileFirst = Median;
+            memcpy(Expected, Work.Outcomes, Work.RequestCount*sizeof(outcome));
+        }
+        for(size_t Index = 0; Index < Work.RequestCount; ++Index) {
+            outcome *Outcome = Work.Outcomes + Index;
+            if(Outcome->Error != Expected[Index].Error || (!Outcome->Error && Outcome->Result != Expected[Index].Result)) {
+                fatalError("%s gave a different result for request %zu (%s)", Policies[Policy].Name, Index,
+                           Work.Sources[Work.Requests[Index].Expression]);
+            }
+        }
+    }
+
+    // NOTE: What each tier costs once an expression settled in it, on the most popular expressions
+    static char Names[Tier_Count][32];
+    Work.Config = (tier_config){UINT64_MAX, UINT64_MAX};
+    Work.SteadyCount = min(Work.Count, (size_t)SteadyExpressions);
+    for(int Tier = 0; Tier < Tier_Count; ++Tier) {
+        for(size_t Index = 0; Index < Work.SteadyCount; ++Index) {
+            tieredInit(Work.Programs + Index, Work.Sources[Index], Work.Asts[Index]);
+            if(Tier != Tier_Tree) {
+                tieredPromote(Work.Programs + Index, Tier);
+            }
+        }
+
+        snprintf(Names[Tier], sizeof(Names[Tier]), "steady %s", TierNames[Tier]);
+        benchMeasure(&Options, Names[Tier], "ns/eval", steadyBody, &Work, Work.SteadyCount*SteadyRuns, 0);
+
+        for(size_t Index = 0; Index < Work.SteadyCount; ++Index) {
+            tieredFree(Work.Programs + Index);
+        }
+    }
+
+    benchWriteJson(&Options, "tiered");
+
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        bufFree(Work.Sources[Index]);
+    }
+    free(Work.Sources);
+    free(Work.Asts);
+    free(Work.Requests);
+    free(Work.Programs);
+    free(Work.Outcomes);
+    free(Expected);
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Integer POW in --wide programs against the 32-bit VM, whose POW converts both operands to
+// double, calls pow() and converts back. First the two on their own over random small bases and
+// exponents, then --count generated sums of --size powers of masked parameters, compiled for both
+// VMs from the same tree. The operands keep every result within int32_t, where both have to agree.
+//
+// Usage: bench_wide [OPTION...], see benchUsage() in harness.h
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <vm.c>
+#include <widevm.c>
+
+#include "bench.h"
+
+enum {
+    PowerPairs = 4096,
+    PowerRounds = 256,
+    ParamSets = 4,
+    // NOTE: 8**7 times the terms of a --size 64 sum still fits in int32_t
+    MaxSize = 64,
+};
+
+typedef struct workload {
+    int32_t Bases[PowerPairs], Exponents[PowerPairs];
+    volatile int64_t Sink;
+
+    size_t Count;
+    uint8_t **Code, **WideCode;
+    int32_t Params[ParamSets][MaxParamCount];
+    int64_t WideParams[ParamSets][MaxParamCount];
+    int64_t *Results, *WideResults;
+} workload;
+
+static void doubleBody(void *Data) {
+    workload *Work = Data;
+    int64_t Sum = 0;
+    for(int Round = 0; Round < PowerRounds; ++Round) {
+        for(int Index = 0; Index < PowerPairs; ++Index) {
+            Sum += (int32_t)pow(Work->Bases[Index], Work->Exponents[Index]);
+        }
+    }
+    Work->Sink = Sum;
+}
+
+static void integerBody(void *Data) {
+    workload *Work = Data;
+    int64_t Sum = 0;
+    bool DivisionByZero = false;
+    for(int Round = 0; Round < PowerRounds; ++Round) {
+        for(int Index = 0; Index < PowerPairs; ++Index) {
+            Sum += bitPower64(Work->Bases[Index], Work->Exponents[Index], &DivisionByZero);
+        }
+    }
+    Work->Sink = Sum;
+}
+
+static void vmBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        for(int Set = 0; Set < ParamSets; ++Set) {
+            Work->Results[Index*ParamSets + Set] = executeVm(Work->Code[Index], Work->Params[Set]);
+        }
+    }
+}
+
+static void wideBody(void *Data) {
+    workload *Work = Data;
+    for(size_t Index = 0; Index < Work->Count; ++Index) {
+        for(int Set = 0; Set < ParamSets; ++Set) {
+            Work->WideResults[Index*ParamSets + Set] = executeWideVm(Work->WideCode[Index], Work->WideParams[Set]);
+        }
+    }
+}
+
+// NOTE: Terms are (($P & 7) + 1) ** ($Q & 7) or ($P & 255), joined by + - and ^
+static void generatePowers(char **Out, bench_options *Options) {
+    static char *Joins[] = {" + ", " - ", " ^ "};
+    for(int Term = 0; Term < Options->Size; ++Term) {
+        if(Term) {
+            appendText(Out, Joins[randomU32() % arrayCount(Joins)], 3);
+        }
+        char Text[64];
+        int Length;
+        if(randomU32() % 4) {
+            Length = sprintf(Text, "(($%u & 7) + 1) ** ($%u & 7)", randomU32() % Options->ParamCount,
+                             randomU32() % Options->ParamCount);
+        } else {
+            Length = sprintf(Text, "($%u & 255)", randomU32() % Options->ParamCount);
+        }
+        appendText(Out, Text, Length);
+    }
+    bufPush(*Out, 0);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    bench_options Options = benchParseOptions(ArgCount, ArgVal);
+    if(!Options.ParamCount || !Options.Size || Options.Size > MaxSize) {
+        benchUsage(ArgVal[0]);
+    }
+
+    static workload Work;
+    for(int Index = 0; Index < PowerPairs; ++Index) {
+        Work.Bases[Index] = randomU32() % 17 - 8;
+        Work.Exponents[Index] = randomU32() % 8;
+    }
+    for(int Index = 0; Index < PowerPairs; ++Index) {
+        bool DivisionByZero = false;
+        int64_t Expected = (int64_t)pow(Work.Bases[Index], Work.Exponents[Index]);
+        if(bitPower64(Work.Bases[Index], Work.Exponents[Index], &DivisionByZero) != Expected) {
+            fatalError("%d ** %d differs from pow()", Work.Bases[Index], Work.Exponents[Index]);
+        }
+    }
+
+    Work.Count = Options.Count;
+    Work.Code = xMalloc(Work.Count*sizeof(uint8_t *));
+    Work.WideCode = xMalloc(Work.Count*sizeof(uint8_t *));
+    Work.Results = xMalloc(Work.Count*ParamSets*sizeof(int64_t));
+    Work.WideResults = xMalloc(Work.Count*ParamSets*sizeof(int64_t));
+    for(int Set = 0; Set < ParamSets; ++Set) {
+        for(int Param = 0; Param < MaxParamCount; ++Param) {
+            Work.Params[Set][Param] = randomU32();
+            Work.WideParams[Set][Param] = Work.Params[Set][Param];
+        }
+    }
+
+    char *Source = 0;
+    size_t CodeBytes = 0;
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        if(Source) {
+            bufHeader_(Source)->Length = 0;
+        }
+        generatePowers(&Source, &Options);
+        expression *Ast = parseSource(Source);
+
+        size_t Size;
+        Work.Code[Index] = generateCode(Ast, &Size);
+        Work.WideCode[Index] = 0;
+        printBinaryWide(&Work.WideCode[Index], Ast);
+        bufPush(Work.WideCode[Index], HALT);
+        CodeBytes += Size;
+        arenaFree(&BenchArena);
+    }
+    bufFree(Source);
+    printf("%zu expressions, %zu bytes of 32-bit code\n", Work.Count, CodeBytes);
+
+    benchMeasure(&Options, "pow() double", "ns/pow", doubleBody, &Work, (double)PowerRounds*PowerPairs, 0);
+    double Double = Results[ResultCount - 1].Median;
+    benchMeasure(&Options, "bitPower64", "ns/pow", integerBody, &Work, (double)PowerRounds*PowerPairs, 0);
+    printf("%20s %10.2fx faster than pow()\n", "", Double/Results[ResultCount - 1].Median);
+
+    double Runs = (double)Work.Count*ParamSets;
+    benchMeasure(&Options, "vm 32-bit", "ns/run", vmBody, &Work, Runs, 0);
+    double Narrow = Results[ResultCount - 1].Median;
+    benchMeasure(&Options, "vm wide", "ns/run", wideBody, &Work, Runs, 0);
+    printf("%20s %10.2fx faster than the 32-bit VM\n", "", Narrow/Results[ResultCount - 1].Median);
+
+    for(size_t Index = 0; Index < Work.Count*ParamSets; ++Index) {
+        if(Work.Results[Index] != Work.WideResults[Index]) {
+            fatalError("Expression %zu gave %lld on 32 bits and %lld on 64 bits", Index/ParamSets,
+                       (long long)Work.Results[Index], (long long)Work.WideResults[Index]);
+        }
+    }
+
+    benchWriteJson(&Options, "wide");
+
+    for(size_t Index = 0; Index < Work.Count; ++Index) {
+        bufFree(Work.Code[Index]);
+        bufFree(Work.WideCode[Index]);
+    }
+    free(Work.Code);
+    free(Work.WideCode);
+    free(Work.Results);
+    free(Work.WideResults);
+    return 0;
+}
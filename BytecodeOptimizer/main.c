@@ -0,0 +1,389 @@
+// Bytecode optimizer for programs whose source is gone.
+//
+// Every program is lifted back to an expression by simulating the VM stack over its instructions.
+// Without a DUP instruction every value is consumed exactly once, so the lifted DAG is a tree, the
+// same kind the parser builds. It then goes through the compiler's passes: idiom rewriting,
+// constant folding and lookup tables, generation and the peephole pass. The result is kept when
+// it is cheaper than the original, with fewer instructions, which is where the VM spends its time
+// on straight-line code, or with as many in fewer bytes. Before anything is written both versions
+// run on --check random inputs and have to agree on every result and error.
+//
+// Programs compiled with --mod, --wide or --bigint are left alone, the passes fold with the VM's
+// 32-bit arithmetic. Debug sections are dropped, their spans point at the old offsets. Modules
+// written by compiler --batch are rewritten entry by entry.
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <specialize.c>
+#include <generator.c>
+#include <vm.c>
+#include <peephole.c>
+#include <compile.c>
+#include <module.c>
+
+enum { BcoptDefaultChecks = 1024 };
+
+static token_type UnaryTokens[256] = {
+    [NOT] = Token_BitNot, [SYM] = Token_UnaryMinus, [POPCNT] = Token_Popcount, [CLZ] = Token_Clz,
+    [CTZ] = Token_Ctz, [BSWAP] = Token_Bswap,
+};
+
+static token_type BinaryTokens[256] = {
+    [ADD] = Token_Add, [SUB] = Token_Subtract, [MUL] = Token_Multiply, [DIV] = Token_Divide,
+    [MOD] = Token_Mod, [OR] = Token_BitOr, [XOR] = Token_BitXor, [AND] = Token_BitAnd,
+    [LSH] = Token_LShift, [RSH] = Token_RShift, [POW] = Token_Power, [ROL] = Token_Rotl,
+    [ROR] = Token_Rotr, [PDEP] = Token_Pdep, [PEXT] = Token_Pext, [LT] = Token_Less,
+    [LE] = Token_LessEqual, [EQ] = Token_Equal, [NE] = Token_NotEqual,
+};
+
+typedef struct bcopt_totals {
+    int Files;
+    size_t Bytes[2];
+    size_t Insns[2];
+} bcopt_totals;
+
+static uint64_t BcoptRandom = 0x9E3779B97F4A7C15ull;
+static uint32_t bcoptRandomU32(void) {
+    BcoptRandom ^= BcoptRandom << 13;
+    BcoptRandom ^= BcoptRandom >> 7;
+    BcoptRandom ^= BcoptRandom << 17;
+    return (uint32_t)BcoptRandom;
+}
+
+// NOTE: Insns come from peepholeDecode() on a validated program, so the stack never underflows
+static expression *bcoptLift(arena *Arena, peephole_insn *Insns) {
+    expression **Stack = 0;
+    for(peephole_insn *Insn = Insns; Insn->Op != HALT; ++Insn) {
+        expression *Node = 0;
+        if(Insn->Op == NOP) {
+            continue;
+        } else if(Insn->Op == LIT) {
+            Node = expressionIntNew(Arena, (uint32_t)Insn->Value);
+        } else if(Insn->Op == ARG) {
+            Node = expressionParamNew(Arena, Insn->Value);
+        } else if(Insn->Op == LUT) {
+            Node = expressionNew(Arena, Expression_Lut);
+            Node->Lut.BitCount = Insn->Bytes[1];
+            for(int Bit = 0; Bit < Node->Lut.BitCount; ++Bit) {
+                Node->Lut.Params[Bit] = Insn->Bytes[2 + 2*Bit];
+                Node->Lut.Bits[Bit] = Insn->Bytes[3 + 2*Bit];
+            }
+
+            uint8_t *Entries = Insn->Bytes + 2 + 2*Node->Lut.BitCount;
+            Node->Lut.Table = arenaAlloc(Arena, sizeof(int32_t) << Node->Lut.BitCount);
+            for(uint32_t Index = 0; Index < (1u << Node->Lut.BitCount); ++Index) {
+                uint8_t *Entry = Entries + 4*Index;
+                Node->Lut.Table[Index] = (int32_t)((uint32_t)Entry[0] | (uint32_t)Entry[1] << 8 |
+                                                   (uint32_t)Entry[2] << 16 | (uint32_t)Entry[3] << 24);
+            }
+        } else if(Insn->Op == SEL) {
+            size_t Top = bufLength(Stack);
+            Node = expressionSelectNew(Arena, Stack[Top - 3], Stack[Top - 2], Stack[Top - 1]);
+            bufHeader_(Stack)->Length -= 3;
+        } else if(UnaryTokens[Insn->Op]) {
+            Node = expressionUnaryNew(Arena, UnaryTokens[Insn->Op], Stack[bufLength(Stack) - 1]);
+            bufHeader_(Stack)->Length -= 1;
+        } else {
+            assert(BinaryTokens[Insn->Op]);
+            size_t Top = bufLength(Stack);
+            Node = expressionBinaryNew(Arena, BinaryTokens[Insn->Op], Stack[Top - 2], Stack[Top - 1]);
+            bufHeader_(Stack)->Length -= 2;
+        }
+        bufPush(Stack, Node);
+    }
+
+    assert(bufLength(Stack) == 1);
+    expression *Result = Stack[0];
+    bufFree(Stack);
+    return Result;
+}
+
+static size_t bcoptCodeSize(peephole_insn *Insns, int *InsnCount) {
+    size_t Size = 0;
+    *InsnCount = 0;
+    for(peephole_insn *Insn = Insns; ; ++Insn) {
+        Size += Insn->Size;
+        if(Insn->Op == HALT) {
+            return Size;
+        }
+        ++*InsnCount;
+    }
+}
+
+static bool bcoptRun(uint8_t *Code, int32_t *Params, int32_t *Result) {
+    vm_context Context;
+    vmInit(&Context, Code, Params);
+    while(!vmRun(&Context, UINT32_MAX)) {}
+    *Result = Context.Result;
+    return Context.Error == VmError_None;
+}
+
+// NOTE: Inputs mix values where arithmetic identities break with random ones
+static bool bcoptAgree(uint8_t *Original, uint8_t *Optimized, int ParamCount, int Checks) {
+    static int32_t Corners[] = {0, 1, -1, 2, 31, 32, INT32_MIN, INT32_MAX};
+    int32_t Params[MaxParamCount] = {};
+    for(int Check = 0; Check < Checks; ++Check) {
+        for(int Param = 0; Param < ParamCount; ++Param) {
+            uint32_t Pick = bcoptRandomU32();
+            Params[Param] = Pick % 4 == 0 ? Corners[Pick / 4 % arrayCount(Corners)] :
+                            Pick % 4 == 1 ? (int32_t)(Pick / 4 % 64) : (int32_t)bcoptRandomU32();
+        }
+
+        int32_t Expected, Result;
+        bool Ok = bcoptRun(Original, Params, &Expected);
+        if(bcoptRun(Optimized, Params, &Result) != Ok || (Ok && Result != Expected)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bcoptWrite(char *Path, uint8_t *Code, size_t Size) {
+    char Temp[4096];
+    snprintf(Temp, sizeof(Temp), "%s.tmp", Path);
+    FILE *File = fopen(Temp, "wb");
+    if(!File || fwrite(Code, 1, Size, File) != Size || fclose(File) != 0 || rename(Temp, Path) != 0) {
+        fatalError("Could not write %s", Path);
+    }
+}
+
+static double bcoptPercent(size_t Old, size_t New) {
+    return Old ? 100.0*((double)New - (double)Old)/(double)Old : 0;
+}
+
+static void bcoptReport(char *Name, bcopt_totals *Totals, char *Suffix) {
+    printf("%s: %zu -> %zu bytes (%+.1f%%), %zu -> %zu instructions (%+.1f%%)%s\n", Name, Totals->Bytes[0],
+           Totals->Bytes[1], bcoptPercent(Totals->Bytes[0], Totals->Bytes[1]), Totals->Insns[0], Totals->Insns[1],
+           bcoptPercent(Totals->Insns[0], Totals->Insns[1]), Suffix);
+}
+
+static void bcoptAddTotals(bcopt_totals *Totals, bcopt_totals *File) {
+    ++Totals->Files;
+    for(int Side = 0; Side < 2; ++Side) {
+        Totals->Bytes[Side] += File->Bytes[Side];
+        Totals->Insns[Side] += File->Insns[Side];
+    }
+}
+
+// NOTE: Appends what replaces the validated program Code to Out: the optimized version when it is
+// cheaper and agrees with Code, else Code itself. Adds the sizes before and after to Totals and
+// returns false when the optimized version disagrees, Name labels that message.
+static bool bcoptProgram(char *Name, uint8_t *Code, size_t Size, int ParamCount, int LutBits, int Checks,
+                         bcopt_totals *Totals, uint8_t **Out, bool *Rewritten)
+{
+    peephole_insn *Insns = peepholeDecode(Code);
+    int OldInsns;
+    size_t OldBytes = bcoptCodeSize(Insns, &OldInsns);
+
+    arena Arena = {};
+    expression *Ast = bcoptLift(&Arena, Insns);
+    uint8_t *Optimized = 0;
+    compileAst(&Optimized, &Arena, Ast, LutBits, 0, 0);
+    arenaFree(&Arena);
+    bufFree(Insns);
+
+    Insns = peepholeDecode(Optimized);
+    int NewInsns;
+    size_t NewBytes = bcoptCodeSize(Insns, &NewInsns);
+    bufFree(Insns);
+
+    bool Ok = true;
+    bool Cheaper = NewInsns < OldInsns || (NewInsns == OldInsns && NewBytes < OldBytes);
+    if(Cheaper && !bcoptAgree(Code, Optimized, ParamCount, Checks)) {
+        fprintf(stderr, "%s: the optimized program disagrees with the original, left unchanged\n", Name);
+        Cheaper = Ok = false;
+    }
+    if(!Cheaper) {
+        NewInsns = OldInsns;
+        NewBytes = OldBytes;
+    }
+
+    emitBytes(Out, Cheaper ? Optimized : Code, Cheaper ? bufLength(Optimized) : Size);
+    Totals->Bytes[0] += OldBytes;
+    Totals->Bytes[1] += NewBytes;
+    Totals->Insns[0] += OldInsns;
+    Totals->Insns[1] += NewInsns;
+    *Rewritten = Cheaper;
+
+    bufFree(Optimized);
+    return Ok;
+}
+
+// NOTE: Every entry of a compiler --batch module is optimized on its own and the module is written
+// back with the same entries in the same order, the ones that did not compile stay empty
+static bool bcoptModule(char *Path, char *Output, uint8_t *Module, size_t Size, int LutBits, int Checks,
+                        bcopt_totals *Totals)
+{
+    uint32_t Count = moduleEntryCount(Module);
+    uint8_t *Code = 0;
+    uint32_t *Sizes = 0;
+    bcopt_totals File = {};
+    uint32_t Rewrites = 0;
+    bool Ok = true;
+
+    for(uint32_t Index = 0; Index < Count; ++Index) {
+        uint8_t *Entry;
+        size_t EntrySize;
+        if(!moduleEntry(Module, Size, Index, &Entry, &EntrySize)) {
+            fprintf(stderr, "%s: truncated module\n", Path);
+            bufFree(Code);
+            bufFree(Sizes);
+            return false;
+        }
+
+        char Name[4096];
+        snprintf(Name, sizeof(Name), "%s entry %u", Path, Index);
+        size_t Length = bufLength(Code);
+        int ParamCount;
+        if(Entry && !vmValidate(Entry, EntrySize, &ParamCount)) {
+            fprintf(stderr, "%s: not a valid program, left unchanged\n", Name);
+            emitBytes(&Code, Entry, EntrySize);
+            Ok = false;
+        } else if(Entry) {
+            bool Rewritten;
+            Ok &= bcoptProgram(Name, Entry, EntrySize, ParamCount, LutBits, Checks, &File, &Code, &Rewritten);
+            Rewrites += Rewritten;
+        }
+        bufPush(Sizes, (uint32_t)(bufLength(Code) - Length));
+    }
+
+    char Suffix[64];
+    snprintf(Suffix, sizeof(Suffix), ", %u of %u entries rewritten", Rewrites, Count);
+    bcoptReport(Path, &File, Suffix);
+    if(Output && Rewrites) {
+        uint8_t *Rewritten = 0;
+        moduleWrite(&Rewritten, Code, Sizes, Count);
+        bcoptWrite(Output, Rewritten, bufLength(Rewritten));
+        bufFree(Rewritten);
+    } else if(Output && strcmp(Output, Path) != 0) {
+        bcoptWrite(Output, Module, Size);
+    }
+    bcoptAddTotals(Totals, &File);
+
+    bufFree(Code);
+    bufFree(Sizes);
+    return Ok;
+}
+
+// NOTE: Returns false when Path could not be optimized at all
+static bool bcoptFile(char *Path, char *Output, int LutBits, int Checks, bcopt_totals *Totals) {
+    size_t Size;
+    uint8_t *Code = readEntireFile(Path, &Size);
+    int ParamCount;
+    if(moduleIs(Code, Size)) {
+        bool Ok = bcoptModule(Path, Output, Code, Size, LutBits, Checks, Totals);
+        free(Code);
+        return Ok;
+    }
+    if(Size && (Code[0] == MODP || Code[0] == WIDE || Code[0] == BIG)) {
+        printf("%s: compiled with %s, left unchanged\n", Path,
+               Code[0] == MODP ? "--mod" : Code[0] == WIDE ? "--wide" : "--bigint");
+        free(Code);
+        return true;
+    }
+    if(!vmValidate(Code, Size, &ParamCount)) {
+        fprintf(stderr, "%s: not a valid program\n", Path);
+        free(Code);
+        return false;
+    }
+
+    bcopt_totals File = {};
+    uint8_t *Result = 0;
+    bool Rewritten;
+    bool Ok = bcoptProgram(Path, Code, Size, ParamCount, LutBits, Checks, &File, &Result, &Rewritten);
+    bcoptReport(Path, &File, Rewritten && Size > File.Bytes[0] ? ", debug section dropped" : "");
+    if(Output && (Rewritten || strcmp(Output, Path) != 0)) {
+        bcoptWrite(Output, Result, bufLength(Result));
+    }
+    bcoptAddTotals(Totals, &File);
+
+    bufFree(Result);
+    free(Code);
+    return Ok;
+}
+
+static void usage(char *Program) {
+    fprintf(stderr, "Usage: %s [--lut-bits N] [--check N] [-o DIR | --in-place] FILE...\n", Program);
+    fprintf(stderr, "  --lut-bits N  Same as the compiler's (default %d)\n", LutDefaultBits);
+    fprintf(stderr, "  --check N     Random inputs both versions have to agree on (default %d)\n",
+            BcoptDefaultChecks);
+    fprintf(stderr, "  -o DIR        Write the programs to DIR under their own names\n");
+    fprintf(stderr, "  --in-place    Replace the programs, without either only the savings are reported\n");
+    exit(1);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    int LutBits = LutDefaultBits;
+    int Checks = BcoptDefaultChecks;
+    char *OutputDir = 0;
+    bool InPlace = false;
+    char **Paths = 0;
+
+    for(int Index = 1; Index < ArgCount; ++Index) {
+        if(strcmp(ArgVal[Index], "--lut-bits") == 0 && Index+1 < ArgCount) {
+            LutBits = atoi(ArgVal[++Index]);
+            if(LutBits < 0 || LutBits > MaxLutBits) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "--check") == 0 && Index+1 < ArgCount) {
+            Checks = atoi(ArgVal[++Index]);
+            if(Checks < 0) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "-o") == 0 && Index+1 < ArgCount) {
+            OutputDir = ArgVal[++Index];
+        }
+        else if(strcmp(ArgVal[Index], "--in-place") == 0) {
+            InPlace = true;
+        }
+        else {
+            bufPush(Paths, ArgVal[Index]);
+        }
+    }
+    if(!bufLength(Paths) || (OutputDir && InPlace)) {
+        usage(ArgVal[0]);
+    }
+
+    bcopt_totals Totals = {};
+    int Failed = 0;
+    for(size_t Index = 0; Index < bufLength(Paths); ++Index) {
+        char *Path = Paths[Index];
+        char Output[4096];
+        if(OutputDir) {
+            char *Name = strrchr(Path, '/');
+            snprintf(Output, sizeof(Output), "%s/%s", OutputDir, Name ? Name + 1 : Path);
+        }
+        Failed += !bcoptFile(Path, OutputDir ? Output : InPlace ? Path : 0, LutBits, Checks, &Totals);
+    }
+
+    if(Totals.Files > 1) {
+        printf("%d files: %zu -> %zu bytes (%+.1f%%), %zu -> %zu instructions (%+.1f%%)\n", Totals.Files,
+               Totals.Bytes[0], Totals.Bytes[1], bcoptPercent(Totals.Bytes[0], Totals.Bytes[1]),
+               Totals.Insns[0], Totals.Insns[1], bcoptPercent(Totals.Insns[0], Totals.Insns[1]));
+    }
+
+    bufFree(Paths);
+    return Failed ? 1 : 0;
+}
@@ -0,0 +1,681 @@
+// Arbitrary precision integers for the --bigint modes of the interpreter and the VM.
+//
+// Requires stretchy.c and memory.c.
+//
+// A value is a sign and a magnitude of 64-bit limbs, least significant first, without leading
+// zero limbs, so zero has no limbs and is never negative. Operations allocate their result in an
+// arena and never modify their operands, values can be shared freely. Only scratch space that
+// does not outlive an operation comes from the heap.
+//
+// The semantics are the ones of the int64_t interpreter without the overflow: division truncates
+// towards zero, the remainder has the sign of the dividend, and bitwise operators and right shifts
+// work on an infinite two's complement representation.
+
+enum {
+    // NOTE: Operands below this many limbs are multiplied by schoolbook, see Bench/bigint.c. At
+    // least 4, smaller operands would not get smaller when split.
+    BigKaratsubaDefault = 40,
+
+    // NOTE: 64M bits, results that would be larger fail with BigError_TooLarge
+    BigMaxLimbs = 1<<20,
+
+    // NOTE: Largest power of ten in a limb, decimal conversion works in chunks of this
+    BigDecimalChunkDigits = 19,
+};
+
+static size_t BigKaratsubaLimbs = BigKaratsubaDefault;
+
+static const uint64_t BigDecimalChunk = 10000000000000000000ull;
+
+typedef unsigned __int128 big_wide;
+
+typedef enum big_error {
+    BigError_None,
+    BigError_DivisionByZero,
+    BigError_TooLarge,
+
+    BigError_Count
+} big_error;
+
+typedef struct bigint {
+    uint64_t *Limbs;
+    size_t Count;
+    bool Negative;
+} bigint;
+
+typedef enum big_bitwise {
+    Big_And,
+    Big_Or,
+    Big_Xor,
+} big_bitwise;
+
+static bigint bigAlloc(arena *Arena, size_t Count) {
+    bigint Result = {arenaAlloc(Arena, max(Count, 1)*sizeof(uint64_t)), Count, false};
+    return Result;
+}
+
+static bigint bigTrim(bigint Value) {
+    while(Value.Count && Value.Limbs[Value.Count - 1] == 0) {
+        --Value.Count;
+    }
+    Value.Negative &= Value.Count != 0;
+    return Value;
+}
+
+static bigint bigFromU64(arena *Arena, uint64_t Value) {
+    bigint Result = bigAlloc(Arena, 1);
+    Result.Limbs[0] = Value;
+    return bigTrim(Result);
+}
+
+static bigint bigFromI64(arena *Arena, int64_t Value) {
+    bigint Result = bigFromU64(Arena, Value < 0 ? -(uint64_t)Value : (uint64_t)Value);
+    Result.Negative = Value < 0;
+    return Result;
+}
+
+static bool bigIsZero(bigint Value) {
+    return Value.Count == 0;
+}
+
+// NOTE: True if Value fits in an int64_t, which is then stored in *Result
+static bool bigToI64(bigint Value, int64_t *Result) {
+    if(Value.Count > 1) {
+        return false;
+    }
+
+    uint64_t Magnitude = Value.Count ? Value.Limbs[0] : 0;
+    if(Magnitude > (uint64_t)INT64_MAX + Value.Negative) {
+        return false;
+    }
+    *Result = Value.Negative ? (int64_t)-Magnitude : (int64_t)Magnitude;
+    return true;
+}
+
+static size_t bigBitCount(bigint Value) {
+    if(!Value.Count) {
+        return 0;
+    }
+    return 64*Value.Count - __builtin_clzll(Value.Limbs[Value.Count - 1]);
+}
+
+static int bigCompareMagnitude(uint64_t *A, size_t ACount, uint64_t *B, size_t BCount) {
+    if(ACount != BCount) {
+        return ACount < BCount ? -1 : 1;
+    }
+
+    for(size_t Index = ACount; Index--;) {
+        if(A[Index] != B[Index]) {
+            return A[Index] < B[Index] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// Magnitude helpers, all of them on raw limb arrays
+
+// NOTE: Out may alias A, returns the carry out of Count limbs
+static uint64_t bigAddLimbs(uint64_t *Out, uint64_t *A, size_t ACount, uint64_t *B, size_t BCount) {
+    assert(ACount >= BCount);
+
+    uint64_t Carry = 0;
+    for(size_t Index = 0; Index < BCount; ++Index) {
+        big_wide Sum = (big_wide)A[Index] + B[Index] + Carry;
+        Out[Index] = (uint64_t)Sum;
+        Carry = (uint64_t)(Sum >> 64);
+    }
+    for(size_t Index = BCount; Index < ACount; ++Index) {
+        uint64_t Sum = A[Index] + Carry;
+        Carry = Carry && Sum == 0;
+        Out[Index] = Sum;
+    }
+    return Carry;
+}
+
+// NOTE: Out may alias A, returns the borrow out of ACount limbs, which is zero when A >= B
+static uint64_t bigSubLimbs(uint64_t *Out, uint64_t *A, size_t ACount, uint64_t *B, size_t BCount) {
+    assert(ACount >= BCount);
+
+    uint64_t Borrow = 0;
+    for(size_t Index = 0; Index < BCount; ++Index) {
+        uint64_t Lhs = A[Index], Rhs = B[Index];
+        uint64_t Difference = Lhs - Rhs - Borrow;
+        Borrow = Lhs < Rhs || (Lhs == Rhs && Borrow);
+        Out[Index] = Difference;
+    }
+    for(size_t Index = BCount; Index < ACount; ++Index) {
+        uint64_t Lhs = A[Index];
+        Out[Index] = Lhs - Borrow;
+        Borrow = Borrow && Lhs == 0;
+    }
+    return Borrow;
+}
+
+// NOTE: Out has ACount + BCount limbs and does not alias either operand
+static void bigMulSchoolbook(uint64_t *Out, uint64_t *A, size_t ACount, uint64_t *B, size_t BCount) {
+    memset(Out, 0, (ACount + BCount)*sizeof(uint64_t));
+    for(size_t I = 0; I < ACount; ++I) {
+        uint64_t Carry = 0;
+        uint64_t Digit = A[I];
+        for(size_t J = 0; J < BCount; ++J) {
+            big_wide Product = (big_wide)Digit*B[J] + Out[I + J] + Carry;
+            Out[I + J] = (uint64_t)Product;
+            Carry = (uint64_t)(Product >> 64);
+        }
+        Out[I + BCount] = Carry;
+    }
+}
+
+// NOTE: Scratch limbs bigMulKaratsuba() needs for operands of Count limbs
+static size_t bigKaratsubaScratch(size_t Count) {
+    size_t Scratch = 0;
+    while(Count >= BigKaratsubaLimbs) {
+        size_t High = Count - Count/2;
+        Scratch += 4*(High + 1);
+        Count = High + 1;
+    }
+    return Scratch;
+}
+
+// NOTE: Out = A*B for two operands of Count limbs, Out has 2*Count limbs. With A = A1*W + A0 and
+// B = B1*W + B0, the middle term A1*B0 + A0*B1 is (A0 + A1)(B0 + B1) - A0*B0 - A1*B1, so three
+// half size products replace four.
+static void bigMulKaratsuba(uint64_t *Out, uint64_t *A, uint64_t *B, size_t Count, uint64_t *Scratch) {
+    if(Count < BigKaratsubaLimbs) {
+        bigMulSchoolbook(Out, A, Count, B, Count);
+        return;
+    }
+
+    size_t Low = Count/2, High = Count - Low;
+    bigMulKaratsuba(Out, A, B, Low, Scratch);
+    bigMulKaratsuba(Out + 2*Low, A + Low, B + Low, High, Scratch);
+
+    uint64_t *SumA = Scratch;
+    uint64_t *SumB = SumA + High + 1;
+    uint64_t *Middle = SumB + High + 1;
+    SumA[High] = bigAddLimbs(SumA, A + Low, High, A, Low);
+    SumB[High] = bigAddLimbs(SumB, B + Low, High, B, Low);
+    bigMulKaratsuba(Middle, SumA, SumB, High + 1, Middle + 2*(High + 1));
+
+    size_t MiddleCount = 2*(High + 1);
+    bigSubLimbs(Middle, Middle, MiddleCount, Out, 2*Low);
+    bigSubLimbs(Middle, Middle, MiddleCount, Out + 2*Low, 2*High);
+
+    // NOTE: The product fits in 2*Count limbs, so the top of Middle past that is zero
+    size_t Added = min(MiddleCount, 2*Count - Low);
+    uint64_t Carry = bigAddLimbs(Out + Low, Out + Low, 2*Count - Low, Middle, Added);
+    assert(!Carry);
+    (void)Carry;
+}
+
+// NOTE: Out has ACount + BCount limbs and does not alias either operand. Unbalanced operands are
+// multiplied a slice of the longer one at a time, each slice as long as the shorter one.
+static void bigMulLimbs(uint64_t *Out, uint64_t *A, size_t ACount, uint64_t *B, size_t BCount) {
+    if(ACount < BCount) {
+        bigMulLimbs(Out, B, BCount, A, ACount);
+        return;
+    }
+
+    if(BCount < BigKaratsubaLimbs) {
+        bigMulSchoolbook(Out, A, ACount, B, BCount);
+        return;
+    }
+
+    uint64_t *Scratch = xMalloc((2*BCount + bigKaratsubaScratch(BCount))*sizeof(uint64_t));
+    uint64_t *Product = Scratch + bigKaratsubaScratch(BCount);
+
+    memset(Out, 0, (ACount + BCount)*sizeof(uint64_t));
+    for(size_t Offset = 0; Offset < ACount; Offset += BCount) {
+        size_t Slice = min(BCount, ACount - Offset);
+        if(Slice == BCount) {
+            bigMulKaratsuba(Product, A + Offset, B, BCount, Scratch);
+        } else {
+            bigMulLimbs(Product, B, BCount, A + Offset, Slice);
+        }
+
+        uint64_t Carry = bigAddLimbs(Out + Offset, Out + Offset, ACount + BCount - Offset, Product, Slice + BCount);
+        assert(!Carry);
+        (void)Carry;
+    }
+
+    free(Scratch);
+}
+
+// NOTE: Divides A in place by a single limb and returns the remainder
+static uint64_t bigDivLimb(uint64_t *A, size_t Count, uint64_t Divisor) {
+    big_wide Remainder = 0;
+    for(size_t Index = Count; Index--;) {
+        big_wide Current = Remainder << 64 | A[Index];
+        A[Index] = (uint64_t)(Current / Divisor);
+        Remainder = Current % Divisor;
+    }
+    return (uint64_t)Remainder;
+}
+
+// NOTE: Knuth's algorithm D. Quotient gets ACount - BCount + 1 limbs and Remainder BCount limbs,
+// A has at least as many limbs as B and B at least two, the top one nonzero.
+static void bigDivLimbs(uint64_t *Quotient, uint64_t *Remainder, uint64_t *A, size_t ACount, uint64_t *B,
+                        size_t BCount)
+{
+    assert(BCount >= 2 && ACount >= BCount && B[BCount - 1]);
+
+    // NOTE: Normalizing makes the top divisor limb at least 2^63, so each quotient estimate is
+    // at most two too large
+    int Shift = __builtin_clzll(B[BCount - 1]);
+    uint64_t *Un = xMalloc((ACount + 1 + BCount)*sizeof(uint64_t));
+    uint64_t *Vn = Un + ACount + 1;
+
+    for(size_t Index = BCount - 1; Index > 0; --Index) {
+        Vn[Index] = (B[Index] << Shift) | (Shift ? B[Index - 1] >> (64 - Shift) : 0);
+    }
+    Vn[0] = B[0] << Shift;
+
+    Un[ACount] = Shift ? A[ACount - 1] >> (64 - Shift) : 0;
+    for(size_t Index = ACount - 1; Index > 0; --Index) {
+        Un[Index] = (A[Index] << Shift) | (Shift ? A[Index - 1] >> (64 - Shift) : 0);
+    }
+    Un[0] = A[0] << Shift;
+
+    uint64_t Top = Vn[BCount - 1], Next = Vn[BCount - 2];
+    for(size_t J = ACount - BCount + 1; J--;) {
+        big_wide Numerator = (big_wide)Un[J + BCount] << 64 | Un[J + BCount - 1];
+        big_wide Estimate = Numerator / Top;
+        big_wide Rest = Numerator % Top;
+        while((Estimate >> 64) || Estimate*Next > (Rest << 64 | Un[J + BCount - 2])) {
+            --Estimate;
+            Rest += Top;
+            if(Rest >> 64) {
+                break;
+            }
+        }
+
+        // NOTE: Subtracts Estimate*Vn from the window of Un, a final borrow means one too many
+        __int128 Borrow = 0, Difference;
+        for(size_t Index = 0; Index < BCount; ++Index) {
+            big_wide Product = Estimate*Vn[Index];
+            Difference = (__int128)Un[Index + J] - Borrow - (uint64_t)Product;
+            Un[Index + J] = (uint64_t)Difference;
+            Borrow = (__int128)(uint64_t)(Product >> 64) - (Difference >> 64);
+        }
+        Difference = (__int128)Un[J + BCount] - Borrow;
+        Un[J + BCount] = (uint64_t)Difference;
+
+        if(Difference < 0) {
+            --Estimate;
+            Un[J + BCount] += bigAddLimbs(Un + J, Un + J, BCount, Vn, BCount);
+        }
+        Quotient[J] = (uint64_t)Estimate;
+    }
+
+    for(size_t Index = 0; Index < BCount - 1; ++Index) {
+        Remainder[Index] = (Un[Index] >> Shift) | (Shift ? Un[Index + 1] << (64 - Shift) : 0);
+    }
+    Remainder[BCount - 1] = Un[BCount - 1] >> Shift;
+
+    free(Un);
+}
+
+// Arithmetic
+
+static bigint bigNegate(bigint Value) {
+    Value.Negative = !Value.Negative && Value.Count;
+    return Value;
+}
+
+// NOTE: -1, 0 or 1 as A is less than, equal to or greater than B
+static int bigCompare(bigint A, bigint B) {
+    if(A.Negative != B.Negative) {
+        return A.Negative ? -1 : 1;
+    }
+    int Magnitude = bigCompareMagnitude(A.Limbs, A.Count, B.Limbs, B.Count);
+    return A.Negative ? -Magnitude : Magnitude;
+}
+
+static bigint bigAddSigned(arena *Arena, bigint A, bigint B, bool NegateB) {
+    B.Negative ^= NegateB;
+    if(A.Count < B.Count) {
+        bigint Swap = A;
+        A = B;
+        B = Swap;
+    }
+
+    bigint Result = bigAlloc(Arena, A.Count + 1);
+    if(A.Negative == B.Negative) {
+        Result.Limbs[A.Count] = bigAddLimbs(Result.Limbs, A.Limbs, A.Count, B.Limbs, B.Count);
+        Result.Negative = A.Negative;
+    } else if(bigCompareMagnitude(A.Limbs, A.Count, B.Limbs, B.Count) >= 0) {
+        bigSubLimbs(Result.Limbs, A.Limbs, A.Count, B.Limbs, B.Count);
+        Result.Limbs[A.Count] = 0;
+        Result.Negative = A.Negative;
+    } else {
+        // NOTE: Same limb count but B is larger
+        bigSubLimbs(Result.Limbs, B.Limbs, B.Count, A.Limbs, A.Count);
+        Result.Limbs[A.Count] = 0;
+        Result.Negative = B.Negative;
+    }
+    return bigTrim(Result);
+}
+
+static bigint bigAdd(arena *Arena, bigint A, bigint B) {
+    return bigAddSigned(Arena, A, B, false);
+}
+
+static bigint bigSub(arena *Arena, bigint A, bigint B) {
+    return bigAddSigned(Arena, A, B, true);
+}
+
+static bigint bigMul(arena *Arena, bigint A, bigint B, big_error *Error) {
+    if(!A.Count || !B.Count) {
+        return (bigint){};
+    }
+    if(A.Count + B.Count > BigMaxLimbs) {
+        *Error = BigError_TooLarge;
+        return (bigint){};
+    }
+
+    bigint Result = bigAlloc(Arena, A.Count + B.Count);
+    bigMulLimbs(Result.Limbs, A.Limbs, A.Count, B.Limbs, B.Count);
+    Result.Negative = A.Negative != B.Negative;
+    return bigTrim(Result);
+}
+
+// NOTE: Truncating division, *Remainder gets the sign of A. Either output may be null.
+static void bigDivMod(arena *Arena, bigint A, bigint B, bigint *Quotient, bigint *Remainder, big_error *Error) {
+    if(!B.Count) {
+        *Error = BigError_DivisionByZero;
+        return;
+    }
+
+    bigint Q = {}, R = {};
+    if(bigCompareMagnitude(A.Limbs, A.Count, B.Limbs, B.Count) < 0) {
+        R = A;
+    } else if(B.Count == 1) {
+        Q = bigAlloc(Arena, A.Count);
+        memcpy(Q.Limbs, A.Limbs, A.Count*sizeof(uint64_t));
+        R = bigFromU64(Arena, bigDivLimb(Q.Limbs, Q.Count, B.Limbs[0]));
+    } else {
+        Q = bigAlloc(Arena, A.Count - B.Count + 1);
+        R = bigAlloc(Arena, B.Count);
+        bigDivLimbs(Q.Limbs, R.Limbs, A.Limbs, A.Count, B.Limbs, B.Count);
+    }
+
+    Q.Negative = A.Negative != B.Negative;
+    R.Negative = A.Negative;
+    if(Quotient) {
+        *Quotient = bigTrim(Q);
+    }
+    if(Remainder) {
+        *Remainder = bigTrim(R);
+    }
+}
+
+// NOTE: Left shifts by a negative count shift right and the other way around, like a
+// multiplication or floor division by 2^Count
+static bigint bigShiftLeft(arena *Arena, bigint A, uint64_t Count, big_error *Error) {
+    if(!A.Count) {
+        return A;
+    }
+    if(Count/64 + A.Count + 1 > BigMaxLimbs) {
+        *Error = BigError_TooLarge;
+        return (bigint){};
+    }
+
+    size_t Words = Count/64;
+    int Bits = Count%64;
+    bigint Result = bigAlloc(Arena, A.Count + Words + 1);
+    memset(Result.Limbs, 0, Words*sizeof(uint64_t));
+
+    uint64_t Carry = 0;
+    for(size_t Index = 0; Index < A.Count; ++Index) {
+        Result.Limbs[Words + Index] = (A.Limbs[Index] << Bits) | Carry;
+        Carry = Bits ? A.Limbs[Index] >> (64 - Bits) : 0;
+    }
+    Result.Limbs[Words + A.Count] = Carry;
+    Result.Negative = A.Negative;
+    return bigTrim(Result);
+}
+
+// NOTE: Floors like an arithmetic shift of the two's complement, -1 >> N stays -1
+static bigint bigShiftRight(arena *Arena, bigint A, uint64_t Count) {
+    size_t Words = Count/64;
+    int Bits = Count%64;
+    if(Words >= A.Count) {
+        return A.Negative ? bigFromI64(Arena, -1) : (bigint){};
+    }
+
+    // NOTE: For negative A, -A >> N = -((A - 1) >> N) - 1 on the magnitude
+    bigint Source = A;
+    if(A.Negative) {
+        Source = bigSub(Arena, bigNegate(A), bigFromU64(Arena, 1));
+    }
+
+    bigint Result = bigAlloc(Arena, Source.Count - min(Words, Source.Count));
+    for(size_t Index = 0; Index < Result.Count; ++Index) {
+        uint64_t Low = Source.Limbs[Words + Index] >> Bits;
+        uint64_t High = Bits && Words + Index + 1 < Source.Count ? Source.Limbs[Words + Index + 1] << (64 - Bits) : 0;
+        Result.Limbs[Index] = Low | High;
+    }
+    Result = bigTrim(Result);
+
+    if(A.Negative) {
+        Result = bigNegate(bigAdd(Arena, Result, bigFromU64(Arena, 1)));
+    }
+    return Result;
+}
+
+static bigint bigShift(arena *Arena, bigint A, bigint Count, bool Left, big_error *Error) {
+    int64_t Amount;
+    if(!bigToI64(Count, &Amount) || Amount == INT64_MIN) {
+        // NOTE: Shifting anything but zero left by 2^63 bits is too large either way
+        if(Left != Count.Negative) {
+            if(A.Count) {
+                *Error = BigError_TooLarge;
+            }
+            return (bigint){};
+        }
+        return A.Negative ? bigFromI64(Arena, -1) : (bigint){};
+    }
+
+    if(Amount < 0) {
+        Left = !Left;
+        Amount = -Amount;
+    }
+    return Left ? bigShiftLeft(Arena, A, Amount, Error) : bigShiftRight(Arena, A, Amount);
+}
+
+// NOTE: Negative exponents truncate like the int64_t pow() does, 0 ** -N divides by zero
+static bigint bigPow(arena *Arena, bigint Base, bigint Exponent, big_error *Error) {
+    bool Unit = Base.Count == 1 && Base.Limbs[0] == 1;
+    if(Exponent.Negative || !Base.Count || Unit) {
+        if(!Base.Count) {
+            if(Exponent.Negative) {
+                *Error = BigError_DivisionByZero;
+            }
+            return bigFromU64(Arena, !Exponent.Count);
+        }
+        if(!Unit) {
+            return (bigint){};
+        }
+        bool Odd = Exponent.Count && (Exponent.Limbs[0] & 1);
+        return bigFromI64(Arena, Base.Negative && Odd ? -1 : 1);
+    }
+
+    int64_t Power;
+    if(!bigToI64(Exponent, &Power) || (double)bigBitCount(Base)*Power > 64.0*BigMaxLimbs) {
+        *Error = BigError_TooLarge;
+        return (bigint){};
+    }
+
+    // NOTE: Squares from the top bit down, so every multiplication by Base is by a short operand
+    bigint Result = bigFromU64(Arena, 1);
+    for(int Bit = 63 - __builtin_clzll(Power | 1); Bit >= 0 && !*Error; --Bit) {
+        Result = bigMul(Arena, Result, Result, Error);
+        if((Power >> Bit) & 1) {
+            Result = bigMul(Arena, Result, Base, Error);
+        }
+    }
+    return *Error ? (bigint){} : Result;
+}
+
+// NOTE: Two's complement limb of a sign and magnitude value, Carry starts at 1 and carries the +1
+// of -M = ~M + 1 through the limbs
+static uint64_t bigComplementLimb(bigint Value, size_t Index, uint64_t *Carry) {
+    uint64_t Limb = Index < Value.Count ? Value.Limbs[Index] : 0;
+    if(!Value.Negative) {
+        return Limb;
+    }
+
+    uint64_t Word = ~Limb + *Carry;
+    *Carry = *Carry && Word == 0;
+    return Word;
+}
+
+static bigint bigBitwise(arena *Arena, big_bitwise Op, bigint A, bigint B) {
+    bool Negative;
+    switch(Op) {
+        case Big_And: { Negative = A.Negative & B.Negative; } break;
+        case Big_Or:  { Negative = A.Negative | B.Negative; } break;
+        case Big_Xor: { Negative = A.Negative ^ B.Negative; } break;
+        InvalidDefaultCase;
+    }
+
+    // NOTE: One more limb, the magnitude of a negative result can be 2^(64*Count)
+    size_t Count = max(A.Count, B.Count);
+    bigint Result = bigAlloc(Arena, Count + 1);
+    uint64_t CarryA = 1, CarryB = 1, CarryResult = 1;
+    for(size_t Index = 0; Index < Count; ++Index) {
+        uint64_t Lhs = bigComplementLimb(A, Index, &CarryA);
+        uint64_t Rhs = bigComplementLimb(B, Index, &CarryB);
+        uint64_t Word = Op == Big_And ? Lhs & Rhs : Op == Big_Or ? Lhs | Rhs : Lhs ^ Rhs;
+        if(Negative) {
+            Word = ~Word + CarryResult;
+            CarryResult = CarryResult && Word == 0;
+        }
+        Result.Limbs[Index] = Word;
+    }
+    Result.Limbs[Count] = Negative ? CarryResult : 0;
+    Result.Negative = Negative;
+    return bigTrim(Result);
+}
+
+// NOTE: ~X = -X - 1
+static bigint bigNot(arena *Arena, bigint A) {
+    return bigSub(Arena, bigNegate(A), bigFromU64(Arena, 1));
+}
+
+// Conversion
+
+static int bigDigit(char Char) {
+    if(Char >= '0' && Char <= '9') {
+        return Char - '0';
+    }
+    Char |= 0x20;
+    return Char >= 'a' && Char <= 'f' ? Char - 'a' + 10 : 16;
+}
+
+// NOTE: Multiplies the magnitude in the stretchy buffer by Factor and adds Addend
+static void bigMulAddSmall(uint64_t **Limbs, uint64_t Factor, uint64_t Addend) {
+    uint64_t Carry = Addend;
+    for(uint64_t *Limb = *Limbs; Limb != bufEnd(*Limbs); ++Limb) {
+        big_wide Product = (big_wide)*Limb*Factor + Carry;
+        *Limb = (uint64_t)Product;
+        Carry = (uint64_t)(Product >> 64);
+    }
+    if(Carry) {
+        bufPush(*Limbs, Carry);
+    }
+}
+
+// NOTE: Accepts what the lexer and strtoll() accept: an optional sign, then a decimal, 0x hex,
+// 0b binary or 0 octal literal of any length. Returns false on anything else.
+static bool bigParse(arena *Arena, char *Text, size_t Length, bigint *Value) {
+    char *End = Text + Length;
+    bool Negative = false;
+    if(Text < End && (*Text == '-' || *Text == '+')) {
+        Negative = *Text++ == '-';
+    }
+
+    int Base = 10;
+    if(End - Text >= 2 && Text[0] == '0') {
+        if(Text[1] == 'x' || Text[1] == 'X') {
+            Base = 16;
+            Text += 2;
+        } else if(Text[1] == 'b' || Text[1] == 'B') {
+            Base = 2;
+            Text += 2;
+        } else {
+            Base = 8;
+            ++Text;
+        }
+    }
+    if(Text == End) {
+        return false;
+    }
+
+    // NOTE: Digits are gathered into chunks that fit a limb, one multiplication per chunk
+    uint64_t ChunkFactor = 1, Chunk = 0;
+    uint64_t *Limbs = 0;
+    for(; Text < End; ++Text) {
+        int Digit = bigDigit(*Text);
+        if(Digit >= Base) {
+            bufFree(Limbs);
+            return false;
+        }
+
+        Chunk = Chunk*Base + Digit;
+        ChunkFactor *= Base;
+        if(ChunkFactor > UINT64_MAX/16) {
+            bigMulAddSmall(&Limbs, ChunkFactor, Chunk);
+            ChunkFactor = 1;
+            Chunk = 0;
+        }
+    }
+    bigMulAddSmall(&Limbs, ChunkFactor, Chunk);
+
+    bigint Result = bigAlloc(Arena, bufLength(Limbs));
+    if(Limbs) {
+        memcpy(Result.Limbs, Limbs, bufLength(Limbs)*sizeof(uint64_t));
+    }
+    Result.Negative = Negative;
+    *Value = bigTrim(Result);
+    bufFree(Limbs);
+    return true;
+}
+
+// NOTE: Appends the decimal digits of Value to the stretchy buffer *Out, without a terminator.
+// Chunks of 19 digits are divided off the bottom, so this is quadratic in the limb count.
+static void bigFormat(char **Out, bigint Value) {
+    if(Value.Negative) {
+        bufPush(*Out, '-');
+    }
+
+    uint64_t *Magnitude = xMalloc(max(Value.Count, 1)*sizeof(uint64_t));
+    size_t Count = Value.Count;
+    if(Count) {
+        memcpy(Magnitude, Value.Limbs, Count*sizeof(uint64_t));
+    }
+
+    uint64_t *Chunks = 0;
+    do {
+        bufPush(Chunks, bigDivLimb(Magnitude, Count, BigDecimalChunk));
+        while(Count && Magnitude[Count - 1] == 0) {
+            --Count;
+        }
+    } while(Count);
+
+    char Digits[BigDecimalChunkDigits + 1];
+    size_t Index = bufLength(Chunks) - 1;
+    int Length = snprintf(Digits, sizeof(Digits), "%llu", (unsigned long long)Chunks[Index]);
+    for(int Digit = 0; Digit < Length; ++Digit) {
+        bufPush(*Out, Digits[Digit]);
+    }
+    while(Index--) {
+        snprintf(Digits, sizeof(Digits), "%019llu", (unsigned long long)Chunks[Index]);
+        for(int Digit = 0; Digit < BigDecimalChunkDigits; ++Digit) {
+            bufPush(*Out, Digits[Digit]);
+        }
+    }
+
+    bufFree(Chunks);
+    free(Magnitude);
+}
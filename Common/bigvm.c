@@ -0,0 +1,159 @@
+// Bytecode execution on arbitrary precision integers, used by vm --bigint.
+//
+// Requires vm.c and bigint.c.
+//
+// Runs the bytecode vmRun() runs, but every stack slot is a bigint and nothing wraps. LIT
+// immediates are read unsigned, as the source literal they were emitted for, and literals past
+// 32 bits come as BIGLIT with their limbs, see printBinaryBig(). Folded constants, lookup tables,
+// builtins from idiom rewrites and peephole rules are all only right on 32 bits, so programs for
+// this mode come from compiler --bigint, which does none of them and starts the program with a
+// BIG instruction. Programs without it are refused.
+
+enum { BigHeaderSize = 1 };
+
+static bool bigProgram(uint8_t *Code, size_t Size) {
+    return Size >= BigHeaderSize && Code[0] == BIG;
+}
+
+static char *BigErrorMessages[BigError_Count] = {
+    [BigError_None]           = "No error.",
+    [BigError_DivisionByZero] = "Division by zero.",
+    [BigError_TooLarge]       = "Integer too large.",
+};
+
+#define bigBinOpCase(M, Expr)                   \
+    case M: {                                   \
+        pops(2);                                \
+        bigint Rhs = pop();                     \
+        bigint Lhs = pop();                     \
+        pushes(1);                              \
+        push(Expr);                             \
+    } break
+
+#define bigUnaOpCase(M, Expr)                   \
+    case M: {                                   \
+        pops(1);                                \
+        bigint Value = pop();                   \
+        pushes(1);                              \
+        push(Expr);                             \
+    } break
+
+// NOTE: Code points at the BIG header. Like executeVm(), errors are fatal. The result and
+// everything computed on the way is allocated in Arena.
+static bigint executeBigVm(arena *Arena, uint8_t *Code, bigint *Params) {
+    static bigint Stack[VmStackSize];
+    bigint *Top = Stack;
+    big_error Error = BigError_None;
+    Code += BigHeaderSize;
+
+    for(;;) {
+        mnemonic Op = *Code++;
+        switch(Op) {
+            case HALT:
+            {
+                pops(1);
+                return pop();
+            } break;
+
+            case LIT:
+            {
+                pushes(1);
+                uint32_t Value;
+                Value  = (uint32_t)(*Code++) <<  0;
+                Value |= (uint32_t)(*Code++) <<  8;
+                Value |= (uint32_t)(*Code++) << 16;
+                Value |= (uint32_t)(*Code++) << 24;
+                push(bigFromU64(Arena, Value));
+            } break;
+
+            case BIGLIT:
+            {
+                pushes(1);
+                uint32_t Count;
+                Count  = (uint32_t)(*Code++) <<  0;
+                Count |= (uint32_t)(*Code++) <<  8;
+                Count |= (uint32_t)(*Code++) << 16;
+                Count |= (uint32_t)(*Code++) << 24;
+                if(Count > BigMaxLimbs) {
+                    fatalError(BigErrorMessages[BigError_TooLarge]);
+                }
+                bigint Value = bigAlloc(Arena, Count);
+                for(uint32_t Index = 0; Index < Count; ++Index) {
+                    Value.Limbs[Index] = 0;
+                    for(int Byte = 0; Byte < 8; ++Byte) {
+                        Value.Limbs[Index] |= (uint64_t)(*Code++) << 8*Byte;
+                    }
+                }
+                push(bigTrim(Value));
+            } break;
+
+            case ARG:
+            {
+                pushes(1);
+                push(Params[*Code++]);
+            } break;
+
+            case DIV:
+            case MOD:
+            {
+                pops(2);
+                bigint Rhs = pop();
+                bigint Lhs = pop();
+                bigint Value = {};
+                bigDivMod(Arena, Lhs, Rhs, Op == DIV ? &Value : 0, Op == MOD ? &Value : 0, &Error);
+                pushes(1);
+                push(Value);
+            } break;
+
+            bigBinOpCase(ADD, bigAdd(Arena, Lhs, Rhs));
+            bigBinOpCase(SUB, bigSub(Arena, Lhs, Rhs));
+            bigBinOpCase(MUL, bigMul(Arena, Lhs, Rhs, &Error));
+            bigBinOpCase(OR,  bigBitwise(Arena, Big_Or, Lhs, Rhs));
+            bigBinOpCase(XOR, bigBitwise(Arena, Big_Xor, Lhs, Rhs));
+            bigBinOpCase(AND, bigBitwise(Arena, Big_And, Lhs, Rhs));
+            bigBinOpCase(LSH, bigShift(Arena, Lhs, Rhs, true, &Error));
+            bigBinOpCase(RSH, bigShift(Arena, Lhs, Rhs, false, &Error));
+            bigBinOpCase(POW, bigPow(Arena, Lhs, Rhs, &Error));
+            bigUnaOpCase(NOT, bigNot(Arena, Value));
+            bigUnaOpCase(SYM, bigNegate(Value));
+            bigBinOpCase(LT, bigFromU64(Arena, bigCompare(Lhs, Rhs) <  0));
+            bigBinOpCase(LE, bigFromU64(Arena, bigCompare(Lhs, Rhs) <= 0));
+            bigBinOpCase(EQ, bigFromU64(Arena, bigCompare(Lhs, Rhs) == 0));
+            bigBinOpCase(NE, bigFromU64(Arena, bigCompare(Lhs, Rhs) != 0));
+
+            case SEL:
+            {
+                pops(3);
+                bigint Else = pop();
+                bigint Then = pop();
+                bigint Cond = pop();
+                pushes(1);
+                push(bigIsZero(Cond) ? Else : Then);
+            } break;
+
+            case NOP: {} break;
+
+            case POPCNT: case CLZ: case CTZ: case BSWAP: case ROL: case ROR: case PDEP: case PEXT:
+            {
+                fatalError("Bit builtins are not defined on arbitrary precision integers");
+            } break;
+
+            case LUT:
+            {
+                fatalError("Lookup tables hold 32-bit results, compile with --bigint for vm --bigint");
+            } break;
+
+            default:
+            {
+                fatalError(VmErrorMessages[VmError_IllegalOpcode]);
+            } break;
+        }
+
+        if(Error) {
+            fatalError(BigErrorMessages[Error]);
+        }
+    }
+}
+
+#undef bigBinOpCase
+#undef bigUnaOpCase
@@ -0,0 +1,173 @@
+// Bit manipulation behind the popcount, clz, ctz, bswap, rotl, rotr, pdep and pext builtins, on
+// 32-bit values for the VM and 64-bit values for the interpreter.
+//
+// The compiler builtins become single POPCNT, LZCNT, TZCNT, ROL and BSWAP instructions when the
+// target has them, build with TARGET_FLAGS=-march=native to get all of them. PDEP and PEXT have
+// no builtin, they use the BMI2 intrinsics where available and a loop over the mask otherwise.
+//
+// clz and ctz of 0 are the width, like LZCNT and TZCNT. Rotation counts are taken modulo the width.
+//
+// Also the shifts and power of the 32-bit VM, which every tier evaluating its programs has to use
+// so that switching tiers cannot change a result, the integer power of the 64-bit interpreter and
+// --wide programs, which square and multiply modulo 2^64 instead of going through pow() and a
+// double, and the select of Cond ? Then : Else.
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+static inline uint32_t bitPopcount(uint32_t Value) {
+    return __builtin_popcount(Value);
+}
+
+static inline uint32_t bitClz(uint32_t Value) {
+    return Value ? __builtin_clz(Value) : 32;
+}
+
+static inline uint32_t bitCtz(uint32_t Value) {
+    return Value ? __builtin_ctz(Value) : 32;
+}
+
+static inline uint32_t bitBswap(uint32_t Value) {
+    return __builtin_bswap32(Value);
+}
+
+// NOTE: The masked form is what gcc and clang turn into a single ROL
+static inline uint32_t bitRotl(uint32_t Value, uint32_t Count) {
+    return (Value << (Count & 31)) | (Value >> (-Count & 31));
+}
+
+static inline uint32_t bitRotr(uint32_t Value, uint32_t Count) {
+    return (Value >> (Count & 31)) | (Value << (-Count & 31));
+}
+
+// NOTE: Scatters the low bits of Value to the set bits of Mask, from the lowest one up
+static inline uint32_t bitPdep(uint32_t Value, uint32_t Mask) {
+#if defined(__BMI2__)
+    return _pdep_u32(Value, Mask);
+#else
+    uint32_t Result = 0;
+    for(uint32_t Bit = 1; Mask; Bit <<= 1) {
+        uint32_t Lowest = Mask & -Mask;
+        Result |= Value & Bit ? Lowest : 0;
+        Mask ^= Lowest;
+    }
+    return Result;
+#endif
+}
+
+// NOTE: Gathers the bits of Value at the set bits of Mask into the low bits, the inverse of pdep
+static inline uint32_t bitPext(uint32_t Value, uint32_t Mask) {
+#if defined(__BMI2__)
+    return _pext_u32(Value, Mask);
+#else
+    uint32_t Result = 0;
+    for(uint32_t Bit = 1; Mask; Bit <<= 1) {
+        uint32_t Lowest = Mask & -Mask;
+        Result |= Value & Lowest ? Bit : 0;
+        Mask ^= Lowest;
+    }
+    return Result;
+#endif
+}
+
+static inline uint64_t bitPopcount64(uint64_t Value) {
+    return __builtin_popcountll(Value);
+}
+
+static inline uint64_t bitClz64(uint64_t Value) {
+    return Value ? __builtin_clzll(Value) : 64;
+}
+
+static inline uint64_t bitCtz64(uint64_t Value) {
+    return Value ? __builtin_ctzll(Value) : 64;
+}
+
+static inline uint64_t bitBswap64(uint64_t Value) {
+    return __builtin_bswap64(Value);
+}
+
+static inline uint64_t bitRotl64(uint64_t Value, uint64_t Count) {
+    return (Value << (Count & 63)) | (Value >> (-Count & 63));
+}
+
+static inline uint64_t bitRotr64(uint64_t Value, uint64_t Count) {
+    return (Value >> (Count & 63)) | (Value << (-Count & 63));
+}
+
+static inline uint64_t bitPdep64(uint64_t Value, uint64_t Mask) {
+#if defined(__BMI2__) && defined(__x86_64__)
+    return _pdep_u64(Value, Mask);
+#else
+    uint64_t Result = 0;
+    for(uint64_t Bit = 1; Mask; Bit <<= 1) {
+        uint64_t Lowest = Mask & -Mask;
+        Result |= Value & Bit ? Lowest : 0;
+        Mask ^= Lowest;
+    }
+    return Result;
+#endif
+}
+
+static inline uint64_t bitPext64(uint64_t Value, uint64_t Mask) {
+#if defined(__BMI2__) && defined(__x86_64__)
+    return _pext_u64(Value, Mask);
+#else
+    uint64_t Result = 0;
+    for(uint64_t Bit = 1; Mask; Bit <<= 1) {
+        uint64_t Lowest = Mask & -Mask;
+        Result |= Value & Lowest ? Bit : 0;
+        Mask ^= Lowest;
+    }
+    return Result;
+#endif
+}
+
+// NOTE: Shift counts are taken modulo 32 like SHL and SAR do, >> is arithmetic
+static inline int32_t bitShiftLeft(int32_t Value, int32_t Count) {
+    return (int32_t)((uint32_t)Value << (Count & 31));
+}
+
+static inline int32_t bitShiftRight(int32_t Value, int32_t Count) {
+    return Value >> (Count & 31);
+}
+
+// NOTE: pow() is exact while the result fits, anything outside int32_t saturates. A negative
+// exponent truncates towards zero, and 0 to a negative power saturates like its infinity does.
+static inline int32_t bitPower(int32_t Base, int32_t Exponent) {
+    double Value = pow(Base, Exponent);
+    return Value >= INT32_MAX ? INT32_MAX : Value <= INT32_MIN ? INT32_MIN : (int32_t)Value;
+}
+
+// NOTE: A mask instead of a branch, the condition is data dependent and would mispredict. gcc and
+// clang keep it a NEG, AND, ANDN and OR or turn it into a CMOV.
+static inline int32_t bitSelect(int32_t Cond, int32_t Then, int32_t Else) {
+    uint32_t Mask = -(uint32_t)(Cond != 0);
+    return (int32_t)(((uint32_t)Then & Mask) | ((uint32_t)Else & ~Mask));
+}
+
+static inline int64_t bitSelect64(int64_t Cond, int64_t Then, int64_t Else) {
+    uint64_t Mask = -(uint64_t)(Cond != 0);
+    return (int64_t)(((uint64_t)Then & Mask) | ((uint64_t)Else & ~Mask));
+}
+
+// NOTE: Wraps modulo 2^64 like the other operators. A negative exponent gives the exact result
+// truncated towards zero, which is 0 unless the base is 1 or -1, and sets *DivisionByZero for a
+// base of 0.
+static inline int64_t bitPower64(int64_t Base, int64_t Exponent, bool *DivisionByZero) {
+    if(Exponent < 0) {
+        if(Base == 0) {
+            *DivisionByZero = true;
+        }
+        return Base == 1 ? 1 : Base == -1 ? (Exponent & 1 ? -1 : 1) : 0;
+    }
+
+    uint64_t Result = 1, Square = Base;
+    for(uint64_t Remaining = Exponent; Remaining; Remaining >>= 1) {
+        if(Remaining & 1) {
+            Result *= Square;
+        }
+        Square *= Square;
+    }
+    return (int64_t)Result;
+}
@@ -0,0 +1,449 @@
+// Bit-sliced evaluator for expressions that only use bitwise operators, shifts by constants,
+// comparisons and selects.
+//
+// Each bit position of a 32-bit value is stored in its own slice, a machine word whose lane L
+// holds that bit for the L-th input. A batch of 64 (or 256 with AVX2) inputs is transposed into
+// slices, the expression runs as straight-line AND/OR/XOR/NOT over slices and the result slices
+// are transposed back. Shifts by constants only rename slices, so they cost nothing at runtime.
+//
+// Every lane takes its own side of a comparison or select without any branch: a select blends
+// the slices of both arms under a mask slice, and a comparison is a chain of such blends from the
+// lowest bit up, like the borrow of a subtraction.
+//
+// Requires stretchy.c and parser.c.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITSLICE_AVX2 1
+#endif
+
+enum {
+    BitsliceBits = 32,
+
+    // NOTE: Fixed slots, parameter slots follow
+    BitsliceSlot_Zero = 0,
+    BitsliceSlot_Ones,
+    BitsliceSlot_FirstParam,
+};
+
+typedef enum bitslice_op_type {
+    BitsliceOp_And,
+    BitsliceOp_Or,
+    BitsliceOp_Xor,
+    BitsliceOp_Not,
+    // NOTE: (Mask & Lhs) | (~Mask & Rhs)
+    BitsliceOp_Select,
+} bitslice_op_type;
+
+typedef struct bitslice_op {
+    bitslice_op_type Type;
+    uint32_t Dst;
+    uint32_t Lhs;
+    uint32_t Rhs;
+    uint32_t Mask;
+} bitslice_op;
+
+typedef struct bitslice_program {
+    int ParamCount;
+    uint32_t SlotCount;
+    bitslice_op *Ops;
+    uint32_t Result[BitsliceBits];
+} bitslice_program;
+
+static bool bitsliceEligible(expression *Node, int *ParamCount) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            return true;
+        } break;
+
+        case Expression_Param: {
+            *ParamCount = max(*ParamCount, (int)Node->IntValue + 1);
+            return true;
+        } break;
+
+        case Expression_Lut: {
+            return false;
+        } break;
+
+        case Expression_Unary: {
+            if(Node->Unary.Op != Token_UnaryPlus && Node->Unary.Op != Token_BitNot) {
+                return false;
+            }
+            return bitsliceEligible(Node->Unary.Expr, ParamCount);
+        } break;
+
+        case Expression_Binary: {
+            switch(Node->Binary.Op) {
+                case Token_BitAnd:
+                case Token_BitOr:
+                case Token_BitXor: {
+                    return (bitsliceEligible(Node->Binary.Lhs, ParamCount) &&
+                            bitsliceEligible(Node->Binary.Rhs, ParamCount));
+                } break;
+
+                case Token_LShift:
+                case Token_RShift: {
+                    expression *Amount = Node->Binary.Rhs;
+                    return (Amount->Type == Expression_Int && Amount->IntValue < BitsliceBits &&
+                            bitsliceEligible(Node->Binary.Lhs, ParamCount));
+                } break;
+
+                case Token_Less:
+                case Token_LessEqual:
+                case Token_Equal:
+                case Token_NotEqual: {
+                    return (bitsliceEligible(Node->Binary.Lhs, ParamCount) &&
+                            bitsliceEligible(Node->Binary.Rhs, ParamCount));
+                } break;
+
+                default: {
+                    return false;
+                } break;
+            }
+        } break;
+
+        case Expression_Select: {
+            return (bitsliceEligible(Node->Select.Cond, ParamCount) &&
+                    bitsliceEligible(Node->Select.Then, ParamCount) &&
+                    bitsliceEligible(Node->Select.Else, ParamCount));
+        } break;
+    }
+
+    return false;
+}
+
+static uint32_t bitsliceEmit(bitslice_program *Prog, bitslice_op_type Type, uint32_t Lhs, uint32_t Rhs) {
+    // NOTE: Fold constants and trivial identities so that masks do not generate any work
+    switch(Type) {
+        case BitsliceOp_And: {
+            if(Lhs == BitsliceSlot_Zero || Rhs == BitsliceSlot_Zero) return BitsliceSlot_Zero;
+            if(Lhs == BitsliceSlot_Ones || Lhs == Rhs) return Rhs;
+            if(Rhs == BitsliceSlot_Ones) return Lhs;
+        } break;
+
+        case BitsliceOp_Or: {
+            if(Lhs == BitsliceSlot_Ones || Rhs == BitsliceSlot_Ones) return BitsliceSlot_Ones;
+            if(Lhs == BitsliceSlot_Zero || Lhs == Rhs) return Rhs;
+            if(Rhs == BitsliceSlot_Zero) return Lhs;
+        } break;
+
+        case BitsliceOp_Xor: {
+            if(Lhs == Rhs) return BitsliceSlot_Zero;
+            if(Lhs == BitsliceSlot_Zero) return Rhs;
+            if(Rhs == BitsliceSlot_Zero) return Lhs;
+            if(Rhs == BitsliceSlot_Ones) return bitsliceEmit(Prog, BitsliceOp_Not, Lhs, 0);
+            if(Lhs == BitsliceSlot_Ones) return bitsliceEmit(Prog, BitsliceOp_Not, Rhs, 0);
+        } break;
+
+        case BitsliceOp_Not: {
+            if(Lhs == BitsliceSlot_Zero) return BitsliceSlot_Ones;
+            if(Lhs == BitsliceSlot_Ones) return BitsliceSlot_Zero;
+        } break;
+
+        case BitsliceOp_Select: { InvalidCodePath; } break;
+    }
+
+    uint32_t Dst = Prog->SlotCount++;
+    bufPush(Prog->Ops, (bitslice_op){Type, Dst, Lhs, Rhs, 0});
+    return Dst;
+}
+
+// NOTE: Lhs in the lanes where Mask is set, Rhs in the others
+static uint32_t bitsliceEmitSelect(bitslice_program *Prog, uint32_t Mask, uint32_t Lhs, uint32_t Rhs) {
+    if(Mask == BitsliceSlot_Ones || Lhs == Rhs) return Lhs;
+    if(Mask == BitsliceSlot_Zero) return Rhs;
+    if(Lhs == BitsliceSlot_Ones && Rhs == BitsliceSlot_Zero) return Mask;
+    if(Lhs == BitsliceSlot_Zero && Rhs == BitsliceSlot_Ones) return bitsliceEmit(Prog, BitsliceOp_Not, Mask, 0);
+    if(Rhs == BitsliceSlot_Zero) return bitsliceEmit(Prog, BitsliceOp_And, Mask, Lhs);
+    if(Lhs == BitsliceSlot_Ones) return bitsliceEmit(Prog, BitsliceOp_Or, Mask, Rhs);
+
+    uint32_t Dst = Prog->SlotCount++;
+    bufPush(Prog->Ops, (bitslice_op){BitsliceOp_Select, Dst, Lhs, Rhs, Mask});
+    return Dst;
+}
+
+// NOTE: Set in the lanes where any of the slices is
+static uint32_t bitsliceAny(bitslice_program *Prog, uint32_t Slices[BitsliceBits]) {
+    uint32_t Result = BitsliceSlot_Zero;
+    for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+        Result = bitsliceEmit(Prog, BitsliceOp_Or, Result, Slices[Bit]);
+    }
+    return Result;
+}
+
+// NOTE: Signed Lhs < Rhs. Going up from bit 0, the highest differing bit so far decides, and at
+// the sign bit the one with the bit set is the smaller.
+static uint32_t bitsliceLess(bitslice_program *Prog, uint32_t Lhs[BitsliceBits], uint32_t Rhs[BitsliceBits]) {
+    uint32_t Less = BitsliceSlot_Zero;
+    for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+        uint32_t Differ = bitsliceEmit(Prog, BitsliceOp_Xor, Lhs[Bit], Rhs[Bit]);
+        Less = bitsliceEmitSelect(Prog, Differ, Bit == BitsliceBits-1 ? Lhs[Bit] : Rhs[Bit], Less);
+    }
+    return Less;
+}
+
+static void bitsliceBuild(bitslice_program *Prog, expression *Node, uint32_t Out[BitsliceBits]) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                Out[Bit] = (Node->IntValue >> Bit) & 1 ? BitsliceSlot_Ones : BitsliceSlot_Zero;
+            }
+        } break;
+
+        case Expression_Param: {
+            for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                Out[Bit] = BitsliceSlot_FirstParam + Node->IntValue*BitsliceBits + Bit;
+            }
+        } break;
+
+        case Expression_Lut: { InvalidCodePath; } break;
+
+        case Expression_Unary: {
+            bitsliceBuild(Prog, Node->Unary.Expr, Out);
+            if(Node->Unary.Op == Token_BitNot) {
+                for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                    Out[Bit] = bitsliceEmit(Prog, BitsliceOp_Not, Out[Bit], 0);
+                }
+            }
+        } break;
+
+        case Expression_Binary: {
+            uint32_t Lhs[BitsliceBits];
+            bitsliceBuild(Prog, Node->Binary.Lhs, Lhs);
+
+            int Amount = Node->Binary.Rhs->Type == Expression_Int ? (int)Node->Binary.Rhs->IntValue : 0;
+            switch(Node->Binary.Op) {
+                case Token_LShift: {
+                    for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                        Out[Bit] = Bit >= Amount ? Lhs[Bit - Amount] : BitsliceSlot_Zero;
+                    }
+                    return;
+                } break;
+
+                case Token_RShift: {
+                    // NOTE: Arithmetic shift, matching the VM's int32_t semantics
+                    for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                        Out[Bit] = Bit + Amount < BitsliceBits ? Lhs[Bit + Amount] : Lhs[BitsliceBits-1];
+                    }
+                    return;
+                } break;
+
+                default: {} break;
+            }
+
+            uint32_t Rhs[BitsliceBits];
+            bitsliceBuild(Prog, Node->Binary.Rhs, Rhs);
+
+            // NOTE: Comparisons only set bit 0
+            bool Comparison = true;
+            switch(Node->Binary.Op) {
+                case Token_Less:      { Out[0] = bitsliceLess(Prog, Lhs, Rhs); } break;
+                case Token_LessEqual: { Out[0] = bitsliceEmit(Prog, BitsliceOp_Not, bitsliceLess(Prog, Rhs, Lhs), 0); } break;
+
+                case Token_Equal:
+                case Token_NotEqual: {
+                    uint32_t Differ[BitsliceBits];
+                    for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                        Differ[Bit] = bitsliceEmit(Prog, BitsliceOp_Xor, Lhs[Bit], Rhs[Bit]);
+                    }
+                    Out[0] = bitsliceAny(Prog, Differ);
+                    if(Node->Binary.Op == Token_Equal) {
+                        Out[0] = bitsliceEmit(Prog, BitsliceOp_Not, Out[0], 0);
+                    }
+                } break;
+
+                default: {
+                    Comparison = false;
+                } break;
+            }
+            if(Comparison) {
+                for(int Bit = 1; Bit < BitsliceBits; ++Bit) {
+                    Out[Bit] = BitsliceSlot_Zero;
+                }
+                return;
+            }
+
+            bitslice_op_type Type = BitsliceOp_And;
+            switch(Node->Binary.Op) {
+                case Token_BitAnd: { Type = BitsliceOp_And; } break;
+                case Token_BitOr:  { Type = BitsliceOp_Or;  } break;
+                case Token_BitXor: { Type = BitsliceOp_Xor; } break;
+                InvalidDefaultCase;
+            }
+
+            for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                Out[Bit] = bitsliceEmit(Prog, Type, Lhs[Bit], Rhs[Bit]);
+            }
+        } break;
+
+        case Expression_Select: {
+            uint32_t Cond[BitsliceBits], Then[BitsliceBits], Else[BitsliceBits];
+            bitsliceBuild(Prog, Node->Select.Cond, Cond);
+            bitsliceBuild(Prog, Node->Select.Then, Then);
+            bitsliceBuild(Prog, Node->Select.Else, Else);
+
+            uint32_t Mask = bitsliceAny(Prog, Cond);
+            for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                Out[Bit] = bitsliceEmitSelect(Prog, Mask, Then[Bit], Else[Bit]);
+            }
+        } break;
+    }
+}
+
+// NOTE: Returns 0 if the expression uses anything other than bitwise operators, constant shifts,
+// comparisons and selects
+static bitslice_program *bitsliceCompile(expression *Ast) {
+    int ParamCount = 0;
+    if(!bitsliceEligible(Ast, &ParamCount)) {
+        return 0;
+    }
+
+    bitslice_program *Prog = xMalloc(sizeof(*Prog));
+    *Prog = (bitslice_program){};
+    Prog->ParamCount = ParamCount;
+    Prog->SlotCount = BitsliceSlot_FirstParam + ParamCount*BitsliceBits;
+    bitsliceBuild(Prog, Ast, Prog->Result);
+
+    return Prog;
+}
+
+static void bitsliceFree(bitslice_program *Prog) {
+    bufFree(Prog->Ops);
+    free(Prog);
+}
+
+// NOTE: In-place transpose of a 64x64 bit matrix (bit C of row R is swapped with bit R of row C),
+// where rows hold lanes and columns hold bits. Values are only 32 bits wide, so lanes L and L+32
+// share row L (low and high half) and the first step of the recursive transpose is skipped.
+static void transpose32x64(uint64_t Rows[BitsliceBits]) {
+    uint64_t Mask = 0x0000FFFF0000FFFF;
+    for(int Width = 16; Width != 0; Width >>= 1, Mask ^= Mask << Width) {
+        for(int Row = 0; Row < BitsliceBits; Row = ((Row | Width) + 1) & ~Width) {
+            uint64_t Swap = ((Rows[Row] >> Width) ^ Rows[Row | Width]) & Mask;
+            Rows[Row] ^= Swap << Width;
+            Rows[Row | Width] ^= Swap;
+        }
+    }
+}
+
+static void bitsliceExecute64(bitslice_program *Prog, uint64_t *Slots) {
+    for(bitslice_op *Op = Prog->Ops; Op != bufEnd(Prog->Ops); ++Op) {
+        switch(Op->Type) {
+            case BitsliceOp_And: { Slots[Op->Dst] = Slots[Op->Lhs] & Slots[Op->Rhs]; } break;
+            case BitsliceOp_Or:  { Slots[Op->Dst] = Slots[Op->Lhs] | Slots[Op->Rhs]; } break;
+            case BitsliceOp_Xor: { Slots[Op->Dst] = Slots[Op->Lhs] ^ Slots[Op->Rhs]; } break;
+            case BitsliceOp_Not: { Slots[Op->Dst] = ~Slots[Op->Lhs]; } break;
+            case BitsliceOp_Select: {
+                Slots[Op->Dst] = (Slots[Op->Mask] & Slots[Op->Lhs]) | (~Slots[Op->Mask] & Slots[Op->Rhs]);
+            } break;
+        }
+    }
+}
+
+#if BITSLICE_AVX2
+__attribute__((target("avx2")))
+static void bitsliceExecute256(bitslice_program *Prog, uint64_t *Slots) {
+    __m256i *Wide = (__m256i *)Slots;
+    __m256i Ones = _mm256_set1_epi64x(-1);
+    for(bitslice_op *Op = Prog->Ops; Op != bufEnd(Prog->Ops); ++Op) {
+        __m256i Lhs = _mm256_load_si256(Wide + Op->Lhs);
+        __m256i Rhs = _mm256_load_si256(Wide + Op->Rhs);
+        __m256i Value = Lhs;
+        switch(Op->Type) {
+            case BitsliceOp_And: { Value = _mm256_and_si256(Lhs, Rhs); } break;
+            case BitsliceOp_Or:  { Value = _mm256_or_si256(Lhs, Rhs);  } break;
+            case BitsliceOp_Xor: { Value = _mm256_xor_si256(Lhs, Rhs); } break;
+            case BitsliceOp_Not: { Value = _mm256_xor_si256(Lhs, Ones); } break;
+            // NOTE: A bitwise blend, VPBLENDVB would only look at the top bit of every byte
+            case BitsliceOp_Select: {
+                __m256i Mask = _mm256_load_si256(Wide + Op->Mask);
+                Value = _mm256_or_si256(_mm256_and_si256(Mask, Lhs), _mm256_andnot_si256(Mask, Rhs));
+            } break;
+            InvalidDefaultCase;
+        }
+        _mm256_store_si256(Wide + Op->Dst, Value);
+    }
+}
+#endif
+
+static bool bitsliceHasAvx2(void) {
+#if BITSLICE_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+// NOTE: Params holds ParamStride values per input, Words is the number of 64-bit words per slice
+// (1 for the scalar path, 4 for AVX2). Returns false without touching Results when the slices
+// could not be allocated.
+static bool bitsliceRunWidth(bitslice_program *Prog, int32_t *Params, int ParamStride,
+                             int32_t *Results, size_t Count, int Words)
+{
+    assert(ParamStride >= Prog->ParamCount);
+    size_t BlockLanes = 64*Words;
+    size_t SlotsSize = (Prog->SlotCount*Words*sizeof(uint64_t) + 31) & ~(size_t)31;
+    uint64_t *Slots = aligned_alloc(32, SlotsSize);
+    if(!Slots) {
+        return false;
+    }
+
+    for(int Word = 0; Word < Words; ++Word) {
+        Slots[BitsliceSlot_Zero*Words + Word] = 0;
+        Slots[BitsliceSlot_Ones*Words + Word] = ~0ull;
+    }
+
+    uint64_t Matrix[BitsliceBits];
+    for(size_t Base = 0; Base < Count; Base += BlockLanes) {
+        size_t Lanes = min(BlockLanes, Count - Base);
+
+        for(int Param = 0; Param < Prog->ParamCount; ++Param) {
+            for(int Word = 0; Word < Words; ++Word) {
+                for(int Row = 0; Row < BitsliceBits; ++Row) {
+                    size_t Low = Word*64 + Row;
+                    size_t High = Low + 32;
+                    uint64_t LowValue = Low < Lanes ? (uint32_t)Params[(Base + Low)*ParamStride + Param] : 0;
+                    uint64_t HighValue = High < Lanes ? (uint32_t)Params[(Base + High)*ParamStride + Param] : 0;
+                    Matrix[Row] = LowValue | HighValue << 32;
+                }
+                transpose32x64(Matrix);
+
+                uint64_t *Slot = Slots + (BitsliceSlot_FirstParam + Param*BitsliceBits)*Words + Word;
+                for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                    Slot[Bit*Words] = Matrix[Bit];
+                }
+            }
+        }
+
+#if BITSLICE_AVX2
+        if(Words == 4) {
+            bitsliceExecute256(Prog, Slots);
+        } else
+#endif
+        {
+            assert(Words == 1);
+            bitsliceExecute64(Prog, Slots);
+        }
+
+        for(int Word = 0; Word < Words; ++Word) {
+            for(int Bit = 0; Bit < BitsliceBits; ++Bit) {
+                Matrix[Bit] = Slots[Prog->Result[Bit]*Words + Word];
+            }
+            transpose32x64(Matrix);
+
+            for(int Row = 0; Row < BitsliceBits; ++Row) {
+                size_t Low = Word*64 + Row;
+                size_t High = Low + 32;
+                if(Low < Lanes)  Results[Base + Low]  = (int32_t)(Matrix[Row] >>  0);
+                if(High < Lanes) Results[Base + High] = (int32_t)(Matrix[Row] >> 32);
+            }
+        }
+    }
+
+    free(Slots);
+    return true;
+}
+
+static bool bitsliceRun(bitslice_program *Prog, int32_t *Params, int ParamStride, int32_t *Results, size_t Count) {
+    return bitsliceRunWidth(Prog, Params, ParamStride, Results, Count, bitsliceHasAvx2() ? 4 : 1);
+}
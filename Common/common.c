@@ -1,8 +1,33 @@
-#define arrayCount(A) sizeof(A)/sizeof(*A)
+#define arrayCount(A) (sizeof(A)/sizeof(*(A)))
+#define max(A, B) ((A) > (B) ? (A) : (B))
+#define min(A, B) ((A) < (B) ? (A) : (B))
+
+// NOTE: Only for M = 2^k
+#define alignDown(N, M) ((N) & ~((M)-1))
+#define alignUp(N, M) alignDown((N)+(M)-1, (M))
+#define alignPointerUp(N, M) (void *)alignDown((uintptr_t)(N)+(M)-1, (M))
 
 #define InvalidCodePath assert(!"InvalidCodePath")
 #define InvalidDefaultCase default: { InvalidCodePath; } break
 
+// NOTE: Parameters are referenced as $0..$255 and encoded in a single byte
+enum { MaxParamCount = 1<<8 };
+
+// NOTE: Byte range [Start, End) of the source text
+typedef struct source_span {
+    uint32_t Start;
+    uint32_t End;
+} source_span;
+
+// NOTE: Maps the instruction at bytecode Offset back to the source it was compiled from
+typedef struct debug_span {
+    uint32_t Offset;
+    source_span Span;
+} debug_span;
+
+// NOTE: Largest table the compiler may embed for a LUT instruction is 2^MaxLutBits entries
+enum { MaxLutBits = 16 };
+
 static void parseError(char *Format, ...) {
     va_list Args;
     va_start(Args, Format);
@@ -22,17 +47,49 @@ static void fatalError(char *Fmt, ...) {
     exit(1);
 }
 
+// NOTE: Per thread, called instead of exiting when an allocation fails. It must not return, the
+// library sets one that jumps back to the entry of the call that ran out of memory.
+static _Thread_local void (*OnOutOfMemory)(void);
+
+static void outOfMemory(void) {
+    if(OnOutOfMemory) {
+        OnOutOfMemory();
+    }
+    fprintf(stderr, "Insufficient space available\n");
+    exit(1);
+}
+
 static void *xMalloc(size_t NumBytes) {
     void *Result = malloc(NumBytes);
     if(!Result) {
-        fprintf(stderr, "Insufficient space available\n");
-        exit(1);
+        outOfMemory();
     }
 
     return Result;
 }
 
-static uint8_t *readEntireFile(char *Path) {
+static void *xRealloc(void *Addr, size_t NumBytes) {
+    void *Result = realloc(Addr, NumBytes);
+    if(!Result) {
+        outOfMemory();
+    }
+
+    return Result;
+}
+
+// NOTE: 64-bit FNV-1a
+static uint64_t hashBytes(void *Data, size_t NumBytes, uint64_t Hash) {
+    uint8_t *Bytes = Data;
+    for(size_t Index = 0; Index < NumBytes; ++Index) {
+        Hash = (Hash ^ Bytes[Index]) * 0x100000001B3;
+    }
+    return Hash;
+}
+
+#define HashSeed 0xCBF29CE484222325ull
+
+// NOTE: The buffer is NUL-terminated, NumBytes may be 0 when the caller does not need the size
+static uint8_t *readEntireFile(char *Path, size_t *NumBytesOut) {
     FILE *File = fopen(Path, "rb");
     if(!File) {
         fprintf(stderr, "Error opening file %s", Path);
@@ -48,5 +105,8 @@ static uint8_t *readEntireFile(char *Path) {
     fclose(File);
     Buffer[NumBytes] = 0;
 
+    if(NumBytesOut) {
+        *NumBytesOut = NumBytes;
+    }
     return Buffer;
 }
@@ -0,0 +1,27 @@
+// The pipeline from a parsed tree to 32-bit bytecode, shared by the compiler and its --batch mode,
+// tiered execution, the library and bcopt, so that all of them emit the same code for a tree.
+//
+// Requires memory.c, parser.c, specialize.c, idiom.c, lut.c, generator.c, vm.c and peephole.c.
+//
+// Specializing goes first, so every later pass sees the folded constants. Idiom rewrites run
+// before lookup tables, which would otherwise swallow the spellings they recognize, and the
+// peephole pass works on the generated bytecode. --mod, --wide and --bigint programs do not go
+// through here, all of these passes assume 32-bit values.
+
+// NOTE: Compiles Ast into Code, which must be empty, new nodes are allocated in Arena. Bindings
+// may be null. Spans, when not null, receives the debug spans of the program, which point
+// at instruction offsets the peephole pass would move, so it is skipped for them.
+static void compileAst(uint8_t **Code, arena *Arena, expression *Ast, int LutBits, specialize_bindings *Bindings,
+                       debug_span **Spans)
+{
+    if(Bindings) {
+        Ast = specialize(Arena, Ast, Bindings);
+    }
+    idiomRewrite(Arena, &Ast);
+    lutCompile(Arena, &Ast, LutBits);
+    printBinaryWithSpans(Code, Ast, Spans);
+    bufPush(*Code, HALT);
+    if(!Spans) {
+        peepholeOptimize(Code);
+    }
+}
@@ -0,0 +1,89 @@
+// Debug section, appended after the bytecode by `compiler --debug`.
+//
+// Requires stretchy.c.
+//
+// The VM stops at HALT and never looks past the code, so programs with a debug section run
+// unchanged. Tools find the section through the fixed-size trailer at the very end of the file:
+//
+//   u8  Code[CodeSize]                         ending in HALT
+//   u32 Offset, Start, End                     one entry per instruction, SpanCount of them
+//   u8  Source[SourceLength]
+//   u32 SpanCount, SourceLength, CodeSize, DebugMagic
+//
+// All integers are little-endian. Offset is a bytecode offset, [Start, End) a range of Source.
+
+enum {
+    DebugMagic = 0x42445742, // "BWDB"
+    DebugTrailerSize = 16,
+    DebugEntrySize = 12,
+};
+
+typedef struct debug_info {
+    size_t CodeSize;
+    debug_span *Spans;
+    char *Source;
+    uint32_t SourceLength;
+} debug_info;
+
+static void debugPushU32(uint8_t **Code, uint32_t Value) {
+    bufPush(*Code, Value);
+    bufPush(*Code, Value >> 8);
+    bufPush(*Code, Value >> 16);
+    bufPush(*Code, Value >> 24);
+}
+
+static uint32_t debugReadU32(uint8_t *Bytes) {
+    return Bytes[0] | Bytes[1] << 8 | Bytes[2] << 16 | (uint32_t)Bytes[3] << 24;
+}
+
+// NOTE: Code must be complete, including its HALT
+static void printDebugSection(uint8_t **Code, debug_span *Spans, char *Source) {
+    uint32_t CodeSize = bufLength(*Code);
+    uint32_t SourceLength = strlen(Source);
+
+    for(size_t Index = 0; Index < bufLength(Spans); ++Index) {
+        debugPushU32(Code, Spans[Index].Offset);
+        debugPushU32(Code, Spans[Index].Span.Start);
+        debugPushU32(Code, Spans[Index].Span.End);
+    }
+    for(uint32_t Index = 0; Index < SourceLength; ++Index) {
+        bufPush(*Code, Source[Index]);
+    }
+
+    debugPushU32(Code, bufLength(Spans));
+    debugPushU32(Code, SourceLength);
+    debugPushU32(Code, CodeSize);
+    debugPushU32(Code, DebugMagic);
+}
+
+// NOTE: Returns false when the file has no well-formed debug section. Info->Source points into
+// File, the spans are a stretchy buffer owned by the caller.
+static bool debugSectionRead(uint8_t *File, size_t Size, debug_info *Info) {
+    *Info = (debug_info){};
+    if(Size < DebugTrailerSize || debugReadU32(File + Size - 4) != DebugMagic) {
+        return false;
+    }
+
+    uint8_t *Trailer = File + Size - DebugTrailerSize;
+    uint64_t SpanCount = debugReadU32(Trailer);
+    uint64_t SourceLength = debugReadU32(Trailer + 4);
+    uint64_t CodeSize = debugReadU32(Trailer + 8);
+    if(CodeSize + SpanCount*DebugEntrySize + SourceLength + DebugTrailerSize != Size) {
+        return false;
+    }
+
+    uint8_t *Entry = File + CodeSize;
+    for(uint64_t Index = 0; Index < SpanCount; ++Index, Entry += DebugEntrySize) {
+        debug_span Span = {debugReadU32(Entry), {debugReadU32(Entry + 4), debugReadU32(Entry + 8)}};
+        if(Span.Offset >= CodeSize || Span.Span.Start > Span.Span.End || Span.Span.End > SourceLength) {
+            bufFree(Info->Spans);
+            return false;
+        }
+        bufPush(Info->Spans, Span);
+    }
+
+    Info->CodeSize = CodeSize;
+    Info->Source = (char *)Entry;
+    Info->SourceLength = SourceLength;
+    return true;
+}
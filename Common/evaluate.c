@@ -0,0 +1,97 @@
+// Tree evaluator with the VM's int32_t semantics, used to fold expressions at compile time.
+//
+// Anything that would trap in executeVm() (division by zero, INT32_MIN / -1) sets *Trapped
+// instead, so callers can leave that part of the expression for runtime. Shifts and POW are the
+// VM's own from bits.c, their out of range counts and results are defined and fold like any other.
+
+static int32_t evaluateUnary(token_type Op, uint32_t Value) {
+    switch(Op) {
+        case Token_UnaryPlus:  { return Value; } break;
+        case Token_UnaryMinus: { return -Value; } break;
+        case Token_BitNot:     { return ~Value; } break;
+        case Token_Popcount:   { return bitPopcount(Value); } break;
+        case Token_Clz:        { return bitClz(Value); } break;
+        case Token_Ctz:        { return bitCtz(Value); } break;
+        case Token_Bswap:      { return bitBswap(Value); } break;
+        InvalidDefaultCase;
+    }
+
+    return 0;
+}
+
+static int32_t evaluateBinary(token_type Op, int32_t Lhs, int32_t Rhs, bool *Trapped) {
+    // NOTE: Wrapping arithmetic is done unsigned, which is what the VM does in practice
+    switch(Op) {
+        case Token_Add:      { return (uint32_t)Lhs + (uint32_t)Rhs; } break;
+        case Token_Subtract: { return (uint32_t)Lhs - (uint32_t)Rhs; } break;
+        case Token_Multiply: { return (uint32_t)Lhs * (uint32_t)Rhs; } break;
+        case Token_BitOr:    { return Lhs | Rhs; } break;
+        case Token_BitXor:   { return Lhs ^ Rhs; } break;
+        case Token_BitAnd:   { return Lhs & Rhs; } break;
+        case Token_Rotl:     { return bitRotl(Lhs, Rhs); } break;
+        case Token_Rotr:     { return bitRotr(Lhs, Rhs); } break;
+        case Token_Pdep:     { return bitPdep(Lhs, Rhs); } break;
+        case Token_Pext:     { return bitPext(Lhs, Rhs); } break;
+        case Token_Less:      { return Lhs <  Rhs; } break;
+        case Token_LessEqual: { return Lhs <= Rhs; } break;
+        case Token_Equal:     { return Lhs == Rhs; } break;
+        case Token_NotEqual:  { return Lhs != Rhs; } break;
+
+        case Token_Divide:
+        case Token_Mod: {
+            if(Rhs == 0 || (Lhs == INT32_MIN && Rhs == -1)) {
+                *Trapped = true;
+                return 0;
+            }
+            return Op == Token_Divide ? Lhs / Rhs : Lhs % Rhs;
+        } break;
+
+        case Token_LShift:   { return bitShiftLeft(Lhs, Rhs); } break;
+        case Token_RShift:   { return bitShiftRight(Lhs, Rhs); } break;
+        case Token_Power:    { return bitPower(Lhs, Rhs); } break;
+
+        InvalidDefaultCase;
+    }
+
+    return 0;
+}
+
+static int32_t expressionEvaluate(expression *Node, int32_t *Params, bool *Trapped) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            return (int32_t)Node->IntValue;
+        } break;
+
+        case Expression_Param: {
+            return Params[Node->IntValue];
+        } break;
+
+        case Expression_Lut: {
+            uint32_t Index = 0;
+            for(int Bit = 0; Bit < Node->Lut.BitCount; ++Bit) {
+                Index |= (((uint32_t)Params[Node->Lut.Params[Bit]] >> Node->Lut.Bits[Bit]) & 1) << Bit;
+            }
+            return Node->Lut.Table[Index];
+        } break;
+
+        case Expression_Unary: {
+            return evaluateUnary(Node->Unary.Op, expressionEvaluate(Node->Unary.Expr, Params, Trapped));
+        } break;
+
+        case Expression_Binary: {
+            int32_t Lhs = expressionEvaluate(Node->Binary.Lhs, Params, Trapped);
+            int32_t Rhs = expressionEvaluate(Node->Binary.Rhs, Params, Trapped);
+            return evaluateBinary(Node->Binary.Op, Lhs, Rhs, Trapped);
+        } break;
+
+        // NOTE: Both arms, like SEL, so a trap in the arm not taken still traps
+        case Expression_Select: {
+            int32_t Cond = expressionEvaluate(Node->Select.Cond, Params, Trapped);
+            int32_t Then = expressionEvaluate(Node->Select.Then, Params, Trapped);
+            int32_t Else = expressionEvaluate(Node->Select.Else, Params, Trapped);
+            return bitSelect(Cond, Then, Else);
+        } break;
+    }
+
+    return 0;
+}
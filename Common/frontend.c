@@ -0,0 +1,372 @@
+// Parallel front end for very large expressions.
+//
+// Requires stretchy.c, memory.c, lexer.c, parser.c and parallel.c.
+//
+// The top level of a large expression is a left-associative chain of the additive operators in
+// Table, so cutting the source at some of those operators gives pieces that parse independently.
+// Pieces are parsed at that precedence, so a comparison or select at the top level fails them.
+// Finding the cuts takes two passes over byte ranges of the source: the first counts parentheses
+// to get the depth at the start of every range, the second runs a prefix sum over the depth
+// changes and stops at the first operator outside all parentheses. Both passes work on 16 bytes
+// at a time where SSE2 is available.
+//
+// Every piece is parsed by its own lexer on its own arena, with the operator that ends it
+// temporarily overwritten by a NUL. Lexers see the whole source, so spans stay global, and the
+// cuts only ever fall on complete operator tokens, never inside a literal or a two character
+// operator. Any error falls back to the sequential parser, which reports it exactly as before.
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FRONTEND_SSE2 1
+#endif
+
+enum {
+    FrontendDefaultGrain = 1<<20,
+    FrontendMaxSplitChars = 16,
+};
+
+typedef struct frontend_splitter {
+    bool Initialized;
+    // NOTE: Zero when the additive operators are right-associative and cannot be split
+    int SplitCharCount;
+    char SplitChars[FrontendMaxSplitChars];
+    int Precedence;
+} frontend_splitter;
+
+typedef struct frontend_range {
+    size_t Start;
+    size_t End;
+    int64_t Delta;
+    int64_t Depth;
+    // NOTE: Offset of the first top level operator in the range, SIZE_MAX for none
+    size_t Split;
+} frontend_range;
+
+typedef struct frontend_piece {
+    size_t Start;
+    size_t End;
+    token_type Op;
+
+    arena Arena;
+    expression *Tree;
+    // NOTE: Lowest node of the left spine of chain operators, its Lhs is the first operand
+    expression *Bottom;
+    bool Ok;
+} frontend_piece;
+
+typedef struct frontend_job {
+    char *Source;
+    size_t Length;
+    uint32_t GlobalStart;
+    frontend_range *Ranges;
+    frontend_piece *Pieces;
+} frontend_job;
+
+static frontend_splitter Splitter;
+
+// NOTE: Derives the characters that start an additive operator from the lexer and Table, so the
+// front end follows any change to either
+static void frontendInitSplitter(void) {
+    if(Splitter.Initialized) {
+        return;
+    }
+    Splitter.Initialized = true;
+
+    // NOTE: Comparisons and selects bind less tightly, but sums are what grows large
+    Splitter.Precedence = Table[Token_Add].Precedence;
+
+    // NOTE: OnError only keeps lexerError() quiet, nextToken() itself never jumps
+    jmp_buf OnError;
+    lexer Lexer = {};
+    Lexer.OnError = &OnError;
+    for(int First = 1; First < 128; ++First) {
+        for(int Second = 0; Second < 128; ++Second) {
+            char Text[3] = {First, Second};
+            lexerInit(&Lexer, Text);
+            token_type Type = Lexer.Token.Type;
+            if(Lexer.TokenStart == Text && Table[Type].Kind == Operator_Binary &&
+               Table[Type].Precedence == Splitter.Precedence)
+            {
+                if(Table[Type].Associativity != Assoc_Left || Splitter.SplitCharCount == FrontendMaxSplitChars) {
+                    Splitter.SplitCharCount = 0;
+                    return;
+                }
+                if(!memchr(Splitter.SplitChars, First, Splitter.SplitCharCount)) {
+                    Splitter.SplitChars[Splitter.SplitCharCount++] = First;
+                }
+            }
+        }
+    }
+}
+
+static bool frontendSplitChar(char C) {
+    return C && memchr(Splitter.SplitChars, C, Splitter.SplitCharCount);
+}
+
+// NOTE: Whether the character just before At ends an operand, which makes an operator at At
+// binary rather than unary
+static bool frontendAfterOperand(char *Source, char *At) {
+    while(At > Source && (At[-1] == ' ' || At[-1] == '\n' || At[-1] == '\t' || At[-1] == '\r' || At[-1] == '\v')) {
+        --At;
+    }
+
+    if(At == Source) {
+        return false;
+    }
+
+    char C = At[-1];
+    return C == ')' || (C >= '0' && C <= '9') || (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z');
+}
+
+// NOTE: Lexes the operator at At, Length is 0 unless it is a complete additive operator that does
+// not continue a two character token started just before it
+static token_type frontendOperatorAt(char *Source, char *At, int *Length) {
+    jmp_buf OnError;
+    lexer Lexer = {};
+    Lexer.OnError = &OnError;
+    *Length = 0;
+
+    if(At > Source && frontendSplitChar(At[-1])) {
+        Lexer.Begin = Lexer.Stream = At - 1;
+        nextToken(&Lexer);
+        if(Lexer.Stream > At) {
+            return Token_Unknown;
+        }
+    }
+
+    Lexer.Begin = Lexer.Stream = At;
+    nextToken(&Lexer);
+    token_type Type = Lexer.Token.Type;
+    if(Lexer.TokenStart != At || Table[Type].Kind != Operator_Binary || Table[Type].Precedence != Splitter.Precedence ||
+       !frontendAfterOperand(Source, At))
+    {
+        return Token_Unknown;
+    }
+
+    *Length = Lexer.Stream - At;
+    return Type;
+}
+
+static void frontendCountDepth(void *Data, size_t Index) {
+    frontend_job *Job = Data;
+    frontend_range *Range = Job->Ranges + Index;
+    char *At = Job->Source + Range->Start, *End = Job->Source + Range->End;
+    int64_t Delta = 0;
+
+#if FRONTEND_SSE2
+    __m128i Open = _mm_set1_epi8('('), Close = _mm_set1_epi8(')'), One = _mm_set1_epi8(1);
+    __m128i Opens = _mm_setzero_si128(), Closes = _mm_setzero_si128(), Zero = _mm_setzero_si128();
+    for(; End - At >= 16; At += 16) {
+        __m128i Bytes = _mm_loadu_si128((__m128i *)At);
+        Opens = _mm_add_epi64(Opens, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(Bytes, Open), One), Zero));
+        Closes = _mm_add_epi64(Closes, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(Bytes, Close), One), Zero));
+    }
+
+    uint64_t Counts[4];
+    _mm_storeu_si128((__m128i *)Counts, Opens);
+    _mm_storeu_si128((__m128i *)Counts + 1, Closes);
+    Delta = (int64_t)(Counts[0] + Counts[1]) - (int64_t)(Counts[2] + Counts[3]);
+#endif
+
+    for(; At < End; ++At) {
+        Delta += (*At == '(') - (*At == ')');
+    }
+
+    Range->Delta = Delta;
+}
+
+static void frontendFindSplit(void *Data, size_t Index) {
+    frontend_job *Job = Data;
+    frontend_range *Range = Job->Ranges + Index;
+    char *Source = Job->Source;
+    char *At = Source + Range->Start, *End = Source + Range->End;
+    int64_t Depth = Range->Depth;
+    int Length;
+    Range->Split = SIZE_MAX;
+
+#if FRONTEND_SSE2
+    __m128i Open = _mm_set1_epi8('('), Close = _mm_set1_epi8(')');
+    __m128i Chars[FrontendMaxSplitChars];
+    for(int Char = 0; Char < Splitter.SplitCharCount; ++Char) {
+        Chars[Char] = _mm_set1_epi8(Splitter.SplitChars[Char]);
+    }
+
+    for(; End - At >= 16; At += 16) {
+        __m128i Bytes = _mm_loadu_si128((__m128i *)At);
+
+        // NOTE: Inclusive prefix sum of +1 per '(' and -1 per ')', the depth after every byte
+        __m128i Sum = _mm_sub_epi8(_mm_cmpeq_epi8(Bytes, Close), _mm_cmpeq_epi8(Bytes, Open));
+        Sum = _mm_add_epi8(Sum, _mm_slli_si128(Sum, 1));
+        Sum = _mm_add_epi8(Sum, _mm_slli_si128(Sum, 2));
+        Sum = _mm_add_epi8(Sum, _mm_slli_si128(Sum, 4));
+        Sum = _mm_add_epi8(Sum, _mm_slli_si128(Sum, 8));
+        int8_t Total = (int8_t)(_mm_extract_epi16(Sum, 7) >> 8);
+
+        // NOTE: Within 16 bytes the depth moves by at most 16
+        if(Depth >= -16 && Depth <= 16) {
+            __m128i Candidates = _mm_setzero_si128();
+            for(int Char = 0; Char < Splitter.SplitCharCount; ++Char) {
+                Candidates = _mm_or_si128(Candidates, _mm_cmpeq_epi8(Bytes, Chars[Char]));
+            }
+
+            __m128i TopLevel = _mm_cmpeq_epi8(Sum, _mm_set1_epi8((char)-Depth));
+            for(uint32_t Mask = _mm_movemask_epi8(_mm_and_si128(Candidates, TopLevel)); Mask; Mask &= Mask - 1) {
+                char *Candidate = At + __builtin_ctz(Mask);
+                if(frontendOperatorAt(Source, Candidate, &Length) != Token_Unknown) {
+                    Range->Split = Candidate - Source;
+                    return;
+                }
+            }
+        }
+
+        Depth += Total;
+    }
+#endif
+
+    for(; At < End; ++At) {
+        Depth += (*At == '(') - (*At == ')');
+        if(Depth == 0 && frontendSplitChar(*At) && frontendOperatorAt(Source, At, &Length) != Token_Unknown) {
+            Range->Split = At - Source;
+            return;
+        }
+    }
+}
+
+static void frontendParsePiece(void *Data, size_t Index) {
+    frontend_job *Job = Data;
+    frontend_piece *Piece = Job->Pieces + Index;
+
+    jmp_buf OnError;
+    lexer Lexer = {};
+    Lexer.OnError = &OnError;
+    if(setjmp(OnError)) {
+        Piece->Ok = false;
+        return;
+    }
+
+    Lexer.Begin = Job->Source;
+    Lexer.Stream = Job->Source + Piece->Start;
+    nextToken(&Lexer);
+
+    expression *Tree = parse(&Lexer, &Piece->Arena, Splitter.Precedence);
+    if(Lexer.Token.Type != Token_EOF || Lexer.Stream != Job->Source + Piece->End + 1) {
+        lexerFatal(&Lexer, Error_UnexpectedToken);
+    }
+
+    // NOTE: Left spine nodes are chain operators that start where their Lhs starts, a
+    // parenthesized operand starts at its parenthesis instead
+    expression *Bottom = 0;
+    for(expression *Node = Tree; Node->Type == Expression_Binary && Table[Node->Binary.Op].Precedence == Splitter.Precedence &&
+                                 Node->Span.Start == Node->Binary.Lhs->Span.Start; Node = Node->Binary.Lhs)
+    {
+        Node->Span.Start = Job->GlobalStart;
+        Bottom = Node;
+    }
+
+    Piece->Tree = Tree;
+    Piece->Bottom = Bottom;
+    Piece->Ok = Lexer.Error == Error_None;
+}
+
+// NOTE: Builds the same tree, spans included, as parseExpression(). Source must be writable and
+// Length bytes long, it is modified while parsing and restored before returning. Inputs below
+// 2*Grain bytes, a null Pool and any parse error use parseExpression() directly.
+static expression *parseExpressionParallel(thread_pool *Pool, lexer *Lexer, arena *Arena, char *Source, size_t Length,
+                                           size_t Grain)
+{
+    frontendInitSplitter();
+
+    int ThreadCount = Pool ? Pool->ThreadCount : 1;
+    size_t RangeCount = min((size_t)ThreadCount*ParallelTasksPerThread, Length/max(Grain, 1));
+    if(ThreadCount == 1 || RangeCount < 2 || !Splitter.SplitCharCount || Length > UINT32_MAX) {
+        return parseExpression(Lexer, Arena, Source);
+    }
+
+    frontend_job Job = {.Source = Source, .Length = Length};
+    while(Job.GlobalStart < Length && strchr(" \n\t\r\v", Source[Job.GlobalStart])) {
+        ++Job.GlobalStart;
+    }
+
+    for(size_t Range = 0; Range < RangeCount; ++Range) {
+        frontend_range Entry = {.Start = Length*Range/RangeCount, .End = Length*(Range + 1)/RangeCount};
+        bufPush(Job.Ranges, Entry);
+    }
+
+    threadPoolRun(Pool, frontendCountDepth, &Job, RangeCount);
+    int64_t Depth = 0;
+    for(size_t Range = 0; Range < RangeCount; ++Range) {
+        Job.Ranges[Range].Depth = Depth;
+        Depth += Job.Ranges[Range].Delta;
+    }
+
+    // NOTE: Ranges without a top level operator simply extend the piece before them
+    threadPoolRun(Pool, frontendFindSplit, &Job, RangeCount);
+    frontend_piece First = {.Start = 0, .Op = Token_Unknown};
+    bufPush(Job.Pieces, First);
+    for(size_t Range = 1; Range < RangeCount; ++Range) {
+        size_t Split = Job.Ranges[Range].Split;
+        if(Split == SIZE_MAX) {
+            continue;
+        }
+
+        int OpLength;
+        frontend_piece Piece = {.Op = frontendOperatorAt(Source, Source + Split, &OpLength)};
+        Piece.Start = Split + OpLength;
+        Job.Pieces[bufLength(Job.Pieces) - 1].End = Split;
+        bufPush(Job.Pieces, Piece);
+    }
+    Job.Pieces[bufLength(Job.Pieces) - 1].End = Length;
+
+    char *Saved = 0;
+    for(size_t Piece = 0; Piece + 1 < bufLength(Job.Pieces); ++Piece) {
+        bufPush(Saved, Source[Job.Pieces[Piece].End]);
+        Source[Job.Pieces[Piece].End] = 0;
+    }
+
+    threadPoolRun(Pool, frontendParsePiece, &Job, bufLength(Job.Pieces));
+
+    for(size_t Piece = 0; Piece + 1 < bufLength(Job.Pieces); ++Piece) {
+        Source[Job.Pieces[Piece].End] = Saved[Piece];
+    }
+
+    bool Ok = Depth == 0;
+    for(size_t Piece = 0; Piece < bufLength(Job.Pieces); ++Piece) {
+        Ok &= Job.Pieces[Piece].Ok;
+    }
+
+    expression *Result = 0;
+    if(Ok) {
+        Result = Job.Pieces[0].Tree;
+        for(size_t Index = 1; Index < bufLength(Job.Pieces); ++Index) {
+            frontend_piece *Piece = Job.Pieces + Index;
+            if(Piece->Bottom) {
+                expression *Operand = Piece->Bottom->Binary.Lhs;
+                Piece->Bottom->Binary.Lhs = expressionBinaryNew(Arena, Piece->Op, Result, Operand);
+                Piece->Bottom->Binary.Lhs->Span = (source_span){Job.GlobalStart, Operand->Span.End};
+                Result = Piece->Tree;
+            } else {
+                Result = expressionBinaryNew(Arena, Piece->Op, Result, Piece->Tree);
+                Result->Span = (source_span){Job.GlobalStart, Piece->Tree->Span.End};
+            }
+        }
+
+        lexerInit(Lexer, Source);
+        Lexer->Stream = Source + Length;
+        nextToken(Lexer);
+    }
+
+    // NOTE: The pieces' blocks now belong to Arena, trees from failed attempts are simply dropped
+    for(size_t Piece = 0; Piece < bufLength(Job.Pieces); ++Piece) {
+        arena *PieceArena = &Job.Pieces[Piece].Arena;
+        for(char **Block = PieceArena->Blocks; Block != bufEnd(PieceArena->Blocks); ++Block) {
+            bufPush(Arena->Blocks, *Block);
+        }
+        bufFree(PieceArena->Blocks);
+    }
+
+    bufFree(Saved);
+    bufFree(Job.Pieces);
+    bufFree(Job.Ranges);
+
+    return Result ? Result : parseExpression(Lexer, Arena, Source);
+}
@@ -0,0 +1,253 @@
+// Binary generator
+//
+// Requires stretchy.c and parser.c.
+
+static void emitBytes(uint8_t **Code, void *Data, size_t NumBytes) {
+    bufFit(*Code, bufLength(*Code) + NumBytes);
+    memcpy(*Code + bufLength(*Code), Data, NumBytes);
+    bufHeader_(*Code)->Length += NumBytes;
+}
+
+// NOTE: Number of VM stack slots the generated code needs
+static int expressionStackDepth(expression *Node) {
+    switch(Node->Type) {
+        case Expression_Int:
+        case Expression_Param:
+        case Expression_Lut: {
+            return 1;
+        } break;
+
+        case Expression_Unary: {
+            return expressionStackDepth(Node->Unary.Expr);
+        } break;
+
+        case Expression_Binary: {
+            int Lhs = expressionStackDepth(Node->Binary.Lhs);
+            int Rhs = expressionStackDepth(Node->Binary.Rhs);
+            return max(Lhs, Rhs + 1);
+        } break;
+
+        case Expression_Select: {
+            int Cond = expressionStackDepth(Node->Select.Cond);
+            int Then = expressionStackDepth(Node->Select.Then);
+            int Else = expressionStackDepth(Node->Select.Else);
+            return max(Cond, max(Then + 1, Else + 2));
+        } break;
+    }
+
+    return 0;
+}
+
+static void recordSpan(debug_span **Spans, uint8_t **Code, expression *Node) {
+    if(Spans) {
+        bufPush(*Spans, (debug_span){bufLength(*Code), Node->Span});
+    }
+}
+
+// NOTE: Emits the literal Node was parsed from in BigSource, which a lexer set to Unbounded may
+// have read past 64 bits. Literals that fit 32 bits stay LIT, the others become BIGLIT, a 32-bit
+// limb count followed by that many 64-bit limbs, least significant first.
+static void printBigLiteral(uint8_t **Code, expression *Node, char *BigSource) {
+    // NOTE: The span of a parenthesized literal starts at the parentheses
+    char *Text = BigSource + Node->Span.Start;
+    while(*Text < '0' || *Text > '9') {
+        ++Text;
+    }
+
+    int Base = 10;
+    if(*Text == '0') {
+        if(Text[1] == 'x' || Text[1] == 'X') {
+            Base = 16;
+            Text += 2;
+        } else if(Text[1] == 'b' || Text[1] == 'B') {
+            Base = 2;
+            Text += 2;
+        } else {
+            Base = 8;
+        }
+    }
+
+    // NOTE: Same digits as the lexer, which has already reported any that are out of range
+    uint64_t *Limbs = 0;
+    int Digit;
+    while((Digit = CharToDigit[(int)*Text]) || *Text == '0') {
+        uint64_t Carry = Digit;
+        for(uint64_t *Limb = Limbs; Limb != bufEnd(Limbs); ++Limb) {
+            unsigned __int128 Product = (unsigned __int128)*Limb*Base + Carry;
+            *Limb = (uint64_t)Product;
+            Carry = (uint64_t)(Product >> 64);
+        }
+        if(Carry) {
+            bufPush(Limbs, Carry);
+        }
+        ++Text;
+    }
+
+    uint32_t Count = bufLength(Limbs);
+    if(Count <= 1 && (Count == 0 || Limbs[0] <= UINT32_MAX)) {
+        uint32_t Value = Count ? Limbs[0] : 0;
+        uint8_t Data[] = {LIT, Value & 0xFF, (Value >> 8) & 0xFF, (Value >> 16) & 0xFF, (Value >> 24) & 0xFF};
+        emitBytes(Code, Data, sizeof(Data));
+    } else {
+        uint8_t Header[] = {BIGLIT, Count & 0xFF, (Count >> 8) & 0xFF, (Count >> 16) & 0xFF, (Count >> 24) & 0xFF};
+        emitBytes(Code, Header, sizeof(Header));
+        for(uint32_t Index = 0; Index < Count; ++Index) {
+            uint8_t Data[8];
+            for(int Byte = 0; Byte < 8; ++Byte) {
+                Data[Byte] = (Limbs[Index] >> 8*Byte) & 0xFF;
+            }
+            emitBytes(Code, Data, sizeof(Data));
+        }
+    }
+    bufFree(Limbs);
+}
+
+#define caseInstr(C, I) case C: { Instr = I; } break;
+// NOTE: When Spans is given, every emitted instruction also records the source span of its node.
+// Wide code runs on 64-bit values, where LIT sign extends and larger literals need LIT64. When
+// BigSource is given, the code is for vm --bigint and literals are read back from the source.
+static void printBinaryNode(uint8_t **Code, expression *Node, debug_span **Spans, bool Wide, char *BigSource) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            recordSpan(Spans, Code, Node);
+            if(BigSource) {
+                printBigLiteral(Code, Node, BigSource);
+                break;
+            }
+            if(Wide && (int64_t)Node->IntValue != (int32_t)Node->IntValue) {
+                uint8_t Data[9] = {LIT64};
+                for(int Byte = 0; Byte < 8; ++Byte) {
+                    Data[1 + Byte] = (Node->IntValue >> 8*Byte) & 0xFF;
+                }
+                emitBytes(Code, Data, sizeof(Data));
+                break;
+            }
+
+            uint8_t Data[] = {
+                LIT,
+                (Node->IntValue >>  0) & 0xFF,
+                (Node->IntValue >>  8) & 0xFF,
+                (Node->IntValue >> 16) & 0xFF,
+                (Node->IntValue >> 24) & 0xFF,
+            };
+            emitBytes(Code, Data, sizeof(Data));
+        } break;
+
+        case Expression_Param: {
+            recordSpan(Spans, Code, Node);
+            uint8_t Data[] = {ARG, Node->IntValue & 0xFF};
+            emitBytes(Code, Data, sizeof(Data));
+        } break;
+
+        case Expression_Lut: {
+            assert(!Wide);
+            recordSpan(Spans, Code, Node);
+            uint8_t Header[] = {LUT, Node->Lut.BitCount};
+            emitBytes(Code, Header, sizeof(Header));
+            for(int Bit = 0; Bit < Node->Lut.BitCount; ++Bit) {
+                uint8_t Source[] = {Node->Lut.Params[Bit], Node->Lut.Bits[Bit]};
+                emitBytes(Code, Source, sizeof(Source));
+            }
+
+            for(uint32_t Index = 0; Index < (1u << Node->Lut.BitCount); ++Index) {
+                uint32_t Value = Node->Lut.Table[Index];
+                uint8_t Data[] = {
+                    (Value >>  0) & 0xFF,
+                    (Value >>  8) & 0xFF,
+                    (Value >> 16) & 0xFF,
+                    (Value >> 24) & 0xFF,
+                };
+                emitBytes(Code, Data, sizeof(Data));
+            }
+        } break;
+
+        case Expression_Unary: {
+            printBinaryNode(Code, Node->Unary.Expr, Spans, Wide, BigSource);
+
+            uint8_t Instr = NOP;
+            switch(Node->Unary.Op) {
+                case Token_UnaryPlus: {} break;
+                caseInstr(Token_UnaryMinus, SYM);
+                caseInstr(Token_BitNot, NOT);
+                caseInstr(Token_Popcount, POPCNT);
+                caseInstr(Token_Clz, CLZ);
+                caseInstr(Token_Ctz, CTZ);
+                caseInstr(Token_Bswap, BSWAP);
+
+                InvalidDefaultCase;
+            }
+
+            if(Instr != NOP) {
+                recordSpan(Spans, Code, Node);
+                emitBytes(Code, &Instr, sizeof(Instr));
+            }
+        } break;
+
+        case Expression_Binary: {
+            printBinaryNode(Code, Node->Binary.Lhs, Spans, Wide, BigSource);
+            printBinaryNode(Code, Node->Binary.Rhs, Spans, Wide, BigSource);
+
+            uint8_t Instr = NOP;
+            switch(Node->Binary.Op) {
+                caseInstr(Token_Add,      ADD);
+                caseInstr(Token_Subtract, SUB);
+                caseInstr(Token_BitOr,    OR);
+                caseInstr(Token_BitXor,   XOR);
+                caseInstr(Token_Multiply, MUL);
+                caseInstr(Token_Divide,   DIV);
+                caseInstr(Token_Mod,      MOD);
+                caseInstr(Token_LShift,   LSH);
+                caseInstr(Token_RShift,   RSH);
+                caseInstr(Token_BitAnd,   AND);
+                caseInstr(Token_Power,    POW);
+                caseInstr(Token_Rotl,     ROL);
+                caseInstr(Token_Rotr,     ROR);
+                caseInstr(Token_Pdep,     PDEP);
+                caseInstr(Token_Pext,     PEXT);
+                caseInstr(Token_Less,      LT);
+                caseInstr(Token_LessEqual, LE);
+                caseInstr(Token_Equal,     EQ);
+                caseInstr(Token_NotEqual,  NE);
+
+                InvalidDefaultCase;
+            }
+
+            assert(Instr != NOP);
+            recordSpan(Spans, Code, Node);
+            emitBytes(Code, &Instr, sizeof(Instr));
+        } break;
+
+        case Expression_Select: {
+            printBinaryNode(Code, Node->Select.Cond, Spans, Wide, BigSource);
+            printBinaryNode(Code, Node->Select.Then, Spans, Wide, BigSource);
+            printBinaryNode(Code, Node->Select.Else, Spans, Wide, BigSource);
+
+            uint8_t Instr = SEL;
+            recordSpan(Spans, Code, Node);
+            emitBytes(Code, &Instr, sizeof(Instr));
+        } break;
+    }
+}
+
+static void printBinaryWithSpans(uint8_t **Code, expression *Node, debug_span **Spans) {
+    printBinaryNode(Code, Node, Spans, false, 0);
+}
+
+static void printBinary(uint8_t **Code, expression *Node) {
+    printBinaryNode(Code, Node, 0, false, 0);
+}
+
+// NOTE: A --wide program, the tree must come from a lexer set to Wide and hold no lookup tables.
+// The WIDE header tells the VM to run it on a 64-bit stack.
+static void printBinaryWide(uint8_t **Code, expression *Node) {
+    bufPush(*Code, WIDE);
+    printBinaryNode(Code, Node, 0, true, 0);
+}
+
+// NOTE: A --bigint program, the tree must come straight from the parser for Source, with a lexer
+// set to Unbounded: folding, rewrites and lookup tables all assume 32-bit values. The BIG header
+// keeps the 32-bit VM from running it.
+static void printBinaryBig(uint8_t **Code, expression *Node, char *Source) {
+    bufPush(*Code, BIG);
+    printBinaryNode(Code, Node, 0, false, Source);
+}
@@ -0,0 +1,606 @@
+// Rewrites hand-written bit manipulation idioms into the popcount, clz, ctz, bswap, rotl, pdep and
+// pext builtins.
+//
+// Requires memory.c, bits.c, parser.c and -pthread.
+//
+// Three recognizers run bottom-up, so every node already sees its rewritten children:
+//
+// - Templates. The usual multi-step spellings of popcount, clz and ctz, written as source where
+//   $0 stands for the result of the previous step, and for the operand in the first step.
+//   Without variables the language repeats every intermediate value, so all copies have to be
+//   structurally equal. They run in a pass of their own first, so the other two never rewrite
+//   one of their steps.
+// - Bit permutations. Every bit of a node is tracked as a constant or as one bit of a single
+//   operand X, through &, |, ^, disjoint +, constant shifts, multiplications by powers of two,
+//   rotations, bswap, pdep and pext. A node whose bits are only a permutation of X's bits is
+//   replaced by the cheapest of rotl(X, N) & Mask, rotl(bswap(X), N) & Mask, pext and pdep.
+// - Bit sums. Single bits of X moved to bit 0 and added up become popcount(X & Mask).
+//
+// Every rewrite computes the same value for every input, in the VM's semantics where >> is
+// arithmetic, and is only applied when it has fewer nodes. X itself is kept, so anything in it
+// that traps still does.
+
+enum {
+    IdiomZero = -1,
+    IdiomOne = -2,
+};
+
+// NOTE: Bits[I] is IdiomZero, IdiomOne or the bit of Source that bit I is a copy of. Source is 0
+// when all bits are constant, Node itself when it is not a permutation of anything smaller.
+typedef struct idiom_info {
+    expression *Source;
+    int SourceCount;
+    int Count;
+    int8_t Bits[32];
+} idiom_info;
+
+typedef struct idiom_template {
+    token_type Op;
+    char *Steps[8];
+    expression *Parsed[8];
+} idiom_template;
+
+static idiom_template IdiomTemplates[] = {
+    {.Op = Token_Popcount, .Steps = {
+        "$0 - (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 + ($0 >> 4)) & 0x0F0F0F0F",
+        "($0 * 0x01010101) >> 24",
+    }},
+    {.Op = Token_Popcount, .Steps = {
+        "$0 - (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 + ($0 >> 4)) & 0x0F0F0F0F",
+        "$0 + ($0 >> 8)",
+        "$0 + ($0 >> 16)",
+        "$0 & 0x3F",
+    }},
+    {.Op = Token_Popcount, .Steps = {
+        "($0 & 0x55555555) + (($0 >> 1) & 0x55555555)",
+        "($0 & 0x33333333) + (($0 >> 2) & 0x33333333)",
+        "($0 & 0x0F0F0F0F) + (($0 >> 4) & 0x0F0F0F0F)",
+        "($0 & 0x00FF00FF) + (($0 >> 8) & 0x00FF00FF)",
+        "($0 & 0x0000FFFF) + (($0 >> 16) & 0x0000FFFF)",
+    }},
+    // NOTE: The smear copies the highest set bit into every bit below it. A negative operand
+    // smears to all ones either way, >> being arithmetic does not matter.
+    {.Op = Token_Clz, .Steps = {
+        "$0 | ($0 >> 1)", "$0 | ($0 >> 2)", "$0 | ($0 >> 4)", "$0 | ($0 >> 8)", "$0 | ($0 >> 16)",
+        "popcount(~$0)",
+    }},
+    {.Op = Token_Clz, .Steps = {
+        "$0 | ($0 >> 1)", "$0 | ($0 >> 2)", "$0 | ($0 >> 4)", "$0 | ($0 >> 8)", "$0 | ($0 >> 16)",
+        "32 - popcount($0)",
+    }},
+    {.Op = Token_Ctz, .Steps = {"popcount(($0 & -$0) - 1)"}},
+    {.Op = Token_Ctz, .Steps = {"popcount(~$0 & ($0 - 1))"}},
+};
+
+// NOTE: The templates are parsed once per process, whichever thread rewrites first does it while
+// the others wait. Their trees live in storage of their own, so parsing them never allocates and
+// cannot run out of memory halfway through.
+static _Alignas(ARENA_ALIGNMENT) char IdiomStorage[1<<15];
+static arena IdiomArena = {.Next = IdiomStorage, .End = IdiomStorage + sizeof(IdiomStorage)};
+static pthread_once_t IdiomParsed = PTHREAD_ONCE_INIT;
+
+static void idiomParseTemplatesOnce(void) {
+    for(int Template = 0; Template < (int)arrayCount(IdiomTemplates); ++Template) {
+        for(int Step = 0; IdiomTemplates[Template].Steps[Step]; ++Step) {
+            lexer Lexer = {};
+            IdiomTemplates[Template].Parsed[Step] = parseExpression(&Lexer, &IdiomArena, IdiomTemplates[Template].Steps[Step]);
+        }
+    }
+    assert(!IdiomArena.Blocks);
+}
+
+static void idiomParseTemplates(void) {
+    pthread_once(&IdiomParsed, idiomParseTemplatesOnce);
+}
+
+static bool idiomEqual(expression *A, expression *B) {
+    if(A == B) {
+        return true;
+    }
+    if(A->Type != B->Type) {
+        return false;
+    }
+
+    switch(A->Type) {
+        case Expression_Int:
+        case Expression_Param: {
+            return A->IntValue == B->IntValue;
+        } break;
+
+        case Expression_Lut: {
+            return false;
+        } break;
+
+        case Expression_Unary: {
+            return A->Unary.Op == B->Unary.Op && idiomEqual(A->Unary.Expr, B->Unary.Expr);
+        } break;
+
+        case Expression_Binary: {
+            return A->Binary.Op == B->Binary.Op && idiomEqual(A->Binary.Lhs, B->Binary.Lhs) &&
+                   idiomEqual(A->Binary.Rhs, B->Binary.Rhs);
+        } break;
+
+        case Expression_Select: {
+            return idiomEqual(A->Select.Cond, B->Select.Cond) && idiomEqual(A->Select.Then, B->Select.Then) &&
+                   idiomEqual(A->Select.Else, B->Select.Else);
+        } break;
+    }
+
+    return false;
+}
+
+static bool idiomCommutative(token_type Op) {
+    return Op == Token_Add || Op == Token_Multiply || Op == Token_BitAnd || Op == Token_BitOr || Op == Token_BitXor;
+}
+
+// NOTE: Param nodes of Pattern match any subtree, all of them the same one, which ends up in *Binding
+static bool idiomMatch(expression *Pattern, expression *Node, expression **Binding) {
+    switch(Pattern->Type) {
+        case Expression_Param: {
+            if(*Binding) {
+                return idiomEqual(*Binding, Node);
+            }
+            *Binding = Node;
+            return true;
+        } break;
+
+        case Expression_Int: {
+            return Node->Type == Expression_Int && Node->IntValue == Pattern->IntValue;
+        } break;
+
+        case Expression_Unary: {
+            return Node->Type == Expression_Unary && Node->Unary.Op == Pattern->Unary.Op &&
+                   idiomMatch(Pattern->Unary.Expr, Node->Unary.Expr, Binding);
+        } break;
+
+        case Expression_Binary: {
+            if(Node->Type != Expression_Binary || Node->Binary.Op != Pattern->Binary.Op) {
+                return false;
+            }
+
+            expression *Saved = *Binding;
+            if(idiomMatch(Pattern->Binary.Lhs, Node->Binary.Lhs, Binding) &&
+               idiomMatch(Pattern->Binary.Rhs, Node->Binary.Rhs, Binding))
+            {
+                return true;
+            }
+
+            *Binding = Saved;
+            if(idiomCommutative(Node->Binary.Op) &&
+               idiomMatch(Pattern->Binary.Lhs, Node->Binary.Rhs, Binding) &&
+               idiomMatch(Pattern->Binary.Rhs, Node->Binary.Lhs, Binding))
+            {
+                return true;
+            }
+
+            *Binding = Saved;
+            return false;
+        } break;
+
+        InvalidDefaultCase;
+    }
+
+    return false;
+}
+
+static void idiomLeaf(expression *Node, int Count, idiom_info *Info) {
+    Info->Source = Node;
+    Info->SourceCount = Info->Count = Count;
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        Info->Bits[Bit] = Bit;
+    }
+}
+
+static bool idiomConstant(idiom_info *Info, uint32_t *Value) {
+    *Value = 0;
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        *Value |= Info->Bits[Bit] == IdiomOne ? 1u << Bit : 0;
+    }
+    return !Info->Source;
+}
+
+// NOTE: Returns false when a bit of the result is no single bit of the sources
+static bool idiomCombineBit(token_type Op, int8_t Lhs, int8_t Rhs, int8_t *Result) {
+    if(Op == Token_BitAnd) {
+        if(Lhs == IdiomZero || Rhs == IdiomZero) {
+            *Result = IdiomZero;
+        } else if(Lhs == IdiomOne || Rhs == IdiomOne) {
+            *Result = Lhs == IdiomOne ? Rhs : Lhs;
+        } else {
+            *Result = Lhs;
+            return Lhs == Rhs;
+        }
+    } else if(Op == Token_BitOr) {
+        if(Lhs == IdiomOne || Rhs == IdiomOne) {
+            *Result = IdiomOne;
+        } else if(Lhs == IdiomZero || Rhs == IdiomZero) {
+            *Result = Lhs == IdiomZero ? Rhs : Lhs;
+        } else {
+            *Result = Lhs;
+            return Lhs == Rhs;
+        }
+    } else if(Op == Token_BitXor) {
+        if(Lhs == IdiomZero || Rhs == IdiomZero) {
+            *Result = Lhs == IdiomZero ? Rhs : Lhs;
+        } else if(Lhs == Rhs) {
+            *Result = IdiomZero;
+        } else {
+            return Lhs == IdiomOne && Rhs == IdiomOne;
+        }
+    } else {
+        // NOTE: A sum is an or while no two operand bits can carry
+        if(Lhs != IdiomZero && Rhs != IdiomZero) {
+            return false;
+        }
+        *Result = Lhs == IdiomZero ? Rhs : Lhs;
+    }
+
+    return true;
+}
+
+// NOTE: Moves bit From[Map[I]] to bit I, a negative Map entry gives a zero bit
+static void idiomPermute(idiom_info *Info, idiom_info *From, int *Map) {
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        Info->Bits[Bit] = Map[Bit] < 0 ? IdiomZero : From->Bits[Map[Bit]];
+    }
+}
+
+static void idiomAnalyzeUnary(expression *Node, idiom_info *Operand, idiom_info *Info) {
+    idiomLeaf(Node, Operand->Count + 1, Info);
+
+    int Map[32];
+    switch(Node->Unary.Op) {
+        case Token_UnaryPlus: {
+            *Info = *Operand;
+            ++Info->Count;
+        } break;
+
+        case Token_Bswap: {
+            for(int Bit = 0; Bit < 32; ++Bit) {
+                Map[Bit] = Bit ^ 24;
+            }
+            idiomPermute(Info, Operand, Map);
+            Info->Source = Operand->Source;
+            Info->SourceCount = Operand->SourceCount;
+        } break;
+
+        default: {} break;
+    }
+}
+
+static void idiomAnalyzeBinary(expression *Node, idiom_info *Lhs, idiom_info *Rhs, idiom_info *Info) {
+    int Count = Lhs->Count + Rhs->Count + 1;
+    idiomLeaf(Node, Count, Info);
+
+    token_type Op = Node->Binary.Op;
+    uint32_t Amount;
+    int Map[32];
+    idiom_info Result = {.Source = Lhs->Source, .SourceCount = Lhs->SourceCount, .Count = Count};
+
+    switch(Op) {
+        case Token_BitAnd:
+        case Token_BitOr:
+        case Token_BitXor:
+        case Token_Add: {
+            if(Lhs->Source && Rhs->Source && !idiomEqual(Lhs->Source, Rhs->Source)) {
+                return;
+            }
+            if(!Lhs->Source) {
+                Result.Source = Rhs->Source;
+                Result.SourceCount = Rhs->SourceCount;
+            }
+            for(int Bit = 0; Bit < 32; ++Bit) {
+                if(!idiomCombineBit(Op, Lhs->Bits[Bit], Rhs->Bits[Bit], Result.Bits + Bit)) {
+                    return;
+                }
+            }
+        } break;
+
+        case Token_Multiply:
+        case Token_LShift:
+        case Token_RShift:
+        case Token_Rotl:
+        case Token_Rotr:
+        case Token_Pdep:
+        case Token_Pext: {
+            if(!idiomConstant(Rhs, &Amount)) {
+                return;
+            }
+            if(Op == Token_Multiply) {
+                if(bitPopcount(Amount) != 1) {
+                    return;
+                }
+                Op = Token_LShift;
+                Amount = bitCtz(Amount);
+            }
+            if((Op == Token_LShift || Op == Token_RShift) && Amount > 31) {
+                return;
+            }
+
+            int Next = 0;
+            for(int Bit = 0; Bit < 32; ++Bit) {
+                switch(Op) {
+                    case Token_LShift: { Map[Bit] = Bit - (int)Amount; } break;
+                    case Token_RShift: { Map[Bit] = min(Bit + (int)Amount, 31); } break;
+                    case Token_Rotl:   { Map[Bit] = (Bit - Amount) & 31; } break;
+                    case Token_Rotr:   { Map[Bit] = (Bit + Amount) & 31; } break;
+                    case Token_Pdep:   { Map[Bit] = Amount & (1u << Bit) ? Next++ : -1; } break;
+                    default: {
+                        while(Next < 32 && !(Amount & (1u << Next))) {
+                            ++Next;
+                        }
+                        Map[Bit] = Next < 32 ? Next++ : -1;
+                    } break;
+                }
+            }
+            idiomPermute(&Result, Lhs, Map);
+        } break;
+
+        default: {
+            return;
+        } break;
+    }
+
+    *Info = Result;
+}
+
+static expression *idiomNew(arena *Arena, expression *Replaced, token_type Op, expression *Lhs, uint32_t Rhs) {
+    expression *Result = expressionBinaryNew(Arena, Op, Lhs, expressionIntNew(Arena, Rhs));
+    Result->Span = Result->Binary.Rhs->Span = Replaced->Span;
+    return Result;
+}
+
+static expression *idiomUnaryNew(arena *Arena, expression *Replaced, token_type Op, expression *Expr) {
+    expression *Result = expressionUnaryNew(Arena, Op, Expr);
+    Result->Span = Replaced->Span;
+    return Result;
+}
+
+// NOTE: Node's bits are a permutation of the bits of Info->Source, Swap says whether they were
+// byte swapped first. Fills in the rotation and mask and returns whether they exist.
+static bool idiomRotation(idiom_info *Info, bool Swap, uint32_t *Amount, uint32_t *Mask) {
+    *Amount = 32;
+    *Mask = 0;
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        if(Info->Bits[Bit] >= 0) {
+            uint32_t Rotation = (Bit - (Swap ? Info->Bits[Bit] ^ 24 : Info->Bits[Bit])) & 31;
+            if(*Amount != 32 && *Amount != Rotation) {
+                return false;
+            }
+            *Amount = Rotation;
+            *Mask |= 1u << Bit;
+        }
+    }
+    return true;
+}
+
+// NOTE: Returns the cheapest spelling of Node's bits, or 0 when none is smaller than Node
+static expression *idiomPermutation(arena *Arena, expression *Node, idiom_info *Info) {
+    uint32_t Ones = 0, Used = 0;
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        Ones |= Info->Bits[Bit] == IdiomOne ? 1u << Bit : 0;
+        Used |= Info->Bits[Bit] >= 0 ? 1u << Bit : 0;
+    }
+    if(!Info->Source || Info->Source == Node || !Used) {
+        return 0;
+    }
+
+    // NOTE: Nodes each spelling adds on top of Source
+    int Best = Info->Count - Info->SourceCount - (Ones ? 2 : 0);
+    expression *Result = 0;
+    expression *Source = Info->Source;
+
+    for(int Swap = 0; Swap < 2; ++Swap) {
+        uint32_t Amount, Mask;
+        if(idiomRotation(Info, Swap, &Amount, &Mask)) {
+            int Cost = Swap + (Amount ? 2 : 0) + (Mask != UINT32_MAX ? 2 : 0);
+            if(Cost < Best) {
+                Best = Cost;
+                Result = Swap ? idiomUnaryNew(Arena, Node, Token_Bswap, Source) : Source;
+                Result = Amount ? idiomNew(Arena, Node, Token_Rotl, Result, Amount) : Result;
+                Result = Mask != UINT32_MAX ? idiomNew(Arena, Node, Token_BitAnd, Result, Mask) : Result;
+            }
+        }
+    }
+
+    // NOTE: pext gathers increasing source bits into the low bits, pdep scatters the low source
+    // bits upwards in order
+    uint32_t Gathered = 0, Scattered = Used;
+    int Next = 0, Low = 0;
+    bool Gather = true, Scatter = true;
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        if(Info->Bits[Bit] >= 0) {
+            Gather = Gather && Bit == Low++ && Info->Bits[Bit] >= Next;
+            Scatter = Scatter && Info->Bits[Bit] == Next;
+            Next = Info->Bits[Bit] + 1;
+            Gathered |= 1u << Info->Bits[Bit];
+        }
+    }
+    // NOTE: A contiguous field is a shift and a mask, which the rotations above already priced.
+    // Without BMI2 pext and pdep loop over the mask, so they only pay for scattered fields.
+    uint32_t Field = Gather ? Gathered : Scattered;
+    Field >>= bitCtz(Field);
+    if(Best > 2 && (Gather || Scatter) && (Field & (Field + 1))) {
+        Result = idiomNew(Arena, Node, Gather ? Token_Pext : Token_Pdep, Source, Gather ? Gathered : Scattered);
+    }
+
+    if(Result && Ones) {
+        Result = idiomNew(Arena, Node, Token_BitOr, Result, Ones);
+    }
+    return Result;
+}
+
+// NOTE: Bits of Info->Source a popcount term counts: popcount(Source), popcount(Source & Mask) or a
+// single bit moved to bit 0
+static bool idiomCountedBits(expression *Term, idiom_info *Info, expression **Source, int *SourceCount,
+                             uint32_t *Bits)
+{
+    if(Term->Type == Expression_Unary && Term->Unary.Op == Token_Popcount) {
+        expression *Operand = Term->Unary.Expr;
+        *Source = Operand;
+        *SourceCount = Info->Count - 1;
+        *Bits = UINT32_MAX;
+        if(Operand->Type == Expression_Binary && Operand->Binary.Op == Token_BitAnd &&
+           Operand->Binary.Rhs->Type == Expression_Int)
+        {
+            *Source = Operand->Binary.Lhs;
+            *SourceCount = Info->Count - 3;
+            *Bits = Operand->Binary.Rhs->IntValue;
+        }
+        return true;
+    }
+
+    for(int Bit = 1; Bit < 32; ++Bit) {
+        if(Info->Bits[Bit] != IdiomZero) {
+            return false;
+        }
+    }
+    if(!Info->Source || Info->Bits[0] < 0) {
+        return false;
+    }
+
+    *Source = Info->Source;
+    *SourceCount = Info->SourceCount;
+    *Bits = 1u << Info->Bits[0];
+    return true;
+}
+
+static expression *idiomBitSum(arena *Arena, expression *Node, idiom_info *Lhs, idiom_info *Rhs, int *Count) {
+    expression *LhsSource, *RhsSource;
+    int LhsCount, RhsCount;
+    uint32_t LhsBits, RhsBits;
+    if(!idiomCountedBits(Node->Binary.Lhs, Lhs, &LhsSource, &LhsCount, &LhsBits) ||
+       !idiomCountedBits(Node->Binary.Rhs, Rhs, &RhsSource, &RhsCount, &RhsBits) ||
+       (LhsBits & RhsBits) || !idiomEqual(LhsSource, RhsSource))
+    {
+        return 0;
+    }
+
+    uint32_t Bits = LhsBits | RhsBits;
+    *Count = LhsCount + (Bits == UINT32_MAX ? 1 : 3);
+    if(*Count >= Lhs->Count + Rhs->Count + 1) {
+        return 0;
+    }
+
+    expression *Operand = Bits == UINT32_MAX ? LhsSource : idiomNew(Arena, Node, Token_BitAnd, LhsSource, Bits);
+    return idiomUnaryNew(Arena, Node, Token_Popcount, Operand);
+}
+
+static int idiomCount(expression *Node) {
+    switch(Node->Type) {
+        case Expression_Unary:  { return 1 + idiomCount(Node->Unary.Expr); } break;
+        case Expression_Binary: { return 1 + idiomCount(Node->Binary.Lhs) + idiomCount(Node->Binary.Rhs); } break;
+        case Expression_Select: {
+            return 1 + idiomCount(Node->Select.Cond) + idiomCount(Node->Select.Then) + idiomCount(Node->Select.Else);
+        } break;
+        default:                { return 1; } break;
+    }
+}
+
+static expression *idiomTemplate(arena *Arena, expression *Node) {
+    for(int Template = 0; Template < (int)arrayCount(IdiomTemplates); ++Template) {
+        int Last = 0;
+        while(IdiomTemplates[Template].Steps[Last + 1]) {
+            ++Last;
+        }
+
+        expression *Step = Node;
+        for(int Index = Last; Index >= 0 && Step; --Index) {
+            expression *Binding = 0;
+            Step = idiomMatch(IdiomTemplates[Template].Parsed[Index], Step, &Binding) ? Binding : 0;
+        }
+
+        if(Step) {
+            return idiomUnaryNew(Arena, Node, IdiomTemplates[Template].Op, Step);
+        }
+    }
+
+    return 0;
+}
+
+static void idiomRewriteTemplates(arena *Arena, expression **Slot) {
+    expression *Node = *Slot;
+    if(Node->Type == Expression_Unary) {
+        idiomRewriteTemplates(Arena, &Node->Unary.Expr);
+    } else if(Node->Type == Expression_Binary) {
+        idiomRewriteTemplates(Arena, &Node->Binary.Lhs);
+        idiomRewriteTemplates(Arena, &Node->Binary.Rhs);
+    } else if(Node->Type == Expression_Select) {
+        idiomRewriteTemplates(Arena, &Node->Select.Cond);
+        idiomRewriteTemplates(Arena, &Node->Select.Then);
+        idiomRewriteTemplates(Arena, &Node->Select.Else);
+    }
+
+    // NOTE: A result can be a step of another template, like popcount in ctz
+    for(expression *Result; (Result = idiomTemplate(Arena, *Slot));) {
+        *Slot = Result;
+    }
+}
+
+static void idiomRewriteNode(arena *Arena, expression **Slot, idiom_info *Info) {
+    expression *Node = *Slot;
+    expression *Result = 0;
+
+    switch(Node->Type) {
+        case Expression_Int: {
+            *Info = (idiom_info){.Count = 1};
+            for(int Bit = 0; Bit < 32; ++Bit) {
+                Info->Bits[Bit] = Node->IntValue & (1u << Bit) ? IdiomOne : IdiomZero;
+            }
+        } break;
+
+        case Expression_Param:
+        case Expression_Lut: {
+            idiomLeaf(Node, 1, Info);
+        } break;
+
+        case Expression_Unary: {
+            idiom_info Operand;
+            idiomRewriteNode(Arena, &Node->Unary.Expr, &Operand);
+            idiomAnalyzeUnary(Node, &Operand, Info);
+        } break;
+
+        case Expression_Binary: {
+            idiom_info Operands[2];
+            idiomRewriteNode(Arena, &Node->Binary.Lhs, Operands);
+            idiomRewriteNode(Arena, &Node->Binary.Rhs, Operands + 1);
+            idiomAnalyzeBinary(Node, Operands, Operands + 1, Info);
+
+            int Count;
+            if(Node->Binary.Op == Token_Add && (Result = idiomBitSum(Arena, Node, Operands, Operands + 1, &Count))) {
+                idiomLeaf(Result, Count, Info);
+            }
+        } break;
+
+        // NOTE: The result is no fixed bit of anything, but the arms may hold idioms of their own
+        case Expression_Select: {
+            idiom_info Operands[3];
+            idiomRewriteNode(Arena, &Node->Select.Cond, Operands);
+            idiomRewriteNode(Arena, &Node->Select.Then, Operands + 1);
+            idiomRewriteNode(Arena, &Node->Select.Else, Operands + 2);
+            idiomLeaf(Node, Operands[0].Count + Operands[1].Count + Operands[2].Count + 1, Info);
+        } break;
+    }
+
+    if(!Result && (Result = idiomPermutation(Arena, Node, Info))) {
+        Info->Count = idiomCount(Result);
+    }
+
+    if(Result) {
+        *Slot = Result;
+    }
+}
+
+// NOTE: Rewrites the tree in place, new nodes are allocated in Arena and carry the span of the
+// subexpression they replace
+static void idiomRewrite(arena *Arena, expression **Ast) {
+    idiomParseTemplates();
+    idiomRewriteTemplates(Arena, Ast);
+
+    idiom_info Info;
+    idiomRewriteNode(Arena, Ast, &Info);
+}
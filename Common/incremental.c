@@ -0,0 +1,311 @@
+// Incremental recompilation of a source that is edited in place.
+//
+// Requires stretchy.c, memory.c, lexer.c, parser.c and generator.c.
+//
+// Parentheses and builtin calls split the source into groups, which nest like the tree. Precedence
+// never reaches across a group's delimiters, so a group whose interior contains an edit can be
+// lexed and parsed again on its own, and its new subtree hung where the old one was. When the
+// edited text no longer parses as a group by itself, say because a parenthesis was typed, its
+// parent is tried next, up to the whole source. Postfix code keeps every subtree contiguous, in the
+// same order as the source, so the group's code is replaced in place as well.
+//
+// Groups store their source and code positions relative to their parent, so an edit updates
+// its ancestors and their later siblings rather than every group behind it. The source and code
+// buffers themselves are still moved with memmove, the one part that grows with the source, at
+// memory bandwidth. Spans in the tree are relative to the group a node was parsed with.
+//
+// The code is what the generator emits without the optimizing passes: lookup tables, idioms and
+// peephole rewrites look across groups, so run the compiler on the final source for those.
+
+typedef struct incremental_group {
+    // NOTE: Relative to the start of the parent group
+    size_t SourceOffset, SourceLength;
+    size_t CodeOffset, CodeLength;
+    // NOTE: Where the group's subtree hangs, a child pointer of a node in the parent's subtree
+    expression **Slot;
+    struct incremental_group *Parent;
+    // NOTE: Ordered by offset, which is the same order in the source and in the code
+    struct incremental_group **Children;
+} incremental_group;
+
+typedef struct incremental {
+    // NOTE: NUL-terminated, the length does not count the terminator
+    char *Source;
+    // NOTE: The program for the last source that parsed, ends with HALT
+    uint8_t *Code;
+    arena Arena;
+    expression *Ast;
+    incremental_group Root;
+
+    // NOTE: When the source does not parse, the tree and code are those of the last one that did
+    // and the next edit parses the whole source again
+    bool Valid;
+    error_code Error;
+    size_t ErrorOffset;
+
+    // NOTE: What the last edit did, for the caller to patch its copy of the code
+    size_t Reparsed;
+    size_t CodeOffset, CodeRemoved, CodeAdded;
+
+    // NOTE: Blocks after the last full parse, edits leave replaced subtrees behind in the arena
+    size_t FullBlocks;
+} incremental;
+
+typedef struct incremental_walk {
+    char *Text;
+    size_t *Match;
+} incremental_walk;
+
+static size_t incrementalSourceLength(incremental *State) {
+    return bufLength(State->Source) - 1;
+}
+
+static void incrementalFreeChildren(incremental_group *Group) {
+    for(size_t Index = 0; Index < bufLength(Group->Children); ++Index) {
+        incrementalFreeChildren(Group->Children[Index]);
+        free(Group->Children[Index]);
+    }
+    bufFree(Group->Children);
+}
+
+// NOTE: Offset of the opening parenthesis in a group's text, after the name of a builtin
+static size_t incrementalOpen(char *Text) {
+    size_t Open = 0;
+    while(Text[Open] >= 'a' && Text[Open] <= 'z') {
+        ++Open;
+    }
+    return Open;
+}
+
+static bool incrementalIsGroup(incremental_walk *Walk, expression *Node) {
+    if((Node->Type == Expression_Unary && Table[Node->Unary.Op].Kind == Operator_Builtin) ||
+       (Node->Type == Expression_Binary && Table[Node->Binary.Op].Kind == Operator_Builtin))
+    {
+        return true;
+    }
+    return Walk->Text[Node->Span.Start] == '(' && Walk->Match[Node->Span.Start] == Node->Span.End - 1;
+}
+
+// NOTE: Returns the size of the code Node generates, which starts at CodeAt, and adds the groups
+// below it to Parent, whose text starts at ParentStart and code at ParentCode
+static size_t incrementalWalk(incremental_walk *Walk, expression **Slot, incremental_group *Parent, size_t ParentStart,
+                              size_t ParentCode, size_t CodeAt, bool Top)
+{
+    expression *Node = *Slot;
+    incremental_group *Group = Parent;
+    if(!Top && incrementalIsGroup(Walk, Node)) {
+        Group = xMalloc(sizeof(*Group));
+        *Group = (incremental_group){
+            .SourceOffset = Node->Span.Start - ParentStart,
+            .SourceLength = Node->Span.End - Node->Span.Start,
+            .CodeOffset = CodeAt - ParentCode,
+            .Slot = Slot,
+            .Parent = Parent,
+        };
+        bufPush(Parent->Children, Group);
+        ParentStart = Node->Span.Start;
+        ParentCode = CodeAt;
+    }
+
+    size_t Size = 0;
+    switch(Node->Type) {
+        case Expression_Int:   { Size = 5; } break;
+        case Expression_Param: { Size = 2; } break;
+        case Expression_Lut:   { Size = 2 + 2*Node->Lut.BitCount + (4u << Node->Lut.BitCount); } break;
+
+        case Expression_Unary: {
+            Size = incrementalWalk(Walk, &Node->Unary.Expr, Group, ParentStart, ParentCode, CodeAt, false);
+            Size += Node->Unary.Op != Token_UnaryPlus;
+        } break;
+
+        case Expression_Binary: {
+            Size = incrementalWalk(Walk, &Node->Binary.Lhs, Group, ParentStart, ParentCode, CodeAt, false);
+            Size += incrementalWalk(Walk, &Node->Binary.Rhs, Group, ParentStart, ParentCode, CodeAt + Size, false);
+            Size += 1;
+        } break;
+
+        case Expression_Select: {
+            Size = incrementalWalk(Walk, &Node->Select.Cond, Group, ParentStart, ParentCode, CodeAt, false);
+            Size += incrementalWalk(Walk, &Node->Select.Then, Group, ParentStart, ParentCode, CodeAt + Size, false);
+            Size += incrementalWalk(Walk, &Node->Select.Else, Group, ParentStart, ParentCode, CodeAt + Size, false);
+            Size += 1;
+        } break;
+    }
+
+    if(Group != Parent) {
+        Group->CodeLength = Size;
+    }
+    return Size;
+}
+
+static void incrementalSplice(uint8_t **Buffer, size_t Offset, size_t Removed, void *Inserted, size_t Added) {
+    size_t Length = bufLength(*Buffer);
+    bufFit(*Buffer, Length - Removed + Added);
+    memmove(*Buffer + Offset + Added, *Buffer + Offset + Removed, Length - Offset - Removed);
+    memcpy(*Buffer + Offset, Inserted, Added);
+    bufHeader_(*Buffer)->Length = Length - Removed + Added;
+}
+
+// NOTE: Parses the Length bytes of the source at Start as Group, which becomes their group when
+// they parse as one. The root accepts any expression.
+static bool incrementalReparse(incremental *State, incremental_group *Group, size_t Start, size_t Length,
+                               size_t CodeStart)
+{
+    char *Text = xMalloc(Length + 1);
+    memcpy(Text, State->Source + Start, Length);
+    Text[Length] = 0;
+    State->Reparsed += Length;
+
+    lexer Lexer = {};
+    expression *Node = tryParseExpression(&Lexer, &State->Arena, Text);
+    incremental_walk Walk = {.Text = Text, .Match = xMalloc((Length + 1)*sizeof(size_t))};
+    size_t *Opened = 0;
+    for(size_t At = 0; At < Length; ++At) {
+        Walk.Match[At] = Length;
+        if(Text[At] == '(') {
+            bufPush(Opened, At);
+        } else if(Text[At] == ')' && bufLength(Opened)) {
+            Walk.Match[Opened[--bufHeader_(Opened)->Length]] = At;
+        }
+    }
+    bufFree(Opened);
+
+    bool Parsed = Node && (Group == &State->Root ||
+                           (Node->Span.Start == 0 && Node->Span.End == Length && incrementalIsGroup(&Walk, Node)));
+    if(!Parsed && Group == &State->Root) {
+        State->Error = Lexer.Error;
+        State->ErrorOffset = Lexer.ErrorOffset;
+    }
+
+    if(Parsed) {
+        incrementalFreeChildren(Group);
+        size_t Size = incrementalWalk(&Walk, &Node, Group, 0, 0, 0, true);
+
+        uint8_t *Code = 0;
+        printBinary(&Code, Node);
+        assert(bufLength(Code) == Size);
+        incrementalSplice(&State->Code, CodeStart, Group->CodeLength, Code, Size);
+        bufFree(Code);
+
+        State->CodeOffset = CodeStart;
+        State->CodeRemoved = Group->CodeLength;
+        State->CodeAdded = Size;
+        *Group->Slot = Node;
+    }
+
+    free(Walk.Match);
+    free(Text);
+    return Parsed;
+}
+
+static bool incrementalParseAll(incremental *State) {
+    arena Old = State->Arena;
+    State->Arena = (arena){};
+    if(!incrementalReparse(State, &State->Root, 0, incrementalSourceLength(State), 0)) {
+        // NOTE: The old tree still describes the code, keep it
+        arenaFree(&State->Arena);
+        State->Arena = Old;
+        State->Valid = false;
+        return false;
+    }
+
+    arenaFree(&Old);
+    State->Valid = true;
+    State->Error = Error_None;
+    State->Root.SourceLength = incrementalSourceLength(State);
+    State->Root.CodeLength = State->CodeAdded;
+    State->FullBlocks = bufLength(State->Arena.Blocks);
+    return true;
+}
+
+static bool incrementalInit(incremental *State, char *Source, size_t Length) {
+    *State = (incremental){.Root = {.Slot = &State->Ast}};
+    bufPush(State->Code, HALT);
+    bufFit(State->Source, Length + 1);
+    memcpy(State->Source, Source, Length);
+    State->Source[Length] = 0;
+    bufHeader_(State->Source)->Length = Length + 1;
+    return incrementalParseAll(State);
+}
+
+static void incrementalFree(incremental *State) {
+    incrementalFreeChildren(&State->Root);
+    arenaFree(&State->Arena);
+    bufFree(State->Source);
+    bufFree(State->Code);
+    *State = (incremental){};
+}
+
+// NOTE: Replaces Deleted bytes at Offset with Inserted. Returns false when the result does not
+// parse, with the error in State. The caller checks that the edit lies within the source.
+static bool incrementalEdit(incremental *State, size_t Offset, size_t Deleted, char *Inserted, size_t InsertedLength) {
+    assert(Offset + Deleted <= incrementalSourceLength(State));
+    State->Reparsed = 0;
+    State->CodeOffset = State->CodeRemoved = State->CodeAdded = 0;
+
+    // NOTE: The smallest group whose interior contains the edit, with the absolute positions
+    incremental_group *Group = &State->Root;
+    size_t Start = 0, CodeStart = 0;
+    for(bool Descended = State->Valid; Descended;) {
+        Descended = false;
+        size_t Low = 0, High = bufLength(Group->Children);
+        while(Low < High) {
+            size_t Middle = (Low + High)/2;
+            if(Start + Group->Children[Middle]->SourceOffset <= Offset) {
+                Low = Middle + 1;
+            } else {
+                High = Middle;
+            }
+        }
+
+        if(Low > 0) {
+            incremental_group *Child = Group->Children[Low - 1];
+            size_t ChildStart = Start + Child->SourceOffset;
+            size_t Open = ChildStart + incrementalOpen(State->Source + ChildStart);
+            if(Offset > Open && Offset + Deleted < ChildStart + Child->SourceLength) {
+                Group = Child;
+                Start = ChildStart;
+                CodeStart += Child->CodeOffset;
+                Descended = true;
+            }
+        }
+    }
+
+    size_t Length = bufLength(State->Source);
+    bufFit(State->Source, Length - Deleted + InsertedLength);
+    memmove(State->Source + Offset + InsertedLength, State->Source + Offset + Deleted, Length - Offset - Deleted);
+    memcpy(State->Source + Offset, Inserted, InsertedLength);
+    bufHeader_(State->Source)->Length = Length - Deleted + InsertedLength;
+
+    // NOTE: Replaced subtrees stay in the arena until a full parse, which runs once they take up
+    // as much as the live tree, so it costs as much as the edits before it did
+    if(!State->Valid || bufLength(State->Arena.Blocks) > 2*State->FullBlocks + 16) {
+        return incrementalParseAll(State);
+    }
+
+    ptrdiff_t Delta = (ptrdiff_t)InsertedLength - (ptrdiff_t)Deleted;
+    while(!incrementalReparse(State, Group, Start, Group->SourceLength + Delta, CodeStart)) {
+        if(Group == &State->Root) {
+            State->Valid = false;
+            return false;
+        }
+        Start -= Group->SourceOffset;
+        CodeStart -= Group->CodeOffset;
+        Group = Group->Parent;
+    }
+
+    ptrdiff_t CodeDelta = (ptrdiff_t)State->CodeAdded - (ptrdiff_t)State->CodeRemoved;
+    Group->SourceLength += Delta;
+    Group->CodeLength += CodeDelta;
+    for(incremental_group *Child = Group, *Parent = Group->Parent; Parent; Child = Parent, Parent = Parent->Parent) {
+        Parent->SourceLength += Delta;
+        Parent->CodeLength += CodeDelta;
+
+        size_t Index = bufLength(Parent->Children);
+        while(Parent->Children[--Index] != Child) {
+            Parent->Children[Index]->SourceOffset += Delta;
+            Parent->Children[Index]->CodeOffset += CodeDelta;
+        }
+    }
+    return true;
+}
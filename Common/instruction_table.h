@@ -1,6 +1,14 @@
 typedef enum mnemonic {
     HALT = 0x00,
     LIT  = 0x01,
+    ARG  = 0x02,
+    LUT  = 0x03,
+    MODP = 0x04,
+    MODULE = 0x05,
+    LIT64 = 0x06,
+    WIDE = 0x07,
+    BIG  = 0x08,
+    BIGLIT = 0x09,
     ADD  = 0x20,
     SUB  = 0x21,
     MUL  = 0x22,
@@ -14,5 +22,18 @@ typedef enum mnemonic {
     MOD  = 0x2A,
     SYM  = 0x2B,
     POW  = 0x2C,
+    POPCNT = 0x2D,
+    CLZ    = 0x2E,
+    CTZ    = 0x2F,
+    BSWAP  = 0x30,
+    ROL    = 0x31,
+    ROR    = 0x32,
+    PDEP   = 0x33,
+    PEXT   = 0x34,
+    LT     = 0x35,
+    LE     = 0x36,
+    EQ     = 0x37,
+    NE     = 0x38,
+    SEL    = 0x39,
     NOP  = 0xFF,
 } mnemonic;
@@ -2,6 +2,13 @@ typedef enum token_type {
     Token_Unknown,
     Token_EOF,
 
+    Token_Question,
+
+    Token_Less,
+    Token_LessEqual,
+    Token_Equal,
+    Token_NotEqual,
+
     Token_Add,
     Token_Subtract,
     Token_BitOr,
@@ -20,23 +27,101 @@ typedef enum token_type {
     Token_UnaryMinus,
     Token_BitNot,
 
+    // NOTE: Builtins, written like calls: popcount(x), rotl(x, n)
+    Token_Popcount,
+    Token_Clz,
+    Token_Ctz,
+    Token_Bswap,
+    Token_Rotl,
+    Token_Rotr,
+    Token_Pdep,
+    Token_Pext,
+
     Token_LParen,
     Token_RParen,
+    Token_Comma,
+    Token_Colon,
 
     Token_Int,
+    Token_Param,
 
     Token_Count
 } token_type;
 
 typedef struct token {
     token_type Type;
-    union {
-        uint32_t IntValue;
-    };
+    // NOTE: Literals only go past 32 bits in lexers set to Wide or Unbounded
+    uint64_t IntValue;
+    source_span Span;
 } token;
 
-static char *Stream;
-static token Token;
+typedef enum error_code {
+    Error_None,
+    Error_InvalidDigit,
+    Error_IntegerOverflow,
+    Error_InvalidParam,
+    Error_UnexpectedToken,
+    Error_MissingOperator,
+    Error_DivisionByZero,
+    Error_UnsupportedBuiltin,
+    Error_TooDeep,
+
+    Error_Count
+} error_code;
+
+static char *ErrorMessages[Error_Count] = {
+    [Error_None]               = "No error.",
+    [Error_InvalidDigit]       = "Digit is greater than base.",
+    [Error_IntegerOverflow]    = "Integer overflow.",
+    [Error_InvalidParam]       = "Invalid parameter index.",
+    [Error_UnexpectedToken]    = "Unexpected token.",
+    [Error_MissingOperator]    = "Missing expected binary operator.",
+    [Error_DivisionByZero]     = "Division by zero.",
+    [Error_UnsupportedBuiltin] = "Builtin is not defined on arbitrary precision integers.",
+    [Error_TooDeep]            = "Expression is nested too deeply.",
+};
+
+typedef struct lexer {
+    char *Begin;
+    char *Stream;
+    char *TokenStart;
+    token Token;
+
+    // NOTE: Only the first error is kept, the following ones are usually caused by it. When
+    // OnError is set, errors are not printed and fatal ones jump there instead of exiting.
+    error_code Error;
+    size_t ErrorOffset;
+    jmp_buf *OnError;
+
+    // NOTE: Literals of any size are accepted, IntValue then only holds their low 64 bits and the
+    // caller reads the digits from the token span itself
+    bool Unbounded;
+    // NOTE: Literals may have up to 64 bits instead of 32, for --wide programs
+    bool Wide;
+    // NOTE: Nesting beyond MaxDepth fails with Error_TooDeep, 0 is unlimited. Every operator of a
+    // chain counts as a level too, since the tree is as deep as the chain is long.
+    int MaxDepth;
+    int Depth;
+} lexer;
+
+static void lexerError(lexer *Lexer, error_code Error, char *At) {
+    if(Lexer->Error == Error_None) {
+        Lexer->Error = Error;
+        Lexer->ErrorOffset = At - Lexer->Begin;
+    }
+
+    if(!Lexer->OnError) {
+        parseError("%s (at offset %zu)", ErrorMessages[Error], (size_t)(At - Lexer->Begin));
+    }
+}
+
+static void lexerFatal(lexer *Lexer, error_code Error) {
+    lexerError(Lexer, Error, Lexer->TokenStart);
+    if(Lexer->OnError) {
+        longjmp(*Lexer->OnError, 1);
+    }
+    exit(1);
+}
 
 static int CharToDigit[256] = {
     ['0'] = 0,
@@ -59,15 +144,15 @@ static int CharToDigit[256] = {
 
 #define case1(C, Type1)                         \
     case (C): {                                 \
-        Token.Type = (Type1); ++Stream;         \
+        Token->Type = (Type1); ++Stream;        \
     } break
 
 #define case2(C, Type2)                         \
     case (C): {                                 \
         if(*(Stream+1) == (C)) {                \
-            Token.Type = (Type2);               \
+            Token->Type = (Type2);              \
         } else {                                \
-            Token.Type = Token_Unknown;         \
+            Token->Type = Token_Unknown;        \
         }                                       \
         Stream += 2;                            \
     } break
@@ -76,22 +161,35 @@ static int CharToDigit[256] = {
     case (C): {                                 \
         ++Stream;                               \
         if(*Stream == (C)) {                    \
-            Token.Type = (Type2);               \
+            Token->Type = (Type2);              \
             ++Stream;                           \
         } else {                                \
-            Token.Type = (Type1);               \
+            Token->Type = (Type1);              \
         }                                       \
     } break
 
-static void nextToken(void) {
+static struct {
+    char *Name;
+    token_type Type;
+} BuiltinNames[] = {
+    {"popcount", Token_Popcount}, {"clz", Token_Clz}, {"ctz", Token_Ctz}, {"bswap", Token_Bswap},
+    {"rotl", Token_Rotl}, {"rotr", Token_Rotr}, {"pdep", Token_Pdep}, {"pext", Token_Pext},
+};
+
+static void nextToken(lexer *Lexer) {
+    char *Stream = Lexer->Stream;
+    token *Token = &Lexer->Token;
+
     while(*Stream == ' ' || *Stream == '\n' || *Stream == '\t' || *Stream == '\r' || *Stream == '\v') {
         ++Stream;
     }
 
+    Lexer->TokenStart = Stream;
+
     switch(*Stream) {
         case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
         {
-            Token.Type = Token_Int;
+            Token->Type = Token_Int;
 
             int Base = 10;
             if(*Stream == '0') {
@@ -114,16 +212,17 @@ static void nextToken(void) {
             }
 
             int Digit;
-            uint32_t Value = 0;
+            uint64_t Value = 0;
+            uint64_t Limit = Lexer->Wide ? UINT64_MAX : UINT32_MAX;
             bool Overflow = false;
             while((Digit = CharToDigit[(int)*Stream]) || *Stream == '0') {
                 if(Digit >= Base) {
-                    parseError("Digit is greater than base.\n");
+                    lexerError(Lexer, Error_InvalidDigit, Stream);
                     Digit = 0;
                 }
 
-                if(!Overflow && Value > (UINT32_MAX - Digit)/Base) {
-                    parseError("Integer overflow.\n");
+                if(!Overflow && !Lexer->Unbounded && Value > (Limit - Digit)/Base) {
+                    lexerError(Lexer, Error_IntegerOverflow, Stream);
                     Value = 0;
                     Overflow = true;
                 }
@@ -135,7 +234,28 @@ static void nextToken(void) {
                 ++Stream;
             }
 
-            Token.IntValue = Value;
+            Token->IntValue = Value;
+        } break;
+
+        case '$': {
+            Token->Type = Token_Param;
+            ++Stream;
+
+            if(*Stream < '0' || *Stream > '9') {
+                lexerError(Lexer, Error_InvalidParam, Stream);
+            }
+
+            uint32_t Index = 0;
+            while(*Stream >= '0' && *Stream <= '9') {
+                Index = Index*10 + (*Stream - '0');
+                if(Index >= MaxParamCount) {
+                    lexerError(Lexer, Error_InvalidParam, Stream);
+                    Index = 0;
+                }
+                ++Stream;
+            }
+
+            Token->IntValue = Index;
         } break;
 
         case1('\0', Token_EOF);
@@ -148,38 +268,117 @@ static void nextToken(void) {
         case1and2('*', Token_Multiply, Token_Power);
         case1('/', Token_Divide);
         case1('%', Token_Mod);
-        case2('<', Token_LShift);
         case2('>', Token_RShift);
         case1('&', Token_BitAnd);
 
         case1('~', Token_BitNot);
 
+        // NOTE: < starts <, <= and <<
+        case '<': {
+            ++Stream;
+            if(*Stream == '<') {
+                Token->Type = Token_LShift;
+                ++Stream;
+            } else if(*Stream == '=') {
+                Token->Type = Token_LessEqual;
+                ++Stream;
+            } else {
+                Token->Type = Token_Less;
+            }
+        } break;
+        case2('=', Token_Equal);
+        case '!': {
+            ++Stream;
+            if(*Stream == '=') {
+                Token->Type = Token_NotEqual;
+                ++Stream;
+            } else {
+                Token->Type = Token_Unknown;
+            }
+        } break;
+        case1('?', Token_Question);
+
         case1('(', Token_LParen);
         case1(')', Token_RParen);
+        case1(',', Token_Comma);
+        case1(':', Token_Colon);
+
+        case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i':
+        case 'j': case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r':
+        case 's': case 't': case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        {
+            char *Name = Stream;
+            while((*Stream >= 'a' && *Stream <= 'z') || (*Stream >= '0' && *Stream <= '9')) {
+                ++Stream;
+            }
+
+            Token->Type = Token_Unknown;
+            for(int Builtin = 0; Builtin < (int)arrayCount(BuiltinNames); ++Builtin) {
+                if(strlen(BuiltinNames[Builtin].Name) == (size_t)(Stream - Name) &&
+                   memcmp(BuiltinNames[Builtin].Name, Name, Stream - Name) == 0)
+                {
+                    Token->Type = BuiltinNames[Builtin].Type;
+                }
+            }
+        } break;
 
         default: {
-            Token.Type = Token_Unknown;
+            Token->Type = Token_Unknown;
             ++Stream;
         } break;
     }
+
+    Lexer->Stream = Stream;
+    Token->Span = (source_span){Lexer->TokenStart - Lexer->Begin, Stream - Lexer->Begin};
 }
 
-static bool matchToken(token_type Type) {
-    if(Token.Type == Type) {
-        nextToken();
+// NOTE: Keeps the OnError target and the Unbounded, Wide and MaxDepth settings the caller may have
+// set
+static void lexerInit(lexer *Lexer, char *Source) {
+    jmp_buf *OnError = Lexer->OnError;
+    bool Unbounded = Lexer->Unbounded;
+    bool Wide = Lexer->Wide;
+    int MaxDepth = Lexer->MaxDepth;
+    *Lexer = (lexer){};
+    Lexer->OnError = OnError;
+    Lexer->Unbounded = Unbounded;
+    Lexer->Wide = Wide;
+    Lexer->MaxDepth = MaxDepth;
+    Lexer->Begin = Lexer->Stream = Source;
+    nextToken(Lexer);
+}
+
+static bool matchToken(lexer *Lexer, token_type Type) {
+    if(Lexer->Token.Type == Type) {
+        nextToken(Lexer);
         return true;
     }
 
     return false;
 }
 
-static bool expectToken(token_type Type) {
-    if(Token.Type == Type) {
-        nextToken();
+static bool expectToken(lexer *Lexer, token_type Type) {
+    if(Lexer->Token.Type == Type) {
+        nextToken(Lexer);
         return true;
     }
 
-    parseError("Token is not of the expected kind!\n");
-    exit(1);
+    lexerFatal(Lexer, Error_UnexpectedToken);
     return false;
 }
+
+// NOTE: Tokenizes Source without parsing it, silently stopping at the first fatal error
+static size_t lexerCountTokens(char *Source) {
+    jmp_buf OnError;
+    lexer Lexer = {};
+    Lexer.OnError = &OnError;
+    volatile size_t Count = 0;
+
+    if(!setjmp(OnError)) {
+        for(lexerInit(&Lexer, Source); Lexer.Token.Type != Token_EOF; nextToken(&Lexer)) {
+            ++Count;
+        }
+    }
+
+    return Count;
+}
@@ -0,0 +1,399 @@
+// Lookup-table compilation for expressions that depend on few input bits.
+//
+// A bottom-up pass tracks, for every bit of a subexpression's value, which parameter bits it can
+// depend on, together with the bits that are known constants. The largest subexpressions whose
+// value depends on at most MaxBits parameter bits are evaluated for every combination of those
+// bits and replaced by an Expression_Lut node, which the generator emits as a LUT instruction with
+// an embedded table. Subexpressions that depend on no parameter at all are folded to a constant.
+//
+// Requires memory.c, bits.c, parser.c and evaluate.c.
+
+enum {
+    // NOTE: Smaller subexpressions are cheaper to run than the bit gathering of LUT
+    LutMinOps = 4,
+
+    LutDefaultBits = 8,
+};
+
+// NOTE: Sorted set of parameter bits, encoded as Param*32 + Bit
+typedef struct lut_deps {
+    int Count;
+    bool Wide;
+    uint16_t Keys[MaxLutBits];
+} lut_deps;
+
+typedef struct lut_info {
+    uint32_t KnownZero;
+    uint32_t KnownOne;
+    int OpCount;
+    lut_deps All;
+    lut_deps Bits[32];
+} lut_info;
+
+static void lutDepsAdd(lut_deps *Deps, uint16_t Key) {
+    if(Deps->Wide) {
+        return;
+    }
+
+    int Index = 0;
+    while(Index < Deps->Count && Deps->Keys[Index] < Key) {
+        ++Index;
+    }
+
+    if(Index < Deps->Count && Deps->Keys[Index] == Key) {
+        return;
+    }
+
+    if(Deps->Count == MaxLutBits) {
+        Deps->Wide = true;
+        return;
+    }
+
+    for(int Move = Deps->Count; Move > Index; --Move) {
+        Deps->Keys[Move] = Deps->Keys[Move-1];
+    }
+    Deps->Keys[Index] = Key;
+    ++Deps->Count;
+}
+
+static void lutDepsUnion(lut_deps *Deps, lut_deps *Other) {
+    if(Other->Wide) {
+        Deps->Wide = true;
+    }
+    for(int Index = 0; Index < Other->Count && !Deps->Wide; ++Index) {
+        lutDepsAdd(Deps, Other->Keys[Index]);
+    }
+}
+
+static bool lutConvert(arena *Arena, expression **Slot, lut_info *Info) {
+    expression *Node = *Slot;
+    int32_t Params[MaxParamCount] = {};
+    bool Trapped = false;
+
+    if(Info->All.Count == 0) {
+        int32_t Value = expressionEvaluate(Node, Params, &Trapped);
+        if(Trapped) {
+            return false;
+        }
+
+        *Slot = expressionIntNew(Arena, Value);
+        (*Slot)->Span = Node->Span;
+        return true;
+    }
+
+    int BitCount = Info->All.Count;
+    int32_t *Table = arenaAlloc(Arena, sizeof(int32_t) << BitCount);
+    for(uint32_t Index = 0; Index < (1u << BitCount); ++Index) {
+        for(int Bit = 0; Bit < BitCount; ++Bit) {
+            uint16_t Key = Info->All.Keys[Bit];
+            uint32_t Mask = 1u << (Key % 32);
+            Params[Key / 32] = ((Index >> Bit) & 1) ? (Params[Key / 32] | Mask) : (Params[Key / 32] & ~Mask);
+        }
+
+        Table[Index] = expressionEvaluate(Node, Params, &Trapped);
+        if(Trapped) {
+            return false;
+        }
+    }
+
+    expression *Result = expressionNew(Arena, Expression_Lut);
+    Result->Span = Node->Span;
+    Result->Lut.BitCount = BitCount;
+    Result->Lut.Table = Table;
+    for(int Bit = 0; Bit < BitCount; ++Bit) {
+        Result->Lut.Params[Bit] = Info->All.Keys[Bit] / 32;
+        Result->Lut.Bits[Bit] = Info->All.Keys[Bit] % 32;
+    }
+    *Slot = Result;
+
+    return true;
+}
+
+static bool lutFits(lut_info *Info, int MaxBits) {
+    return !Info->All.Wide && Info->All.Count <= MaxBits;
+}
+
+static void lutConvertChild(arena *Arena, expression **Slot, lut_info *Info, int MaxBits) {
+    if(lutFits(Info, MaxBits) && (Info->OpCount >= LutMinOps || (Info->All.Count == 0 && Info->OpCount > 0))) {
+        lutConvert(Arena, Slot, Info);
+    }
+}
+
+// NOTE: Bit I of an arithmetic result may depend on every bit at or below I of its operands
+static void lutPrefixDeps(lut_info *Info, lut_info *Lhs, lut_info *Rhs) {
+    lut_deps Running = {};
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        lutDepsUnion(&Running, &Lhs->Bits[Bit]);
+        if(Rhs) {
+            lutDepsUnion(&Running, &Rhs->Bits[Bit]);
+        }
+        Info->Bits[Bit] = Running;
+    }
+}
+
+static void lutFullDeps(lut_info *Info, lut_info *Lhs, lut_info *Rhs) {
+    lut_deps All = Lhs->All;
+    lutDepsUnion(&All, &Rhs->All);
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        Info->Bits[Bit] = All;
+    }
+}
+
+static bool lutIsConstant(lut_info *Info) {
+    return ~(Info->KnownZero | Info->KnownOne) == 0;
+}
+
+static void lutAnalyze(arena *Arena, expression *Node, lut_info *Info, int MaxBits) {
+    *Info = (lut_info){};
+
+    // NOTE: Children are only turned into tables when this node itself is too wide for one
+    lut_info *Children = 0;
+    expression **ChildSlots[3] = {};
+
+    switch(Node->Type) {
+        case Expression_Int: {
+            Info->KnownOne = Node->IntValue;
+            Info->KnownZero = ~Node->IntValue;
+        } break;
+
+        case Expression_Param: {
+            for(int Bit = 0; Bit < 32; ++Bit) {
+                lutDepsAdd(&Info->Bits[Bit], Node->IntValue*32 + Bit);
+            }
+        } break;
+
+        case Expression_Lut: {
+            Info->OpCount = LutMinOps;
+            for(int Bit = 0; Bit < Node->Lut.BitCount; ++Bit) {
+                lutDepsAdd(&Info->Bits[0], Node->Lut.Params[Bit]*32 + Node->Lut.Bits[Bit]);
+            }
+            for(int Bit = 1; Bit < 32; ++Bit) {
+                Info->Bits[Bit] = Info->Bits[0];
+            }
+        } break;
+
+        case Expression_Unary: {
+            lut_info *Operand = Children = xMalloc(sizeof(*Operand));
+            ChildSlots[0] = &Node->Unary.Expr;
+            lutAnalyze(Arena, Node->Unary.Expr, Operand, MaxBits);
+
+            switch(Node->Unary.Op) {
+                case Token_UnaryPlus: {
+                    *Info = *Operand;
+                } break;
+
+                case Token_BitNot: {
+                    *Info = *Operand;
+                    Info->KnownZero = Operand->KnownOne;
+                    Info->KnownOne = Operand->KnownZero;
+                } break;
+
+                case Token_UnaryMinus: {
+                    lutPrefixDeps(Info, Operand, 0);
+                    if(lutIsConstant(Operand)) {
+                        Info->KnownOne = -Operand->KnownOne;
+                        Info->KnownZero = ~Info->KnownOne;
+                    }
+                } break;
+
+                case Token_Bswap: {
+                    for(int Bit = 0; Bit < 32; ++Bit) {
+                        Info->Bits[Bit] = Operand->Bits[Bit ^ 24];
+                    }
+                    Info->KnownZero = bitBswap(Operand->KnownZero);
+                    Info->KnownOne = bitBswap(Operand->KnownOne);
+                } break;
+
+                // NOTE: Counts depend on every bit, but never exceed 32
+                case Token_Popcount:
+                case Token_Clz:
+                case Token_Ctz: {
+                    for(int Bit = 0; Bit < 6; ++Bit) {
+                        Info->Bits[Bit] = Operand->All;
+                    }
+                    Info->KnownZero = ~63u;
+                    if(lutIsConstant(Operand)) {
+                        Info->KnownOne = evaluateUnary(Node->Unary.Op, Operand->KnownOne);
+                        Info->KnownZero = ~Info->KnownOne;
+                    }
+                } break;
+
+                InvalidDefaultCase;
+            }
+
+            Info->OpCount = Operand->OpCount + 1;
+        } break;
+
+        case Expression_Binary: {
+            lut_info *Lhs = Children = xMalloc(2*sizeof(*Lhs));
+            lut_info *Rhs = Lhs + 1;
+            ChildSlots[0] = &Node->Binary.Lhs;
+            ChildSlots[1] = &Node->Binary.Rhs;
+            lutAnalyze(Arena, Node->Binary.Lhs, Lhs, MaxBits);
+            lutAnalyze(Arena, Node->Binary.Rhs, Rhs, MaxBits);
+
+            uint32_t Amount = Rhs->KnownOne;
+            switch(Node->Binary.Op) {
+                case Token_BitAnd:
+                case Token_BitOr:
+                case Token_BitXor: {
+                    for(int Bit = 0; Bit < 32; ++Bit) {
+                        Info->Bits[Bit] = Lhs->Bits[Bit];
+                        lutDepsUnion(&Info->Bits[Bit], &Rhs->Bits[Bit]);
+                    }
+
+                    if(Node->Binary.Op == Token_BitAnd) {
+                        Info->KnownZero = Lhs->KnownZero | Rhs->KnownZero;
+                        Info->KnownOne = Lhs->KnownOne & Rhs->KnownOne;
+                    } else if(Node->Binary.Op == Token_BitOr) {
+                        Info->KnownZero = Lhs->KnownZero & Rhs->KnownZero;
+                        Info->KnownOne = Lhs->KnownOne | Rhs->KnownOne;
+                    } else {
+                        uint32_t Known = (Lhs->KnownZero | Lhs->KnownOne) & (Rhs->KnownZero | Rhs->KnownOne);
+                        Info->KnownOne = (Lhs->KnownOne ^ Rhs->KnownOne) & Known;
+                        Info->KnownZero = ~Info->KnownOne & Known;
+                    }
+                } break;
+
+                case Token_LShift:
+                case Token_RShift: {
+                    if(!lutIsConstant(Rhs) || Amount > 31) {
+                        lutFullDeps(Info, Lhs, Rhs);
+                        break;
+                    }
+
+                    for(int Bit = 0; Bit < 32; ++Bit) {
+                        int From = Node->Binary.Op == Token_LShift ? Bit - (int)Amount : min(Bit + (int)Amount, 31);
+                        if(From >= 0) {
+                            Info->Bits[Bit] = Lhs->Bits[From];
+                        }
+                    }
+
+                    if(Node->Binary.Op == Token_LShift) {
+                        Info->KnownZero = (Lhs->KnownZero << Amount) | ((1u << Amount) - 1);
+                        Info->KnownOne = Lhs->KnownOne << Amount;
+                    } else {
+                        Info->KnownZero = (uint32_t)((int32_t)Lhs->KnownZero >> Amount);
+                        Info->KnownOne = (uint32_t)((int32_t)Lhs->KnownOne >> Amount);
+                    }
+                } break;
+
+                case Token_Add:
+                case Token_Subtract:
+                case Token_Multiply: {
+                    lutPrefixDeps(Info, Lhs, Rhs);
+                } break;
+
+                case Token_Rotl:
+                case Token_Rotr: {
+                    if(!lutIsConstant(Rhs)) {
+                        lutFullDeps(Info, Lhs, Rhs);
+                        break;
+                    }
+
+                    uint32_t Left = Node->Binary.Op == Token_Rotl ? Amount : -Amount;
+                    for(int Bit = 0; Bit < 32; ++Bit) {
+                        Info->Bits[Bit] = Lhs->Bits[(Bit - Left) & 31];
+                    }
+                    Info->KnownZero = bitRotl(Lhs->KnownZero, Left);
+                    Info->KnownOne = bitRotl(Lhs->KnownOne, Left);
+                } break;
+
+                // NOTE: Comparisons give 0 or 1
+                case Token_Less:
+                case Token_LessEqual:
+                case Token_Equal:
+                case Token_NotEqual: {
+                    Info->Bits[0] = Lhs->All;
+                    lutDepsUnion(&Info->Bits[0], &Rhs->All);
+                    Info->KnownZero = ~1u;
+                } break;
+
+                default: {
+                    lutFullDeps(Info, Lhs, Rhs);
+                } break;
+            }
+
+            // NOTE: Operations on two constants are constant, unless they trap
+            if(lutIsConstant(Lhs) && lutIsConstant(Rhs)) {
+                expression LhsValue = {Expression_Int, .IntValue = Lhs->KnownOne};
+                expression RhsValue = {Expression_Int, .IntValue = Rhs->KnownOne};
+                expression Folded = {Expression_Binary, .Binary = {Node->Binary.Op, &LhsValue, &RhsValue}};
+
+                bool Trapped = false;
+                uint32_t Value = expressionEvaluate(&Folded, 0, &Trapped);
+                if(!Trapped) {
+                    Info->KnownOne = Value;
+                    Info->KnownZero = ~Value;
+                }
+            }
+
+            Info->OpCount = Lhs->OpCount + Rhs->OpCount + 1;
+        } break;
+
+        // NOTE: Every bit may come from either arm, picked by any bit of the condition
+        case Expression_Select: {
+            lut_info *Cond = Children = xMalloc(3*sizeof(*Cond));
+            lut_info *Then = Cond + 1;
+            lut_info *Else = Cond + 2;
+            ChildSlots[0] = &Node->Select.Cond;
+            ChildSlots[1] = &Node->Select.Then;
+            ChildSlots[2] = &Node->Select.Else;
+            lutAnalyze(Arena, Node->Select.Cond, Cond, MaxBits);
+            lutAnalyze(Arena, Node->Select.Then, Then, MaxBits);
+            lutAnalyze(Arena, Node->Select.Else, Else, MaxBits);
+
+            for(int Bit = 0; Bit < 32; ++Bit) {
+                Info->Bits[Bit] = Cond->All;
+                lutDepsUnion(&Info->Bits[Bit], &Then->Bits[Bit]);
+                lutDepsUnion(&Info->Bits[Bit], &Else->Bits[Bit]);
+            }
+
+            if(Cond->KnownOne) {
+                Info->KnownZero = Then->KnownZero;
+                Info->KnownOne = Then->KnownOne;
+            } else if(lutIsConstant(Cond)) {
+                Info->KnownZero = Else->KnownZero;
+                Info->KnownOne = Else->KnownOne;
+            } else {
+                Info->KnownZero = Then->KnownZero & Else->KnownZero;
+                Info->KnownOne = Then->KnownOne & Else->KnownOne;
+            }
+
+            Info->OpCount = Cond->OpCount + Then->OpCount + Else->OpCount + 1;
+        } break;
+    }
+
+    // NOTE: Known bits do not depend on anything
+    Info->All = (lut_deps){};
+    for(int Bit = 0; Bit < 32; ++Bit) {
+        if((Info->KnownZero | Info->KnownOne) & (1u << Bit)) {
+            Info->Bits[Bit] = (lut_deps){};
+        }
+        lutDepsUnion(&Info->All, &Info->Bits[Bit]);
+    }
+
+    if(Children) {
+        if(!lutFits(Info, MaxBits)) {
+            for(int Child = 0; Child < (int)arrayCount(ChildSlots) && ChildSlots[Child]; ++Child) {
+                lutConvertChild(Arena, ChildSlots[Child], &Children[Child], MaxBits);
+            }
+        }
+        free(Children);
+    }
+}
+
+// NOTE: Rewrites the tree in place, MaxBits of 0 disables table compilation
+static void lutCompile(arena *Arena, expression **Ast, int MaxBits) {
+    if(MaxBits <= 0) {
+        return;
+    }
+    assert(MaxBits <= MaxLutBits);
+
+    lut_info *Info = xMalloc(sizeof(*Info));
+    lutAnalyze(Arena, *Ast, Info, MaxBits);
+    if(lutFits(Info, MaxBits) && Info->OpCount > 0) {
+        lutConvert(Arena, Ast, Info);
+    }
+    free(Info);
+}
@@ -0,0 +1,114 @@
+// Compilation of expressions evaluated modulo a fixed modulus, used by compiler --mod.
+//
+// Requires parser.c, evaluate.c, generator.c and montgomery.c.
+//
+// Only operators with a meaning on residues are accepted: +, -, *, unary + and -, ** with a
+// constant exponent, and % by the modulus itself, which is dropped so that expressions written
+// with % around every subterm compile unchanged. Constant subexpressions are folded modulo the
+// modulus and literals are emitted in Montgomery form, see modvm.c for the bytecode.
+
+static void modFatal(char *Source, expression *Node, char *Message, uint32_t Modulus) {
+    fatalError("%s %u: %.*s", Message, Modulus, (int)(Node->Span.End - Node->Span.Start), Source + Node->Span.Start);
+}
+
+// NOTE: Rewrites Node in place and returns it, or a constant replacing it. Constants hold
+// Montgomery form residues, except for exponents.
+static expression *modCompileNode(arena *Arena, montgomery *Mont, char *Source, expression *Node) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            Node->IntValue = montIn(Mont, Node->IntValue);
+            return Node;
+        } break;
+
+        case Expression_Param: {
+            return Node;
+        } break;
+
+        case Expression_Unary: {
+            expression *Expr = modCompileNode(Arena, Mont, Source, Node->Unary.Expr);
+            if(Node->Unary.Op == Token_UnaryPlus) {
+                return Expr;
+            }
+            if(Node->Unary.Op != Token_UnaryMinus) {
+                modFatal(Source, Node, "Operator is not defined with --mod", Mont->Modulus);
+            }
+            if(Expr->Type == Expression_Int) {
+                Expr->IntValue = montNegate(Mont, Expr->IntValue);
+                return Expr;
+            }
+            Node->Unary.Expr = Expr;
+            return Node;
+        } break;
+
+        case Expression_Binary: {
+            token_type Op = Node->Binary.Op;
+            expression *Rhs = Node->Binary.Rhs;
+
+            if(Op == Token_Mod) {
+                if(Rhs->Type != Expression_Int || Rhs->IntValue != Mont->Modulus) {
+                    modFatal(Source, Node, "Only % by the modulus is allowed with --mod", Mont->Modulus);
+                }
+                return modCompileNode(Arena, Mont, Source, Node->Binary.Lhs);
+            }
+
+            // NOTE: Exponents are plain integers, evaluated with the VM's int32_t semantics
+            if(Op == Token_Power) {
+                bool Trapped = false;
+                int32_t Exponent = 0;
+                if(expressionParamCount(Rhs) == 0) {
+                    Exponent = expressionEvaluate(Rhs, 0, &Trapped);
+                }
+                if(expressionParamCount(Rhs) != 0 || Trapped || Exponent < 0) {
+                    modFatal(Source, Rhs, "Exponents must be non-negative constants with --mod", Mont->Modulus);
+                }
+                Rhs = expressionIntNew(Arena, Exponent);
+                Rhs->Span = Node->Binary.Rhs->Span;
+            } else if(Op == Token_Add || Op == Token_Subtract || Op == Token_Multiply) {
+                Rhs = modCompileNode(Arena, Mont, Source, Rhs);
+            } else {
+                modFatal(Source, Node, "Operator is not defined with --mod", Mont->Modulus);
+            }
+
+            expression *Lhs = modCompileNode(Arena, Mont, Source, Node->Binary.Lhs);
+            if(Lhs->Type == Expression_Int && Rhs->Type == Expression_Int) {
+                switch(Op) {
+                    case Token_Add:      { Lhs->IntValue = montAdd(Mont, Lhs->IntValue, Rhs->IntValue); } break;
+                    case Token_Subtract: { Lhs->IntValue = montSub(Mont, Lhs->IntValue, Rhs->IntValue); } break;
+                    case Token_Multiply: { Lhs->IntValue = montMul(Mont, Lhs->IntValue, Rhs->IntValue); } break;
+                    case Token_Power:    { Lhs->IntValue = montPow(Mont, Lhs->IntValue, Rhs->IntValue); } break;
+                    InvalidDefaultCase;
+                }
+                Lhs->Span = Node->Span;
+                return Lhs;
+            }
+
+            Node->Binary.Lhs = Lhs;
+            Node->Binary.Rhs = Rhs;
+            return Node;
+        } break;
+
+        case Expression_Select: {
+            modFatal(Source, Node, "Operator is not defined with --mod", Mont->Modulus);
+        } break;
+
+        InvalidDefaultCase;
+    }
+
+    return Node;
+}
+
+// NOTE: Appends the MODP header and the program for Ast to Code, without the final HALT. Errors
+// are fatal and quote the offending part of Source.
+static void modCompile(uint8_t **Code, arena *Arena, montgomery *Mont, char *Source, expression *Ast) {
+    Ast = modCompileNode(Arena, Mont, Source, Ast);
+
+    uint8_t Header[ModHeaderSize] = {
+        MODP,
+        (Mont->Modulus >>  0) & 0xFF,
+        (Mont->Modulus >>  8) & 0xFF,
+        (Mont->Modulus >> 16) & 0xFF,
+        (Mont->Modulus >> 24) & 0xFF,
+    };
+    emitBytes(Code, Header, sizeof(Header));
+    printBinary(Code, Ast);
+}
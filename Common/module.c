@@ -0,0 +1,69 @@
+// Modules hold many programs in one file, compiler --batch writes them.
+//
+// Requires common.c and stretchy.c.
+//
+// A module starts with a MODULE instruction and the number of entries, followed by an offset and
+// a size for every entry and then the programs themselves, each ending with HALT. All numbers are
+// 4 byte little endian immediates and offsets count from the start of the file. An entry whose
+// expression did not compile has size 0.
+
+enum {
+    ModuleHeaderSize = 5,
+    ModuleEntrySize = 8,
+};
+
+static uint32_t moduleRead32(uint8_t *At) {
+    return (uint32_t)At[0] | (uint32_t)At[1] << 8 | (uint32_t)At[2] << 16 | (uint32_t)At[3] << 24;
+}
+
+static void moduleWrite32(uint8_t **Out, uint32_t Value) {
+    for(int Byte = 0; Byte < 4; ++Byte) {
+        bufPush(*Out, (uint8_t)(Value >> 8*Byte));
+    }
+}
+
+static bool moduleIs(uint8_t *Data, size_t Size) {
+    return Size >= ModuleHeaderSize && Data[0] == MODULE;
+}
+
+static uint32_t moduleEntryCount(uint8_t *Data) {
+    return moduleRead32(Data + 1);
+}
+
+// NOTE: Returns false when Index is out of range or the module is truncated. Entries that did not
+// compile give a null Code.
+static bool moduleEntry(uint8_t *Data, size_t Size, uint32_t Index, uint8_t **Code, size_t *CodeSize) {
+    uint32_t Count = moduleEntryCount(Data);
+    if(Index >= Count || Size < ModuleHeaderSize + (uint64_t)Count*ModuleEntrySize) {
+        return false;
+    }
+
+    uint8_t *Entry = Data + ModuleHeaderSize + (size_t)Index*ModuleEntrySize;
+    uint32_t Offset = moduleRead32(Entry), EntrySize = moduleRead32(Entry + 4);
+    if((uint64_t)Offset + EntrySize > Size) {
+        return false;
+    }
+
+    *Code = EntrySize ? Data + Offset : 0;
+    *CodeSize = EntrySize;
+    return true;
+}
+
+// NOTE: Appends a module to Out, Code holds the Count programs back to back
+static void moduleWrite(uint8_t **Out, uint8_t *Code, uint32_t *Sizes, uint32_t Count) {
+    size_t Start = bufLength(*Out);
+    bufPush(*Out, MODULE);
+    moduleWrite32(Out, Count);
+
+    uint32_t Offset = ModuleHeaderSize + Count*ModuleEntrySize;
+    for(uint32_t Index = 0; Index < Count; ++Index) {
+        moduleWrite32(Out, Sizes[Index] ? Offset : 0);
+        moduleWrite32(Out, Sizes[Index]);
+        Offset += Sizes[Index];
+    }
+
+    size_t Length = Offset;
+    bufFit(*Out, Start + Length);
+    memcpy(*Out + bufLength(*Out), Code, Length - (bufLength(*Out) - Start));
+    bufHeader_(*Out)->Length = Start + Length;
+}
@@ -0,0 +1,75 @@
+// Bytecode execution modulo a fixed modulus, used by vm --mod.
+//
+// Requires vm.c and montgomery.c.
+//
+// Programs compiled with --mod P start with a MODP instruction holding P. Every stack slot
+// holds a residue in Montgomery form. LIT immediates are already converted by the compiler,
+// parameters are converted as ARG loads them and the result is the only value converted back.
+// The right operand of POW is a plain exponent pushed by a LIT, not a residue.
+
+#define modBinOpCase(M, Fun)                    \
+    case M: {                                   \
+        pops(2);                                \
+        uint32_t Rhs = pop();                   \
+        uint32_t Lhs = pop();                   \
+        pushes(1);                              \
+        push(Fun(Mont, Lhs, Rhs));              \
+    } break
+
+// NOTE: Code points at the MODP header. Params are read as signed 32-bit integers, the result is
+// in [0, Modulus). Like executeVm(), errors are fatal.
+static uint32_t executeModVm(montgomery *Mont, uint8_t *Code, int32_t *Params) {
+    uint32_t Stack[VmStackSize];
+    uint32_t *Top = Stack;
+    Code += ModHeaderSize;
+
+    for(;;) {
+        mnemonic Op = *Code++;
+        switch(Op) {
+            case HALT:
+            {
+                pops(1);
+                return montOut(Mont, pop());
+            } break;
+
+            case LIT:
+            {
+                pushes(1);
+                uint32_t Value;
+                Value  = (uint32_t)(*Code++) <<  0;
+                Value |= (uint32_t)(*Code++) <<  8;
+                Value |= (uint32_t)(*Code++) << 16;
+                Value |= (uint32_t)(*Code++) << 24;
+                push(Value);
+            } break;
+
+            case ARG:
+            {
+                pushes(1);
+                push(montInSigned(Mont, Params[*Code++]));
+            } break;
+
+            modBinOpCase(ADD, montAdd);
+            modBinOpCase(SUB, montSub);
+            modBinOpCase(MUL, montMul);
+            modBinOpCase(POW, montPow);
+
+            case SYM:
+            {
+                pops(1);
+                uint32_t Value = pop();
+                pushes(1);
+                push(montNegate(Mont, Value));
+            } break;
+
+            case NOP: {} break;
+
+            default:
+            {
+                fatalError(VmErrorMessages[VmError_IllegalOpcode]);
+            } break;
+        }
+    }
+}
+
+#undef modBinOpCase
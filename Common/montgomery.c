@@ -0,0 +1,105 @@
+// Arithmetic modulo an odd 32-bit modulus in Montgomery form, used by --mod.
+//
+// A residue X is kept as X*R mod Modulus with R = 2^32, so a product only needs a multiplication
+// and montReduce() instead of a 64-bit division. Values enter with montIn() and leave with
+// montOut(), everything in between stays in Montgomery form. Every value is below Modulus.
+
+typedef struct montgomery {
+    uint32_t Modulus;
+    // NOTE: Modulus^-1 mod 2^32
+    uint32_t Inverse;
+    // NOTE: R^2 mod Modulus, montIn() multiplies by it
+    uint32_t R2;
+    // NOTE: 1 in Montgomery form, R mod Modulus
+    uint32_t One;
+} montgomery;
+
+// NOTE: Computes (Value / R) mod Modulus for Value < Modulus*R. The low halves of Value and
+// M*Modulus are equal, so their difference is a multiple of R and never needs the 65th bit that
+// Value + M*Modulus would for a modulus above 2^31.
+static inline uint32_t montReduce(montgomery *Mont, uint64_t Value) {
+    uint32_t M = (uint32_t)Value*Mont->Inverse;
+    uint32_t High = Value >> 32;
+    uint32_t Sub = ((uint64_t)M*Mont->Modulus) >> 32;
+    uint32_t Result = High - Sub;
+    return High < Sub ? Result + Mont->Modulus : Result;
+}
+
+static inline uint32_t montAdd(montgomery *Mont, uint32_t Lhs, uint32_t Rhs) {
+    uint64_t Sum = (uint64_t)Lhs + Rhs;
+    return Sum >= Mont->Modulus ? Sum - Mont->Modulus : Sum;
+}
+
+// NOTE: Residues are random, so a borrow is taken half the time. Masks avoid the branch that gcc
+// emits for the conditional.
+static inline uint32_t montSub(montgomery *Mont, uint32_t Lhs, uint32_t Rhs) {
+    return Lhs - Rhs + (Mont->Modulus & -(uint32_t)(Lhs < Rhs));
+}
+
+static inline uint32_t montNegate(montgomery *Mont, uint32_t Value) {
+    return (Mont->Modulus - Value) & -(uint32_t)(Value != 0);
+}
+
+static inline uint32_t montMul(montgomery *Mont, uint32_t Lhs, uint32_t Rhs) {
+    return montReduce(Mont, (uint64_t)Lhs*Rhs);
+}
+
+// NOTE: Any 32-bit Value works, Value*R2 stays below Modulus*R
+static inline uint32_t montIn(montgomery *Mont, uint32_t Value) {
+    return montReduce(Mont, (uint64_t)Value*Mont->R2);
+}
+
+static inline uint32_t montInSigned(montgomery *Mont, int32_t Value) {
+    return Value < 0 ? montNegate(Mont, montIn(Mont, -(uint32_t)Value)) : montIn(Mont, Value);
+}
+
+static inline uint32_t montOut(montgomery *Mont, uint32_t Value) {
+    return montReduce(Mont, Value);
+}
+
+// NOTE: Exponent is a plain integer, not a residue
+static uint32_t montPow(montgomery *Mont, uint32_t Base, uint32_t Exponent) {
+    uint32_t Result = Mont->One;
+    for(; Exponent; Exponent >>= 1) {
+        if(Exponent & 1) {
+            Result = montMul(Mont, Result, Base);
+        }
+        Base = montMul(Mont, Base, Base);
+    }
+    return Result;
+}
+
+// NOTE: Returns false for an even modulus or one below 3, Montgomery form needs it coprime to R
+static bool montInit(montgomery *Mont, uint32_t Modulus) {
+    if(Modulus < 3 || !(Modulus & 1)) {
+        return false;
+    }
+
+    // NOTE: Newton's iteration doubles the correct low bits, Modulus is its own inverse mod 8
+    uint32_t Inverse = Modulus;
+    for(int Step = 0; Step < 4; ++Step) {
+        Inverse *= 2 - Modulus*Inverse;
+    }
+    assert(Modulus*Inverse == 1);
+
+    uint64_t R = ((uint64_t)1 << 32) % Modulus;
+    *Mont = (montgomery){
+        .Modulus = Modulus,
+        .Inverse = Inverse,
+        .R2 = (R*R) % Modulus,
+        .One = R,
+    };
+    return true;
+}
+
+// NOTE: Bytecode compiled with --mod starts with MODP and the modulus as a 4 byte immediate
+enum { ModHeaderSize = 5 };
+
+// NOTE: Returns false when Code was not compiled with --mod
+static bool modProgramModulus(uint8_t *Code, size_t Size, uint32_t *Modulus) {
+    if(Size < ModHeaderSize || Code[0] != MODP) {
+        return false;
+    }
+    *Modulus = (uint32_t)Code[1] | (uint32_t)Code[2] << 8 | (uint32_t)Code[3] << 16 | (uint32_t)Code[4] << 24;
+    return true;
+}
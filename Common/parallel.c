@@ -0,0 +1,335 @@
+// Parallel evaluation of large expression trees on a fork-join thread pool.
+//
+// Requires stretchy.c, parser.c, evaluate.c and threadpool.c.
+//
+// The tree is cut into tasks of at least Grain source bytes, using the node spans as an estimate
+// of the work below a node. Chains of one associative operator, like the top level of a sum of
+// millions of terms, are flattened first so their operands can be grouped into tasks regardless
+// of how the parser nested them. The nodes above the tasks are evaluated afterwards, by replaying
+// them as a stack program, together with the small operands of the other operators.
+//
+// All chain operators wrap modulo 2^32 (+ - *) or work bitwise (& | ^), so regrouping their
+// operands gives the same bits as expressionEvaluate(). Everything else is applied in its
+// original order through the same evaluateBinary().
+
+enum {
+    ParallelDefaultGrain = 1<<16,
+    // NOTE: Tasks per thread, so uneven tasks still keep every thread busy until the end
+    ParallelTasksPerThread = 4,
+    // NOTE: Bounds the grain picked from the thread count, tasks evaluate recursively and a chain
+    // of comparisons nests one level every few bytes, which must fit the default thread stack
+    ParallelMaxGrain = 1<<17,
+};
+
+typedef struct chain_term {
+    expression *Node;
+    bool Negate;
+} chain_term;
+
+// NOTE: Folds Terms[First, First+Count) with Op, a single term is simply evaluated
+typedef struct eval_task {
+    token_type Op;
+    size_t First;
+    size_t Count;
+
+    int32_t Value;
+    bool Trapped;
+} eval_task;
+
+typedef enum plan_type {
+    Plan_Task,
+    Plan_Node,
+    Plan_Unary,
+    Plan_Binary,
+    Plan_Chain,
+} plan_type;
+
+// NOTE: Postorder stack program over the task results: Plan_Task pushes one, Plan_Node pushes the
+// value of the small Node, evaluated in place, Plan_Unary and Plan_Binary apply Op to the top one
+// or two, Plan_Chain folds the top Count with Op
+typedef struct plan_step {
+    plan_type Type;
+    token_type Op;
+    size_t Index;
+    expression *Node;
+} plan_step;
+
+typedef struct eval_plan {
+    int32_t *Params;
+    size_t Grain;
+    chain_term *Terms;
+    eval_task *Tasks;
+    plan_step *Steps;
+} eval_plan;
+
+typedef enum plan_frame_type {
+    Frame_Node,
+    Frame_Step,
+    Frame_Chain,
+} plan_frame_type;
+
+// NOTE: Pending work of planExpression(): a node to plan, a step to emit once the operands before
+// it are planned, or more operands of the innermost chain being grouped
+typedef struct plan_frame {
+    plan_frame_type Type;
+    expression *Node;
+    plan_step Step;
+} plan_frame;
+
+// NOTE: A flattened chain, grouped into tasks from operand Next on. Terms from First on are not in
+// a task yet, Count is the number of chain operands planned so far.
+typedef struct plan_chain {
+    token_type Op;
+    chain_term *Operands;
+    size_t Next;
+    size_t First;
+    size_t Pushed;
+    size_t Count;
+} plan_chain;
+
+static size_t expressionSourceSize(expression *Node) {
+    return Node->Span.End - Node->Span.Start;
+}
+
+// NOTE: Operators whose chains may be regrouped freely, Subtract joins the chains of Add
+static token_type chainOperator(expression *Node) {
+    if(Node->Type != Expression_Binary) {
+        return Token_Unknown;
+    }
+
+    switch(Node->Binary.Op) {
+        case Token_Add:
+        case Token_Subtract: { return Token_Add; } break;
+        case Token_Multiply:
+        case Token_BitAnd:
+        case Token_BitOr:
+        case Token_BitXor: { return Node->Binary.Op; } break;
+        default: { return Token_Unknown; } break;
+    }
+}
+
+static void planPushTask(eval_plan *Plan, token_type Op, size_t First) {
+    if(First == bufLength(Plan->Terms)) {
+        return;
+    }
+
+    eval_task Task = {.Op = Op, .First = First, .Count = bufLength(Plan->Terms) - First};
+    plan_step Step = {.Type = Plan_Task, .Index = bufLength(Plan->Tasks)};
+    bufPush(Plan->Tasks, Task);
+    bufPush(Plan->Steps, Step);
+}
+
+// NOTE: Operands of other operators below Grain are evaluated in place, a long chain of comparisons
+// would otherwise make a task of every single right operand
+static void planPushOperand(eval_plan *Plan, plan_frame **Frames, expression *Node) {
+    if(expressionSourceSize(Node) < Plan->Grain) {
+        plan_frame Frame = {.Type = Frame_Step, .Step = {.Type = Plan_Node, .Node = Node}};
+        bufPush(*Frames, Frame);
+    } else {
+        plan_frame Frame = {.Type = Frame_Node, .Node = Node};
+        bufPush(*Frames, Frame);
+    }
+}
+
+// NOTE: Flattens the chain below Node, with an explicit stack since a left-leaning chain is as deep
+// as it is long
+static plan_chain planFlattenChain(expression *Node, token_type Op) {
+    plan_chain Chain = {.Op = Op};
+    chain_term *Pending = 0;
+    chain_term Root = {Node, false};
+    bufPush(Pending, Root);
+
+    while(bufLength(Pending)) {
+        chain_term Term = Pending[--bufHeader_(Pending)->Length];
+        if(chainOperator(Term.Node) == Op) {
+            chain_term Rhs = {Term.Node->Binary.Rhs, Term.Negate ^ (Term.Node->Binary.Op == Token_Subtract)};
+            chain_term Lhs = {Term.Node->Binary.Lhs, Term.Negate};
+            bufPush(Pending, Rhs);
+            bufPush(Pending, Lhs);
+        } else {
+            bufPush(Chain.Operands, Term);
+        }
+    }
+
+    bufFree(Pending);
+    return Chain;
+}
+
+// NOTE: Groups the operands of Chain into tasks until one is large enough to be planned on its
+// own, that one is pushed to Frames after Chain itself so it is planned first. Returns true once
+// every operand is planned.
+static bool planChainOperands(eval_plan *Plan, plan_chain *Chain, plan_frame **Frames) {
+    while(Chain->Next < bufLength(Chain->Operands)) {
+        chain_term Term = Chain->Operands[Chain->Next++];
+        if(expressionSourceSize(Term.Node) >= Plan->Grain) {
+            // NOTE: Large operands become plans of their own, after the small ones before them
+            planPushTask(Plan, Chain->Op, Chain->First);
+            Chain->Count += bufLength(Plan->Terms) > Chain->First;
+            ++Chain->Count;
+
+            plan_frame Resume = {.Type = Frame_Chain};
+            bufPush(*Frames, Resume);
+            if(Term.Negate) {
+                plan_frame Negate = {.Type = Frame_Step, .Step = {.Type = Plan_Unary, .Op = Token_UnaryMinus}};
+                bufPush(*Frames, Negate);
+            }
+            plan_frame Operand = {.Type = Frame_Node, .Node = Term.Node};
+            bufPush(*Frames, Operand);
+            return false;
+        }
+
+        bufPush(Plan->Terms, Term);
+        Chain->Pushed += expressionSourceSize(Term.Node);
+        if(Chain->Pushed >= Plan->Grain) {
+            planPushTask(Plan, Chain->Op, Chain->First);
+            ++Chain->Count;
+            Chain->First = bufLength(Plan->Terms);
+            Chain->Pushed = 0;
+        }
+    }
+
+    planPushTask(Plan, Chain->Op, Chain->First);
+    Chain->Count += bufLength(Plan->Terms) > Chain->First;
+    plan_step Step = {.Type = Plan_Chain, .Op = Chain->Op, .Index = Chain->Count};
+    bufPush(Plan->Steps, Step);
+    return true;
+}
+
+// NOTE: Iterative, the tree below a node that is not a chain may be as deep as the source is long
+static void planExpression(eval_plan *Plan, expression *Root) {
+    plan_frame *Frames = 0;
+    plan_chain *Chains = 0;
+    plan_frame First = {.Type = Frame_Node, .Node = Root};
+    bufPush(Frames, First);
+
+    while(bufLength(Frames)) {
+        plan_frame Frame = Frames[--bufHeader_(Frames)->Length];
+        if(Frame.Type == Frame_Step) {
+            bufPush(Plan->Steps, Frame.Step);
+            continue;
+        }
+
+        if(Frame.Type == Frame_Chain) {
+            // NOTE: Back from a large operand, its terms are in tasks of its own
+            plan_chain *Chain = Chains + bufLength(Chains) - 1;
+            Chain->First = bufLength(Plan->Terms);
+            Chain->Pushed = 0;
+            if(planChainOperands(Plan, Chain, &Frames)) {
+                bufFree(Chain->Operands);
+                --bufHeader_(Chains)->Length;
+            }
+            continue;
+        }
+
+        expression *Node = Frame.Node;
+        token_type Op = chainOperator(Node);
+        if(expressionSourceSize(Node) < 2*Plan->Grain ||
+           (Op == Token_Unknown && Node->Type != Expression_Binary && Node->Type != Expression_Unary))
+        {
+            chain_term Term = {Node, false};
+            bufPush(Plan->Terms, Term);
+            planPushTask(Plan, Token_Add, bufLength(Plan->Terms) - 1);
+        } else if(Op != Token_Unknown) {
+            plan_chain Chain = planFlattenChain(Node, Op);
+            Chain.First = bufLength(Plan->Terms);
+            bufPush(Chains, Chain);
+            if(planChainOperands(Plan, Chains + bufLength(Chains) - 1, &Frames)) {
+                bufFree(Chains[bufLength(Chains) - 1].Operands);
+                --bufHeader_(Chains)->Length;
+            }
+        } else if(Node->Type == Expression_Unary) {
+            plan_frame Step = {.Type = Frame_Step, .Step = {.Type = Plan_Unary, .Op = Node->Unary.Op}};
+            bufPush(Frames, Step);
+            planPushOperand(Plan, &Frames, Node->Unary.Expr);
+        } else {
+            // NOTE: Pushed in reverse, Lhs is planned first
+            plan_frame Step = {.Type = Frame_Step, .Step = {.Type = Plan_Binary, .Op = Node->Binary.Op}};
+            bufPush(Frames, Step);
+            planPushOperand(Plan, &Frames, Node->Binary.Rhs);
+            planPushOperand(Plan, &Frames, Node->Binary.Lhs);
+        }
+    }
+
+    assert(!bufLength(Chains));
+    bufFree(Chains);
+    bufFree(Frames);
+}
+
+static void evaluateTask(void *Data, size_t Index) {
+    eval_plan *Plan = Data;
+    eval_task *Task = Plan->Tasks + Index;
+    chain_term *Terms = Plan->Terms + Task->First;
+
+    bool Trapped = false;
+    int32_t Value = 0;
+    for(size_t Term = 0; Term < Task->Count; ++Term) {
+        int32_t Operand = expressionEvaluate(Terms[Term].Node, Plan->Params, &Trapped);
+        if(Terms[Term].Negate) {
+            Operand = evaluateUnary(Token_UnaryMinus, Operand);
+        }
+        Value = Term ? evaluateBinary(Task->Op, Value, Operand, &Trapped) : Operand;
+    }
+
+    Task->Value = Value;
+    Task->Trapped = Trapped;
+}
+
+// NOTE: Same result and *Trapped as expressionEvaluate(), below 2*Grain source bytes it is just
+// that. Pool may be null, the tasks then run on the calling thread, which still avoids recursing
+// once per operator of a long chain. Trees without source spans are evaluated sequentially.
+static int32_t expressionEvaluateParallel(thread_pool *Pool, expression *Node, int32_t *Params, size_t Grain,
+                                          bool *Trapped)
+{
+    int ThreadCount = Pool ? Pool->ThreadCount : 1;
+    size_t Size = expressionSourceSize(Node);
+    Grain = max(Grain, min(Size/(ThreadCount*ParallelTasksPerThread), ParallelMaxGrain));
+    if(Size < 2*Grain) {
+        return expressionEvaluate(Node, Params, Trapped);
+    }
+
+    eval_plan Plan = {.Params = Params, .Grain = max(Grain, 1)};
+    planExpression(&Plan, Node);
+    threadPoolRun(Pool, evaluateTask, &Plan, bufLength(Plan.Tasks));
+
+    int32_t *Stack = 0;
+    for(plan_step *Step = Plan.Steps; Step != bufEnd(Plan.Steps); ++Step) {
+        switch(Step->Type) {
+            case Plan_Task: {
+                *Trapped |= Plan.Tasks[Step->Index].Trapped;
+                bufPush(Stack, Plan.Tasks[Step->Index].Value);
+            } break;
+
+            case Plan_Node: {
+                bufPush(Stack, expressionEvaluate(Step->Node, Params, Trapped));
+            } break;
+
+            case Plan_Unary: {
+                int32_t *Top = Stack + bufLength(Stack) - 1;
+                *Top = evaluateUnary(Step->Op, *Top);
+            } break;
+
+            case Plan_Binary: {
+                int32_t Rhs = Stack[--bufHeader_(Stack)->Length];
+                int32_t *Top = Stack + bufLength(Stack) - 1;
+                *Top = evaluateBinary(Step->Op, *Top, Rhs, Trapped);
+            } break;
+
+            case Plan_Chain: {
+                size_t Base = bufLength(Stack) - Step->Index;
+                for(size_t Operand = Base + 1; Operand < bufLength(Stack); ++Operand) {
+                    Stack[Base] = evaluateBinary(Step->Op, Stack[Base], Stack[Operand], Trapped);
+                }
+                bufHeader_(Stack)->Length = Base + 1;
+            } break;
+        }
+    }
+
+    assert(bufLength(Stack) == 1);
+    int32_t Result = Stack[0];
+
+    bufFree(Stack);
+    bufFree(Plan.Steps);
+    bufFree(Plan.Tasks);
+    bufFree(Plan.Terms);
+    return Result;
+}
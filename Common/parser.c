@@ -0,0 +1,333 @@
+// Requires lexer.c and memory.c.
+
+// AST
+typedef enum expression_type {
+    Expression_Int,
+    Expression_Param,
+    Expression_Lut,
+    Expression_Unary,
+    Expression_Binary,
+    Expression_Select,
+} expression_type;
+
+typedef struct expression {
+    expression_type Type;
+    union {
+        // NOTE: Literals only go past 32 bits in trees parsed for --wide
+        uint64_t IntValue;
+
+        // NOTE: Bit I of the table index is bit Bits[I] of parameter Params[I]
+        struct {
+            int BitCount;
+            uint8_t Params[MaxLutBits];
+            uint8_t Bits[MaxLutBits];
+            int32_t *Table;
+        } Lut;
+
+        struct {
+            token_type Op;
+            struct expression *Expr;
+        } Unary;
+
+        struct {
+            token_type Op;
+            struct expression *Lhs;
+            struct expression *Rhs;
+        } Binary;
+
+        // NOTE: Cond ? Then : Else, both arms are always evaluated
+        struct {
+            struct expression *Cond;
+            struct expression *Then;
+            struct expression *Else;
+        } Select;
+    };
+
+    // NOTE: Source text the node was parsed from, including enclosing parentheses
+    source_span Span;
+} expression;
+
+static expression *expressionNew(arena *Arena, expression_type Type) {
+    expression *Result = arenaAlloc(Arena, sizeof(*Result));
+    Result->Type = Type;
+    Result->Span = (source_span){};
+    return Result;
+}
+
+static expression *expressionIntNew(arena *Arena, uint32_t Value) {
+    expression *Result = expressionNew(Arena, Expression_Int);
+    Result->IntValue = Value;
+    return Result;
+}
+
+static expression *expressionParamNew(arena *Arena, uint32_t Index) {
+    expression *Result = expressionNew(Arena, Expression_Param);
+    Result->IntValue = Index;
+    return Result;
+}
+
+static expression *expressionUnaryNew(arena *Arena, token_type Op, expression *Expr) {
+    expression *Result = expressionNew(Arena, Expression_Unary);
+    Result->Unary.Op = Op;
+    Result->Unary.Expr = Expr;
+    return Result;
+}
+
+static expression *expressionBinaryNew(arena *Arena, token_type Op, expression *Lhs, expression *Rhs) {
+    expression *Result = expressionNew(Arena, Expression_Binary);
+    Result->Binary.Op = Op;
+    Result->Binary.Lhs = Lhs;
+    Result->Binary.Rhs = Rhs;
+    return Result;
+}
+
+static expression *expressionSelectNew(arena *Arena, expression *Cond, expression *Then, expression *Else) {
+    expression *Result = expressionNew(Arena, Expression_Select);
+    Result->Select.Cond = Cond;
+    Result->Select.Then = Then;
+    Result->Select.Else = Else;
+    return Result;
+}
+
+
+// NOTE: One past the highest parameter index used by the expression
+static int expressionParamCount(expression *Node) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            return 0;
+        } break;
+
+        case Expression_Param: {
+            return Node->IntValue + 1;
+        } break;
+
+        case Expression_Lut: {
+            int Result = 0;
+            for(int Bit = 0; Bit < Node->Lut.BitCount; ++Bit) {
+                Result = max(Result, Node->Lut.Params[Bit] + 1);
+            }
+            return Result;
+        } break;
+
+        case Expression_Unary: {
+            return expressionParamCount(Node->Unary.Expr);
+        } break;
+
+        case Expression_Binary: {
+            int Lhs = expressionParamCount(Node->Binary.Lhs);
+            int Rhs = expressionParamCount(Node->Binary.Rhs);
+            return max(Lhs, Rhs);
+        } break;
+
+        case Expression_Select: {
+            int Cond = expressionParamCount(Node->Select.Cond);
+            int Then = expressionParamCount(Node->Select.Then);
+            int Else = expressionParamCount(Node->Select.Else);
+            return max(Cond, max(Then, Else));
+        } break;
+    }
+
+    return 0;
+}
+
+
+// Parser
+typedef enum operator_assoc {
+    Assoc_Left,
+    Assoc_Right,
+} operator_assoc;
+
+typedef enum operator_kind {
+    Operator_NoOp,
+    Operator_Unary,
+    Operator_Binary,
+    Operator_Builtin,
+    // NOTE: The ? of Cond ? Then : Else
+    Operator_Select,
+} operator_kind;
+
+typedef struct operator {
+    operator_kind Kind;
+    int Precedence;
+    operator_assoc Associativity;
+    // NOTE: Arguments of a builtin
+    int Arity;
+} operator;
+
+static operator Table[Token_Count] = {
+    [Token_Question]   = {Operator_Select, 0, Assoc_Right},
+
+    [Token_Less]       = {Operator_Binary, 1, Assoc_Left},
+    [Token_LessEqual]  = {Operator_Binary, 1, Assoc_Left},
+    [Token_Equal]      = {Operator_Binary, 1, Assoc_Left},
+    [Token_NotEqual]   = {Operator_Binary, 1, Assoc_Left},
+
+    [Token_Add]        = {Operator_Binary, 2, Assoc_Left},
+    [Token_Subtract]   = {Operator_Binary, 2, Assoc_Left},
+    [Token_BitOr]      = {Operator_Binary, 2, Assoc_Left},
+    [Token_BitXor]     = {Operator_Binary, 2, Assoc_Left},
+
+    [Token_Multiply]   = {Operator_Binary, 3, Assoc_Left},
+    [Token_Divide]     = {Operator_Binary, 3, Assoc_Left},
+    [Token_Mod]        = {Operator_Binary, 3, Assoc_Left},
+    [Token_LShift]     = {Operator_Binary, 3, Assoc_Left},
+    [Token_RShift]     = {Operator_Binary, 3, Assoc_Left},
+    [Token_BitAnd]     = {Operator_Binary, 3, Assoc_Left},
+
+    [Token_Power]      = {Operator_Binary, 4, Assoc_Right},
+
+    [Token_UnaryPlus]  = {Operator_Unary,  5, Assoc_Right},
+    [Token_UnaryMinus] = {Operator_Unary,  5, Assoc_Right},
+    [Token_BitNot]     = {Operator_Unary,  5, Assoc_Right},
+
+    [Token_Popcount]   = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Clz]        = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Ctz]        = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Bswap]      = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Rotl]       = {Operator_Builtin, 0, Assoc_Left, 2},
+    [Token_Rotr]       = {Operator_Builtin, 0, Assoc_Left, 2},
+    [Token_Pdep]       = {Operator_Builtin, 0, Assoc_Left, 2},
+    [Token_Pext]       = {Operator_Builtin, 0, Assoc_Left, 2},
+};
+
+static bool isBinaryOp(lexer *Lexer) {
+    return Table[Lexer->Token.Type].Kind == Operator_Binary;
+}
+
+static bool isUnaryOp(lexer *Lexer) {
+    if(Lexer->Token.Type == Token_Add) {
+        Lexer->Token.Type = Token_UnaryPlus;
+    }
+    else if(Lexer->Token.Type == Token_Subtract) {
+        Lexer->Token.Type = Token_UnaryMinus;
+    }
+    return Table[Lexer->Token.Type].Kind == Operator_Unary;
+}
+
+static expression *parse(lexer *Lexer, arena *Arena, int Precedence);
+
+static expression *parseUnary(lexer *Lexer, arena *Arena) {
+    expression *Result = 0;
+
+    source_span Span = Lexer->Token.Span;
+
+    if(isUnaryOp(Lexer)) {
+        token_type Op = Lexer->Token.Type;
+
+        nextToken(Lexer);
+        Result = expressionUnaryNew(Arena, Op, parse(Lexer, Arena, Table[Op].Precedence));
+        Result->Span = (source_span){Span.Start, Result->Unary.Expr->Span.End};
+    }
+    else if(matchToken(Lexer, Token_LParen)) {
+        Result = parse(Lexer, Arena, 0);
+        Result->Span = (source_span){Span.Start, Lexer->Token.Span.End};
+        expectToken(Lexer, Token_RParen);
+    }
+    else if(Table[Lexer->Token.Type].Kind == Operator_Builtin) {
+        token_type Op = Lexer->Token.Type;
+
+        nextToken(Lexer);
+        expectToken(Lexer, Token_LParen);
+        expression *Arg = parse(Lexer, Arena, 0);
+        if(Table[Op].Arity == 2) {
+            expectToken(Lexer, Token_Comma);
+            Result = expressionBinaryNew(Arena, Op, Arg, parse(Lexer, Arena, 0));
+        } else {
+            Result = expressionUnaryNew(Arena, Op, Arg);
+        }
+        Result->Span = (source_span){Span.Start, Lexer->Token.Span.End};
+        expectToken(Lexer, Token_RParen);
+    }
+    else if(Lexer->Token.Type == Token_Int) {
+        Result = expressionNew(Arena, Expression_Int);
+        Result->IntValue = Lexer->Token.IntValue;
+        Result->Span = Span;
+        nextToken(Lexer);
+    }
+    else if(Lexer->Token.Type == Token_Param) {
+        Result = expressionParamNew(Arena, Lexer->Token.IntValue);
+        Result->Span = Span;
+        nextToken(Lexer);
+    }
+    else {
+        lexerFatal(Lexer, Error_UnexpectedToken);
+    }
+
+    return Result;
+}
+
+// NOTE: Raises the nesting depth of Lexer by one level, see lexer.MaxDepth
+static void parseDescend(lexer *Lexer) {
+    if(++Lexer->Depth > Lexer->MaxDepth && Lexer->MaxDepth) {
+        lexerFatal(Lexer, Error_TooDeep);
+    }
+}
+
+static expression *parse(lexer *Lexer, arena *Arena, int Precedence) {
+    int Depth = Lexer->Depth;
+    parseDescend(Lexer);
+    expression *Result = parseUnary(Lexer, Arena);
+
+    while(Table[Lexer->Token.Type].Precedence >= Precedence &&
+          (Lexer->Token.Type != Token_EOF && Lexer->Token.Type != Token_RParen &&
+           Lexer->Token.Type != Token_Comma && Lexer->Token.Type != Token_Colon))
+    {
+        parseDescend(Lexer);
+        if(matchToken(Lexer, Token_Question)) {
+            expression *Then = parse(Lexer, Arena, 0);
+            expectToken(Lexer, Token_Colon);
+            expression *Else = parse(Lexer, Arena, Table[Token_Question].Precedence);
+
+            Result = expressionSelectNew(Arena, Result, Then, Else);
+            Result->Span = (source_span){Result->Select.Cond->Span.Start, Else->Span.End};
+            continue;
+        }
+
+        if(!isBinaryOp(Lexer)) {
+            lexerFatal(Lexer, Error_MissingOperator);
+        }
+
+        token_type Op = Lexer->Token.Type;
+
+        nextToken(Lexer);
+        expression *Rhs;
+        if(Table[Op].Associativity == Assoc_Left) {
+            Rhs = parse(Lexer, Arena, Table[Op].Precedence + 1);
+        } else {
+            assert(Table[Op].Associativity == Assoc_Right);
+            Rhs = parse(Lexer, Arena, Table[Op].Precedence);
+        }
+
+        Result = expressionBinaryNew(Arena, Op, Result, Rhs);
+        Result->Span = (source_span){Result->Binary.Lhs->Span.Start, Rhs->Span.End};
+    }
+
+    Lexer->Depth = Depth;
+    return Result;
+}
+
+// NOTE: Parses a whole source string, which must be fully consumed
+static expression *parseExpression(lexer *Lexer, arena *Arena, char *Source) {
+    lexerInit(Lexer, Source);
+    expression *Result = parse(Lexer, Arena, 0);
+    if(Lexer->Token.Type != Token_EOF) {
+        lexerFatal(Lexer, Error_UnexpectedToken);
+    }
+
+    return Result;
+}
+
+// NOTE: Never prints or exits, returns 0 with the error recorded in Lexer instead. Lexer and Arena
+// live in the caller's frame, so they stay valid after the longjmp.
+static expression *tryParseExpression(lexer *Lexer, arena *Arena, char *Source) {
+    jmp_buf OnError;
+    Lexer->OnError = &OnError;
+    if(setjmp(OnError)) {
+        Lexer->OnError = 0;
+        return 0;
+    }
+
+    expression *Result = parseExpression(Lexer, Arena, Source);
+    Lexer->OnError = 0;
+    return Lexer->Error == Error_None ? Result : 0;
+}
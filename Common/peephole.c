@@ -0,0 +1,255 @@
+// Bytecode peephole pass driven by the rewrite database in rewrites.inc, which superopt fills.
+//
+// Requires stretchy.c, vm.c and -pthread.
+//
+// A rule replaces a straight-line instruction sequence that takes Inputs values from the stack and
+// leaves one value with a cheaper sequence computing the same value, trapping exactly when it does.
+// Sequences are written as mnemonics separated by spaces. ARG $K matches any parameter and LIT #K
+// any literal, the same K the same one every time it appears, LIT N only the literal N. The
+// replacement refers back to them. Rules hold for every value on the stack and every parameter
+// and literal, so a match anywhere in a valid program can be replaced.
+
+enum {
+    PeepholeMaxLength = 16,
+    PeepholeMaxBindings = 8,
+};
+
+typedef struct peephole_insn {
+    mnemonic Op;
+    // NOTE: LIT value or ARG index, the placeholder number in a pattern if Placeholder is set
+    int32_t Value;
+    bool Placeholder;
+    // NOTE: Encoding of LUT, which is copied as is
+    uint8_t *Bytes;
+    size_t Size;
+} peephole_insn;
+
+typedef struct peephole_rule {
+    int Inputs;
+    char *From;
+    char *To;
+    int FromCount;
+    int ToCount;
+    peephole_insn From_[PeepholeMaxLength];
+    peephole_insn To_[PeepholeMaxLength];
+} peephole_rule;
+
+#define Rewrite(InputCount, FromText, ToText) {.Inputs = InputCount, .From = FromText, .To = ToText},
+static peephole_rule PeepholeRules[] = {
+#include <rewrites.inc>
+};
+#undef Rewrite
+
+// NOTE: The rules are parsed in place once per process, whichever thread optimizes first does it
+// while the others wait
+static pthread_once_t PeepholeParsed = PTHREAD_ONCE_INIT;
+
+// NOTE: Returns the instruction count, -1 when Text is not a valid sequence
+static int peepholeParse(char *Text, peephole_insn *Insns) {
+    int Count = 0;
+    for(char *At = Text; *At;) {
+        if(*At == ' ') {
+            ++At;
+            continue;
+        }
+
+        char *Start = At;
+        while(*At && *At != ' ') {
+            ++At;
+        }
+
+        int Op = 0;
+        while(Op < 256 && !(MnemonicNames[Op] && strlen(MnemonicNames[Op]) == (size_t)(At - Start) &&
+                            memcmp(MnemonicNames[Op], Start, At - Start) == 0))
+        {
+            ++Op;
+        }
+        if(Op == 256 || Op == HALT || Op == LUT || Op == MODP || Count == PeepholeMaxLength) {
+            return -1;
+        }
+
+        peephole_insn *Insn = Insns + Count++;
+        *Insn = (peephole_insn){.Op = Op};
+        if(Op == ARG || Op == LIT) {
+            while(*At == ' ') {
+                ++At;
+            }
+            char Sigil = Op == ARG ? '$' : '#';
+            Insn->Placeholder = *At == Sigil;
+            At += Insn->Placeholder;
+
+            char *End;
+            long Value = strtol(At, &End, 0);
+            if(End == At || (Op == ARG && !Insn->Placeholder) ||
+               (Insn->Placeholder && (Value < 0 || Value >= PeepholeMaxBindings)))
+            {
+                return -1;
+            }
+            Insn->Value = (int32_t)Value;
+            At = End;
+        }
+    }
+
+    return Count;
+}
+
+static size_t peepholeBytes(peephole_insn *Insns, int Count) {
+    size_t Bytes = 0;
+    for(int Index = 0; Index < Count; ++Index) {
+        Bytes += Insns[Index].Op == LIT ? 5 : Insns[Index].Op == ARG ? 2 : 1;
+    }
+    return Bytes;
+}
+
+// NOTE: Fewer instructions, or as many in fewer bytes. Every rewrite makes the program cheaper,
+// which is what makes the pass terminate.
+static bool peepholeCheaper(peephole_insn *Insns, int Count, peephole_insn *Than, int ThanCount) {
+    return Count < ThanCount || (Count == ThanCount && peepholeBytes(Insns, Count) < peepholeBytes(Than, ThanCount));
+}
+
+static void peepholeInitOnce(void) {
+    for(int Index = 0; Index < (int)arrayCount(PeepholeRules); ++Index) {
+        peephole_rule *Rule = PeepholeRules + Index;
+        Rule->FromCount = peepholeParse(Rule->From, Rule->From_);
+        Rule->ToCount = peepholeParse(Rule->To, Rule->To_);
+        if(Rule->FromCount <= 0 || Rule->ToCount < 0 ||
+           !peepholeCheaper(Rule->To_, Rule->ToCount, Rule->From_, Rule->FromCount))
+        {
+            fatalError("Invalid rewrite rule \"%s\" => \"%s\"", Rule->From, Rule->To);
+        }
+    }
+}
+
+static void peepholeInit(void) {
+    pthread_once(&PeepholeParsed, peepholeInitOnce);
+}
+
+// NOTE: Decodes instructions up to and including the first HALT of a validated program
+static peephole_insn *peepholeDecode(uint8_t *Code) {
+    peephole_insn *Insns = 0;
+    for(;;) {
+        peephole_insn Insn = {.Op = *Code, .Bytes = Code, .Size = 1};
+        if(Insn.Op == LIT) {
+            Insn.Value = (int32_t)((uint32_t)Code[1] | (uint32_t)Code[2] << 8 | (uint32_t)Code[3] << 16 |
+                                   (uint32_t)Code[4] << 24);
+            Insn.Size = 5;
+        } else if(Insn.Op == ARG) {
+            Insn.Value = Code[1];
+            Insn.Size = 2;
+        } else if(Insn.Op == LUT) {
+            Insn.Size = 2 + 2*Code[1] + (4u << Code[1]);
+        }
+
+        bufPush(Insns, Insn);
+        if(Insn.Op == HALT) {
+            return Insns;
+        }
+        Code += Insn.Size;
+    }
+}
+
+static void peepholeEncode(uint8_t **Code, peephole_insn *Insns, size_t Count) {
+    for(size_t Index = 0; Index < Count; ++Index) {
+        peephole_insn *Insn = Insns + Index;
+        bufPush(*Code, Insn->Op);
+        if(Insn->Op == LIT) {
+            for(int Byte = 0; Byte < 4; ++Byte) {
+                bufPush(*Code, (uint32_t)Insn->Value >> 8*Byte);
+            }
+        } else if(Insn->Op == ARG) {
+            bufPush(*Code, Insn->Value);
+        } else if(Insn->Op == LUT) {
+            for(size_t Byte = 1; Byte < Insn->Size; ++Byte) {
+                bufPush(*Code, Insn->Bytes[Byte]);
+            }
+        }
+    }
+}
+
+typedef struct peephole_bindings {
+    bool Bound[2][PeepholeMaxBindings];
+    int32_t Value[2][PeepholeMaxBindings];
+} peephole_bindings;
+
+static bool peepholeMatch(peephole_rule *Rule, peephole_insn *Insns, size_t Count, peephole_bindings *Bindings) {
+    if(Count < (size_t)Rule->FromCount) {
+        return false;
+    }
+
+    *Bindings = (peephole_bindings){};
+    for(int Index = 0; Index < Rule->FromCount; ++Index) {
+        peephole_insn *Pattern = Rule->From_ + Index;
+        peephole_insn *Insn = Insns + Index;
+        if(Insn->Op != Pattern->Op) {
+            return false;
+        }
+
+        if(Pattern->Placeholder) {
+            int Kind = Pattern->Op == LIT;
+            if(Bindings->Bound[Kind][Pattern->Value] && Bindings->Value[Kind][Pattern->Value] != Insn->Value) {
+                return false;
+            }
+            Bindings->Bound[Kind][Pattern->Value] = true;
+            Bindings->Value[Kind][Pattern->Value] = Insn->Value;
+        } else if(Pattern->Op == LIT && Insn->Value != Pattern->Value) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// NOTE: Applies the rules until none matches, longer matches first at every position. Code must be
+// a validated, HALT terminated program, it is replaced by the rewritten one. Returns the number
+// of rewrites.
+static int peepholeOptimize(uint8_t **Code) {
+    peepholeInit();
+
+    peephole_insn *Insns = peepholeDecode(*Code);
+    int Rewrites = 0;
+    for(size_t At = 0; At < bufLength(Insns);) {
+        peephole_rule *Best = 0;
+        peephole_bindings Bindings, BestBindings;
+        for(int Index = 0; Index < (int)arrayCount(PeepholeRules); ++Index) {
+            peephole_rule *Rule = PeepholeRules + Index;
+            if((!Best || Rule->FromCount > Best->FromCount) &&
+               peepholeMatch(Rule, Insns + At, bufLength(Insns) - At, &Bindings))
+            {
+                Best = Rule;
+                BestBindings = Bindings;
+            }
+        }
+
+        if(!Best) {
+            ++At;
+            continue;
+        }
+
+        peephole_insn Replacement[PeepholeMaxLength];
+        for(int Index = 0; Index < Best->ToCount; ++Index) {
+            Replacement[Index] = Best->To_[Index];
+            if(Replacement[Index].Placeholder) {
+                int Kind = Replacement[Index].Op == LIT;
+                Replacement[Index].Value = BestBindings.Value[Kind][Replacement[Index].Value];
+                Replacement[Index].Placeholder = false;
+            }
+        }
+
+        // NOTE: Replacements are never longer, so the buffer only shrinks
+        size_t Tail = bufLength(Insns) - At - Best->FromCount;
+        memmove(Insns + At + Best->ToCount, Insns + At + Best->FromCount, Tail*sizeof(*Insns));
+        memcpy(Insns + At, Replacement, Best->ToCount*sizeof(*Insns));
+        bufHeader_(Insns)->Length -= Best->FromCount - Best->ToCount;
+        ++Rewrites;
+
+        // NOTE: The replacement can complete a match that starts a little earlier
+        At = At > PeepholeMaxLength ? At - PeepholeMaxLength : 0;
+    }
+
+    uint8_t *Result = 0;
+    peepholeEncode(&Result, Insns, bufLength(Insns));
+    bufFree(Insns);
+    bufFree(*Code);
+    *Code = Result;
+    return Rewrites;
+}
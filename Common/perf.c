@@ -0,0 +1,232 @@
+// Hardware performance counters per pipeline phase, behind the --perf-counters option.
+//
+// Every counter is opened on its own rather than as a group, so one event the CPU or the
+// container does not allow only blanks its column. When the kernel multiplexes counters the
+// values are scaled by the fraction of time they were running.
+
+typedef enum perf_phase {
+    Phase_Lex,
+    Phase_Parse,
+    Phase_Emit,
+    Phase_Load,
+    Phase_Execute,
+
+    Phase_Count
+} perf_phase;
+
+typedef enum perf_counter {
+    Counter_Cycles,
+    Counter_Instructions,
+    Counter_BranchMisses,
+    Counter_L1dMisses,
+    Counter_LlcMisses,
+    Counter_ItlbMisses,
+
+    Counter_Count
+} perf_counter;
+
+static char *PhaseNames[Phase_Count] = {
+    [Phase_Lex]     = "lex",
+    [Phase_Parse]   = "parse",
+    [Phase_Emit]    = "emit",
+    [Phase_Load]    = "load",
+    [Phase_Execute] = "execute",
+};
+
+static char *CounterNames[Counter_Count] = {
+    [Counter_Cycles]       = "cycles",
+    [Counter_Instructions] = "instructions",
+    [Counter_BranchMisses] = "branch-misses",
+    [Counter_L1dMisses]    = "L1d-misses",
+    [Counter_LlcMisses]    = "LLC-misses",
+    [Counter_ItlbMisses]   = "iTLB-misses",
+};
+
+#define cacheEvent(Cache, Result) \
+    ((Cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((Result) << 16))
+
+static struct {
+    uint32_t Type;
+    uint64_t Config;
+} CounterEvents[Counter_Count] = {
+    [Counter_Cycles]       = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [Counter_Instructions] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [Counter_BranchMisses] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [Counter_L1dMisses]    = {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    [Counter_LlcMisses]    = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [Counter_ItlbMisses]   = {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_ITLB, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+};
+
+typedef enum perf_format {
+    PerfFormat_None,
+    PerfFormat_Table,
+    PerfFormat_Json,
+} perf_format;
+
+typedef struct perf_state {
+    perf_format Format;
+    int Files[Counter_Count];
+    int OpenError;
+
+    // NOTE: A phase may run several times, its totals add up
+    double Start[Phase_Count][Counter_Count];
+    double StartTime[Phase_Count];
+    double Totals[Phase_Count][Counter_Count];
+    double Seconds[Phase_Count];
+    bool Used[Phase_Count];
+} perf_state;
+
+static perf_state Perf;
+
+// NOTE: Accepts --perf-counters and --perf-counters=json|table, returns false for other arguments
+static bool perfParseOption(char *Arg) {
+    if(strcmp(Arg, "--perf-counters") == 0 || strcmp(Arg, "--perf-counters=table") == 0) {
+        Perf.Format = PerfFormat_Table;
+        return true;
+    }
+    if(strcmp(Arg, "--perf-counters=json") == 0) {
+        Perf.Format = PerfFormat_Json;
+        return true;
+    }
+
+    return false;
+}
+
+static double perfSeconds(void) {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return Time.tv_sec + Time.tv_nsec*1e-9;
+}
+
+static void perfInit(void) {
+    for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+        Perf.Files[Counter] = -1;
+        if(!Perf.Format) {
+            continue;
+        }
+
+        struct perf_event_attr Attr = {
+            .size = sizeof(Attr),
+            .type = CounterEvents[Counter].Type,
+            .config = CounterEvents[Counter].Config,
+            .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+            // NOTE: Required when perf_event_paranoid is 2, and the kernel side is not ours anyway
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+        };
+
+        long File = syscall(SYS_perf_event_open, &Attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if(File < 0) {
+            Perf.OpenError = errno;
+        } else {
+            Perf.Files[Counter] = File;
+        }
+    }
+}
+
+// NOTE: Scaled value, or NAN when the counter is unavailable or never got scheduled
+static double perfRead(int Counter) {
+    uint64_t Values[3];
+    if(Perf.Files[Counter] < 0 || read(Perf.Files[Counter], Values, sizeof(Values)) != sizeof(Values) || !Values[2]) {
+        return NAN;
+    }
+
+    return Values[2] == Values[1] ? (double)Values[0] : Values[0]*((double)Values[1]/Values[2]);
+}
+
+static void perfBegin(perf_phase Phase) {
+    if(!Perf.Format) {
+        return;
+    }
+
+    Perf.Used[Phase] = true;
+    Perf.StartTime[Phase] = perfSeconds();
+    for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+        Perf.Start[Phase][Counter] = perfRead(Counter);
+    }
+}
+
+static void perfEnd(perf_phase Phase) {
+    if(!Perf.Format) {
+        return;
+    }
+
+    for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+        Perf.Totals[Phase][Counter] += perfRead(Counter) - Perf.Start[Phase][Counter];
+    }
+    Perf.Seconds[Phase] += perfSeconds() - Perf.StartTime[Phase];
+}
+
+static void perfReport(void) {
+    if(!Perf.Format) {
+        return;
+    }
+
+    bool Any = false;
+    for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+        Any |= Perf.Files[Counter] >= 0;
+    }
+
+    if(Perf.Format == PerfFormat_Json) {
+        fprintf(stderr, "{\"available\": %s, \"phases\": [", Any ? "true" : "false");
+        bool First = true;
+        for(int Phase = 0; Phase < Phase_Count; ++Phase) {
+            if(!Perf.Used[Phase]) {
+                continue;
+            }
+
+            fprintf(stderr, "%s\n  {\"phase\": \"%s\", \"seconds\": %.9f", First ? "" : ",", PhaseNames[Phase], Perf.Seconds[Phase]);
+            for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+                double Value = Perf.Totals[Phase][Counter];
+                if(isnan(Value)) {
+                    fprintf(stderr, ", \"%s\": null", CounterNames[Counter]);
+                } else {
+                    fprintf(stderr, ", \"%s\": %.0f", CounterNames[Counter], Value);
+                }
+            }
+            fprintf(stderr, "}");
+            First = false;
+        }
+        fprintf(stderr, "\n]}\n");
+    } else {
+        if(!Any) {
+            fprintf(stderr, "Performance counters unavailable (%s), only wall time is reported.\n",
+                    strerror(Perf.OpenError));
+        }
+
+        fprintf(stderr, "%-8s %12s", "phase", "time (us)");
+        for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+            fprintf(stderr, " %14s", CounterNames[Counter]);
+        }
+        fprintf(stderr, " %6s\n", "IPC");
+
+        for(int Phase = 0; Phase < Phase_Count; ++Phase) {
+            if(!Perf.Used[Phase]) {
+                continue;
+            }
+
+            fprintf(stderr, "%-8s %12.1f", PhaseNames[Phase], Perf.Seconds[Phase]*1e6);
+            for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+                double Value = Perf.Totals[Phase][Counter];
+                if(isnan(Value)) {
+                    fprintf(stderr, " %14s", "n/a");
+                } else {
+                    fprintf(stderr, " %14.0f", Value);
+                }
+            }
+
+            double Ipc = Perf.Totals[Phase][Counter_Instructions]/Perf.Totals[Phase][Counter_Cycles];
+            if(isfinite(Ipc)) {
+                fprintf(stderr, " %6.2f\n", Ipc);
+            } else {
+                fprintf(stderr, " %6s\n", "n/a");
+            }
+        }
+    }
+
+    for(int Counter = 0; Counter < Counter_Count; ++Counter) {
+        if(Perf.Files[Counter] >= 0) {
+            close(Perf.Files[Counter]);
+        }
+    }
+}
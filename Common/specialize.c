@@ -0,0 +1,248 @@
+// Partial evaluation of an expression for some of its parameters.
+//
+// Requires memory.c, bits.c, parser.c and evaluate.c.
+//
+// Bound parameters become constants, which are folded bottom-up with the VM's semantics. Identities
+// with the new constants then remove operations (x & -1, x * 1, x << 0) or whole subtrees (x & 0,
+// x * 0), and multiplications by a power of two become shifts. A subtree is only dropped when it
+// cannot trap, so the specialized program fails on exactly the inputs the generic one fails on.
+// That includes the arm of a select with a constant condition, both arms run in the VM.
+// Signed division by a power of two is no shift and its fixup costs more instructions than DIV,
+// so divisions stay as they are. The rest of the pipeline, idiomRewrite() and lutCompile() in
+// particular, runs on the result as on any other tree and profits from the narrower inputs.
+
+typedef struct specialize_bindings {
+    bool Bound[MaxParamCount];
+    int32_t Values[MaxParamCount];
+} specialize_bindings;
+
+static bool specializeIsInt(expression *Node, int32_t Value) {
+    return Node->Type == Expression_Int && (int32_t)Node->IntValue == Value;
+}
+
+// NOTE: Only division and modulo trap in the VM, and not when the divisor is a constant other
+// than 0 and -1
+static bool specializeCanTrap(expression *Node) {
+    switch(Node->Type) {
+        case Expression_Int:
+        case Expression_Param:
+        case Expression_Lut: {
+            return false;
+        } break;
+
+        case Expression_Unary: {
+            return specializeCanTrap(Node->Unary.Expr);
+        } break;
+
+        case Expression_Binary: {
+            expression *Rhs = Node->Binary.Rhs;
+            if((Node->Binary.Op == Token_Divide || Node->Binary.Op == Token_Mod) &&
+               !(Rhs->Type == Expression_Int && !specializeIsInt(Rhs, 0) && !specializeIsInt(Rhs, -1)))
+            {
+                return true;
+            }
+            return specializeCanTrap(Node->Binary.Lhs) || specializeCanTrap(Rhs);
+        } break;
+
+        case Expression_Select: {
+            return specializeCanTrap(Node->Select.Cond) || specializeCanTrap(Node->Select.Then) ||
+                   specializeCanTrap(Node->Select.Else);
+        } break;
+    }
+
+    return false;
+}
+
+static expression *specializeInt(arena *Arena, expression *Replaced, int32_t Value) {
+    expression *Result = expressionIntNew(Arena, Value);
+    Result->Span = Replaced->Span;
+    return Result;
+}
+
+static expression *specializeUnary(arena *Arena, expression *Replaced, token_type Op, expression *Expr) {
+    expression *Result = expressionUnaryNew(Arena, Op, Expr);
+    Result->Span = Replaced->Span;
+    return Result;
+}
+
+// NOTE: Lhs and Rhs are the specialized operands of Node, which did not fold. Returns the
+// simplified node, or 0 when no identity applies.
+static expression *specializeIdentity(arena *Arena, expression *Node, expression *Lhs, expression *Rhs) {
+    token_type Op = Node->Binary.Op;
+    bool Commutative = Op == Token_Add || Op == Token_Multiply || Op == Token_BitAnd || Op == Token_BitOr ||
+                       Op == Token_BitXor;
+    if(Commutative && Lhs->Type == Expression_Int) {
+        expression *Swap = Lhs;
+        Lhs = Rhs;
+        Rhs = Swap;
+    }
+    if(Rhs->Type != Expression_Int) {
+        // NOTE: 0 - x is the only identity with the constant on the left of a non-commutative operator
+        if(Op == Token_Subtract && specializeIsInt(Lhs, 0)) {
+            return specializeUnary(Arena, Node, Token_UnaryMinus, Rhs);
+        }
+        return 0;
+    }
+
+    int32_t Value = (int32_t)Rhs->IntValue;
+    bool Dead = !specializeCanTrap(Lhs);
+    switch(Op) {
+        case Token_Add:
+        case Token_Subtract:
+        case Token_BitOr:
+        case Token_BitXor:
+        case Token_LShift:
+        case Token_RShift: {
+            if(Value == 0) {
+                return Lhs;
+            }
+            if(Op == Token_BitOr && Value == -1 && Dead) {
+                return Rhs;
+            }
+            if(Op == Token_BitXor && Value == -1) {
+                return specializeUnary(Arena, Node, Token_BitNot, Lhs);
+            }
+        } break;
+
+        case Token_Multiply: {
+            if(Value == 1) {
+                return Lhs;
+            }
+            if(Value == 0 && Dead) {
+                return Rhs;
+            }
+            if(Value == -1) {
+                return specializeUnary(Arena, Node, Token_UnaryMinus, Lhs);
+            }
+            if(bitPopcount(Value) == 1) {
+                expression *Result = expressionBinaryNew(Arena, Token_LShift, Lhs,
+                                                         specializeInt(Arena, Rhs, bitCtz(Value)));
+                Result->Span = Node->Span;
+                return Result;
+            }
+        } break;
+
+        case Token_Divide: {
+            if(Value == 1) {
+                return Lhs;
+            }
+        } break;
+
+        case Token_Mod: {
+            if(Value == 1 && Dead) {
+                return specializeInt(Arena, Node, 0);
+            }
+        } break;
+
+        case Token_BitAnd:
+        case Token_Pdep:
+        case Token_Pext: {
+            if(Value == -1) {
+                return Lhs;
+            }
+            if(Value == 0 && Dead) {
+                return specializeInt(Arena, Node, 0);
+            }
+        } break;
+
+        case Token_Rotl:
+        case Token_Rotr: {
+            if(Value % 32 == 0) {
+                return Lhs;
+            }
+        } break;
+
+        // NOTE: pow() is exact for these, anything else could change what out of range results do
+        case Token_Power: {
+            if(Value == 1) {
+                return Lhs;
+            }
+            if(Value == 0 && Dead) {
+                return specializeInt(Arena, Node, 1);
+            }
+        } break;
+
+        case Token_Less:
+        case Token_LessEqual:
+        case Token_Equal:
+        case Token_NotEqual: {} break;
+
+        InvalidDefaultCase;
+    }
+
+    return 0;
+}
+
+// NOTE: Returns a new tree, Node itself is left as it is. Spans are kept for --debug.
+static expression *specialize(arena *Arena, expression *Node, specialize_bindings *Bindings) {
+    switch(Node->Type) {
+        case Expression_Int:
+        case Expression_Lut: {
+            return Node;
+        } break;
+
+        case Expression_Param: {
+            if(Bindings->Bound[Node->IntValue]) {
+                return specializeInt(Arena, Node, Bindings->Values[Node->IntValue]);
+            }
+            return Node;
+        } break;
+
+        case Expression_Unary: {
+            expression *Expr = specialize(Arena, Node->Unary.Expr, Bindings);
+            if(Expr->Type == Expression_Int) {
+                return specializeInt(Arena, Node, evaluateUnary(Node->Unary.Op, Expr->IntValue));
+            }
+            if(Node->Unary.Op == Token_UnaryPlus) {
+                return Expr;
+            }
+            return Expr == Node->Unary.Expr ? Node : specializeUnary(Arena, Node, Node->Unary.Op, Expr);
+        } break;
+
+        case Expression_Binary: {
+            expression *Lhs = specialize(Arena, Node->Binary.Lhs, Bindings);
+            expression *Rhs = specialize(Arena, Node->Binary.Rhs, Bindings);
+            if(Lhs->Type == Expression_Int && Rhs->Type == Expression_Int) {
+                bool Trapped = false;
+                int32_t Value = evaluateBinary(Node->Binary.Op, Lhs->IntValue, Rhs->IntValue, &Trapped);
+                if(!Trapped) {
+                    return specializeInt(Arena, Node, Value);
+                }
+            }
+
+            expression *Simplified = specializeIdentity(Arena, Node, Lhs, Rhs);
+            if(Simplified) {
+                return Simplified;
+            }
+            if(Lhs == Node->Binary.Lhs && Rhs == Node->Binary.Rhs) {
+                return Node;
+            }
+
+            expression *Result = expressionBinaryNew(Arena, Node->Binary.Op, Lhs, Rhs);
+            Result->Span = Node->Span;
+            return Result;
+        } break;
+
+        case Expression_Select: {
+            expression *Cond = specialize(Arena, Node->Select.Cond, Bindings);
+            expression *Then = specialize(Arena, Node->Select.Then, Bindings);
+            expression *Else = specialize(Arena, Node->Select.Else, Bindings);
+            if(Cond->Type == Expression_Int) {
+                expression *Taken = (int32_t)Cond->IntValue ? Then : Else;
+                expression *Dropped = (int32_t)Cond->IntValue ? Else : Then;
+                if(!specializeCanTrap(Dropped)) {
+                    return Taken;
+                }
+            }
+            if(Cond == Node->Select.Cond && Then == Node->Select.Then && Else == Node->Select.Else) {
+                return Node;
+            }
+
+            expression *Result = expressionSelectNew(Arena, Cond, Then, Else);
+            Result->Span = Node->Span;
+            return Result;
+        } break;
+    }
+
+    return Node;
+}
@@ -0,0 +1,121 @@
+// Fork-join thread pool: every job is a number of independent tasks, claimed one at a time by
+// the workers and the calling thread, and the caller returns once all of them finished.
+//
+// Requires common.c and -pthread.
+
+typedef void thread_task_function(void *Data, size_t Index);
+
+typedef struct thread_pool {
+    int ThreadCount;
+    pthread_t *Threads;
+    pthread_mutex_t Lock;
+    pthread_cond_t JobReady;
+    pthread_cond_t JobDone;
+
+    // NOTE: Current job, workers claim its tasks through NextTask
+    thread_task_function *Function;
+    void *Data;
+    size_t TaskCount;
+    _Atomic size_t NextTask;
+
+    uint64_t Generation;
+    int Busy;
+    bool Quit;
+} thread_pool;
+
+static void threadPoolDrain(thread_pool *Pool, thread_task_function *Function, void *Data) {
+    for(size_t Index; (Index = atomic_fetch_add(&Pool->NextTask, 1)) < Pool->TaskCount;) {
+        Function(Data, Index);
+    }
+}
+
+static void *threadPoolWorker(void *Arg) {
+    thread_pool *Pool = Arg;
+    uint64_t Seen = 0;
+
+    pthread_mutex_lock(&Pool->Lock);
+    for(;;) {
+        while(Pool->Generation == Seen && !Pool->Quit) {
+            pthread_cond_wait(&Pool->JobReady, &Pool->Lock);
+        }
+        if(Pool->Quit) {
+            break;
+        }
+
+        Seen = Pool->Generation;
+        thread_task_function *Function = Pool->Function;
+        void *Data = Pool->Data;
+        pthread_mutex_unlock(&Pool->Lock);
+
+        threadPoolDrain(Pool, Function, Data);
+
+        // NOTE: The next job may only reset NextTask once every worker stopped claiming
+        pthread_mutex_lock(&Pool->Lock);
+        if(--Pool->Busy == 0) {
+            pthread_cond_signal(&Pool->JobDone);
+        }
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+
+    return 0;
+}
+
+// NOTE: ThreadCount includes the calling thread, which works on every job as well
+static void threadPoolInit(thread_pool *Pool, int ThreadCount) {
+    *Pool = (thread_pool){.ThreadCount = max(ThreadCount, 1)};
+    pthread_mutex_init(&Pool->Lock, 0);
+    pthread_cond_init(&Pool->JobReady, 0);
+    pthread_cond_init(&Pool->JobDone, 0);
+
+    Pool->Threads = xMalloc(Pool->ThreadCount*sizeof(pthread_t));
+    for(int Thread = 1; Thread < Pool->ThreadCount; ++Thread) {
+        if(pthread_create(Pool->Threads + Thread, 0, threadPoolWorker, Pool) != 0) {
+            fatalError("Could not create worker thread: %s", strerror(errno));
+        }
+    }
+}
+
+static void threadPoolFree(thread_pool *Pool) {
+    pthread_mutex_lock(&Pool->Lock);
+    Pool->Quit = true;
+    pthread_cond_broadcast(&Pool->JobReady);
+    pthread_mutex_unlock(&Pool->Lock);
+
+    for(int Thread = 1; Thread < Pool->ThreadCount; ++Thread) {
+        pthread_join(Pool->Threads[Thread], 0);
+    }
+
+    free(Pool->Threads);
+    pthread_cond_destroy(&Pool->JobDone);
+    pthread_cond_destroy(&Pool->JobReady);
+    pthread_mutex_destroy(&Pool->Lock);
+}
+
+// NOTE: Calls Function(Data, Index) for every Index below Count and returns once all calls did.
+// A null Pool runs everything on the calling thread.
+static void threadPoolRun(thread_pool *Pool, thread_task_function *Function, void *Data, size_t Count) {
+    if(!Pool || Pool->ThreadCount == 1 || Count <= 1) {
+        for(size_t Index = 0; Index < Count; ++Index) {
+            Function(Data, Index);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&Pool->Lock);
+    Pool->Function = Function;
+    Pool->Data = Data;
+    Pool->TaskCount = Count;
+    atomic_store(&Pool->NextTask, 0);
+    Pool->Busy = Pool->ThreadCount - 1;
+    ++Pool->Generation;
+    pthread_cond_broadcast(&Pool->JobReady);
+    pthread_mutex_unlock(&Pool->Lock);
+
+    threadPoolDrain(Pool, Function, Data);
+
+    pthread_mutex_lock(&Pool->Lock);
+    while(Pool->Busy) {
+        pthread_cond_wait(&Pool->JobDone, &Pool->Lock);
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+}
@@ -0,0 +1,177 @@
+// Tiered execution of expressions that are evaluated many times.
+//
+// Requires memory.c, lexer.c, parser.c, evaluate.c, vm.c and compile.c.
+//
+// A program starts out interpreted: a compact copy of its parse tree is walked directly, so an
+// expression that only runs a few times never pays for compilation.
+// After WarmThreshold runs it is compiled to bytecode with LutDefaultBits tables. After
+// HotThreshold runs it is recompiled with tables of up to MaxLutBits inputs, the fastest code the VM
+// has for a single evaluation, but also the most expensive to build and the largest.
+//
+// Every tier returns what executeVm() would, switching tiers never changes a result or an error.
+
+// NOTE: Compiling a generated 16 operator expression costs about as much as 70 tree walks more
+// than running its bytecode, and wide tables only pay off after thousands of runs
+enum {
+    TierDefaultWarm = 64,
+    TierDefaultHot = 1<<14,
+};
+
+typedef enum tier {
+    Tier_Tree,
+    Tier_Bytecode,
+    Tier_Tables,
+    Tier_Count,
+} tier;
+
+static char *TierNames[Tier_Count] = {
+    [Tier_Tree]     = "tree",
+    [Tier_Bytecode] = "bytecode",
+    [Tier_Tables]   = "tables",
+};
+
+typedef struct tier_config {
+    uint64_t WarmThreshold;
+    uint64_t HotThreshold;
+} tier_config;
+
+typedef struct tiered_program {
+    // NOTE: NUL-terminated and owned by the caller, every promotion parses it again
+    char *Source;
+    int ParamCount;
+    tier Tier;
+    uint64_t Runs;
+
+    // NOTE: Tree is only set in Tier_Tree, Code in every other tier
+    expression *Tree;
+    uint8_t *Code;
+} tiered_program;
+
+static size_t tieredNodeCount(expression *Node) {
+    switch(Node->Type) {
+        case Expression_Unary:  { return 1 + tieredNodeCount(Node->Unary.Expr); } break;
+        case Expression_Binary: { return 1 + tieredNodeCount(Node->Binary.Lhs) + tieredNodeCount(Node->Binary.Rhs); } break;
+        case Expression_Select: {
+            return 1 + tieredNodeCount(Node->Select.Cond) + tieredNodeCount(Node->Select.Then) +
+                   tieredNodeCount(Node->Select.Else);
+        } break;
+        default:                { return 1; } break;
+    }
+}
+
+static expression *tieredCopyTree(expression **Free, expression *Node) {
+    // NOTE: Tables point into the arena of the tree they were built for
+    assert(Node->Type != Expression_Lut);
+
+    expression *Copy = (*Free)++;
+    *Copy = *Node;
+    if(Node->Type == Expression_Unary) {
+        Copy->Unary.Expr = tieredCopyTree(Free, Node->Unary.Expr);
+    } else if(Node->Type == Expression_Binary) {
+        Copy->Binary.Lhs = tieredCopyTree(Free, Node->Binary.Lhs);
+        Copy->Binary.Rhs = tieredCopyTree(Free, Node->Binary.Rhs);
+    } else if(Node->Type == Expression_Select) {
+        Copy->Select.Cond = tieredCopyTree(Free, Node->Select.Cond);
+        Copy->Select.Then = tieredCopyTree(Free, Node->Select.Then);
+        Copy->Select.Else = tieredCopyTree(Free, Node->Select.Else);
+    }
+    return Copy;
+}
+
+// NOTE: Ast is the tree parsed from Source, the caller may free its arena afterwards. Trees are
+// copied into one allocation, since arena blocks are far larger than a typical expression.
+static void tieredInit(tiered_program *Program, char *Source, expression *Ast) {
+    *Program = (tiered_program){.Source = Source, .Tier = Tier_Tree};
+    Program->ParamCount = expressionParamCount(Ast);
+
+    expression *Free = xMalloc(tieredNodeCount(Ast)*sizeof(expression));
+    Program->Tree = tieredCopyTree(&Free, Ast);
+}
+
+static int32_t tieredEvaluate(expression *Node, int32_t *Params, vm_error *Error) {
+    switch(Node->Type) {
+        case Expression_Int: {
+            return (int32_t)Node->IntValue;
+        } break;
+
+        case Expression_Param: {
+            return Params[Node->IntValue];
+        } break;
+
+        case Expression_Unary: {
+            return evaluateUnary(Node->Unary.Op, tieredEvaluate(Node->Unary.Expr, Params, Error));
+        } break;
+
+        case Expression_Binary: {
+            int32_t Lhs = tieredEvaluate(Node->Binary.Lhs, Params, Error);
+            int32_t Rhs = tieredEvaluate(Node->Binary.Rhs, Params, Error);
+
+            bool Trapped = false;
+            int32_t Value = evaluateBinary(Node->Binary.Op, Lhs, Rhs, &Trapped);
+            if(Trapped) {
+                *Error = VmError_DivisionByZero;
+            }
+            return Value;
+        } break;
+
+        case Expression_Select: {
+            int32_t Cond = tieredEvaluate(Node->Select.Cond, Params, Error);
+            int32_t Then = tieredEvaluate(Node->Select.Then, Params, Error);
+            int32_t Else = tieredEvaluate(Node->Select.Else, Params, Error);
+            return bitSelect(Cond, Then, Else);
+        } break;
+
+        InvalidDefaultCase;
+    }
+
+    return 0;
+}
+
+static void tieredFree(tiered_program *Program) {
+    free(Program->Tree);
+    bufFree(Program->Code);
+    *Program = (tiered_program){};
+}
+
+static void tieredPromote(tiered_program *Program, tier Tier) {
+    assert(Tier > Program->Tier);
+
+    // NOTE: The source was parsed before, so this cannot fail
+    lexer Lexer = {};
+    arena Arena = {};
+    expression *Ast = parseExpression(&Lexer, &Arena, Program->Source);
+    uint8_t *Code = 0;
+    compileAst(&Code, &Arena, Ast, Tier == Tier_Tables ? MaxLutBits : LutDefaultBits, 0, 0);
+    arenaFree(&Arena);
+
+    free(Program->Tree);
+    bufFree(Program->Code);
+    Program->Tree = 0;
+    Program->Code = Code;
+    Program->Tier = Tier;
+}
+
+// NOTE: Params holds at least ParamCount values. Returns VmError_None and the result in *Result,
+// or the error executeVm() stops with. Context is only used by the compiled tiers.
+static vm_error tieredRun(tiered_program *Program, tier_config *Config, vm_context *Context, int32_t *Params,
+                          int32_t *Result)
+{
+    ++Program->Runs;
+    if(Program->Tier < Tier_Tables && Program->Runs > Config->HotThreshold) {
+        tieredPromote(Program, Tier_Tables);
+    } else if(Program->Tier < Tier_Bytecode && Program->Runs > Config->WarmThreshold) {
+        tieredPromote(Program, Tier_Bytecode);
+    }
+
+    if(Program->Tier == Tier_Tree) {
+        vm_error Error = VmError_None;
+        *Result = tieredEvaluate(Program->Tree, Params, &Error);
+        return Error;
+    }
+
+    vmInit(Context, Program->Code, Params);
+    while(!vmRun(Context, UINT32_MAX)) {}
+
+    *Result = Context->Result;
+    return Context->Error;
+}
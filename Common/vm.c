@@ -0,0 +1,531 @@
+// Requires stretchy.c and bits.c.
+
+#define push(x) *Top++ = (x)
+#define pop() *--Top
+#define pushes(x) assert(Top+(x) - Stack <= VmStackSize)
+#define pops(x) assert(Top - (x) >= Stack)
+
+#define unaOpCase(M, Op)                        \
+    case M: {                                   \
+        pops(1);                                \
+        int32_t val = pop();                    \
+        pushes(1);                              \
+        push(Op val);                           \
+    } break
+
+#define binOpCase(M, Op)                        \
+    case M: {                                   \
+        pops(2);                                \
+        int32_t rhs = pop();                    \
+        int32_t lhs = pop();                    \
+        pushes(1);                              \
+        push(lhs Op rhs);                       \
+    } break
+
+// NOTE: Division by zero and INT32_MIN / -1 trap in hardware, so they stop the program instead
+#define divOpCase(M, Op)                                   \
+    case M: {                                              \
+        pops(2);                                           \
+        int32_t rhs = pop();                               \
+        int32_t lhs = pop();                               \
+        if(rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {  \
+            Context->Error = VmError_DivisionByZero;       \
+            return true;                                   \
+        }                                                  \
+        pushes(1);                                         \
+        push(lhs Op rhs);                                  \
+    } break
+
+#define binFnCase(M, Fun)                       \
+    case M: {                                   \
+        pops(2);                                \
+        int32_t rhs = pop();                    \
+        int32_t lhs = pop();                    \
+        pushes(1);                              \
+        push(Fun(lhs, rhs));                    \
+    } break
+
+#define unaFnCase(M, Fun)                       \
+    case M: {                                   \
+        pops(1);                                \
+        int32_t val = pop();                    \
+        pushes(1);                              \
+        push(Fun(val));                         \
+    } break
+
+
+enum { VmStackSize = 1<<10 };
+
+typedef enum vm_error {
+    VmError_None,
+    VmError_DivisionByZero,
+    VmError_IllegalOpcode,
+
+    VmError_Count
+} vm_error;
+
+static char *VmErrorMessages[VmError_Count] = {
+    [VmError_None]           = "No error.",
+    [VmError_DivisionByZero] = "Division by zero.",
+    [VmError_IllegalOpcode]  = "Illegal opcode.",
+};
+
+static char *MnemonicNames[256] = {
+    [HALT] = "HALT", [LIT] = "LIT", [ARG] = "ARG", [LUT] = "LUT", [MODP] = "MODP",
+    [MODULE] = "MODULE", [LIT64] = "LIT64", [WIDE] = "WIDE", [BIG] = "BIG", [BIGLIT] = "BIGLIT",
+    [ADD] = "ADD", [SUB] = "SUB", [MUL] = "MUL", [DIV] = "DIV",
+    [OR] = "OR", [XOR] = "XOR", [AND] = "AND", [NOT] = "NOT",
+    [LSH] = "LSH", [RSH] = "RSH", [MOD] = "MOD", [SYM] = "SYM",
+    [POW] = "POW", [POPCNT] = "POPCNT", [CLZ] = "CLZ", [CTZ] = "CTZ",
+    [BSWAP] = "BSWAP", [ROL] = "ROL", [ROR] = "ROR", [PDEP] = "PDEP",
+    [PEXT] = "PEXT", [LT] = "LT", [LE] = "LE", [EQ] = "EQ", [NE] = "NE",
+    [SEL] = "SEL", [NOP] = "NOP",
+};
+
+// NOTE: Filled by vmRunProfiled(), accumulates over any number of runs
+typedef struct vm_profile {
+    uint64_t Counts[256];
+    uint64_t Cycles[256];
+    uint64_t Pairs[256][256];
+    int MaxDepth;
+    uint64_t Runs;
+
+    // NOTE: Optional, indexed by the bytecode offset of each instruction from Base
+    uint8_t *Base;
+    uint64_t *OffsetCounts;
+    uint64_t *OffsetCycles;
+
+    // NOTE: Cost of the timestamp reads themselves, subtracted from every sample
+    uint64_t Overhead;
+} vm_profile;
+
+static inline uint64_t vmTimestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void vmProfileInit(vm_profile *Profile) {
+    *Profile = (vm_profile){};
+    Profile->Overhead = UINT64_MAX;
+    for(int Sample = 0; Sample < 64; ++Sample) {
+        uint64_t Start = vmTimestamp();
+        Profile->Overhead = min(Profile->Overhead, vmTimestamp() - Start);
+    }
+}
+
+typedef struct vm_context {
+    uint8_t *Code;
+    int32_t *Params;
+    int32_t *Top;
+    int32_t Result;
+    vm_error Error;
+    int32_t Stack[VmStackSize];
+} vm_context;
+
+static void vmInit(vm_context *Context, uint8_t *Code, int32_t *Params) {
+    Context->Code = Code;
+    Context->Params = Params;
+    Context->Top = Context->Stack;
+    Context->Error = VmError_None;
+}
+
+// NOTE: Shared by vmRun() and vmRunProfiled(). Profile is a constant at both call sites, so the
+// unprofiled loop is compiled without any trace of the instrumentation.
+static inline __attribute__((always_inline))
+bool vmRunLoop(vm_context *Context, uint32_t Budget, vm_profile *Profile) {
+    uint8_t *Code = Context->Code;
+    int32_t *Params = Context->Params;
+    int32_t *Stack = Context->Stack;
+    int32_t *Top = Context->Top;
+    (void)Stack;
+
+    mnemonic Previous = NOP;
+    uint64_t PreviousStart = 0;
+    size_t PreviousOffset = 0;
+    bool HasPrevious = false;
+
+    for(; Budget; --Budget) {
+        mnemonic Op = *Code++;
+
+        if(Profile) {
+            uint64_t Now = vmTimestamp();
+            if(HasPrevious) {
+                uint64_t Elapsed = Now - PreviousStart;
+                Elapsed = Elapsed > Profile->Overhead ? Elapsed - Profile->Overhead : 0;
+                Profile->Cycles[Previous] += Elapsed;
+                ++Profile->Pairs[Previous][Op];
+                if(Profile->OffsetCycles) {
+                    Profile->OffsetCycles[PreviousOffset] += Elapsed;
+                }
+            }
+            ++Profile->Counts[Op];
+            if(Profile->OffsetCounts) {
+                PreviousOffset = Code - 1 - Profile->Base;
+                ++Profile->OffsetCounts[PreviousOffset];
+            }
+            Profile->MaxDepth = max(Profile->MaxDepth, (int)(Top - Stack));
+            Previous = Op;
+            PreviousStart = Now;
+            HasPrevious = true;
+        }
+
+        switch(Op) {
+            case HALT:
+            {
+                pops(1);
+                Context->Result = pop();
+                if(Profile) {
+                    ++Profile->Runs;
+                }
+                return true;
+            } break;
+
+            case LIT:
+            {
+                pushes(1);
+                int32_t Value;
+                Value  = (*Code++) <<  0;
+                Value |= (*Code++) <<  8;
+                Value |= (*Code++) << 16;
+                Value |= (*Code++) << 24;
+                push(Value);
+            } break;
+
+            case ARG:
+            {
+                pushes(1);
+                push(Params[*Code++]);
+            } break;
+
+            case LUT:
+            {
+                pushes(1);
+                int BitCount = *Code++;
+                uint32_t Index = 0;
+                for(int Bit = 0; Bit < BitCount; ++Bit) {
+                    Index |= (((uint32_t)Params[Code[0]] >> Code[1]) & 1) << Bit;
+                    Code += 2;
+                }
+
+                uint8_t *Entry = Code + 4*Index;
+                int32_t Value;
+                Value  = Entry[0] <<  0;
+                Value |= Entry[1] <<  8;
+                Value |= Entry[2] << 16;
+                Value |= Entry[3] << 24;
+                push(Value);
+
+                Code += 4u << BitCount;
+            } break;
+
+            binOpCase(ADD,  +);
+            binOpCase(SUB,  -);
+            binOpCase(MUL,  *);
+            divOpCase(DIV,  /);
+            binOpCase(OR,   |);
+            binOpCase(XOR,  ^);
+            binOpCase(AND,  &);
+            unaOpCase(NOT,  ~);
+            binFnCase(LSH, bitShiftLeft);
+            binFnCase(RSH, bitShiftRight);
+            divOpCase(MOD,  %);
+            unaOpCase(SYM,  -);
+            binFnCase(POW, bitPower);
+            unaFnCase(POPCNT, bitPopcount);
+            unaFnCase(CLZ,    bitClz);
+            unaFnCase(CTZ,    bitCtz);
+            unaFnCase(BSWAP,  bitBswap);
+            binFnCase(ROL,    bitRotl);
+            binFnCase(ROR,    bitRotr);
+            binFnCase(PDEP,   bitPdep);
+            binFnCase(PEXT,   bitPext);
+            // NOTE: Comparisons compile to SETcc and SEL to a mask or CMOV, none of them branch
+            binOpCase(LT,  <);
+            binOpCase(LE, <=);
+            binOpCase(EQ, ==);
+            binOpCase(NE, !=);
+
+            case SEL:
+            {
+                pops(3);
+                int32_t Else = pop();
+                int32_t Then = pop();
+                int32_t Cond = pop();
+                pushes(1);
+                push(bitSelect(Cond, Then, Else));
+            } break;
+
+            case NOP: {} break;
+
+            default:
+            {
+                Context->Error = VmError_IllegalOpcode;
+                return true;
+            } break;
+        }
+    }
+
+    Context->Code = Code;
+    Context->Top = Top;
+    return false;
+}
+
+// NOTE: Executes at most Budget instructions and returns true once the program stopped, either
+// with its value in Context->Result or with Context->Error set. Otherwise the context can be
+// resumed later.
+static bool vmRun(vm_context *Context, uint32_t Budget) {
+    return vmRunLoop(Context, Budget, 0);
+}
+
+// NOTE: Same as vmRun(), counting opcodes, opcode pairs and timestamp cycles into Profile. The
+// cycles of the last instruction before a budget stop are not attributed.
+static bool vmRunProfiled(vm_context *Context, uint32_t Budget, vm_profile *Profile) {
+    return vmRunLoop(Context, Budget, Profile);
+}
+
+// NOTE: Checks that untrusted bytecode never reads past Size bytes, never under- or overflows the
+// stack and stops at a HALT, so vmRun() can execute it without any bounds checks. On success
+// ParamCount receives the number of parameters the program may read.
+static bool vmValidate(uint8_t *Code, size_t Size, int *ParamCount) {
+    uint8_t *End = Code + Size;
+    int Depth = 0;
+    int Params = 0;
+
+    while(Code < End) {
+        mnemonic Op = *Code++;
+        switch(Op) {
+            case HALT:
+            {
+                *ParamCount = Params;
+                return Depth == 1;
+            } break;
+
+            case LIT:
+            {
+                if(End - Code < 4) {
+                    return false;
+                }
+                Code += 4;
+                ++Depth;
+            } break;
+
+            case ARG:
+            {
+                if(Code == End) {
+                    return false;
+                }
+                Params = max(Params, *Code + 1);
+                ++Code;
+                ++Depth;
+            } break;
+
+            case LUT:
+            {
+                if(Code == End || *Code > MaxLutBits) {
+                    return false;
+                }
+                int BitCount = *Code++;
+                if(End - Code < 2*BitCount + (4l << BitCount)) {
+                    return false;
+                }
+                for(int Bit = 0; Bit < BitCount; ++Bit, Code += 2) {
+                    if(Code[1] >= 32) {
+                        return false;
+                    }
+                    Params = max(Params, Code[0] + 1);
+                }
+                Code += 4l << BitCount;
+                ++Depth;
+            } break;
+
+            case ADD: case SUB: case MUL: case DIV: case OR: case XOR:
+            case AND: case LSH: case RSH: case MOD: case POW:
+            case ROL: case ROR: case PDEP: case PEXT: case LT: case LE: case EQ: case NE:
+            {
+                if(Depth < 2) {
+                    return false;
+                }
+                --Depth;
+            } break;
+
+            case SEL:
+            {
+                if(Depth < 3) {
+                    return false;
+                }
+                Depth -= 2;
+            } break;
+
+            case NOT: case SYM: case POPCNT: case CLZ: case CTZ: case BSWAP:
+            {
+                if(Depth < 1) {
+                    return false;
+                }
+            } break;
+
+            case NOP: {} break;
+
+            default:
+            {
+                return false;
+            } break;
+        }
+
+        if(Depth > VmStackSize) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static int32_t executeVm(uint8_t *Code, int32_t *Params) {
+    vm_context Context;
+    vmInit(&Context, Code, Params);
+    while(!vmRun(&Context, UINT32_MAX)) {}
+    if(Context.Error) {
+        fatalError(VmErrorMessages[Context.Error]);
+    }
+    return Context.Result;
+}
+
+static int32_t executeVmProfiled(uint8_t *Code, int32_t *Params, vm_profile *Profile) {
+    vm_context Context;
+    vmInit(&Context, Code, Params);
+    while(!vmRunProfiled(&Context, UINT32_MAX, Profile)) {}
+    if(Context.Error) {
+        fatalError(VmErrorMessages[Context.Error]);
+    }
+    return Context.Result;
+}
+
+typedef struct vm_profile_row {
+    int First, Second;
+    uint64_t Count;
+} vm_profile_row;
+
+static int compareProfileRows(const void *A, const void *B) {
+    uint64_t Lhs = ((vm_profile_row *)A)->Count, Rhs = ((vm_profile_row *)B)->Count;
+    return (Lhs < Rhs) - (Lhs > Rhs);
+}
+
+static void vmProfileReport(FILE *File, vm_profile *Profile, int MaxPairs) {
+    vm_profile_row Rows[256];
+    int RowCount = 0;
+    uint64_t Total = 0, TotalCycles = 0;
+    for(int Op = 0; Op < 256; ++Op) {
+        if(Profile->Counts[Op]) {
+            Rows[RowCount++] = (vm_profile_row){Op, 0, Profile->Counts[Op]};
+            Total += Profile->Counts[Op];
+            TotalCycles += Profile->Cycles[Op];
+        }
+    }
+    qsort(Rows, RowCount, sizeof(*Rows), compareProfileRows);
+
+    fprintf(File, "%llu runs, %llu instructions, max stack depth %d, timestamp overhead %llu cycles\n\n",
+            (unsigned long long)Profile->Runs, (unsigned long long)Total, Profile->MaxDepth,
+            (unsigned long long)Profile->Overhead);
+    fprintf(File, "%-8s %14s %7s %14s %7s %9s\n", "opcode", "count", "%", "cycles", "%", "cyc/op");
+    for(int Row = 0; Row < RowCount; ++Row) {
+        int Op = Rows[Row].First;
+        char *Name = MnemonicNames[Op] ? MnemonicNames[Op] : "?";
+        fprintf(File, "%-8s %14llu %6.2f%% %14llu %6.2f%% %9.2f\n", Name,
+                (unsigned long long)Profile->Counts[Op], 100.0*Profile->Counts[Op]/Total,
+                (unsigned long long)Profile->Cycles[Op], TotalCycles ? 100.0*Profile->Cycles[Op]/TotalCycles : 0.0,
+                (double)Profile->Cycles[Op]/Profile->Counts[Op]);
+    }
+
+    vm_profile_row *Pairs = 0;
+    uint64_t PairTotal = 0;
+    for(int First = 0; First < 256; ++First) {
+        for(int Second = 0; Second < 256; ++Second) {
+            if(Profile->Pairs[First][Second]) {
+                bufPush(Pairs, (vm_profile_row){First, Second, Profile->Pairs[First][Second]});
+                PairTotal += Profile->Pairs[First][Second];
+            }
+        }
+    }
+    qsort(Pairs, bufLength(Pairs), sizeof(*Pairs), compareProfileRows);
+
+    fprintf(File, "\n%-17s %14s %7s\n", "pair", "count", "%");
+    for(size_t Row = 0; Row < bufLength(Pairs) && (int)Row < MaxPairs; ++Row) {
+        char Name[32];
+        snprintf(Name, sizeof(Name), "%s %s", MnemonicNames[Pairs[Row].First] ? MnemonicNames[Pairs[Row].First] : "?",
+                 MnemonicNames[Pairs[Row].Second] ? MnemonicNames[Pairs[Row].Second] : "?");
+        fprintf(File, "%-17s %14llu %6.2f%%\n", Name, (unsigned long long)Pairs[Row].Count, 100.0*Pairs[Row].Count/PairTotal);
+    }
+    bufFree(Pairs);
+}
+
+static void executeVmBatch(uint8_t *Code, int32_t *Params, int ParamCount, int32_t *Results, size_t Count) {
+    for(size_t Index = 0; Index < Count; ++Index) {
+        Results[Index] = executeVm(Code, Params + Index*ParamCount);
+    }
+}
+
+enum {
+    VmMaxInterleave = 16,
+
+    // NOTE: Instructions a context runs before yielding to the next one
+    VmInterleaveSlice = 16,
+};
+
+static void vmPrefetchCode(uint8_t *Code) {
+    __builtin_prefetch(Code);
+    __builtin_prefetch(Code + 64);
+}
+
+// NOTE: Runs Count independent programs sharing Params, Width of them at a time in round-robin.
+// While one context executes, the bytecode of the next one is prefetched, so the cache misses of
+// cold programs overlap with useful work instead of stalling a sequential executeVm() loop.
+static void executeVmInterleaved(uint8_t **Programs, int32_t *Params, int32_t *Results, size_t Count, int Width) {
+    assert(Width > 0 && Width <= VmMaxInterleave);
+
+    vm_context *Contexts = xMalloc(Width*sizeof(vm_context));
+    size_t Indices[VmMaxInterleave];
+    bool Running[VmMaxInterleave] = {};
+
+    size_t Next = 0;
+    int Active = 0;
+    for(int Slot = 0; Slot < Width; ++Slot) {
+        if(Next < Count) {
+            vmPrefetchCode(Programs[Next]);
+            vmInit(Contexts + Slot, Programs[Next], Params);
+            Indices[Slot] = Next++;
+            Running[Slot] = true;
+            ++Active;
+        } else {
+            Contexts[Slot].Code = 0;
+        }
+    }
+
+    for(int Slot = 0; Active; Slot = (Slot + 1) % Width) {
+        if(!Running[Slot]) {
+            continue;
+        }
+
+        vm_context *Context = Contexts + Slot;
+        vmPrefetchCode(Contexts[(Slot + 1) % Width].Code);
+
+        if(vmRun(Context, VmInterleaveSlice)) {
+            if(Context->Error) {
+                fatalError("%s (program %zu)", VmErrorMessages[Context->Error], Indices[Slot]);
+            }
+            Results[Indices[Slot]] = Context->Result;
+
+            if(Next < Count) {
+                vmPrefetchCode(Programs[Next]);
+                vmInit(Context, Programs[Next], Params);
+                Indices[Slot] = Next++;
+            } else {
+                Running[Slot] = false;
+                --Active;
+            }
+        }
+    }
+
+    free(Contexts);
+}
@@ -0,0 +1,160 @@
+// VM for programs compiled with --wide.
+//
+// Requires vm.c and bits.c.
+//
+// Wide programs start with a WIDE instruction and run on a stack of int64_t with the opcodes of
+// the 32-bit VM. LIT sign extends its immediate, LIT64 carries 8 bytes. The semantics are those of
+// the interpreter: arithmetic wraps modulo 2^64, shift and rotation counts are taken modulo 64,
+// the builtins work on all 64 bits and POW squares and multiplies in integers, see bitPower64().
+// Division by zero and INT64_MIN / -1 stop the program like they do in the 32-bit VM.
+
+enum { WideHeaderSize = 1 };
+
+#define wideBinOpCase(M, Expr)                  \
+    case M: {                                   \
+        pops(2);                                \
+        int64_t rhs = pop();                    \
+        int64_t lhs = pop();                    \
+        pushes(1);                              \
+        push(Expr);                             \
+    } break
+
+#define wideUnaOpCase(M, Expr)                  \
+    case M: {                                   \
+        pops(1);                                \
+        int64_t val = pop();                    \
+        pushes(1);                              \
+        push(Expr);                             \
+    } break
+
+#define wideDivOpCase(M, Op)                                \
+    case M: {                                               \
+        pops(2);                                            \
+        int64_t rhs = pop();                                \
+        int64_t lhs = pop();                                \
+        if(rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {   \
+            return VmError_DivisionByZero;                  \
+        }                                                   \
+        pushes(1);                                          \
+        push(lhs Op rhs);                                   \
+    } break
+
+static bool wideProgram(uint8_t *Code, size_t Size) {
+    return Size >= WideHeaderSize && Code[0] == WIDE;
+}
+
+// NOTE: Code points at the WIDE header
+static vm_error wideRun(uint8_t *Code, int64_t *Params, int64_t *Result) {
+    int64_t Stack[VmStackSize];
+    int64_t *Top = Stack;
+    Code += WideHeaderSize;
+
+    for(;;) {
+        mnemonic Op = *Code++;
+        switch(Op) {
+            case HALT:
+            {
+                pops(1);
+                *Result = pop();
+                return VmError_None;
+            } break;
+
+            case LIT:
+            {
+                pushes(1);
+                uint32_t Value;
+                Value  = (uint32_t)(*Code++) <<  0;
+                Value |= (uint32_t)(*Code++) <<  8;
+                Value |= (uint32_t)(*Code++) << 16;
+                Value |= (uint32_t)(*Code++) << 24;
+                push((int32_t)Value);
+            } break;
+
+            case LIT64:
+            {
+                pushes(1);
+                uint64_t Value = 0;
+                for(int Byte = 0; Byte < 8; ++Byte) {
+                    Value |= (uint64_t)(*Code++) << 8*Byte;
+                }
+                push((int64_t)Value);
+            } break;
+
+            case ARG:
+            {
+                pushes(1);
+                push(Params[*Code++]);
+            } break;
+
+            wideBinOpCase(ADD, (uint64_t)lhs + (uint64_t)rhs);
+            wideBinOpCase(SUB, (uint64_t)lhs - (uint64_t)rhs);
+            wideBinOpCase(MUL, (uint64_t)lhs * (uint64_t)rhs);
+            wideDivOpCase(DIV, /);
+            wideBinOpCase(OR,  lhs | rhs);
+            wideBinOpCase(XOR, lhs ^ rhs);
+            wideBinOpCase(AND, lhs & rhs);
+            wideUnaOpCase(NOT, ~val);
+            wideBinOpCase(LSH, (uint64_t)lhs << (rhs & 63));
+            wideBinOpCase(RSH, lhs >> (rhs & 63));
+            wideDivOpCase(MOD, %);
+            wideUnaOpCase(SYM, -(uint64_t)val);
+            wideUnaOpCase(POPCNT, bitPopcount64(val));
+            wideUnaOpCase(CLZ,    bitClz64(val));
+            wideUnaOpCase(CTZ,    bitCtz64(val));
+            wideUnaOpCase(BSWAP,  bitBswap64(val));
+            wideBinOpCase(ROL,    bitRotl64(lhs, rhs));
+            wideBinOpCase(ROR,    bitRotr64(lhs, rhs));
+            wideBinOpCase(PDEP,   bitPdep64(lhs, rhs));
+            wideBinOpCase(PEXT,   bitPext64(lhs, rhs));
+            wideBinOpCase(LT, lhs <  rhs);
+            wideBinOpCase(LE, lhs <= rhs);
+            wideBinOpCase(EQ, lhs == rhs);
+            wideBinOpCase(NE, lhs != rhs);
+
+            case SEL:
+            {
+                pops(3);
+                int64_t Else = pop();
+                int64_t Then = pop();
+                int64_t Cond = pop();
+                pushes(1);
+                push(bitSelect64(Cond, Then, Else));
+            } break;
+
+            case POW:
+            {
+                pops(2);
+                int64_t Exponent = pop();
+                int64_t Base = pop();
+                bool DivisionByZero = false;
+                int64_t Value = bitPower64(Base, Exponent, &DivisionByZero);
+                if(DivisionByZero) {
+                    return VmError_DivisionByZero;
+                }
+                pushes(1);
+                push(Value);
+            } break;
+
+            case NOP: {} break;
+
+            default:
+            {
+                return VmError_IllegalOpcode;
+            } break;
+        }
+    }
+}
+
+#undef wideBinOpCase
+#undef wideUnaOpCase
+#undef wideDivOpCase
+
+// NOTE: Like executeVm(), errors are fatal
+static int64_t executeWideVm(uint8_t *Code, int64_t *Params) {
+    int64_t Result;
+    vm_error Error = wideRun(Code, Params, &Result);
+    if(Error) {
+        fatalError(VmErrorMessages[Error]);
+    }
+    return Result;
+}
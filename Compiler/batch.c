@@ -0,0 +1,128 @@
+// compiler --batch: one expression per line of a file, compiled into a module, see module.c.
+//
+// Requires compile.c, threadpool.c and module.c.
+//
+// Consecutive lines are grouped into chunks, and every chunk is compiled by one thread with its
+// own lexer and arena into its own buffers. The chunks are joined in order at the end, so the
+// module only depends on the input, never on the thread count or on which thread took what.
+
+enum {
+    BatchChunkLines = 256,
+};
+
+typedef struct batch_error {
+    size_t Line;
+    error_code Error;
+    size_t Offset;
+} batch_error;
+
+typedef struct batch_chunk {
+    uint8_t *Code;
+    uint32_t *Sizes;
+    batch_error *Errors;
+} batch_chunk;
+
+typedef struct batch_job {
+    char **Lines;
+    size_t LineCount;
+    int LutBits;
+    // NOTE: Null when no parameter is bound
+    specialize_bindings *Bindings;
+    batch_chunk *Chunks;
+} batch_job;
+
+static void batchCompileChunk(void *Data, size_t Index) {
+    batch_job *Job = Data;
+    batch_chunk *Chunk = Job->Chunks + Index;
+    arena Arena = {};
+    lexer Lexer = {};
+    uint8_t *Code = 0;
+
+    size_t End = min((Index + 1)*BatchChunkLines, Job->LineCount);
+    for(size_t Line = Index*BatchChunkLines; Line < End; ++Line) {
+        expression *Ast = tryParseExpression(&Lexer, &Arena, Job->Lines[Line]);
+        if(!Ast) {
+            bufPush(Chunk->Errors, ((batch_error){Line, Lexer.Error, Lexer.ErrorOffset}));
+            bufPush(Chunk->Sizes, 0);
+            continue;
+        }
+
+        if(Code) {
+            bufHeader_(Code)->Length = 0;
+        }
+        compileAst(&Code, &Arena, Ast, Job->LutBits, Job->Bindings, 0);
+
+        size_t Size = bufLength(Code), Length = bufLength(Chunk->Code);
+        bufFit(Chunk->Code, Length + Size);
+        memcpy(Chunk->Code + Length, Code, Size);
+        bufHeader_(Chunk->Code)->Length = Length + Size;
+        bufPush(Chunk->Sizes, Size);
+    }
+
+    bufFree(Code);
+    arenaFree(&Arena);
+}
+
+// NOTE: Appends the module for Lines to Module and the lines that did not compile to Errors, in
+// line order. Pool may be null.
+static void batchCompile(thread_pool *Pool, char **Lines, size_t LineCount, int LutBits, specialize_bindings *Bindings,
+                         uint8_t **Module, batch_error **Errors)
+{
+    size_t ChunkCount = (LineCount + BatchChunkLines - 1)/BatchChunkLines;
+    batch_job Job = {
+        .Lines = Lines,
+        .LineCount = LineCount,
+        .LutBits = LutBits,
+        .Bindings = Bindings,
+        .Chunks = xMalloc(ChunkCount*sizeof(batch_chunk)),
+    };
+    memset(Job.Chunks, 0, ChunkCount*sizeof(batch_chunk));
+    threadPoolRun(Pool, batchCompileChunk, &Job, ChunkCount);
+
+    uint8_t *Code = 0;
+    uint32_t *Sizes = 0;
+    for(size_t Index = 0; Index < ChunkCount; ++Index) {
+        batch_chunk *Chunk = Job.Chunks + Index;
+        size_t Length = bufLength(Code);
+        bufFit(Code, Length + bufLength(Chunk->Code));
+        memcpy(Code + Length, Chunk->Code, bufLength(Chunk->Code));
+        bufHeader_(Code)->Length = Length + bufLength(Chunk->Code);
+        for(size_t Line = 0; Line < bufLength(Chunk->Sizes); ++Line) {
+            bufPush(Sizes, Chunk->Sizes[Line]);
+        }
+        for(size_t Error = 0; Error < bufLength(Chunk->Errors); ++Error) {
+            bufPush(*Errors, Chunk->Errors[Error]);
+        }
+
+        bufFree(Chunk->Code);
+        bufFree(Chunk->Sizes);
+        bufFree(Chunk->Errors);
+    }
+
+    // NOTE: Offsets in the entry table are 32-bit
+    if((uint64_t)bufLength(Code) + LineCount*ModuleEntrySize + ModuleHeaderSize > UINT32_MAX) {
+        fatalError("The module would be larger than 4GB");
+    }
+    moduleWrite(Module, Code, Sizes, LineCount);
+
+    bufFree(Code);
+    bufFree(Sizes);
+    free(Job.Chunks);
+}
+
+// NOTE: Splits Text in place at line ends, a final line end does not start another line. Text[Length]
+// must be writable, readEntireFile() leaves a terminator there.
+static char **batchSplitLines(char *Text, size_t Length) {
+    char **Lines = 0;
+    for(char *Line = Text, *End = Text + Length; Line < End;) {
+        char *Next = memchr(Line, '\n', End - Line);
+        Next = Next ? Next : End;
+        *Next = 0;
+        if(Next > Line && Next[-1] == '\r') {
+            Next[-1] = 0;
+        }
+        bufPush(Lines, Line);
+        Line = Next + 1;
+    }
+    return Lines;
+}
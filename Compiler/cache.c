@@ -0,0 +1,224 @@
+// Persistent compilation cache shared by concurrent compiler processes.
+//
+// Entries live in DIR/XX/KEY where XX are the first two hex digits of the key. Every file is
+// written to a temporary name and renamed into place, so readers only ever see complete files.
+// Eviction works per subdirectory: keys are uniformly distributed, so keeping each of the 256
+// subdirectories below 1/256 of the limit bounds the whole cache without ever scanning all of it.
+
+enum {
+    CacheFanout = 256,
+    CacheKeyLength = 32,
+    CacheDefaultMegabytes = 256,
+};
+
+// NOTE: Part of every key, bump it whenever the generated code changes for the same input
+#define CompilerVersion "bitwise-compiler 7"
+
+typedef struct cache_file {
+    char Name[CacheKeyLength + 1];
+    uint64_t Bytes;
+    struct timespec Used;
+} cache_file;
+
+// NOTE: Spelling, whitespace and literal radix do not change the program, so the key hashes the
+// token stream rather than the source text. The debug section embeds the source, so with --debug
+// the text itself is hashed. Fails for sources that do not lex, the compiler then reports the
+// error itself. Every flag that changes the output must be hashed here as well, and so are the
+// peephole rules, so editing rewrites.inc invalidates the entries compiled with the old ones.
+static bool cacheKey(char *Source, int LutBits, bool Debug, uint32_t Modulus, bool Wide, bool Big,
+                     specialize_bindings *Bindings, char *Key)
+{
+    jmp_buf OnError;
+    lexer Lexer = {.Wide = Wide};
+    Lexer.OnError = &OnError;
+    if(setjmp(OnError)) {
+        return false;
+    }
+
+    uint64_t Hashes[2] = {HashSeed, HashSeed ^ 0x5851F42D4C957F2Dull};
+    for(int Half = 0; Half < 2; ++Half) {
+        Hashes[Half] = hashBytes(CompilerVersion, sizeof(CompilerVersion), Hashes[Half]);
+        Hashes[Half] = hashBytes(&LutBits, sizeof(LutBits), Hashes[Half]);
+        Hashes[Half] = hashBytes(&Debug, sizeof(Debug), Hashes[Half]);
+        Hashes[Half] = hashBytes(&Modulus, sizeof(Modulus), Hashes[Half]);
+        Hashes[Half] = hashBytes(&Wide, sizeof(Wide), Hashes[Half]);
+        Hashes[Half] = hashBytes(&Big, sizeof(Big), Hashes[Half]);
+        Hashes[Half] = hashBytes(Bindings, sizeof(*Bindings), Hashes[Half]);
+        for(int Rule = 0; Rule < (int)arrayCount(PeepholeRules); ++Rule) {
+            Hashes[Half] = hashBytes(PeepholeRules[Rule].From, strlen(PeepholeRules[Rule].From) + 1, Hashes[Half]);
+            Hashes[Half] = hashBytes(PeepholeRules[Rule].To, strlen(PeepholeRules[Rule].To) + 1, Hashes[Half]);
+        }
+    }
+
+    for(lexerInit(&Lexer, Source); Lexer.Token.Type != Token_EOF; nextToken(&Lexer)) {
+        if(Lexer.Token.Type == Token_Unknown) {
+            return false;
+        }
+
+        uint8_t Bytes[9] = {Lexer.Token.Type};
+        int Length = 1;
+        if(Lexer.Token.Type == Token_Int || Lexer.Token.Type == Token_Param) {
+            memcpy(Bytes + 1, &Lexer.Token.IntValue, 8);
+            Length = 9;
+        }
+
+        for(int Half = 0; Half < 2; ++Half) {
+            Hashes[Half] = hashBytes(Bytes, Length, Hashes[Half]);
+        }
+    }
+
+    if(Lexer.Error != Error_None) {
+        return false;
+    }
+
+    if(Debug) {
+        for(int Half = 0; Half < 2; ++Half) {
+            Hashes[Half] = hashBytes(Source, strlen(Source), Hashes[Half]);
+        }
+    }
+
+    snprintf(Key, CacheKeyLength + 1, "%016llx%016llx",
+             (unsigned long long)Hashes[0], (unsigned long long)Hashes[1]);
+    return true;
+}
+
+static void cacheEntryPath(char *Path, size_t Size, char *Dir, char *Key) {
+    snprintf(Path, Size, "%s/%.2s/%s", Dir, Key, Key);
+}
+
+// NOTE: Writes Data next to Path and renames it over Path, replacing any previous file or link
+static bool writeFileAtomic(char *Path, void *Data, size_t Size, mode_t Mode) {
+    char Temp[PATH_MAX];
+    if(snprintf(Temp, sizeof(Temp), "%s.XXXXXX", Path) >= (int)sizeof(Temp)) {
+        return false;
+    }
+
+    int File = mkstemp(Temp);
+    if(File < 0) {
+        return false;
+    }
+
+    bool Ok = true;
+    for(uint8_t *At = Data, *End = At + Size; Ok && At < End;) {
+        ssize_t Written = write(File, At, End - At);
+        Ok = Written > 0 || (Written < 0 && errno == EINTR);
+        At += max(Written, 0);
+    }
+
+    Ok = Ok && fchmod(File, Mode) == 0;
+    Ok = close(File) == 0 && Ok;
+    Ok = Ok && rename(Temp, Path) == 0;
+    if(!Ok) {
+        unlink(Temp);
+    }
+
+    return Ok;
+}
+
+// NOTE: Materializes a cached entry at Output, preferring a reflink, then a hard link, then a
+// plain copy. Returns false on a miss.
+static bool cacheFetch(char *Dir, char *Key, char *Output) {
+    char Entry[PATH_MAX], Temp[PATH_MAX];
+    cacheEntryPath(Entry, sizeof(Entry), Dir, Key);
+    if(snprintf(Temp, sizeof(Temp), "%s.XXXXXX", Output) >= (int)sizeof(Temp)) {
+        return false;
+    }
+
+    int Source = open(Entry, O_RDONLY | O_CLOEXEC);
+    if(Source < 0) {
+        return false;
+    }
+
+    // NOTE: Touching the entry makes eviction least recently used instead of least recently written
+    futimens(Source, 0);
+
+    bool Done = false;
+    int Clone = mkstemp(Temp);
+    if(Clone >= 0) {
+#ifdef FICLONE
+        Done = ioctl(Clone, FICLONE, Source) == 0 && fchmod(Clone, 0644) == 0;
+#endif
+        close(Clone);
+        if(!Done) {
+            unlink(Temp);
+            Done = link(Entry, Temp) == 0;
+        }
+        if(Done && rename(Temp, Output) != 0) {
+            unlink(Temp);
+            Done = false;
+        }
+    }
+
+    if(!Done) {
+        struct stat Info;
+        if(fstat(Source, &Info) == 0) {
+            uint8_t *Data = xMalloc(max(Info.st_size, 1));
+            Done = read(Source, Data, Info.st_size) == Info.st_size && writeFileAtomic(Output, Data, Info.st_size, 0644);
+            free(Data);
+        }
+    }
+
+    close(Source);
+    return Done;
+}
+
+static int compareCacheFiles(const void *A, const void *B) {
+    const struct timespec *Lhs = &((cache_file *)A)->Used, *Rhs = &((cache_file *)B)->Used;
+    if(Lhs->tv_sec != Rhs->tv_sec) {
+        return Lhs->tv_sec < Rhs->tv_sec ? -1 : 1;
+    }
+    return (Lhs->tv_nsec > Rhs->tv_nsec) - (Lhs->tv_nsec < Rhs->tv_nsec);
+}
+
+// NOTE: Removes the least recently used entries of one subdirectory until it is below 90% of its
+// share. Entries another process is linking to right now stay valid through their new link.
+static void cacheEvict(char *SubDir, uint64_t MaxBytes) {
+    DIR *Directory = opendir(SubDir);
+    if(!Directory) {
+        return;
+    }
+
+    cache_file *Files = 0;
+    uint64_t Total = 0;
+    for(struct dirent *Entry; (Entry = readdir(Directory));) {
+        if(strlen(Entry->d_name) != CacheKeyLength) {
+            continue;
+        }
+
+        struct stat Info;
+        if(fstatat(dirfd(Directory), Entry->d_name, &Info, 0) == 0) {
+            cache_file File = {.Bytes = Info.st_blocks*512, .Used = Info.st_mtim};
+            memcpy(File.Name, Entry->d_name, CacheKeyLength + 1);
+            bufPush(Files, File);
+            Total += File.Bytes;
+        }
+    }
+
+    if(Total > MaxBytes) {
+        qsort(Files, bufLength(Files), sizeof(*Files), compareCacheFiles);
+        // NOTE: The newest entry is the one just stored, it always survives
+        for(size_t Index = 0; Index + 1 < bufLength(Files) && Total > MaxBytes/10*9; ++Index) {
+            if(unlinkat(dirfd(Directory), Files[Index].Name, 0) == 0) {
+                Total -= Files[Index].Bytes;
+            }
+        }
+    }
+
+    bufFree(Files);
+    closedir(Directory);
+}
+
+// NOTE: Failures only cost the next run a recompilation, so they are silently ignored
+static void cacheStore(char *Dir, char *Key, uint8_t *Code, size_t Size, uint64_t MaxBytes) {
+    char SubDir[PATH_MAX], Entry[PATH_MAX];
+    snprintf(SubDir, sizeof(SubDir), "%s/%.2s", Dir, Key);
+    cacheEntryPath(Entry, sizeof(Entry), Dir, Key);
+
+    mkdir(Dir, 0777);
+    mkdir(SubDir, 0777);
+
+    // NOTE: Read-only, because outputs may be hard links to the entry
+    if(writeFileAtomic(Entry, Code, Size, 0444)) {
+        cacheEvict(SubDir, MaxBytes/CacheFanout);
+    }
+}
@@ -1,255 +1,457 @@
 #include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include <instruction_table.h>
 #include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
 #include <lexer.c>
-
-// AST
-typedef enum expression_type {
-    Expression_Int,
-    Expression_Unary,
-    Expression_Binary,
-} expression_type;
-
-typedef struct expression {
-    expression_type Type;
-    union {
-        uint32_t IntValue;
-
-        struct {
-            token_type Op;
-            struct expression *Expr;
-        } Unary;
-
-        struct {
-            token_type Op;
-            struct expression *Lhs;
-            struct expression *Rhs;
-        } Binary;
-    };
-} expression;
-
-static expression *expressionNew(expression_type Type) {
-    expression *Result = malloc(sizeof(*Result));
-    Result->Type = Type;
-    return Result;
+#include <parser.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <specialize.c>
+#include <generator.c>
+#include <vm.c>
+#include <peephole.c>
+#include <compile.c>
+#include <incremental.c>
+#include <montgomery.c>
+#include <modcompile.c>
+#include <debug.c>
+#include <perf.c>
+#include <threadpool.c>
+#include <parallel.c>
+#include <frontend.c>
+#include <module.c>
+
+#include "cache.c"
+#include "batch.c"
+
+static void usage(char *Program) {
+    fprintf(stderr, "Usage: %s [--lut-bits N] [--debug | --mod P | --wide | --bigint] [--bind K=V...] [--cache-dir DIR [--cache-size MB]]\n"
+                    "       [--perf-counters[=json]] [--threads N] (EXPR | --source FILE) OUTPUT\n"
+                    "       %s [--lut-bits N] [--bind K=V...] [--threads N] --batch INPUT -o MODULE\n"
+                    "       %s [--perf-counters[=json]] [--threads N] --eval (EXPR | --source FILE) [PARAM...]\n"
+                    "       %s --incremental OUTPUT\n", Program, Program, Program, Program);
+    fprintf(stderr, "  --lut-bits N  Replace subexpressions depending on at most N parameter bits\n");
+    fprintf(stderr, "                with a lookup table (0 disables, max %d, default %d)\n",
+            MaxLutBits, LutDefaultBits);
+    fprintf(stderr, "  --debug          Append a section mapping bytecode back to source spans, used by\n");
+    fprintf(stderr, "                   vm --profile\n");
+    fprintf(stderr, "  --mod P          Evaluate modulo the odd modulus P, 3 <= P < 2^32. Only +, -, *, **\n");
+    fprintf(stderr, "                   with a constant exponent and %% P are allowed. Run with vm --mod P\n");
+    fprintf(stderr, "  --wide           Compute in 64 bits like the interpreter: 64-bit literals and parameters,\n");
+    fprintf(stderr, "                   wrapping arithmetic, integer **. No lookup tables or rewrites\n");
+    fprintf(stderr, "  --bigint         Compile for vm --bigint: no folding, lookup tables or rewrites, which\n");
+    fprintf(stderr, "                   all assume 32-bit values\n");
+    fprintf(stderr, "  --bind K=V       Specialize for $K = V, the program still reads $K but ignores it.\n");
+    fprintf(stderr, "                   Not with --mod, --wide or --bigint\n");
+    fprintf(stderr, "  --source FILE    Read the expression from FILE instead of the EXPR argument, which the\n");
+    fprintf(stderr, "                   system limits to about 128KB\n");
+    fprintf(stderr, "  --cache-dir DIR  Reuse bytecode compiled earlier from the same tokens\n");
+    fprintf(stderr, "  --cache-size MB  Evict least recently used entries past this size (default %d)\n",
+            CacheDefaultMegabytes);
+    fprintf(stderr, "  --perf-counters  Print hardware counters per phase to stderr as a table or JSON\n");
+    fprintf(stderr, "  --batch INPUT    Compile every line of INPUT into one module, entry N being line N\n");
+    fprintf(stderr, "                   counted from 0. Run entries with vm --entry N. Lines that do not\n");
+    fprintf(stderr, "                   compile are reported, get an empty entry and fail the command\n");
+    fprintf(stderr, "  --threads N      Threads compiling a batch, or parsing an expression of more than %dMB\n",
+            2*FrontendDefaultGrain >> 20);
+    fprintf(stderr, "                   or evaluating one of more than %dKB (default: one per CPU)\n",
+            2*ParallelDefaultGrain >> 10);
+    fprintf(stderr, "  --eval           Print the value of the expression for PARAM... instead of compiling\n");
+    fprintf(stderr, "                   it, with the VM's 32-bit semantics\n");
+    fprintf(stderr, "  --incremental    Keep a source open and recompile only what edits change. Reads\n");
+    fprintf(stderr, "                   commands from stdin, each followed by LENGTH bytes of text:\n");
+    fprintf(stderr, "                     s LENGTH                  Set the whole source\n");
+    fprintf(stderr, "                     e OFFSET DELETED LENGTH   Replace DELETED bytes at OFFSET\n");
+    fprintf(stderr, "                     w                         Write the bytecode to OUTPUT\n");
+    fprintf(stderr, "                   and answers each with a line 'ok REPARSED CODE_OFFSET REMOVED ADDED'\n");
+    fprintf(stderr, "                   or 'error OFFSET MESSAGE'. The bytecode is not optimized\n");
+    exit(1);
 }
 
-static expression *expressionIntNew(uint32_t Value) {
-    expression *Result = expressionNew(Expression_Int);
-    Result->IntValue = Value;
-    return Result;
+static void incrementalAnswer(incremental *State, bool Ok) {
+    if(Ok) {
+        printf("ok %zu %zu %zu %zu\n", State->Reparsed, State->CodeOffset, State->CodeRemoved, State->CodeAdded);
+    } else {
+        printf("error %zu %s\n", State->ErrorOffset, ErrorMessages[State->Error]);
+    }
 }
 
-static expression *expressionUnaryNew(token_type Op, expression *Expr) {
-    expression *Result = expressionNew(Expression_Unary);
-    Result->Unary.Op = Op;
-    Result->Unary.Expr = Expr;
-    return Result;
-}
+// NOTE: Serves the commands of --incremental until stdin ends
+static void serveIncremental(char *Output) {
+    incremental State;
+    incrementalInit(&State, "", 0);
+    char *Text = 0;
+    char Line[128];
+
+    while(fgets(Line, sizeof(Line), stdin)) {
+        size_t Offset, Deleted, Length = 0;
+        bool Set = sscanf(Line, "s %zu", &Length) == 1;
+        bool Edit = !Set && sscanf(Line, "e %zu %zu %zu", &Offset, &Deleted, &Length) == 3;
+        bufFit(Text, Length);
+        if(fread(Text, 1, Length, stdin) != Length) {
+            fatalError("Truncated command");
+        }
 
-static expression *expressionBinaryNew(token_type Op, expression *Lhs, expression *Rhs) {
-    expression *Result = expressionNew(Expression_Binary);
-    Result->Binary.Op = Op;
-    Result->Binary.Lhs = Lhs;
-    Result->Binary.Rhs = Rhs;
-    return Result;
+        if(Set) {
+            incrementalFree(&State);
+            incrementalAnswer(&State, incrementalInit(&State, Text, Length));
+        } else if(Edit) {
+            size_t SourceLength = incrementalSourceLength(&State);
+            if(Offset > SourceLength || Deleted > SourceLength - Offset) {
+                printf("error %zu Edit past the end of the source\n", Offset);
+            } else {
+                incrementalAnswer(&State, incrementalEdit(&State, Offset, Deleted, Text, Length));
+            }
+        } else if(strcmp(Line, "w\n") == 0) {
+            if(!State.Valid) {
+                incrementalAnswer(&State, false);
+            } else if(!writeFileAtomic(Output, State.Code, bufLength(State.Code), 0644)) {
+                printf("error 0 Could not write %s: %s\n", Output, strerror(errno));
+            } else {
+                printf("ok 0 0 0 0\n");
+            }
+        } else {
+            printf("error 0 Unknown command\n");
+        }
+        fflush(stdout);
+    }
+
+    bufFree(Text);
+    incrementalFree(&State);
 }
 
+// NOTE: Sources past 2*FrontendDefaultGrain bytes are parsed on ThreadCount threads, below that
+// starting the threads costs more than they save. Source must be writable. The pieces are lexed
+// for 32 bits, so --wide and --bigint sources are always parsed sequentially.
+static expression *compilerParse(lexer *Lexer, arena *Arena, char *Source, int ThreadCount) {
+    size_t Length = strlen(Source);
+    if(ThreadCount < 2 || Lexer->Wide || Lexer->Unbounded || Length < 2*FrontendDefaultGrain) {
+        return parseExpression(Lexer, Arena, Source);
+    }
 
-// Parser
-typedef enum operator_assoc {
-    Assoc_Left,
-    Assoc_Right,
-} operator_assoc;
-
-typedef enum operator_kind {
-    Operator_NoOp,
-    Operator_Unary,
-    Operator_Binary,
-} operator_kind;
-
-typedef struct operator {
-    operator_kind Kind;
-    int Precedence;
-    operator_assoc Associativity;
-} operator;
-
-static operator Table[Token_Count] = {
-    [Token_Add]        = {Operator_Binary, 0, Assoc_Left},
-    [Token_Subtract]   = {Operator_Binary, 0, Assoc_Left},
-    [Token_BitOr]      = {Operator_Binary, 0, Assoc_Left},
-    [Token_BitXor]     = {Operator_Binary, 0, Assoc_Left},
-
-    [Token_Multiply]   = {Operator_Binary, 1, Assoc_Left},
-    [Token_Divide]     = {Operator_Binary, 1, Assoc_Left},
-    [Token_Mod]        = {Operator_Binary, 1, Assoc_Left},
-    [Token_LShift]     = {Operator_Binary, 1, Assoc_Left},
-    [Token_RShift]     = {Operator_Binary, 1, Assoc_Left},
-    [Token_BitAnd]     = {Operator_Binary, 1, Assoc_Left},
-
-    [Token_Power]      = {Operator_Binary, 2, Assoc_Right},
-
-    [Token_UnaryPlus]  = {Operator_Unary,  3, Assoc_Right},
-    [Token_UnaryMinus] = {Operator_Unary,  3, Assoc_Right},
-    [Token_BitNot]     = {Operator_Unary,  3, Assoc_Right},
-};
-
-static bool isBinaryOp(void) {
-    return Table[Token.Type].Kind == Operator_Binary;
+    thread_pool Pool;
+    threadPoolInit(&Pool, ThreadCount);
+    expression *Ast = parseExpressionParallel(&Pool, Lexer, Arena, Source, Length, FrontendDefaultGrain);
+    threadPoolFree(&Pool);
+    return Ast;
 }
 
-static bool isUnaryOp(void) {
-    if(Token.Type == Token_Add) {
-        Token.Type = Token_UnaryPlus;
+// NOTE: --eval, the tree is evaluated the way executeVm() would run its bytecode. Sources past
+// 2*ParallelDefaultGrain bytes are split into tasks for ThreadCount threads, see parallel.c,
+// and the same pool parses them once they are large enough for that too.
+static int evaluateSource(char *Source, char **Args, int ArgCount, int ThreadCount) {
+    int32_t Params[MaxParamCount] = {};
+    for(int Index = 0; Index < ArgCount && Index < MaxParamCount; ++Index) {
+        Params[Index] = strtol(Args[Index], 0, 0);
     }
-    else if(Token.Type == Token_Subtract) {
-        Token.Type = Token_UnaryMinus;
-    }
-    return Table[Token.Type].Kind == Operator_Unary;
-}
 
-static expression *parse(int);
+    size_t Length = strlen(Source);
+    bool Parallel = ThreadCount > 1 && Length >= 2*ParallelDefaultGrain;
+    thread_pool Pool;
+    if(Parallel) {
+        threadPoolInit(&Pool, ThreadCount);
+    }
 
-static expression *parseUnary(void) {
-    expression *Result;
+    perfBegin(Phase_Parse);
+    lexer Lexer = {};
+    arena Arena = {};
+    expression *Ast = parseExpressionParallel(Parallel ? &Pool : 0, &Lexer, &Arena, Source, Length, FrontendDefaultGrain);
+    perfEnd(Phase_Parse);
+    if(Lexer.Error != Error_None) {
+        if(Parallel) {
+            threadPoolFree(&Pool);
+        }
+        return 1;
+    }
 
-    if(isUnaryOp()) {
-        token_type Op = Token.Type;
+    perfBegin(Phase_Execute);
+    bool Trapped = false;
+    int32_t Result = expressionEvaluateParallel(Parallel ? &Pool : 0, Ast, Params, ParallelDefaultGrain, &Trapped);
+    perfEnd(Phase_Execute);
 
-        nextToken();
-        Result = expressionUnaryNew(Op, parse(Table[Op].Precedence));
+    if(Parallel) {
+        threadPoolFree(&Pool);
     }
-    else if(matchToken(Token_LParen)) {
-        Result = parse(0);
-        expectToken(Token_RParen);
+    if(Trapped) {
+        fatalError(VmErrorMessages[VmError_DivisionByZero]);
     }
-    else if(Token.Type == Token_Int) {
-        Result = expressionIntNew(Token.IntValue);
-        nextToken();
+
+    printf("Result: %d\n", Result);
+    perfReport();
+    arenaFree(&Arena);
+    return 0;
+}
+
+static int compileBatch(char *Input, char *Output, int LutBits, specialize_bindings *Bindings, int ThreadCount) {
+    perfInit();
+    perfBegin(Phase_Load);
+    size_t Length;
+    char *Text = (char *)readEntireFile(Input, &Length);
+    char **Lines = batchSplitLines(Text, Length);
+    perfEnd(Phase_Load);
+
+    perfBegin(Phase_Emit);
+    thread_pool Pool;
+    threadPoolInit(&Pool, ThreadCount);
+    uint8_t *Module = 0;
+    batch_error *Errors = 0;
+    batchCompile(&Pool, Lines, bufLength(Lines), LutBits, Bindings, &Module, &Errors);
+    threadPoolFree(&Pool);
+    perfEnd(Phase_Emit);
+
+    for(size_t Index = 0; Index < bufLength(Errors); ++Index) {
+        fprintf(stderr, "%s:%zu: %s (at offset %zu)\n", Input, Errors[Index].Line + 1,
+                ErrorMessages[Errors[Index].Error], Errors[Index].Offset);
     }
-    else {
-        parseError("No expected token available.\n");
-        exit(1);
+    if(!writeFileAtomic(Output, Module, bufLength(Module), 0644)) {
+        fatalError("Could not write %s: %s", Output, strerror(errno));
     }
 
-    return Result;
+    int Status = bufLength(Errors) ? 1 : 0;
+    bufFree(Errors);
+    bufFree(Module);
+    bufFree(Lines);
+    free(Text);
+    perfReport();
+    return Status;
 }
 
-static expression *parse(int Precedence) {
-    expression *Result = parseUnary();
+int main(int ArgCount, char *ArgVal[]) {
+    int LutBits = LutDefaultBits;
+    bool Debug = false;
+    bool Wide = false;
+    bool Big = false;
+    montgomery Mont = {};
+    char *CacheDir = 0;
+    uint64_t CacheBytes = (uint64_t)CacheDefaultMegabytes << 20;
+    specialize_bindings Bindings = {};
+    bool Specialized = false;
+    bool Incremental = false;
+    bool Eval = false;
+    char *BatchInput = 0, *ModuleOutput = 0;
+    char *SourcePath = 0;
+    int ThreadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    // NOTE: EXPR and OUTPUT, or EXPR and the parameters with --eval
+    char *Positional[1 + MaxParamCount];
+    int PositionalCount = 0;
+
+    for(int Index = 1; Index < ArgCount; ++Index) {
+        if(strcmp(ArgVal[Index], "--lut-bits") == 0 && Index+1 < ArgCount) {
+            LutBits = atoi(ArgVal[++Index]);
+            if(LutBits < 0 || LutBits > MaxLutBits) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "--debug") == 0) {
+            Debug = true;
+        }
+        else if(strcmp(ArgVal[Index], "--wide") == 0) {
+            Wide = true;
+        }
+        else if(strcmp(ArgVal[Index], "--bigint") == 0) {
+            Big = true;
+        }
+        else if(strcmp(ArgVal[Index], "--mod") == 0 && Index+1 < ArgCount) {
+            char *End;
+            unsigned long long Modulus = strtoull(ArgVal[++Index], &End, 0);
+            if(*End || Modulus > UINT32_MAX || !montInit(&Mont, Modulus)) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "--bind") == 0 && Index+1 < ArgCount) {
+            char *End;
+            long Param = strtol(ArgVal[++Index], &End, 10);
+            if(*End != '=' || End == ArgVal[Index] || Param < 0 || Param >= MaxParamCount) {
+                usage(ArgVal[0]);
+            }
+            char *Value = End + 1;
+            long long Parsed = strtoll(Value, &End, 0);
+            if(*End || End == Value || Parsed < INT32_MIN || Parsed > UINT32_MAX) {
+                usage(ArgVal[0]);
+            }
+            Bindings.Bound[Param] = true;
+            Bindings.Values[Param] = (int32_t)Parsed;
+            Specialized = true;
+        }
+        else if(strcmp(ArgVal[Index], "--cache-dir") == 0 && Index+1 < ArgCount) {
+            CacheDir = ArgVal[++Index];
+        }
+        else if(strcmp(ArgVal[Index], "--cache-size") == 0 && Index+1 < ArgCount) {
+            CacheBytes = strtoull(ArgVal[++Index], 0, 0) << 20;
+        }
+        else if(strcmp(ArgVal[Index], "--source") == 0 && Index+1 < ArgCount) {
+            SourcePath = ArgVal[++Index];
+        }
+        else if(strcmp(ArgVal[Index], "--batch") == 0 && Index+1 < ArgCount) {
+            BatchInput = ArgVal[++Index];
+        }
+        else if(strcmp(ArgVal[Index], "-o") == 0 && Index+1 < ArgCount) {
+            ModuleOutput = ArgVal[++Index];
+        }
+        else if(strcmp(ArgVal[Index], "--threads") == 0 && Index+1 < ArgCount) {
+            ThreadCount = atoi(ArgVal[++Index]);
+            if(ThreadCount < 1) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "--incremental") == 0) {
+            Incremental = true;
+        }
+        else if(strcmp(ArgVal[Index], "--eval") == 0) {
+            Eval = true;
+        }
+        else if(perfParseOption(ArgVal[Index])) {}
+        else if(PositionalCount < (int)arrayCount(Positional)) {
+            Positional[PositionalCount++] = ArgVal[Index];
+        }
+        else {
+            usage(ArgVal[0]);
+        }
+    }
 
-    while(Table[Token.Type].Precedence >= Precedence &&
-          (Token.Type != Token_EOF && Token.Type != Token_RParen))
-    {
-        if(!isBinaryOp()) {
-            parseError("Missing expected binary operator.\n");
-            exit(1);
+    if(Incremental) {
+        if(PositionalCount != 1) {
+            usage(ArgVal[0]);
         }
+        serveIncremental(Positional[0]);
+        return 0;
+    }
 
-        token_type Op = Token.Type;
+    // NOTE: The passes recurse once per operator of a chain, which a long sum or comparison easily
+    // makes deeper than the default stack. Raised before any mode is dispatched.
+    struct rlimit Stack;
+    if(getrlimit(RLIMIT_STACK, &Stack) == 0 && Stack.rlim_cur != RLIM_INFINITY) {
+        Stack.rlim_cur = Stack.rlim_max;
+        setrlimit(RLIMIT_STACK, &Stack);
+    }
 
-        nextToken();
-        expression *Rhs;
-        if(Table[Op].Associativity == Assoc_Left) {
-            Rhs = parse(Table[Op].Precedence + 1);
-        } else {
-            assert(Table[Op].Associativity == Assoc_Right);
-            Rhs = parse(Table[Op].Precedence);
+    // NOTE: Debug sections, modular programs and the cache are per file, a module has none of them
+    if(BatchInput) {
+        if(!ModuleOutput || PositionalCount || Debug || Mont.Modulus || Wide || Big || CacheDir || SourcePath || Eval) {
+            usage(ArgVal[0]);
         }
-
-        Result = expressionBinaryNew(Op, Result, Rhs);
+        return compileBatch(BatchInput, ModuleOutput, LutBits, Specialized ? &Bindings : 0, ThreadCount);
     }
 
-    return Result;
-}
+    // NOTE: Evaluating writes no program, none of the options for one apply
+    if(Eval) {
+        if((!SourcePath && !PositionalCount) || ModuleOutput || Debug || Mont.Modulus || Wide || Big || Specialized ||
+           CacheDir)
+        {
+            usage(ArgVal[0]);
+        }
 
+        perfInit();
+        char *Source = SourcePath ? (char *)readEntireFile(SourcePath, 0) : Positional[0];
+        int First = SourcePath ? 0 : 1;
+        return evaluateSource(Source, Positional + First, PositionalCount - First, ThreadCount);
+    }
 
-// Binary generator
-#define caseInstr(C, I) case C: { Instr = I; } break;
-static void printBinary(FILE *File, expression *Node) {
-    switch(Node->Type) {
-        case Expression_Int: {
-            uint8_t Data[] = {
-                LIT,
-                (Node->IntValue >>  0) & 0xFF,
-                (Node->IntValue >>  8) & 0xFF,
-                (Node->IntValue >> 16) & 0xFF,
-                (Node->IntValue >> 24) & 0xFF,
-            };
-            fwrite(Data, 1, sizeof(Data), File);
-        } break;
-
-        case Expression_Unary: {
-            printBinary(File, Node->Unary.Expr);
-
-            uint8_t Instr = NOP;
-            switch(Node->Unary.Op) {
-                case Token_UnaryPlus: {} break;
-                caseInstr(Token_UnaryMinus, SYM);
-                caseInstr(Token_BitNot, NOT);
-
-                InvalidDefaultCase;
-            }
+    // NOTE: The 32-bit passes would fold and rewrite wide and bigint trees with the wrong semantics
+    if(PositionalCount != (SourcePath ? 1 : 2) || ModuleOutput || (Debug && Mont.Modulus) || (Specialized && Mont.Modulus) ||
+       (Wide && (Debug || Mont.Modulus || Specialized)) || (Big && (Debug || Mont.Modulus || Wide || Specialized)))
+    {
+        usage(ArgVal[0]);
+    }
 
-            if(Instr != NOP) {
-                fwrite(&Instr, 1, sizeof(Instr), File);
-            }
-        } break;
-
-        case Expression_Binary: {
-            printBinary(File, Node->Binary.Lhs);
-            printBinary(File, Node->Binary.Rhs);
-
-            uint8_t Instr = NOP;
-            switch(Node->Binary.Op) {
-                caseInstr(Token_Add,      ADD);
-                caseInstr(Token_Subtract, SUB);
-                caseInstr(Token_BitOr,    OR);
-                caseInstr(Token_BitXor,   XOR);
-                caseInstr(Token_Multiply, MUL);
-                caseInstr(Token_Divide,   DIV);
-                caseInstr(Token_Mod,      MOD);
-                caseInstr(Token_LShift,   LSH);
-                caseInstr(Token_RShift,   RSH);
-                caseInstr(Token_BitAnd,   AND);
-                caseInstr(Token_Power,    POW);
-
-                InvalidDefaultCase;
-            }
+    perfInit();
 
-            assert(Instr != NOP);
-            fwrite(&Instr, 1, sizeof(Instr), File);
-        } break;
+    char *Source = Positional[0], *Output = Positional[PositionalCount - 1];
+    if(SourcePath) {
+        perfBegin(Phase_Load);
+        Source = (char *)readEntireFile(SourcePath, 0);
+        perfEnd(Phase_Load);
+    }
+    char Key[CacheKeyLength + 1];
+    bool Cacheable = CacheDir && cacheKey(Source, LutBits, Debug, Mont.Modulus, Wide, Big, &Bindings, Key);
+
+    // NOTE: A cache hit replaces the whole pipeline by loading the cached bytecode
+    if(Cacheable) {
+        perfBegin(Phase_Load);
+        bool Cached = cacheFetch(CacheDir, Key, Output);
+        perfEnd(Phase_Load);
+        if(Cached) {
+            perfReport();
+            return 0;
+        }
     }
-}
-
-static void outputBinary(char *Path, expression *Ast) {
-    FILE *File = fopen(Path, "wb");
 
-    printBinary(File, Ast);
-    fwrite((uint8_t[]){HALT}, 1, 1, File);
+    // NOTE: The parser pulls tokens on demand, a separate pass isolates the cost of lexing
+    if(Perf.Format) {
+        perfBegin(Phase_Lex);
+        lexerCountTokens(Source);
+        perfEnd(Phase_Lex);
+    }
 
-    fclose(File);
-}
+    perfBegin(Phase_Parse);
+    lexer Lexer = {.Wide = Wide, .Unbounded = Big};
+    arena Arena = {};
+    expression *Ast = compilerParse(&Lexer, &Arena, Source, ThreadCount);
+    perfEnd(Phase_Parse);
 
-int main(int ArgCount, char *ArgVal[]) {
-    if(ArgCount != 3) {
-        fprintf(stderr, "Usage: %s EXPR OUTPUT\n", ArgVal[0]);
-        exit(1);
+    // NOTE: Errors the parser recovers from were printed already, but the tree holds a placeholder
+    // where they happened, so no program is written for it
+    if(Lexer.Error != Error_None) {
+        return 1;
     }
 
-    Stream = ArgVal[1];
-    nextToken();
-    expression *Ast = parse(0);
+    perfBegin(Phase_Emit);
+    uint8_t *Code = 0;
+    debug_span *Spans = 0;
+    // NOTE: Tables and folding hold int32_t results, modular programs fold residues themselves
+    if(Mont.Modulus) {
+        modCompile(&Code, &Arena, &Mont, Source, Ast);
+        bufPush(Code, HALT);
+    } else if(Wide) {
+        printBinaryWide(&Code, Ast);
+        bufPush(Code, HALT);
+    } else if(Big) {
+        printBinaryBig(&Code, Ast, Source);
+        bufPush(Code, HALT);
+    } else {
+        compileAst(&Code, &Arena, Ast, LutBits, Specialized ? &Bindings : 0, Debug ? &Spans : 0);
+    }
+    if(Debug) {
+        printDebugSection(&Code, Spans, Source);
+        bufFree(Spans);
+    }
+    perfEnd(Phase_Emit);
 
-    outputBinary(ArgVal[2], Ast);
+    if(!writeFileAtomic(Output, Code, bufLength(Code), 0644)) {
+        fatalError("Could not write %s: %s", Output, strerror(errno));
+    }
+    if(Cacheable) {
+        cacheStore(CacheDir, Key, Code, bufLength(Code), CacheBytes);
+    }
 
+    bufFree(Code);
+    perfReport();
     return 0;
 }
@@ -0,0 +1,587 @@
+// Evaluation daemon: keeps compiled programs in memory and answers requests over a Unix domain
+// socket, so clients pay neither process startup nor recompilation per expression.
+//
+// All integers are little-endian. A request is
+//
+//   u32 Length              bytes following this field
+//   u8  Type                Request_Expression, Request_Bytecode or Request_Stats
+//   u8  ParamCount          parameters not supplied read as 0
+//   i32 Params[ParamCount]
+//   u8  Payload[]           expression source or compiled bytecode, empty for stats
+//
+// and every request gets a response, in request order:
+//
+//   u32 Length
+//   u8  Status              Status_Ok or the kind of failure
+//   ...                     i32 result, stats text, or u32 source offset followed by a message
+//
+// Clients may pipeline any number of requests. Everything that arrived with one read is answered
+// with a single write.
+//
+// Expressions run tiered, see tiered.c: one that is requested only a few times is never compiled,
+// one that is requested often ends up with the fastest bytecode. --warm and --hot set the request
+// counts at which an expression moves up a tier.
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <specialize.c>
+#include <vm.c>
+#include <peephole.c>
+#include <compile.c>
+#include <tiered.c>
+
+enum {
+    MaxClients = 256,
+    ReadSize = 1<<16,
+    MaxFrameSize = 1<<24,
+
+    // NOTE: A client that does not read its responses is not served again until it caught up
+    MaxPendingOutput = 1<<22,
+
+    DefaultCacheSize = 1<<12,
+    LatencySamples = 1<<16,
+};
+
+typedef enum request_type {
+    Request_Expression = 1,
+    Request_Bytecode   = 2,
+    Request_Stats      = 3,
+} request_type;
+
+typedef enum response_status {
+    Status_Ok           = 0,
+    Status_CompileError = 1,
+    Status_RuntimeError = 2,
+    Status_BadRequest   = 3,
+} response_status;
+
+typedef struct cache_entry {
+    uint64_t Hash;
+    uint32_t SourceLength;
+    tiered_program Program;
+
+    struct cache_entry *Chain;
+    // NOTE: Recency list, most recently used first
+    struct cache_entry *Prev, *Next;
+
+    // NOTE: NUL-terminated, programs recompile from it when they move up a tier
+    char Source[];
+} cache_entry;
+
+// NOTE: LRU cache of tiered programs, keyed by the hash of their source text. Entries keep the
+// source so that hash collisions never return the wrong program.
+typedef struct program_cache {
+    cache_entry **Buckets;
+    size_t BucketMask;
+    cache_entry *Newest, *Oldest;
+    size_t Count, Capacity;
+    uint64_t Hits, Misses;
+} program_cache;
+
+typedef struct daemon_stats {
+    uint64_t Requests[Request_Stats + 1];
+    uint64_t Errors;
+    uint64_t TierRuns[Tier_Count];
+    uint64_t LatencyCount;
+    uint32_t Latencies[LatencySamples];
+} daemon_stats;
+
+typedef struct client {
+    int Socket;
+    uint8_t *Input;
+    uint8_t *Output;
+    size_t OutputSent;
+} client;
+
+static program_cache Cache;
+static daemon_stats Stats;
+static tier_config TierConfig = {TierDefaultWarm, TierDefaultHot};
+static vm_context Context;
+static int32_t Params[MaxParamCount];
+
+static void cacheInit(program_cache *Cache, size_t Capacity) {
+    size_t BucketCount = 16;
+    while(BucketCount < 2*Capacity) {
+        BucketCount *= 2;
+    }
+
+    *Cache = (program_cache){};
+    Cache->Buckets = xMalloc(BucketCount*sizeof(*Cache->Buckets));
+    memset(Cache->Buckets, 0, BucketCount*sizeof(*Cache->Buckets));
+    Cache->BucketMask = BucketCount - 1;
+    Cache->Capacity = max(Capacity, 1);
+}
+
+static void cacheUnlink(program_cache *Cache, cache_entry *Entry) {
+    *(Entry->Prev ? &Entry->Prev->Next : &Cache->Newest) = Entry->Next;
+    *(Entry->Next ? &Entry->Next->Prev : &Cache->Oldest) = Entry->Prev;
+}
+
+static void cachePushNewest(program_cache *Cache, cache_entry *Entry) {
+    Entry->Prev = 0;
+    Entry->Next = Cache->Newest;
+    *(Cache->Newest ? &Cache->Newest->Prev : &Cache->Oldest) = Entry;
+    Cache->Newest = Entry;
+}
+
+static cache_entry *cacheFind(program_cache *Cache, uint64_t Hash, char *Source, uint32_t Length) {
+    for(cache_entry *Entry = Cache->Buckets[Hash & Cache->BucketMask]; Entry; Entry = Entry->Chain) {
+        if(Entry->Hash == Hash && Entry->SourceLength == Length && memcmp(Entry->Source, Source, Length) == 0) {
+            cacheUnlink(Cache, Entry);
+            cachePushNewest(Cache, Entry);
+            return Entry;
+        }
+    }
+
+    return 0;
+}
+
+static void cacheEvictOldest(program_cache *Cache) {
+    cache_entry *Entry = Cache->Oldest;
+    cache_entry **Link = &Cache->Buckets[Entry->Hash & Cache->BucketMask];
+    while(*Link != Entry) {
+        Link = &(*Link)->Chain;
+    }
+    *Link = Entry->Chain;
+
+    cacheUnlink(Cache, Entry);
+    tieredFree(&Entry->Program);
+    free(Entry);
+    --Cache->Count;
+}
+
+// NOTE: Ast is the tree parsed from Source, the entry keeps its own copy of both
+static cache_entry *cacheInsert(program_cache *Cache, uint64_t Hash, char *Source, uint32_t Length, expression *Ast) {
+    if(Cache->Count == Cache->Capacity) {
+        cacheEvictOldest(Cache);
+    }
+
+    cache_entry *Entry = xMalloc(sizeof(cache_entry) + Length + 1);
+    Entry->Hash = Hash;
+    Entry->SourceLength = Length;
+    memcpy(Entry->Source, Source, Length);
+    Entry->Source[Length] = 0;
+    tieredInit(&Entry->Program, Entry->Source, Ast);
+
+    cache_entry **Bucket = &Cache->Buckets[Hash & Cache->BucketMask];
+    Entry->Chain = *Bucket;
+    *Bucket = Entry;
+    cachePushNewest(Cache, Entry);
+    ++Cache->Count;
+
+    return Entry;
+}
+
+static uint32_t readU32(uint8_t *Bytes) {
+    return Bytes[0] | Bytes[1] << 8 | Bytes[2] << 16 | (uint32_t)Bytes[3] << 24;
+}
+
+static void emitU32(uint8_t **Output, uint32_t Value) {
+    uint8_t Bytes[4] = {Value, Value >> 8, Value >> 16, Value >> 24};
+    emitBytes(Output, Bytes, sizeof(Bytes));
+}
+
+// NOTE: Responses are written in place, the length is patched once the payload is known
+static size_t beginResponse(uint8_t **Output, response_status Status) {
+    size_t Start = bufLength(*Output);
+    emitU32(Output, 0);
+    bufPush(*Output, Status);
+    return Start;
+}
+
+static void endResponse(uint8_t **Output, size_t Start) {
+    uint32_t Length = bufLength(*Output) - Start - 4;
+    uint8_t *Bytes = *Output + Start;
+    Bytes[0] = Length;
+    Bytes[1] = Length >> 8;
+    Bytes[2] = Length >> 16;
+    Bytes[3] = Length >> 24;
+}
+
+static void respondError(uint8_t **Output, response_status Status, uint32_t Offset, char *Message) {
+    size_t Start = beginResponse(Output, Status);
+    emitU32(Output, Offset);
+    emitBytes(Output, Message, strlen(Message));
+    endResponse(Output, Start);
+    ++Stats.Errors;
+}
+
+static void respondResult(uint8_t **Output, int32_t Result) {
+    size_t Start = beginResponse(Output, Status_Ok);
+    emitU32(Output, Result);
+    endResponse(Output, Start);
+}
+
+static int compareLatency(const void *A, const void *B) {
+    uint32_t Lhs = *(uint32_t *)A, Rhs = *(uint32_t *)B;
+    return (Lhs > Rhs) - (Lhs < Rhs);
+}
+
+// NOTE: Percentiles are taken over the most recent LatencySamples requests
+static void respondStats(uint8_t **Output) {
+    size_t Count = min(Stats.LatencyCount, (uint64_t)LatencySamples);
+    uint32_t *Sorted = xMalloc(max(Count, 1)*sizeof(uint32_t));
+    memcpy(Sorted, Stats.Latencies, Count*sizeof(uint32_t));
+    qsort(Sorted, Count, sizeof(uint32_t), compareLatency);
+
+    uint64_t Lookups = Cache.Hits + Cache.Misses;
+    char Text[1024];
+    int Length = snprintf(Text, sizeof(Text),
+                          "expression_requests %llu\n"
+                          "bytecode_requests %llu\n"
+                          "errors %llu\n"
+                          "cache_entries %zu\n"
+                          "cache_hits %llu\n"
+                          "cache_misses %llu\n"
+                          "cache_hit_rate %.4f\n"
+                          "latency_p50_ns %u\n"
+                          "latency_p99_ns %u\n",
+                          (unsigned long long)Stats.Requests[Request_Expression],
+                          (unsigned long long)Stats.Requests[Request_Bytecode],
+                          (unsigned long long)Stats.Errors,
+                          Cache.Count,
+                          (unsigned long long)Cache.Hits,
+                          (unsigned long long)Cache.Misses,
+                          Lookups ? (double)Cache.Hits/Lookups : 0.0,
+                          Count ? Sorted[(Count - 1)*50/100] : 0,
+                          Count ? Sorted[(Count - 1)*99/100] : 0);
+    for(int Tier = 0; Tier < Tier_Count; ++Tier) {
+        Length += snprintf(Text + Length, sizeof(Text) - Length, "tier_%s_runs %llu\n", TierNames[Tier],
+                           (unsigned long long)Stats.TierRuns[Tier]);
+    }
+    free(Sorted);
+
+    size_t Start = beginResponse(Output, Status_Ok);
+    emitBytes(Output, Text, Length);
+    endResponse(Output, Start);
+}
+
+// NOTE: Source is NUL-terminated by the caller. Returns 0 and reports the error on failure.
+static cache_entry *compileSource(uint8_t **Output, uint64_t Hash, char *Source, uint32_t Length) {
+    lexer Lexer = {};
+    arena Arena = {};
+    cache_entry *Entry = 0;
+
+    // NOTE: Checked up front, so the tree tier rejects exactly what the bytecode tiers would
+    expression *Ast = tryParseExpression(&Lexer, &Arena, Source);
+    if(!Ast) {
+        respondError(Output, Status_CompileError, Lexer.ErrorOffset, ErrorMessages[Lexer.Error]);
+    }
+    else if(expressionStackDepth(Ast) > VmStackSize) {
+        respondError(Output, Status_CompileError, 0, "Expression is nested too deeply.");
+    }
+    else {
+        Entry = cacheInsert(&Cache, Hash, Source, Length, Ast);
+    }
+
+    arenaFree(&Arena);
+    return Entry;
+}
+
+static void respondRun(uint8_t **Output, vm_error Error, int32_t Result) {
+    if(Error) {
+        respondError(Output, Status_RuntimeError, 0, VmErrorMessages[Error]);
+    } else {
+        respondResult(Output, Result);
+    }
+}
+
+static void runProgram(uint8_t **Output, uint8_t *Code) {
+    vmInit(&Context, Code, Params);
+    while(!vmRun(&Context, UINT32_MAX)) {}
+    respondRun(Output, Context.Error, Context.Result);
+}
+
+static void readParams(uint8_t *Frame, int Supplied, int ParamCount) {
+    for(int Param = 0; Param < ParamCount; ++Param) {
+        Params[Param] = Param < Supplied ? (int32_t)readU32(Frame + 2 + 4*Param) : 0;
+    }
+}
+
+static uint64_t nowNanoseconds(void) {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return Time.tv_sec*1000000000ull + Time.tv_nsec;
+}
+
+static void evaluateRequest(uint8_t **Output, request_type Type, uint8_t *Frame, uint32_t Length) {
+    int Supplied = Frame[1];
+    uint8_t *Payload = Frame + 2 + 4*Supplied;
+    uint32_t PayloadLength = Length - 2 - 4*Supplied;
+
+    if(Type == Request_Expression) {
+        char *Source = (char *)Payload;
+        uint64_t Hash = hashBytes(Source, PayloadLength, HashSeed);
+        cache_entry *Entry = cacheFind(&Cache, Hash, Source, PayloadLength);
+
+        if(Entry) {
+            ++Cache.Hits;
+        } else {
+            ++Cache.Misses;
+
+            // NOTE: The lexer stops at the first NUL, which would silently truncate the expression
+            char *Nul = memchr(Source, 0, PayloadLength);
+            if(Nul) {
+                respondError(Output, Status_CompileError, Nul - Source, ErrorMessages[Error_UnexpectedToken]);
+                return;
+            }
+
+            char *Terminated = xMalloc(PayloadLength + 1);
+            memcpy(Terminated, Source, PayloadLength);
+            Terminated[PayloadLength] = 0;
+            Entry = compileSource(Output, Hash, Terminated, PayloadLength);
+            free(Terminated);
+
+            if(!Entry) {
+                return;
+            }
+        }
+
+        readParams(Frame, Supplied, Entry->Program.ParamCount);
+        int32_t Result;
+        vm_error Error = tieredRun(&Entry->Program, &TierConfig, &Context, Params, &Result);
+        ++Stats.TierRuns[Entry->Program.Tier];
+        respondRun(Output, Error, Result);
+    } else {
+        int ParamCount = 0;
+        if(!vmValidate(Payload, PayloadLength, &ParamCount)) {
+            respondError(Output, Status_BadRequest, 0, "Invalid bytecode.");
+            return;
+        }
+
+        // NOTE: Frames are unaligned views into the input buffer, the VM gets its own copy
+        uint8_t *Code = xMalloc(PayloadLength);
+        memcpy(Code, Payload, PayloadLength);
+        readParams(Frame, Supplied, ParamCount);
+        runProgram(Output, Code);
+        free(Code);
+    }
+}
+
+static void handleRequest(uint8_t **Output, uint8_t *Frame, uint32_t Length) {
+    if(Length < 2 || Length - 2 < 4u*Frame[1]) {
+        respondError(Output, Status_BadRequest, 0, "Truncated request.");
+        return;
+    }
+
+    request_type Type = Frame[0];
+    if(Type == Request_Stats) {
+        respondStats(Output);
+    }
+    else if(Type == Request_Expression || Type == Request_Bytecode) {
+        uint64_t Start = nowNanoseconds();
+        evaluateRequest(Output, Type, Frame, Length);
+        ++Stats.Requests[Type];
+
+        uint64_t Elapsed = nowNanoseconds() - Start;
+        Stats.Latencies[Stats.LatencyCount++ % LatencySamples] = min(Elapsed, (uint64_t)UINT32_MAX);
+    }
+    else {
+        respondError(Output, Status_BadRequest, 0, "Unknown request type.");
+    }
+}
+
+// NOTE: Answers every complete frame in the input buffer and keeps a trailing partial one.
+// Returns false on a malformed stream, after which the connection is dropped.
+static bool processInput(client *Client) {
+    uint8_t *At = Client->Input;
+    uint8_t *End = bufEnd(Client->Input);
+
+    while(End - At >= 4) {
+        uint32_t Length = readU32(At);
+        if(Length > MaxFrameSize) {
+            return false;
+        }
+        if((size_t)(End - At) - 4 < Length) {
+            break;
+        }
+
+        handleRequest(&Client->Output, At + 4, Length);
+        At += 4 + Length;
+    }
+
+    size_t Remaining = End - At;
+    memmove(Client->Input, At, Remaining);
+    if(Client->Input) {
+        bufHeader_(Client->Input)->Length = Remaining;
+    }
+    return true;
+}
+
+// NOTE: Returns false once the peer is gone
+static bool flushOutput(client *Client) {
+    size_t Pending = bufLength(Client->Output) - Client->OutputSent;
+    while(Pending) {
+        ssize_t Written = send(Client->Socket, Client->Output + Client->OutputSent, Pending, MSG_NOSIGNAL);
+        if(Written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        Client->OutputSent += Written;
+        Pending -= Written;
+    }
+
+    if(Client->Output) {
+        bufHeader_(Client->Output)->Length = 0;
+    }
+    Client->OutputSent = 0;
+    return true;
+}
+
+// NOTE: Returns false once the peer is gone
+static bool readInput(client *Client) {
+    bufFit(Client->Input, bufLength(Client->Input) + ReadSize);
+    size_t Used = bufLength(Client->Input);
+
+    ssize_t Received = recv(Client->Socket, Client->Input + Used, ReadSize, 0);
+    if(Received < 0) {
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    if(Received == 0) {
+        return false;
+    }
+
+    bufHeader_(Client->Input)->Length = Used + Received;
+    return processInput(Client) && flushOutput(Client);
+}
+
+static void closeClient(client *Client) {
+    close(Client->Socket);
+    bufFree(Client->Input);
+    bufFree(Client->Output);
+}
+
+static int listenOn(char *Path) {
+    struct sockaddr_un Address = {.sun_family = AF_UNIX};
+    if(strlen(Path) >= sizeof(Address.sun_path)) {
+        fatalError("Socket path too long: %s", Path);
+    }
+    strcpy(Address.sun_path, Path);
+
+    int Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(Socket < 0) {
+        fatalError("Cannot create socket: %s", strerror(errno));
+    }
+
+    unlink(Path);
+    if(bind(Socket, (struct sockaddr *)&Address, sizeof(Address)) < 0 || listen(Socket, SOMAXCONN) < 0) {
+        fatalError("Cannot listen on %s: %s", Path, strerror(errno));
+    }
+
+    return Socket;
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    size_t CacheSize = DefaultCacheSize;
+    char *Path = 0;
+
+    for(int Index = 1; Index < ArgCount; ++Index) {
+        if(strcmp(ArgVal[Index], "--cache-size") == 0 && Index + 1 < ArgCount) {
+            CacheSize = strtoull(ArgVal[++Index], 0, 0);
+        } else if(strcmp(ArgVal[Index], "--warm") == 0 && Index + 1 < ArgCount) {
+            TierConfig.WarmThreshold = strtoull(ArgVal[++Index], 0, 0);
+        } else if(strcmp(ArgVal[Index], "--hot") == 0 && Index + 1 < ArgCount) {
+            TierConfig.HotThreshold = strtoull(ArgVal[++Index], 0, 0);
+        } else if(!Path) {
+            Path = ArgVal[Index];
+        } else {
+            Path = 0;
+            break;
+        }
+    }
+
+    if(!Path) {
+        fprintf(stderr, "Usage: %s [--cache-size N] [--warm N] [--hot N] SOCKET\n", ArgVal[0]);
+        fprintf(stderr, "  --warm N  Compile an expression to bytecode after N requests (default: %d)\n",
+                TierDefaultWarm);
+        fprintf(stderr, "  --hot N   Recompile it with %d-bit tables after N requests (default: %d)\n",
+                MaxLutBits, TierDefaultHot);
+        exit(1);
+    }
+
+    cacheInit(&Cache, CacheSize);
+    signal(SIGPIPE, SIG_IGN);
+
+    int Listener = listenOn(Path);
+    static client Clients[MaxClients];
+    static struct pollfd Polls[MaxClients + 1];
+    int ClientCount = 0;
+
+    for(;;) {
+        Polls[0] = (struct pollfd){.fd = Listener, .events = ClientCount < MaxClients ? POLLIN : 0};
+        for(int Index = 0; Index < ClientCount; ++Index) {
+            client *Client = Clients + Index;
+            bool Backlogged = bufLength(Client->Output) - Client->OutputSent > MaxPendingOutput;
+            Polls[Index + 1] = (struct pollfd){
+                .fd = Client->Socket,
+                .events = (Backlogged ? 0 : POLLIN) | (Client->OutputSent < bufLength(Client->Output) ? POLLOUT : 0),
+            };
+        }
+
+        if(poll(Polls, ClientCount + 1, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fatalError("poll failed: %s", strerror(errno));
+        }
+
+        // NOTE: Walk backwards so closed clients can be replaced by the last one
+        for(int Index = ClientCount - 1; Index >= 0; --Index) {
+            client *Client = Clients + Index;
+            short Events = Polls[Index + 1].revents;
+
+            bool Alive = true;
+            if(Events & POLLOUT) {
+                Alive = flushOutput(Client);
+            }
+            if(Alive && (Events & (POLLIN | POLLHUP | POLLERR))) {
+                Alive = readInput(Client);
+            }
+
+            if(!Alive) {
+                closeClient(Client);
+                *Client = Clients[--ClientCount];
+            }
+        }
+
+        if(Polls[0].revents & POLLIN) {
+            int Socket;
+            while(ClientCount < MaxClients && (Socket = accept4(Listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                Clients[ClientCount++] = (client){.Socket = Socket};
+            }
+        }
+    }
+
+    return 0;
+}
@@ -1,31 +1,58 @@
 // This is an interpreter which uses table-driven Precedence Climbing to parse the expression.
 //
 // Expression syntax:
-//   INT = 0 | [1-9][0-9]* | 0[xX][0-9a-fA-F]+ | 0[0-7]+ | 0[bB][0-1]+
+//   INT   = 0 | [1-9][0-9]* | 0[xX][0-9a-fA-F]+ | 0[0-7]+ | 0[bB][0-1]+
+//   PARAM = '$' [0-9]+
 //
-//   unary_expr = [~-+] unary_expr | '(' expression ')' | INT
-//   factor     = unary_expr ('^' factor)?
+//   BUILTIN1 = 'popcount' | 'clz' | 'ctz' | 'bswap'
+//   BUILTIN2 = 'rotl' | 'rotr' | 'pdep' | 'pext'
+//
+//   call       = BUILTIN1 '(' expression ')' | BUILTIN2 '(' expression ',' expression ')'
+//   unary_expr = [~-+] unary_expr | '(' expression ')' | call | INT | PARAM
+//   factor     = unary_expr ('**' factor)?
 //   mul_op     = '*' | '/' | '%' | '<<' | '>>' | '&'
 //   mul_expr   = factor   (mul_op factor)*
 //   add_expr   = mul_expr ([+-|^] mul_expr)*
-//   expression = add_expr
+//   cmp_op     = '<' | '<=' | '==' | '!='
+//   cmp_expr   = add_expr (cmp_op add_expr)*
+//   expression = cmp_expr ('?' expression ':' expression)?
+//
+// Comparisons give 0 or 1. Both arms of a select are evaluated, like in the VM, so an error in
+// the arm not taken is still an error.
 //
 // References:
 //   - Bitwise, https://bitwise.handmade.network
 //   - Parsing Expressions by Recursive Descent, https://www.engr.mun.ca/~theo/Misc/exp_parsing.htm
 
 #include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
 #include <lexer.c>
+#include <bigint.c>
+#include <perf.c>
 
 // Parser and evaluator
+static int64_t Params[MaxParamCount];
+
 typedef enum operator_assoc {
     Assoc_Left,
     Assoc_Right,
@@ -35,64 +62,85 @@ typedef enum operator_kind {
     Operator_NoOp,
     Operator_Unary,
     Operator_Binary,
+    Operator_Builtin,
+    // NOTE: The ? of Cond ? Then : Else
+    Operator_Select,
 } operator_kind;
 
 typedef struct operator {
     operator_kind Kind;
     int Precedence;
     operator_assoc Associativity;
+    // NOTE: Arguments of a builtin
+    int Arity;
 } operator;
 
 static operator Table[Token_Count] = {
-    [Token_Add]        = {Operator_Binary, 0, Assoc_Left},
-    [Token_Subtract]   = {Operator_Binary, 0, Assoc_Left},
-    [Token_BitOr]      = {Operator_Binary, 0, Assoc_Left},
-    [Token_BitXor]     = {Operator_Binary, 0, Assoc_Left},
-
-    [Token_Multiply]   = {Operator_Binary, 1, Assoc_Left},
-    [Token_Divide]     = {Operator_Binary, 1, Assoc_Left},
-    [Token_Mod]        = {Operator_Binary, 1, Assoc_Left},
-    [Token_LShift]     = {Operator_Binary, 1, Assoc_Left},
-    [Token_RShift]     = {Operator_Binary, 1, Assoc_Left},
-    [Token_BitAnd]     = {Operator_Binary, 1, Assoc_Left},
-
-    [Token_Power]      = {Operator_Binary, 2, Assoc_Right},
-
-    [Token_UnaryPlus]  = {Operator_Unary,  3, Assoc_Right},
-    [Token_UnaryMinus] = {Operator_Unary,  3, Assoc_Right},
-    [Token_BitNot]     = {Operator_Unary,  3, Assoc_Right},
+    [Token_Question]   = {Operator_Select, 0, Assoc_Right},
+
+    [Token_Less]       = {Operator_Binary, 1, Assoc_Left},
+    [Token_LessEqual]  = {Operator_Binary, 1, Assoc_Left},
+    [Token_Equal]      = {Operator_Binary, 1, Assoc_Left},
+    [Token_NotEqual]   = {Operator_Binary, 1, Assoc_Left},
+
+    [Token_Add]        = {Operator_Binary, 2, Assoc_Left},
+    [Token_Subtract]   = {Operator_Binary, 2, Assoc_Left},
+    [Token_BitOr]      = {Operator_Binary, 2, Assoc_Left},
+    [Token_BitXor]     = {Operator_Binary, 2, Assoc_Left},
+
+    [Token_Multiply]   = {Operator_Binary, 3, Assoc_Left},
+    [Token_Divide]     = {Operator_Binary, 3, Assoc_Left},
+    [Token_Mod]        = {Operator_Binary, 3, Assoc_Left},
+    [Token_LShift]     = {Operator_Binary, 3, Assoc_Left},
+    [Token_RShift]     = {Operator_Binary, 3, Assoc_Left},
+    [Token_BitAnd]     = {Operator_Binary, 3, Assoc_Left},
+
+    [Token_Power]      = {Operator_Binary, 4, Assoc_Right},
+
+    [Token_UnaryPlus]  = {Operator_Unary,  5, Assoc_Right},
+    [Token_UnaryMinus] = {Operator_Unary,  5, Assoc_Right},
+    [Token_BitNot]     = {Operator_Unary,  5, Assoc_Right},
+
+    [Token_Popcount]   = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Clz]        = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Ctz]        = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Bswap]      = {Operator_Builtin, 0, Assoc_Left, 1},
+    [Token_Rotl]       = {Operator_Builtin, 0, Assoc_Left, 2},
+    [Token_Rotr]       = {Operator_Builtin, 0, Assoc_Left, 2},
+    [Token_Pdep]       = {Operator_Builtin, 0, Assoc_Left, 2},
+    [Token_Pext]       = {Operator_Builtin, 0, Assoc_Left, 2},
 };
 
-static bool isBinaryOp(void) {
-    return Table[Token.Type].Kind == Operator_Binary;
+static bool isBinaryOp(lexer *Lexer) {
+    return Table[Lexer->Token.Type].Kind == Operator_Binary;
 }
 
-static bool isUnaryOp(void) {
-    if(Token.Type == Token_Add) {
-        Token.Type = Token_UnaryPlus;
+static bool isUnaryOp(lexer *Lexer) {
+    if(Lexer->Token.Type == Token_Add) {
+        Lexer->Token.Type = Token_UnaryPlus;
     }
-    else if(Token.Type == Token_Subtract) {
-        Token.Type = Token_UnaryMinus;
+    else if(Lexer->Token.Type == Token_Subtract) {
+        Lexer->Token.Type = Token_UnaryMinus;
     }
-    return Table[Token.Type].Kind == Operator_Unary;
+    return Table[Lexer->Token.Type].Kind == Operator_Unary;
 }
 
-static int64_t evaluate(int);
+static int64_t evaluate(lexer *Lexer, int Precedence);
 
-static int64_t parseUnary(void) {
+static int64_t parseUnary(lexer *Lexer) {
     int64_t Result = 0;
 
-    if(isUnaryOp()) {
-        token_type Type = Token.Type;
+    if(isUnaryOp(Lexer)) {
+        token_type Type = Lexer->Token.Type;
 
-        nextToken();
-        Result = evaluate(Table[Type].Precedence);
+        nextToken(Lexer);
+        Result = evaluate(Lexer, Table[Type].Precedence);
 
         switch(Type) {
             case Token_UnaryPlus: {} break;
 
             case Token_UnaryMinus: {
-                Result = -Result;
+                Result = -(uint64_t)Result;
             } break;
 
             case Token_BitNot: {
@@ -102,75 +150,554 @@ static int64_t parseUnary(void) {
             InvalidDefaultCase;
         }
     }
-    else if(matchToken(Token_LParen)) {
-        Result = evaluate(0);
-        expectToken(Token_RParen);
+    else if(matchToken(Lexer, Token_LParen)) {
+        Result = evaluate(Lexer, 0);
+        expectToken(Lexer, Token_RParen);
+    }
+    else if(Table[Lexer->Token.Type].Kind == Operator_Builtin) {
+        token_type Type = Lexer->Token.Type;
+
+        nextToken(Lexer);
+        expectToken(Lexer, Token_LParen);
+        uint64_t Value = evaluate(Lexer, 0);
+        uint64_t Arg = 0;
+        if(Table[Type].Arity == 2) {
+            expectToken(Lexer, Token_Comma);
+            Arg = evaluate(Lexer, 0);
+        }
+        expectToken(Lexer, Token_RParen);
+
+        // NOTE: 64 bits wide like every other interpreter operation, the VM works on 32
+        switch(Type) {
+            case Token_Popcount: { Result = bitPopcount64(Value); } break;
+            case Token_Clz:      { Result = bitClz64(Value); } break;
+            case Token_Ctz:      { Result = bitCtz64(Value); } break;
+            case Token_Bswap:    { Result = bitBswap64(Value); } break;
+            case Token_Rotl:     { Result = bitRotl64(Value, Arg); } break;
+            case Token_Rotr:     { Result = bitRotr64(Value, Arg); } break;
+            case Token_Pdep:     { Result = bitPdep64(Value, Arg); } break;
+            case Token_Pext:     { Result = bitPext64(Value, Arg); } break;
+            InvalidDefaultCase;
+        }
+    }
+    else if(Lexer->Token.Type == Token_Int) {
+        Result = Lexer->Token.IntValue;
+        nextToken(Lexer);
     }
-    else if(Token.Type == Token_Int) {
-        Result = Token.IntValue;
-        nextToken();
+    else if(Lexer->Token.Type == Token_Param) {
+        Result = Params[Lexer->Token.IntValue];
+        nextToken(Lexer);
     }
     else {
-        fatalError("No expected token available.");
+        lexerFatal(Lexer, Error_UnexpectedToken);
     }
 
     return Result;
 }
 
-static int64_t evaluate(int Precedence) {
-    int64_t Result = parseUnary();
+static int64_t evaluate(lexer *Lexer, int Precedence) {
+    int64_t Result = parseUnary(Lexer);
 
-    while(Table[Token.Type].Precedence >= Precedence &&
-          (Token.Type != Token_EOF && Token.Type != Token_RParen))
+    while(Table[Lexer->Token.Type].Precedence >= Precedence &&
+          (Lexer->Token.Type != Token_EOF && Lexer->Token.Type != Token_RParen &&
+           Lexer->Token.Type != Token_Comma && Lexer->Token.Type != Token_Colon))
     {
-        if(!isBinaryOp()) {
-            fatalError("Missing expected binary operator.");
+        if(matchToken(Lexer, Token_Question)) {
+            int64_t Then = evaluate(Lexer, 0);
+            expectToken(Lexer, Token_Colon);
+            int64_t Else = evaluate(Lexer, Table[Token_Question].Precedence);
+            Result = bitSelect64(Result, Then, Else);
+            continue;
         }
 
-        token_type OpType = Token.Type;
+        if(!isBinaryOp(Lexer)) {
+            lexerFatal(Lexer, Error_MissingOperator);
+        }
+
+        token_type OpType = Lexer->Token.Type;
+        char *OpStart = Lexer->TokenStart;
 
-        nextToken();
+        nextToken(Lexer);
 
         int64_t Rhs;
         if(Table[OpType].Associativity == Assoc_Left) {
-            Rhs = evaluate(Table[OpType].Precedence + 1);
+            Rhs = evaluate(Lexer, Table[OpType].Precedence + 1);
+        } else {
+            assert(Table[OpType].Associativity == Assoc_Right);
+            Rhs = evaluate(Lexer, Table[OpType].Precedence);
+        }
+
+        // NOTE: Both trap in hardware, a streaming batch must survive them
+        bool DivisionByZero = (OpType == Token_Divide || OpType == Token_Mod) &&
+                              (Rhs == 0 || (Result == INT64_MIN && Rhs == -1));
+
+        // NOTE: Same semantics as --wide programs in the VM: arithmetic wraps, shift counts are
+        // taken modulo 64
+        switch(OpType) {
+            case Token_Add:      { Result = (uint64_t)Result + (uint64_t)Rhs; } break;
+            case Token_Subtract: { Result = (uint64_t)Result - (uint64_t)Rhs; } break;
+            case Token_BitOr:    { Result |= Rhs; } break;
+            case Token_BitXor:   { Result ^= Rhs; } break;
+
+            case Token_Multiply: { Result = (uint64_t)Result * (uint64_t)Rhs; } break;
+            case Token_Divide:   { Result = DivisionByZero ? 0 : Result / Rhs; } break;
+            case Token_Mod:      { Result = DivisionByZero ? 0 : Result % Rhs; } break;
+            case Token_LShift:   { Result = (uint64_t)Result << (Rhs & 63); } break;
+            case Token_RShift:   { Result >>= Rhs & 63; } break;
+            case Token_BitAnd:   { Result &= Rhs; } break;
+
+            case Token_Power:    { Result = bitPower64(Result, Rhs, &DivisionByZero); } break;
+
+            case Token_Less:      { Result = Result <  Rhs; } break;
+            case Token_LessEqual: { Result = Result <= Rhs; } break;
+            case Token_Equal:     { Result = Result == Rhs; } break;
+            case Token_NotEqual:  { Result = Result != Rhs; } break;
+
+            InvalidDefaultCase;
+        }
+
+        if(DivisionByZero) {
+            Lexer->TokenStart = OpStart;
+            lexerFatal(Lexer, Error_DivisionByZero);
+        }
+    }
+
+    return Result;
+}
+
+// Arbitrary precision evaluator, --bigint
+static bigint BigParams[MaxParamCount];
+static arena BigArena;
+
+static error_code ErrorFromBigError[BigError_Count] = {
+    [BigError_None]           = Error_None,
+    [BigError_DivisionByZero] = Error_DivisionByZero,
+    [BigError_TooLarge]       = Error_IntegerOverflow,
+};
+
+static bigint evaluateBig(lexer *Lexer, int Precedence);
+
+static bigint parseUnaryBig(lexer *Lexer) {
+    bigint Result = {};
+
+    if(isUnaryOp(Lexer)) {
+        token_type Type = Lexer->Token.Type;
+
+        nextToken(Lexer);
+        Result = evaluateBig(Lexer, Table[Type].Precedence);
+
+        switch(Type) {
+            case Token_UnaryPlus: {} break;
+
+            case Token_UnaryMinus: {
+                Result = bigNegate(Result);
+            } break;
+
+            case Token_BitNot: {
+                Result = bigNot(&BigArena, Result);
+            } break;
+
+            InvalidDefaultCase;
+        }
+    }
+    else if(matchToken(Lexer, Token_LParen)) {
+        Result = evaluateBig(Lexer, 0);
+        expectToken(Lexer, Token_RParen);
+    }
+    else if(Table[Lexer->Token.Type].Kind == Operator_Builtin) {
+        lexerFatal(Lexer, Error_UnsupportedBuiltin);
+    }
+    else if(Lexer->Token.Type == Token_Int) {
+        // NOTE: Malformed literals keep the value the lexer gave them, it already reported them
+        source_span Span = Lexer->Token.Span;
+        if(!bigParse(&BigArena, Lexer->Begin + Span.Start, Span.End - Span.Start, &Result)) {
+            Result = bigFromU64(&BigArena, Lexer->Token.IntValue);
+        }
+        nextToken(Lexer);
+    }
+    else if(Lexer->Token.Type == Token_Param) {
+        Result = BigParams[Lexer->Token.IntValue];
+        nextToken(Lexer);
+    }
+    else {
+        lexerFatal(Lexer, Error_UnexpectedToken);
+    }
+
+    return Result;
+}
+
+static bigint evaluateBig(lexer *Lexer, int Precedence) {
+    bigint Result = parseUnaryBig(Lexer);
+
+    while(Table[Lexer->Token.Type].Precedence >= Precedence &&
+          (Lexer->Token.Type != Token_EOF && Lexer->Token.Type != Token_RParen &&
+           Lexer->Token.Type != Token_Comma && Lexer->Token.Type != Token_Colon))
+    {
+        if(matchToken(Lexer, Token_Question)) {
+            bigint Then = evaluateBig(Lexer, 0);
+            expectToken(Lexer, Token_Colon);
+            bigint Else = evaluateBig(Lexer, Table[Token_Question].Precedence);
+            Result = bigIsZero(Result) ? Else : Then;
+            continue;
+        }
+
+        if(!isBinaryOp(Lexer)) {
+            lexerFatal(Lexer, Error_MissingOperator);
+        }
+
+        token_type OpType = Lexer->Token.Type;
+        char *OpStart = Lexer->TokenStart;
+
+        nextToken(Lexer);
+
+        bigint Rhs;
+        if(Table[OpType].Associativity == Assoc_Left) {
+            Rhs = evaluateBig(Lexer, Table[OpType].Precedence + 1);
         } else {
             assert(Table[OpType].Associativity == Assoc_Right);
-            Rhs = evaluate(Table[OpType].Precedence);
+            Rhs = evaluateBig(Lexer, Table[OpType].Precedence);
         }
 
+        arena *Arena = &BigArena;
+        big_error Error = BigError_None;
         switch(OpType) {
-            case Token_Add:      { Result +=  Rhs; } break;
-            case Token_Subtract: { Result -=  Rhs; } break;
-            case Token_BitOr:    { Result |=  Rhs; } break;
-            case Token_BitXor:   { Result ^=  Rhs; } break;
+            case Token_Add:      { Result = bigAdd(Arena, Result, Rhs); } break;
+            case Token_Subtract: { Result = bigSub(Arena, Result, Rhs); } break;
+            case Token_BitOr:    { Result = bigBitwise(Arena, Big_Or, Result, Rhs); } break;
+            case Token_BitXor:   { Result = bigBitwise(Arena, Big_Xor, Result, Rhs); } break;
 
-            case Token_Multiply: { Result *=  Rhs; } break;
-            case Token_Divide:   { Result /=  Rhs; } break;
-            case Token_Mod:      { Result %=  Rhs; } break;
-            case Token_LShift:   { Result <<= Rhs; } break;
-            case Token_RShift:   { Result <<= Rhs; } break;
-            case Token_BitAnd:   { Result &=  Rhs; } break;
+            case Token_Multiply: { Result = bigMul(Arena, Result, Rhs, &Error); } break;
+            case Token_Divide:   { bigDivMod(Arena, Result, Rhs, &Result, 0, &Error); } break;
+            case Token_Mod:      { bigDivMod(Arena, Result, Rhs, 0, &Result, &Error); } break;
+            case Token_LShift:   { Result = bigShift(Arena, Result, Rhs, true, &Error); } break;
+            case Token_RShift:   { Result = bigShift(Arena, Result, Rhs, false, &Error); } break;
+            case Token_BitAnd:   { Result = bigBitwise(Arena, Big_And, Result, Rhs); } break;
 
-            case Token_Power:    { Result = pow(Result, Rhs); } break;
+            case Token_Power:    { Result = bigPow(Arena, Result, Rhs, &Error); } break;
+
+            case Token_Less:      { Result = bigFromU64(Arena, bigCompare(Result, Rhs) <  0); } break;
+            case Token_LessEqual: { Result = bigFromU64(Arena, bigCompare(Result, Rhs) <= 0); } break;
+            case Token_Equal:     { Result = bigFromU64(Arena, bigCompare(Result, Rhs) == 0); } break;
+            case Token_NotEqual:  { Result = bigFromU64(Arena, bigCompare(Result, Rhs) != 0); } break;
 
             InvalidDefaultCase;
         }
+
+        if(Error) {
+            Lexer->TokenStart = OpStart;
+            lexerFatal(Lexer, ErrorFromBigError[Error]);
+        }
     }
 
     return Result;
 }
 
+// Streaming mode
+enum {
+    StreamReadSize = 1<<20,
+    StreamOutputSize = 1<<18,
+
+    // NOTE: Longest formatted line that is not an external iovec, see streamError()
+    StreamMaxLine = 64,
+    StreamMaxIovecs = 1<<10,
+};
+
+typedef struct output_stream {
+    int File;
+    char *Buffer;
+    char *At;
+    // NOTE: Start of the buffer part not yet covered by an iovec
+    char *Pending;
+    struct iovec Iovecs[StreamMaxIovecs];
+    int IovecCount;
+} output_stream;
+
+static char DigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// NOTE: Writes Value backwards from End two digits at a time and returns where it starts
+static char *formatU64(char *End, uint64_t Value) {
+    while(Value >= 100) {
+        char *Pair = DigitPairs + 2*(Value % 100);
+        Value /= 100;
+        *--End = Pair[1];
+        *--End = Pair[0];
+    }
+
+    if(Value >= 10) {
+        *--End = DigitPairs[2*Value + 1];
+        *--End = DigitPairs[2*Value];
+    } else {
+        *--End = '0' + Value;
+    }
+
+    return End;
+}
+
+static char *formatI64(char *Out, int64_t Value) {
+    char Digits[20];
+    char *End = Digits + sizeof(Digits);
+    if(Value < 0) {
+        *Out++ = '-';
+    }
+
+    char *Start = formatU64(End, Value < 0 ? -(uint64_t)Value : (uint64_t)Value);
+    memcpy(Out, Start, End - Start);
+    return Out + (End - Start);
+}
+
+static void streamReserve(output_stream *Stream);
+
+// NOTE: Copies text of any length, at most a line's worth at a time
+static void streamWrite(output_stream *Stream, char *Text, size_t Length) {
+    while(Length) {
+        streamReserve(Stream);
+        size_t Chunk = min(Length, (size_t)StreamMaxLine);
+        memcpy(Stream->At, Text, Chunk);
+        Stream->At += Chunk;
+        Text += Chunk;
+        Length -= Chunk;
+    }
+}
+
+static void streamCutIovec(output_stream *Stream) {
+    if(Stream->At > Stream->Pending) {
+        Stream->Iovecs[Stream->IovecCount++] = (struct iovec){Stream->Pending, Stream->At - Stream->Pending};
+        Stream->Pending = Stream->At;
+    }
+}
+
+static void streamFlush(output_stream *Stream) {
+    streamCutIovec(Stream);
+
+    struct iovec *Iovecs = Stream->Iovecs;
+    int Count = Stream->IovecCount;
+    while(Count) {
+        ssize_t Written = writev(Stream->File, Iovecs, Count);
+        if(Written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fatalError("Could not write results: %s", strerror(errno));
+        }
+
+        for(; Count && (size_t)Written >= Iovecs->iov_len; ++Iovecs, --Count) {
+            Written -= Iovecs->iov_len;
+        }
+        if(Count) {
+            Iovecs->iov_base = (char *)Iovecs->iov_base + Written;
+            Iovecs->iov_len -= Written;
+        }
+    }
+
+    Stream->At = Stream->Pending = Stream->Buffer;
+    Stream->IovecCount = 0;
+}
+
+// NOTE: Guarantees room for one line and two external iovecs
+static void streamReserve(output_stream *Stream) {
+    if(Stream->At + StreamMaxLine > Stream->Buffer + StreamOutputSize || Stream->IovecCount + 3 > StreamMaxIovecs) {
+        streamFlush(Stream);
+    }
+}
+
+// NOTE: The message is referenced by an iovec rather than copied into the buffer
+static void streamError(output_stream *Stream, lexer *Lexer, size_t Line) {
+    streamReserve(Stream);
+    char *Message = ErrorMessages[Lexer->Error];
+    Stream->At += sprintf(Stream->At, "error: ");
+    streamCutIovec(Stream);
+    Stream->Iovecs[Stream->IovecCount++] = (struct iovec){Message, strlen(Message)};
+    Stream->At += sprintf(Stream->At, " (line %zu, offset %zu)\n", Line, Lexer->ErrorOffset);
+}
+
+// NOTE: Evaluates the line in place, the newline has already been replaced by a NUL
+static void streamLine(output_stream *Stream, lexer *Lexer, char *Line, size_t LineNumber) {
+    jmp_buf OnError;
+    Lexer->OnError = &OnError;
+
+    if(!setjmp(OnError)) {
+        lexerInit(Lexer, Line);
+        if(Lexer->Token.Type == Token_EOF) {
+            streamReserve(Stream);
+            *Stream->At++ = '\n';
+            return;
+        }
+
+        if(Lexer->Unbounded) {
+            arenaFree(&BigArena);
+            bigint Result = evaluateBig(Lexer, 0);
+            if(Lexer->Token.Type != Token_EOF) {
+                lexerFatal(Lexer, Error_UnexpectedToken);
+            }
+
+            if(Lexer->Error == Error_None) {
+                static char *Text;
+                bigFormat(&Text, Result);
+                bufPush(Text, '\n');
+                streamWrite(Stream, Text, bufLength(Text));
+                bufHeader_(Text)->Length = 0;
+                return;
+            }
+        } else {
+            int64_t Result = evaluate(Lexer, 0);
+            if(Lexer->Token.Type != Token_EOF) {
+                lexerFatal(Lexer, Error_UnexpectedToken);
+            }
+
+            if(Lexer->Error == Error_None) {
+                streamReserve(Stream);
+                Stream->At = formatI64(Stream->At, Result);
+                *Stream->At++ = '\n';
+                return;
+            }
+        }
+    }
+
+    streamError(Stream, Lexer, LineNumber);
+}
+
+// NOTE: Lines are evaluated straight out of the read buffer, only a line crossing the end of a
+// chunk is moved to the front before the next read
+static void streamExpressions(char *Path, bool Big) {
+    int Input = strcmp(Path, "-") == 0 ? 0 : open(Path, O_RDONLY);
+    if(Input < 0) {
+        fatalError("Could not open %s: %s", Path, strerror(errno));
+    }
+
+    size_t Capacity = StreamReadSize;
+    char *Buffer = xMalloc(Capacity + 1);
+    size_t Used = 0;
+
+    static output_stream Stream;
+    Stream.File = 1;
+    Stream.Buffer = Stream.At = Stream.Pending = xMalloc(StreamOutputSize);
+
+    lexer Lexer = {.Unbounded = Big, .Wide = true};
+    size_t LineNumber = 1;
+    bool Done = false;
+
+    while(!Done) {
+        if(Capacity - Used < StreamReadSize/2) {
+            Capacity *= 2;
+            Buffer = xRealloc(Buffer, Capacity + 1);
+        }
+
+        ssize_t Received = read(Input, Buffer + Used, Capacity - Used);
+        if(Received < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fatalError("Could not read %s: %s", Path, strerror(errno));
+        }
+
+        Used += Received;
+        Done = Received == 0;
+        // NOTE: At the end of the input the last line needs no newline
+        if(Done && Used) {
+            Buffer[Used++] = '\n';
+        }
+
+        char *Line = Buffer;
+        char *End = Buffer + Used;
+        for(char *Newline; (Newline = memchr(Line, '\n', End - Line)); Line = Newline + 1) {
+            *Newline = 0;
+            streamLine(&Stream, &Lexer, Line, LineNumber++);
+        }
+
+        Used = End - Line;
+        memmove(Buffer, Line, Used);
+    }
+
+    streamFlush(&Stream);
+    free(Buffer);
+    free(Stream.Buffer);
+    if(Input) {
+        close(Input);
+    }
+}
+
+static void usage(char *Program) {
+    fprintf(stderr, "Usage: %s [--perf-counters[=json]] [--bigint] EXPR [PARAM...]\n", Program);
+    fprintf(stderr, "       %s [--perf-counters[=json]] [--bigint] --stream FILE [PARAM...]\n", Program);
+    fprintf(stderr, "  --stream FILE    Evaluate every line of FILE (- for stdin), printing one result\n");
+    fprintf(stderr, "                   or error per line\n");
+    fprintf(stderr, "  --bigint         Evaluate with arbitrary precision integers, literals and parameters\n");
+    fprintf(stderr, "                   may have any size\n");
+    fprintf(stderr, "  --perf-counters  Print hardware counters per phase to stderr as a table or JSON\n");
+    exit(1);
+}
+
 int main(int ArgCount, char *ArgVal[]) {
-    if(ArgCount != 2) {
-        fprintf(stderr, "Usage: %s EXPR\n", ArgVal[0]);
-        exit(1);
+    int First = 1;
+    bool Big = false;
+    for(; First < ArgCount; ++First) {
+        if(strcmp(ArgVal[First], "--bigint") == 0) {
+            Big = true;
+        } else if(!perfParseOption(ArgVal[First])) {
+            break;
+        }
+    }
+
+    bool Streaming = First < ArgCount && strcmp(ArgVal[First], "--stream") == 0;
+    First += Streaming;
+    if(First >= ArgCount) {
+        usage(ArgVal[0]);
+    }
+
+    // NOTE: Big parameters live in their own arena, BigArena is reset per expression
+    static arena ParamArena;
+    for(int Index = First+1; Index < ArgCount && Index-First-1 < MaxParamCount; ++Index) {
+        Params[Index-First-1] = strtoll(ArgVal[Index], 0, 0);
+        if(Big && !bigParse(&ParamArena, ArgVal[Index], strlen(ArgVal[Index]), BigParams + Index-First-1)) {
+            fatalError("Invalid integer parameter: %s", ArgVal[Index]);
+        }
     }
 
-    Stream = ArgVal[1];
-    nextToken();
+    perfInit();
+
+    if(Streaming) {
+        perfBegin(Phase_Execute);
+        streamExpressions(ArgVal[First], Big);
+        perfEnd(Phase_Execute);
+        perfReport();
+        return 0;
+    }
+
+    // NOTE: Parsing and evaluation are a single pass, only lexing can be measured on its own
+    if(Perf.Format) {
+        perfBegin(Phase_Lex);
+        lexerCountTokens(ArgVal[First]);
+        perfEnd(Phase_Lex);
+    }
 
-    printf("Result: %ld\n", evaluate(0));
+    perfBegin(Phase_Execute);
+    lexer Lexer = {.Unbounded = Big, .Wide = true};
+    lexerInit(&Lexer, ArgVal[First]);
+    int64_t Result = 0;
+    bigint BigResult = {};
+    if(Big) {
+        BigResult = evaluateBig(&Lexer, 0);
+    } else {
+        Result = evaluate(&Lexer, 0);
+    }
+    if(Lexer.Token.Type != Token_EOF) {
+        lexerFatal(&Lexer, Error_UnexpectedToken);
+    }
+    perfEnd(Phase_Execute);
+
+    if(Big) {
+        char *Text = 0;
+        bigFormat(&Text, BigResult);
+        bufPush(Text, 0);
+        printf("Result: %s\n", Text);
+        bufFree(Text);
+    } else {
+        printf("Result: %ld\n", Result);
+    }
+    perfReport();
 
     return 0;
 }
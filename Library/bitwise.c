@@ -0,0 +1,438 @@
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <lexer.c>
+#include <parser.c>
+#include <generator.c>
+#include <evaluate.c>
+#include <lut.c>
+#include <idiom.c>
+#include <vm.c>
+#include <bitslice.c>
+#include <specialize.c>
+#include <peephole.c>
+#include <compile.c>
+
+#include "bitwise.h"
+
+struct bw_program {
+    int ParamCount;
+    uint8_t *Code;
+    // NOTE: Only set for pure-bitwise expressions, used for batches
+    bitslice_program *Bitslice;
+
+    // NOTE: NUL-terminated, specializations recompile from it. Bindings is only set on
+    // specialized programs, which bw_specialize() specializes further.
+    char *Source;
+    specialize_bindings *Bindings;
+};
+
+typedef struct specializer_entry {
+    uint64_t Hash;
+    bw_program *Program;
+
+    struct specializer_entry *Chain;
+    // NOTE: Recency list, most recently used first
+    struct specializer_entry *Prev, *Next;
+
+    size_t Count;
+    bw_binding Bindings[];
+} specializer_entry;
+
+// NOTE: LRU cache keyed by the hash of the bindings sorted by parameter, entries keep the bindings
+// so that hash collisions never return the wrong program
+struct bw_specializer {
+    const bw_program *Program;
+    specializer_entry **Buckets;
+    size_t BucketMask;
+    specializer_entry *Newest, *Oldest;
+    size_t Count, Capacity;
+};
+
+static bw_status StatusFromError[Error_Count] = {
+    [Error_None]               = BW_OK,
+    [Error_InvalidDigit]       = BW_ERROR_INVALID_DIGIT,
+    [Error_IntegerOverflow]    = BW_ERROR_INTEGER_OVERFLOW,
+    [Error_InvalidParam]       = BW_ERROR_INVALID_PARAM,
+    [Error_UnexpectedToken]    = BW_ERROR_UNEXPECTED_TOKEN,
+    [Error_MissingOperator]    = BW_ERROR_MISSING_OPERATOR,
+    [Error_DivisionByZero]     = BW_ERROR_DIVISION_BY_ZERO,
+    [Error_UnsupportedBuiltin] = BW_ERROR_INVALID_ARGUMENT,
+    [Error_TooDeep]            = BW_ERROR_TOO_DEEP,
+};
+
+static bw_status StatusFromVmError[VmError_Count] = {
+    [VmError_None]           = BW_OK,
+    [VmError_DivisionByZero] = BW_ERROR_DIVISION_BY_ZERO,
+    [VmError_IllegalOpcode]  = BW_ERROR_INVALID_ARGUMENT,
+};
+
+const char *bw_status_message(bw_status Status) {
+    switch(Status) {
+        case BW_OK:                     return "No error.";
+        case BW_ERROR_INVALID_DIGIT:    return ErrorMessages[Error_InvalidDigit];
+        case BW_ERROR_INTEGER_OVERFLOW: return ErrorMessages[Error_IntegerOverflow];
+        case BW_ERROR_INVALID_PARAM:    return ErrorMessages[Error_InvalidParam];
+        case BW_ERROR_UNEXPECTED_TOKEN: return ErrorMessages[Error_UnexpectedToken];
+        case BW_ERROR_MISSING_OPERATOR: return ErrorMessages[Error_MissingOperator];
+        case BW_ERROR_TOO_DEEP:         return ErrorMessages[Error_TooDeep];
+        case BW_ERROR_DIVISION_BY_ZERO: return VmErrorMessages[VmError_DivisionByZero];
+        case BW_ERROR_INVALID_ARGUMENT: return "Invalid argument.";
+        case BW_ERROR_OUT_OF_MEMORY:    return "Insufficient space available.";
+    }
+
+    return "Unknown error.";
+}
+
+static bw_status reportError(bw_error *Error, bw_status Status, size_t Offset) {
+    if(Error) {
+        Error->Status = Status;
+        Error->Offset = Offset;
+        Error->Message = bw_status_message(Status);
+    }
+
+    return Status;
+}
+
+// NOTE: Keeps the recursive passes over the tree well within the stack of any thread, see
+// lexer.MaxDepth
+enum { BwMaxDepth = 1000 };
+
+// NOTE: Where running out of memory jumps to, for the call running on this thread
+static _Thread_local jmp_buf *OutOfMemoryTarget;
+
+static void jumpOutOfMemory(void) {
+    longjmp(*OutOfMemoryTarget, 1);
+}
+
+// NOTE: Parses Program->Source and compiles it into Program, which holds no code yet. Bindings may
+// be null. An allocation failing anywhere below jumps back here and fails with
+// BW_ERROR_OUT_OF_MEMORY, the caller then frees Program and Arena, whatever the failing pass held
+// on its own is lost. Lexer and Arena live in the caller's frame, so they stay valid after the
+// longjmp.
+static bw_status compileSource(lexer *Lexer, arena *Arena, specialize_bindings *Bindings, bw_program *Program) {
+    jmp_buf OnError;
+    OutOfMemoryTarget = &OnError;
+    OnOutOfMemory = jumpOutOfMemory;
+    if(setjmp(OnError)) {
+        OnOutOfMemory = 0;
+        return BW_ERROR_OUT_OF_MEMORY;
+    }
+
+    bw_status Status = BW_OK;
+    expression *Ast = tryParseExpression(Lexer, Arena, Program->Source);
+    if(!Ast) {
+        Status = StatusFromError[Lexer->Error];
+        // NOTE: A lexer error missing from StatusFromError must not turn a failed parse into BW_OK
+        if(Status == BW_OK) {
+            Status = BW_ERROR_INVALID_ARGUMENT;
+        }
+    } else {
+        if(Bindings) {
+            Ast = specialize(Arena, Ast, Bindings);
+        }
+        if(expressionStackDepth(Ast) > VmStackSize) {
+            Status = BW_ERROR_TOO_DEEP;
+        } else {
+            Program->ParamCount = expressionParamCount(Ast);
+            Program->Bitslice = bitsliceCompile(Ast);
+            compileAst(&Program->Code, Arena, Ast, LutDefaultBits, 0, 0);
+        }
+    }
+
+    OnOutOfMemory = 0;
+    return Status;
+}
+
+bw_status bw_compile(const char *Source, size_t Length, bw_program **Program, bw_error *Error) {
+    if(!Program || (!Source && Length)) {
+        return reportError(Error, BW_ERROR_INVALID_ARGUMENT, 0);
+    }
+    *Program = 0;
+
+    // NOTE: The lexer stops at the first NUL, which would silently truncate the expression
+    char *Nul = Length ? memchr(Source, 0, Length) : 0;
+    if(Nul) {
+        return reportError(Error, BW_ERROR_UNEXPECTED_TOKEN, Nul - Source);
+    }
+
+    char *Copy = malloc(Length + 1);
+    bw_program *Result = malloc(sizeof(*Result));
+    if(!Copy || !Result) {
+        free(Copy);
+        free(Result);
+        return reportError(Error, BW_ERROR_OUT_OF_MEMORY, 0);
+    }
+    memcpy(Copy, Source, Length);
+    Copy[Length] = 0;
+
+    *Result = (bw_program){.Source = Copy};
+    lexer Lexer = {.MaxDepth = BwMaxDepth};
+    arena Arena = {};
+    bw_status Status = compileSource(&Lexer, &Arena, 0, Result);
+    arenaFree(&Arena);
+
+    if(Status != BW_OK) {
+        bw_free(Result);
+        return reportError(Error, Status, Lexer.ErrorOffset);
+    }
+
+    *Program = Result;
+    return reportError(Error, BW_OK, 0);
+}
+
+bw_status bw_specialize(const bw_program *Program, const bw_binding *Bindings, size_t Count,
+                        bw_program **Specialized)
+{
+    if(!Program || !Specialized || (Count && !Bindings)) {
+        return BW_ERROR_INVALID_ARGUMENT;
+    }
+    *Specialized = 0;
+
+    bw_program *Result = malloc(sizeof(*Result));
+    char *Copy = strdup(Program->Source);
+    specialize_bindings *Merged = malloc(sizeof(*Merged));
+    if(!Result || !Copy || !Merged) {
+        free(Result);
+        free(Copy);
+        free(Merged);
+        return BW_ERROR_OUT_OF_MEMORY;
+    }
+
+    *Result = (bw_program){.Source = Copy, .Bindings = Merged};
+    *Merged = Program->Bindings ? *Program->Bindings : (specialize_bindings){};
+    bw_status Status = BW_OK;
+    for(size_t Index = 0; Index < Count && Status == BW_OK; ++Index) {
+        int Param = Bindings[Index].Param;
+        int32_t Value = Bindings[Index].Value;
+        if(Param < 0 || Param >= MaxParamCount || (Merged->Bound[Param] && Merged->Values[Param] != Value)) {
+            Status = BW_ERROR_INVALID_ARGUMENT;
+        } else {
+            Merged->Bound[Param] = true;
+            Merged->Values[Param] = Value;
+        }
+    }
+
+    // NOTE: The source compiled once already, it parses again
+    if(Status == BW_OK) {
+        lexer Lexer = {.MaxDepth = BwMaxDepth};
+        arena Arena = {};
+        Status = compileSource(&Lexer, &Arena, Merged, Result);
+        arenaFree(&Arena);
+    }
+
+    if(Status != BW_OK) {
+        bw_free(Result);
+        return Status;
+    }
+
+    *Specialized = Result;
+    return BW_OK;
+}
+
+bw_status bw_specializer_new(const bw_program *Program, size_t Capacity, bw_specializer **Specializer) {
+    if(!Program || !Specializer) {
+        return BW_ERROR_INVALID_ARGUMENT;
+    }
+
+    size_t BucketCount = 16;
+    while(BucketCount < 2*Capacity) {
+        BucketCount *= 2;
+    }
+
+    bw_specializer *Result = malloc(sizeof(*Result));
+    specializer_entry **Buckets = calloc(BucketCount, sizeof(*Buckets));
+    if(!Result || !Buckets) {
+        free(Result);
+        free(Buckets);
+        return BW_ERROR_OUT_OF_MEMORY;
+    }
+
+    *Result = (bw_specializer){
+        .Program = Program,
+        .Buckets = Buckets,
+        .BucketMask = BucketCount - 1,
+        .Capacity = max(Capacity, 1),
+    };
+    *Specializer = Result;
+    return BW_OK;
+}
+
+static void specializerUnlink(bw_specializer *Specializer, specializer_entry *Entry) {
+    *(Entry->Prev ? &Entry->Prev->Next : &Specializer->Newest) = Entry->Next;
+    *(Entry->Next ? &Entry->Next->Prev : &Specializer->Oldest) = Entry->Prev;
+}
+
+static void specializerPushNewest(bw_specializer *Specializer, specializer_entry *Entry) {
+    Entry->Prev = 0;
+    Entry->Next = Specializer->Newest;
+    *(Specializer->Newest ? &Specializer->Newest->Prev : &Specializer->Oldest) = Entry;
+    Specializer->Newest = Entry;
+}
+
+static void specializerEvictOldest(bw_specializer *Specializer) {
+    specializer_entry *Entry = Specializer->Oldest;
+    specializer_entry **Link = &Specializer->Buckets[Entry->Hash & Specializer->BucketMask];
+    while(*Link != Entry) {
+        Link = &(*Link)->Chain;
+    }
+    *Link = Entry->Chain;
+
+    specializerUnlink(Specializer, Entry);
+    bw_free(Entry->Program);
+    free(Entry);
+    --Specializer->Count;
+}
+
+bw_status bw_specializer_get(bw_specializer *Specializer, const bw_binding *Bindings, size_t Count,
+                             const bw_program **Specialized)
+{
+    if(!Specializer || !Specialized || (Count && !Bindings) || Count > MaxParamCount) {
+        return BW_ERROR_INVALID_ARGUMENT;
+    }
+    *Specialized = 0;
+
+    // NOTE: Sorted by parameter, so the order the caller lists them in does not matter. Insertion
+    // sort, there are only a few.
+    bw_binding Sorted[MaxParamCount];
+    size_t SortedCount = 0;
+    for(size_t Index = 0; Index < Count; ++Index) {
+        bw_binding Binding = Bindings[Index];
+        size_t At = SortedCount;
+        while(At > 0 && Sorted[At - 1].Param > Binding.Param) {
+            Sorted[At] = Sorted[At - 1];
+            --At;
+        }
+        if(At > 0 && Sorted[At - 1].Param == Binding.Param) {
+            if(Sorted[At - 1].Value != Binding.Value) {
+                return BW_ERROR_INVALID_ARGUMENT;
+            }
+            memmove(Sorted + At, Sorted + At + 1, (SortedCount - At)*sizeof(*Sorted));
+            continue;
+        }
+        Sorted[At] = Binding;
+        ++SortedCount;
+    }
+
+    uint64_t Hash = hashBytes(Sorted, SortedCount*sizeof(*Sorted), HashSeed);
+    for(specializer_entry *Entry = Specializer->Buckets[Hash & Specializer->BucketMask]; Entry; Entry = Entry->Chain) {
+        if(Entry->Hash == Hash && Entry->Count == SortedCount &&
+           memcmp(Entry->Bindings, Sorted, SortedCount*sizeof(*Sorted)) == 0)
+        {
+            specializerUnlink(Specializer, Entry);
+            specializerPushNewest(Specializer, Entry);
+            *Specialized = Entry->Program;
+            return BW_OK;
+        }
+    }
+
+    specializer_entry *Entry = malloc(sizeof(*Entry) + SortedCount*sizeof(*Sorted));
+    if(!Entry) {
+        return BW_ERROR_OUT_OF_MEMORY;
+    }
+    bw_status Status = bw_specialize(Specializer->Program, Sorted, SortedCount, &Entry->Program);
+    if(Status != BW_OK) {
+        free(Entry);
+        return Status;
+    }
+
+    if(Specializer->Count == Specializer->Capacity) {
+        specializerEvictOldest(Specializer);
+    }
+    Entry->Hash = Hash;
+    Entry->Count = SortedCount;
+    memcpy(Entry->Bindings, Sorted, SortedCount*sizeof(*Sorted));
+
+    specializer_entry **Bucket = &Specializer->Buckets[Hash & Specializer->BucketMask];
+    Entry->Chain = *Bucket;
+    *Bucket = Entry;
+    specializerPushNewest(Specializer, Entry);
+    ++Specializer->Count;
+
+    *Specialized = Entry->Program;
+    return BW_OK;
+}
+
+void bw_specializer_free(bw_specializer *Specializer) {
+    if(Specializer) {
+        while(Specializer->Oldest) {
+            specializerEvictOldest(Specializer);
+        }
+        free(Specializer->Buckets);
+        free(Specializer);
+    }
+}
+
+int bw_param_count(const bw_program *Program) {
+    return Program ? Program->ParamCount : 0;
+}
+
+bw_status bw_eval(const bw_program *Program, const int32_t *Params, int32_t *Result) {
+    if(!Program || !Result || (!Params && Program->ParamCount)) {
+        return BW_ERROR_INVALID_ARGUMENT;
+    }
+
+    vm_context Context;
+    vmInit(&Context, Program->Code, (int32_t *)Params);
+    while(!vmRun(&Context, UINT32_MAX)) {}
+
+    if(Context.Error) {
+        return StatusFromVmError[Context.Error];
+    }
+
+    *Result = Context.Result;
+    return BW_OK;
+}
+
+bw_status bw_eval_batch(const bw_program *Program, const int32_t *Params, size_t ParamStride,
+                        int32_t *Results, size_t Count, bw_error *Error)
+{
+    if(!Program || (Count && !Results) || ParamStride < (size_t)Program->ParamCount ||
+       (Count && Program->ParamCount && !Params))
+    {
+        return reportError(Error, BW_ERROR_INVALID_ARGUMENT, 0);
+    }
+
+    // NOTE: Bit slicing pays off once a whole 64-lane block is filled, and it cannot trap. Without
+    // memory for the slices the inputs still run one by one.
+    if(Program->Bitslice && Count >= 64 &&
+       bitsliceRun(Program->Bitslice, (int32_t *)Params, ParamStride, Results, Count))
+    {
+        return reportError(Error, BW_OK, 0);
+    }
+
+    for(size_t Index = 0; Index < Count; ++Index) {
+        bw_status Status = bw_eval(Program, Params + Index*ParamStride, Results + Index);
+        if(Status != BW_OK) {
+            return reportError(Error, Status, Index);
+        }
+    }
+
+    return reportError(Error, BW_OK, 0);
+}
+
+void bw_free(bw_program *Program) {
+    if(Program) {
+        bufFree(Program->Code);
+        if(Program->Bitslice) {
+            bitsliceFree(Program->Bitslice);
+        }
+        free(Program->Source);
+        free(Program->Bindings);
+        free(Program);
+    }
+}
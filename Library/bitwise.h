@@ -0,0 +1,107 @@
+// libbitwise: compile an expression once and evaluate it many times in-process.
+//
+// The library never exits the process: every call reports failures through its return value,
+// running out of memory included. Expressions nested more than about a thousand levels deep,
+// counting every operator of a chain as a level, fail to compile with BW_ERROR_TOO_DEEP, so
+// compiling never overflows the stack. Its only global state is the idiom templates and peephole
+// rules compiling matches against, parsed once under pthread_once() by whichever call needs them
+// first, so any number of threads may compile at the same time. Link with -pthread. A compiled
+// program is immutable, so it can be shared by any number of threads evaluating it concurrently.
+//
+//   bw_program *Program;
+//   bw_error Error;
+//   if(bw_compile("($0 & 0xFF) * $1", 16, &Program, &Error) != BW_OK) {
+//       fprintf(stderr, "%s at offset %zu\n", Error.Message, Error.Offset);
+//   }
+//
+//   int32_t Params[] = {0x1234, 3}, Result;
+//   bw_eval(Program, Params, &Result);
+//   bw_free(Program);
+
+#ifndef BITWISE_H
+#define BITWISE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bw_program bw_program;
+
+typedef enum bw_status {
+    BW_OK = 0,
+
+    // Compilation
+    BW_ERROR_INVALID_DIGIT,
+    BW_ERROR_INTEGER_OVERFLOW,
+    BW_ERROR_INVALID_PARAM,
+    BW_ERROR_UNEXPECTED_TOKEN,
+    BW_ERROR_MISSING_OPERATOR,
+    BW_ERROR_TOO_DEEP,
+
+    // Evaluation
+    BW_ERROR_DIVISION_BY_ZERO,
+
+    BW_ERROR_INVALID_ARGUMENT,
+    BW_ERROR_OUT_OF_MEMORY,
+} bw_status;
+
+typedef struct bw_error {
+    bw_status Status;
+    // Byte offset into the source for compilation errors, index of the failing input for
+    // bw_eval_batch()
+    size_t Offset;
+    const char *Message;
+} bw_error;
+
+// Compiles Length bytes of Source, which need not be NUL-terminated. Error may be NULL.
+bw_status bw_compile(const char *Source, size_t Length, bw_program **Program, bw_error *Error);
+
+// Parameters $0..$(N-1) the program reads, every Params vector must hold at least N values.
+int bw_param_count(const bw_program *Program);
+
+bw_status bw_eval(const bw_program *Program, const int32_t *Params, int32_t *Result);
+
+// Evaluates Count inputs, input I reads its parameters from Params + I*ParamStride. Stops at the
+// first failing input, whose index is reported through Error (which may be NULL).
+bw_status bw_eval_batch(const bw_program *Program, const int32_t *Params, size_t ParamStride,
+                        int32_t *Results, size_t Count, bw_error *Error);
+
+void bw_free(bw_program *Program);
+
+// A parameter fixed to a value by bw_specialize()
+typedef struct bw_binding {
+    int Param;
+    int32_t Value;
+} bw_binding;
+
+// Compiles a copy of Program with the Count bound parameters folded in, for parameters that
+// rarely change. The specialized program reads the same parameter vectors as Program, the bound
+// slots are ignored, and fails on the same inputs. Binding one parameter to two values is
+// BW_ERROR_INVALID_ARGUMENT. Specialized programs can be specialized further.
+bw_status bw_specialize(const bw_program *Program, const bw_binding *Bindings, size_t Count,
+                        bw_program **Specialized);
+
+// Cache of the specializations of one program, keyed by the bindings in any order. It keeps the
+// Capacity most recently used ones. Unlike programs it is not synchronized: use one per thread,
+// or lock around bw_specializer_get(). Program must outlive the specializer.
+typedef struct bw_specializer bw_specializer;
+
+bw_status bw_specializer_new(const bw_program *Program, size_t Capacity, bw_specializer **Specializer);
+
+// The returned program belongs to the specializer. It stays valid until Capacity other bindings
+// have been requested, or the specializer is freed.
+bw_status bw_specializer_get(bw_specializer *Specializer, const bw_binding *Bindings, size_t Count,
+                             const bw_program **Specialized);
+
+void bw_specializer_free(bw_specializer *Specializer);
+
+const char *bw_status_message(bw_status Status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
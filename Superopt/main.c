@@ -0,0 +1,716 @@
+// Superoptimizer for short bytecode sequences.
+//
+// A window is a straight-line run of a program's instructions that takes some values from the
+// stack and leaves one. Its inputs are those stack values, the parameters it reads and its
+// literals, except 0, 1, 2 and -1, which mean the same at every bit width. The other literals
+// become placeholders, so a rule found for a window holds for every literal in their place.
+//
+// Candidates over the opcode set are enumerated by increasing length, or sampled by a stochastic
+// search with --stochastic, and have to be cheaper than the window. A candidate that agrees with
+// the window on a few inputs is run on thousands more at 32 bits, then on every combination of
+// inputs in a model of the same instructions at a reduced bit width. Traps count as results, a
+// candidate has to trap exactly when the window does, and shifts by amounts outside the width
+// trap in the model because they are undefined in the VM. Agreement at a reduced width is strong
+// evidence rather than a proof, which is why verified rules are still reviewed before they are
+// committed to Common/rewrites.inc, the database the compiler's peephole pass applies.
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <instruction_table.h>
+#include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <vm.c>
+#include <peephole.c>
+
+enum {
+    SuperMaxWindow = 10,
+    SuperMaxInputs = 8,
+    SuperQuickTests = 16,
+    SuperTests = 4096,
+    // NOTE: Reduced width models run 2^SuperExhaustiveBits input combinations at most
+    SuperExhaustiveBits = 18,
+    SuperMinWidth = 3,
+    SuperMaxWidth = 8,
+    SuperDefaultLength = 4,
+    SuperMaxAlphabet = 48,
+};
+
+typedef struct super_window {
+    int Inputs;
+    int ParamCount;
+    int LiteralCount;
+    int Count;
+    // NOTE: Highest stack depth reached, counting the inputs
+    int Peak;
+    peephole_insn Insns[PeepholeMaxLength];
+} super_window;
+
+// NOTE: Values of one test, stack inputs first, then parameters, then literal placeholders
+typedef struct super_test {
+    int64_t Inputs[SuperMaxInputs];
+    int64_t Result;
+    bool Trapped;
+} super_test;
+
+typedef struct super_search {
+    super_window *Window;
+    super_test *Tests;
+    int TestCount;
+    peephole_insn Alphabet[SuperMaxAlphabet];
+    int AlphabetCount;
+
+    peephole_insn Candidate[PeepholeMaxLength];
+    peephole_insn Best[PeepholeMaxLength];
+    int BestCount;
+    bool Found;
+    uint64_t Tried;
+} super_search;
+
+static uint64_t SuperRandom = 0x2545F4914F6CDD1Dull;
+static uint32_t superRandomU32(void) {
+    SuperRandom ^= SuperRandom << 13;
+    SuperRandom ^= SuperRandom >> 7;
+    SuperRandom ^= SuperRandom << 17;
+    return (uint32_t)SuperRandom;
+}
+
+// NOTE: Random values favor the ones where identities break: corners, shift amounts, small numbers
+static int64_t superRandomValue(void) {
+    static int32_t Corners[] = {0, 1, -1, 2, 31, 32, INT32_MIN, INT32_MAX, INT32_MIN + 1, 0x55555555};
+    switch(superRandomU32() % 4) {
+        case 0:  { return Corners[superRandomU32() % arrayCount(Corners)]; } break;
+        case 1:  { return superRandomU32() % 40; } break;
+        default: { return (int32_t)superRandomU32(); } break;
+    }
+}
+
+static int64_t superWrap(uint64_t Value, int Width) {
+    return (int64_t)(Value << (64 - Width)) >> (64 - Width);
+}
+
+static bool superGeneric(int32_t Value) {
+    return Value == 0 || Value == 1 || Value == 2 || Value == -1;
+}
+
+// NOTE: Runs Insns on the values of a window's inputs in the model of the given Width, 32 being
+// the VM itself. Returns false when it traps.
+static bool superRun(peephole_insn *Insns, int Count, super_window *Window, int Width, int64_t *Inputs,
+                     int64_t *Result)
+{
+    int64_t Stack[SuperMaxInputs + PeepholeMaxLength];
+    int Top = 0;
+    for(; Top < Window->Inputs; ++Top) {
+        Stack[Top] = Inputs[Top];
+    }
+
+    uint64_t Mask = Width == 64 ? UINT64_MAX : ((uint64_t)1 << Width) - 1;
+    int64_t Smallest = -((int64_t)1 << (Width - 1));
+    for(int Index = 0; Index < Count; ++Index) {
+        peephole_insn *Insn = Insns + Index;
+        if(Insn->Op == ARG) {
+            Stack[Top++] = Inputs[Window->Inputs + Insn->Value];
+            continue;
+        }
+        if(Insn->Op == LIT) {
+            Stack[Top++] = Insn->Placeholder ? Inputs[Window->Inputs + Window->ParamCount + Insn->Value] :
+                                               superWrap(Insn->Value, Width);
+            continue;
+        }
+        if(Insn->Op == NOP) {
+            continue;
+        }
+
+        int64_t Rhs = Stack[--Top];
+        uint64_t Value = Rhs & Mask;
+        switch(Insn->Op) {
+            case NOT:    { Stack[Top++] = ~Rhs; } break;
+            case SYM:    { Stack[Top++] = superWrap(-(uint64_t)Rhs, Width); } break;
+            case POPCNT: { Stack[Top++] = superWrap(__builtin_popcountll(Value), Width); } break;
+            case CLZ:    { Stack[Top++] = superWrap(Value ? __builtin_clzll(Value) - (64 - Width) : Width, Width); } break;
+            case CTZ:    { Stack[Top++] = superWrap(Value ? __builtin_ctzll(Value) : Width, Width); } break;
+
+            default: {
+                int64_t Lhs = Stack[--Top];
+                uint64_t Bits = Lhs & Mask;
+                int64_t Out = 0;
+                switch(Insn->Op) {
+                    case ADD: { Out = superWrap(Lhs + Rhs, Width); } break;
+                    case SUB: { Out = superWrap(Lhs - Rhs, Width); } break;
+                    case MUL: { Out = superWrap((uint64_t)Lhs * (uint64_t)Rhs, Width); } break;
+                    case OR:  { Out = Lhs | Rhs; } break;
+                    case XOR: { Out = Lhs ^ Rhs; } break;
+                    case AND: { Out = Lhs & Rhs; } break;
+
+                    case DIV:
+                    case MOD: {
+                        if(Rhs == 0 || (Lhs == Smallest && Rhs == -1)) {
+                            return false;
+                        }
+                        Out = Insn->Op == DIV ? Lhs / Rhs : Lhs % Rhs;
+                    } break;
+
+                    // NOTE: Counts are taken modulo the width, like the VM does modulo 32
+                    case LSH:
+                    case RSH: {
+                        int Amount = Value % Width;
+                        Out = Insn->Op == LSH ? superWrap(Bits << Amount, Width) : Lhs >> Amount;
+                    } break;
+
+                    case ROL:
+                    case ROR: {
+                        int Amount = Value % Width;
+                        if(Insn->Op == ROR) {
+                            Amount = (Width - Amount) % Width;
+                        }
+                        Out = superWrap(Amount ? (Bits << Amount) | (Bits >> (Width - Amount)) : Bits, Width);
+                    } break;
+
+                    case PDEP:
+                    case PEXT: {
+                        uint64_t Result = 0;
+                        int Next = 0;
+                        for(int Bit = 0; Bit < Width; ++Bit) {
+                            if(Value & ((uint64_t)1 << Bit)) {
+                                if(Insn->Op == PDEP) {
+                                    Result |= ((Bits >> Next) & 1) << Bit;
+                                } else {
+                                    Result |= ((Bits >> Bit) & 1) << Next;
+                                }
+                                ++Next;
+                            }
+                        }
+                        Out = superWrap(Result, Width);
+                    } break;
+
+                    // NOTE: Stack values are sign extended, so these compare as the VM does
+                    case LT: { Out = Lhs <  Rhs; } break;
+                    case LE: { Out = Lhs <= Rhs; } break;
+                    case EQ: { Out = Lhs == Rhs; } break;
+                    case NE: { Out = Lhs != Rhs; } break;
+
+                    InvalidDefaultCase;
+                }
+                Stack[Top++] = Out;
+            } break;
+        }
+    }
+
+    assert(Top == 1);
+    *Result = Stack[0];
+    return true;
+}
+
+static bool superSupported(mnemonic Op) {
+    switch(Op) {
+        case LIT: case ARG: case ADD: case SUB: case MUL: case DIV: case MOD: case OR: case XOR:
+        case AND: case NOT: case SYM: case LSH: case RSH: case POPCNT: case CLZ: case CTZ:
+        case ROL: case ROR: case PDEP: case PEXT: case LT: case LE: case EQ: case NE:
+        {
+            return true;
+        } break;
+
+        // NOTE: POW goes through double in the VM and BSWAP has no reduced width counterpart. SEL
+        // takes three operands, the search assumes at most two.
+        default: {
+            return false;
+        } break;
+    }
+}
+
+static int superStackEffect(mnemonic Op) {
+    switch(Op) {
+        case LIT: case ARG: { return 1; } break;
+        case NOT: case SYM: case POPCNT: case CLZ: case CTZ: case NOP: { return 0; } break;
+        default: { return -1; } break;
+    }
+}
+
+// NOTE: Turns Count raw instructions into a window with placeholders, false when they are no
+// window the search supports
+static bool superWindow(peephole_insn *Insns, int Count, super_window *Window) {
+    *Window = (super_window){.Count = Count};
+    int32_t Params[PeepholeMaxBindings], Literals[PeepholeMaxBindings];
+
+    int Depth = 0, Lowest = 0, Highest = 0;
+    for(int Index = 0; Index < Count; ++Index) {
+        peephole_insn Insn = Insns[Index];
+        if(!superSupported(Insn.Op)) {
+            return false;
+        }
+
+        int Effect = superStackEffect(Insn.Op);
+        Depth -= Effect < 0 ? 2 : Effect == 0;
+        Lowest = min(Lowest, Depth);
+        Depth += Effect < 0 ? 1 : Effect == 0 ? 1 : Effect;
+        Highest = max(Highest, Depth);
+
+        if(Insn.Op == ARG || (Insn.Op == LIT && !superGeneric(Insn.Value))) {
+            int32_t *Seen = Insn.Op == ARG ? Params : Literals;
+            int *SeenCount = Insn.Op == ARG ? &Window->ParamCount : &Window->LiteralCount;
+            int Slot = 0;
+            while(Slot < *SeenCount && Seen[Slot] != Insn.Value) {
+                ++Slot;
+            }
+            if(Slot == *SeenCount) {
+                if(Slot == PeepholeMaxBindings) {
+                    return false;
+                }
+                Seen[(*SeenCount)++] = Insn.Value;
+            }
+            Insn.Value = Slot;
+            Insn.Placeholder = true;
+        }
+        Insn.Bytes = 0;
+        Window->Insns[Index] = Insn;
+    }
+
+    Window->Inputs = -Lowest;
+    Window->Peak = Highest - Lowest;
+    return Depth - Lowest == 1 && Window->Inputs + Window->ParamCount + Window->LiteralCount <= SuperMaxInputs;
+}
+
+static int superInputCount(super_window *Window) {
+    return Window->Inputs + Window->ParamCount + Window->LiteralCount;
+}
+
+static void superFormat(peephole_insn *Insns, int Count, char *Out, size_t Size) {
+    size_t Length = 0;
+    Out[0] = 0;
+    for(int Index = 0; Index < Count && Length < Size; ++Index) {
+        peephole_insn *Insn = Insns + Index;
+        if(Insn->Op == NOP) {
+            continue;
+        }
+
+        char *Separator = Length ? " " : "";
+        if(Insn->Op == ARG) {
+            Length += snprintf(Out + Length, Size - Length, "%sARG $%d", Separator, Insn->Value);
+        } else if(Insn->Op == LIT) {
+            Length += snprintf(Out + Length, Size - Length, Insn->Placeholder ? "%sLIT #%d" : "%sLIT %d",
+                               Separator, Insn->Value);
+        } else {
+            Length += snprintf(Out + Length, Size - Length, "%s%s", Separator, MnemonicNames[Insn->Op]);
+        }
+    }
+}
+
+// NOTE: Drops the NOP slots of the stochastic search
+static int superCompact(peephole_insn *Insns, int Count, peephole_insn *Out) {
+    int Result = 0;
+    for(int Index = 0; Index < Count; ++Index) {
+        if(Insns[Index].Op != NOP) {
+            Out[Result++] = Insns[Index];
+        }
+    }
+    return Result;
+}
+
+static bool superAgrees(super_search *Search, peephole_insn *Insns, int Count, super_test *Test, int Width) {
+    int64_t Result;
+    bool Trapped = !superRun(Insns, Count, Search->Window, Width, Test->Inputs, &Result);
+    return Trapped == Test->Trapped && (Trapped || Result == Test->Result);
+}
+
+static void superMakeTests(super_window *Window, super_test *Tests, int Count) {
+    for(int Index = 0; Index < Count; ++Index) {
+        super_test *Test = Tests + Index;
+        for(int Input = 0; Input < superInputCount(Window); ++Input) {
+            Test->Inputs[Input] = superRandomValue();
+        }
+        Test->Trapped = !superRun(Window->Insns, Window->Count, Window, 32, Test->Inputs, &Test->Result);
+    }
+}
+
+// NOTE: Every combination of input values at the largest width that keeps it below
+// 2^SuperExhaustiveBits runs
+static bool superVerifyReduced(super_search *Search, peephole_insn *Insns, int Count) {
+    super_window *Window = Search->Window;
+    int Inputs = superInputCount(Window);
+    int Width = min(SuperMaxWidth, SuperExhaustiveBits / max(Inputs, 1));
+    if(Width < SuperMinWidth) {
+        return false;
+    }
+
+    uint64_t Combinations = (uint64_t)1 << (Width*Inputs);
+    for(uint64_t Combination = 0; Combination < Combinations; ++Combination) {
+        super_test Test;
+        for(int Input = 0; Input < Inputs; ++Input) {
+            Test.Inputs[Input] = superWrap(Combination >> (Width*Input), Width);
+        }
+        Test.Trapped = !superRun(Window->Insns, Window->Count, Window, Width, Test.Inputs, &Test.Result);
+        if(!superAgrees(Search, Insns, Count, &Test, Width)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool superVerify(super_search *Search, peephole_insn *Insns, int Count) {
+    for(int Index = SuperQuickTests; Index < Search->TestCount; ++Index) {
+        if(!superAgrees(Search, Insns, Count, Search->Tests + Index, 32)) {
+            return false;
+        }
+    }
+    return superVerifyReduced(Search, Insns, Count);
+}
+
+static bool superQuick(super_search *Search, peephole_insn *Insns, int Count) {
+    for(int Index = 0; Index < SuperQuickTests; ++Index) {
+        if(!superAgrees(Search, Insns, Count, Search->Tests + Index, 32)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void superConsider(super_search *Search, peephole_insn *Insns, int Count) {
+    ++Search->Tried;
+    peephole_insn *Than = Search->Found ? Search->Best : Search->Window->Insns;
+    int ThanCount = Search->Found ? Search->BestCount : Search->Window->Count;
+    if(peepholeCheaper(Insns, Count, Than, ThanCount) && superQuick(Search, Insns, Count) &&
+       superVerify(Search, Insns, Count))
+    {
+        memcpy(Search->Best, Insns, Count*sizeof(*Insns));
+        Search->BestCount = Count;
+        Search->Found = true;
+    }
+}
+
+static void superBuildAlphabet(super_search *Search) {
+    super_window *Window = Search->Window;
+    int Count = 0;
+    for(int Param = 0; Param < Window->ParamCount; ++Param) {
+        Search->Alphabet[Count++] = (peephole_insn){.Op = ARG, .Value = Param, .Placeholder = true};
+    }
+    for(int Literal = 0; Literal < Window->LiteralCount; ++Literal) {
+        Search->Alphabet[Count++] = (peephole_insn){.Op = LIT, .Value = Literal, .Placeholder = true};
+    }
+    static int32_t Generic[] = {0, 1, 2, -1};
+    for(int Literal = 0; Literal < (int)arrayCount(Generic); ++Literal) {
+        Search->Alphabet[Count++] = (peephole_insn){.Op = LIT, .Value = Generic[Literal]};
+    }
+    static mnemonic Ops[] = {NOT, SYM, POPCNT, CLZ, CTZ, ADD, SUB, MUL, DIV, MOD, OR, XOR, AND, LSH, RSH,
+                             ROL, ROR, PDEP, PEXT, LT, LE, EQ, NE};
+    for(int Op = 0; Op < (int)arrayCount(Ops); ++Op) {
+        Search->Alphabet[Count++] = (peephole_insn){.Op = Ops[Op]};
+    }
+    Search->AlphabetCount = Count;
+}
+
+static void superEnumerate(super_search *Search, int Length, int At, int Depth, int Peak) {
+    if(At == Length) {
+        if(Depth == 1) {
+            superConsider(Search, Search->Candidate, Length);
+        }
+        return;
+    }
+
+    // NOTE: Every remaining instruction lowers the depth by at most one
+    int Remaining = Length - At;
+    for(int Symbol = 0; Symbol < Search->AlphabetCount; ++Symbol) {
+        peephole_insn *Insn = Search->Alphabet + Symbol;
+        int Effect = superStackEffect(Insn->Op);
+        int Needed = Effect < 0 ? 2 : Effect == 0;
+        int Next = Depth + (Effect < 0 ? -1 : Effect);
+        if(Depth < Needed || Next - (Remaining - 1) > 1 || max(Peak, Next) > Search->Window->Peak) {
+            continue;
+        }
+
+        Search->Candidate[At] = *Insn;
+        superEnumerate(Search, Length, At + 1, Next, max(Peak, Next));
+    }
+}
+
+// NOTE: Hamming distance of the results on the quick tests, a mismatched trap counts as all bits.
+// A program that does not leave one value on the stack costs half a test per missing or extra
+// value instead, so removing an instruction and then its operand is no insurmountable step.
+static int superMismatch(super_search *Search, peephole_insn *Insns, int Count) {
+    int Depth = Search->Window->Inputs, Peak = Depth, Errors = 0;
+    for(int Index = 0; Index < Count; ++Index) {
+        int Effect = superStackEffect(Insns[Index].Op);
+        int Needed = Effect < 0 ? 2 : Effect == 0 && Insns[Index].Op != NOP;
+        if(Depth < Needed) {
+            Errors += Needed - Depth;
+            Depth = Needed;
+        }
+        Depth += Effect < 0 ? -1 : Effect;
+        Peak = max(Peak, Depth);
+    }
+    Errors += abs(Depth - 1) + max(Peak - Search->Window->Peak, 0);
+    if(Errors) {
+        return 16*Errors;
+    }
+
+    int Mismatch = 0;
+    for(int Index = 0; Index < SuperQuickTests; ++Index) {
+        super_test *Test = Search->Tests + Index;
+        int64_t Result;
+        bool Trapped = !superRun(Insns, Count, Search->Window, 32, Test->Inputs, &Result);
+        Mismatch += Trapped != Test->Trapped ? 32 : Trapped ? 0 : bitPopcount((uint32_t)(Result ^ Test->Result));
+    }
+    return Mismatch;
+}
+
+// NOTE: Markov chain over programs with one slot per window instruction, a NOP slot is empty. It
+// starts at the window itself. Moves swap two slots, replace an opcode by one with the same stack
+// effect or replace a slot by anything. The cost is the mismatch plus the instruction count, and a
+// worse program is accepted with probability exp(-Increase/2), so the chain can cross the invalid
+// programs between two correct ones.
+static void superStochastic(super_search *Search, uint64_t Iterations) {
+    int Slots = Search->Window->Count;
+    peephole_insn Current[PeepholeMaxLength], Compact[PeepholeMaxLength];
+    memcpy(Current, Search->Window->Insns, Slots*sizeof(*Current));
+    int Cost = Slots;
+
+    for(uint64_t Iteration = 0; Iteration < Iterations; ++Iteration) {
+        int Slot = superRandomU32() % Slots, Other = superRandomU32() % Slots;
+        peephole_insn Saved = Current[Slot], SavedOther = Current[Other];
+        switch(superRandomU32() % 3) {
+            case 0: {
+                Current[Slot] = SavedOther;
+                Current[Other] = Saved;
+            } break;
+
+            // NOTE: Opcode moves keep the stack effect, so they mostly stay among valid programs
+            case 1: {
+                for(int Attempt = 0; Attempt < 8; ++Attempt) {
+                    peephole_insn *Insn = Search->Alphabet + superRandomU32() % Search->AlphabetCount;
+                    if(superStackEffect(Insn->Op) == superStackEffect(Saved.Op) && Saved.Op != NOP) {
+                        Current[Slot] = *Insn;
+                        break;
+                    }
+                }
+            } break;
+
+            default: {
+                uint32_t Symbol = superRandomU32() % (Search->AlphabetCount + 1);
+                Current[Slot] = Symbol == (uint32_t)Search->AlphabetCount ? (peephole_insn){.Op = NOP} :
+                                                                             Search->Alphabet[Symbol];
+            } break;
+        }
+
+        int Count = superCompact(Current, Slots, Compact);
+        int Mismatch = superMismatch(Search, Current, Slots);
+        int Next = Mismatch + Count;
+        if(Next > Cost && (double)superRandomU32() / UINT32_MAX >= exp(0.5*(Cost - Next))) {
+            Current[Other] = SavedOther;
+            Current[Slot] = Saved;
+            continue;
+        }
+
+        Cost = Next;
+        if(Mismatch == 0) {
+            superConsider(Search, Compact, Count);
+        }
+    }
+}
+
+// NOTE: Reads the Rewrite(Inputs, "From", "To") lines of a database file
+static peephole_rule *superLoadRules(char *Path) {
+    peephole_rule *Rules = 0;
+    FILE *File = fopen(Path, "r");
+    if(!File) {
+        return 0;
+    }
+
+    char Line[1024];
+    while(fgets(Line, sizeof(Line), File)) {
+        char *Quotes[4];
+        int QuoteCount = 0;
+        for(char *At = Line; *At && QuoteCount < 4; ++At) {
+            if(*At == '"') {
+                Quotes[QuoteCount++] = At;
+            }
+        }
+
+        peephole_rule Rule = {};
+        if(sscanf(Line, " Rewrite(%d,", &Rule.Inputs) != 1 || QuoteCount != 4) {
+            continue;
+        }
+        *Quotes[1] = *Quotes[3] = 0;
+        Rule.From = strdup(Quotes[0] + 1);
+        Rule.To = strdup(Quotes[2] + 1);
+        Rule.FromCount = peepholeParse(Rule.From, Rule.From_);
+        Rule.ToCount = peepholeParse(Rule.To, Rule.To_);
+        if(Rule.FromCount <= 0 || Rule.ToCount < 0) {
+            fatalError("Invalid rewrite rule in %s: %s", Path, Line);
+        }
+        bufPush(Rules, Rule);
+    }
+
+    fclose(File);
+    return Rules;
+}
+
+// NOTE: A window some rule already rewrites, anywhere inside it, needs no search
+static bool superCovered(peephole_rule *Rules, peephole_insn *Insns, int Count) {
+    for(int At = 0; At < Count; ++At) {
+        for(size_t Index = 0; Index < bufLength(Rules); ++Index) {
+            peephole_bindings Bindings;
+            if(peepholeMatch(Rules + Index, Insns + At, Count - At, &Bindings)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void usage(char *Program) {
+    fprintf(stderr, "Usage: %s [--window START LENGTH] [--max-length N] [--stochastic ITERATIONS]\n"
+                    "       [--seed N] [--db FILE] PROGRAM\n", Program);
+    fprintf(stderr, "  --window START LENGTH    Only optimize the instructions START..START+LENGTH-1,\n");
+    fprintf(stderr, "                           by default every window of up to %d instructions\n", SuperMaxWindow);
+    fprintf(stderr, "  --max-length N           Longest candidate enumerated (default %d)\n", SuperDefaultLength);
+    fprintf(stderr, "  --stochastic ITERATIONS  Sample candidates as long as the window instead\n");
+    fprintf(stderr, "  --seed N                 Seed of the random tests and the stochastic search\n");
+    fprintf(stderr, "  --db FILE                Skip windows its rules cover and append the new ones\n");
+    exit(1);
+}
+
+int main(int ArgCount, char *ArgVal[]) {
+    int WindowStart = -1, WindowLength = 0;
+    int MaxLength = SuperDefaultLength;
+    uint64_t Iterations = 0;
+    char *DbPath = 0, *Path = 0;
+
+    for(int Index = 1; Index < ArgCount; ++Index) {
+        if(strcmp(ArgVal[Index], "--window") == 0 && Index+2 < ArgCount) {
+            WindowStart = atoi(ArgVal[++Index]);
+            WindowLength = atoi(ArgVal[++Index]);
+            if(WindowStart < 0 || WindowLength <= 0 || WindowLength > PeepholeMaxLength) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "--max-length") == 0 && Index+1 < ArgCount) {
+            MaxLength = atoi(ArgVal[++Index]);
+            if(MaxLength < 0 || MaxLength > PeepholeMaxLength) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[Index], "--stochastic") == 0 && Index+1 < ArgCount) {
+            Iterations = strtoull(ArgVal[++Index], 0, 0);
+        }
+        else if(strcmp(ArgVal[Index], "--seed") == 0 && Index+1 < ArgCount) {
+            SuperRandom = 2*strtoull(ArgVal[++Index], 0, 0) + 1;
+        }
+        else if(strcmp(ArgVal[Index], "--db") == 0 && Index+1 < ArgCount) {
+            DbPath = ArgVal[++Index];
+        }
+        else if(!Path) {
+            Path = ArgVal[Index];
+        }
+        else {
+            usage(ArgVal[0]);
+        }
+    }
+    if(!Path) {
+        usage(ArgVal[0]);
+    }
+
+    size_t Size;
+    int ParamCount;
+    uint8_t *Code = readEntireFile(Path, &Size);
+    if(Size && Code[0] == MODP) {
+        fatalError("%s was compiled with --mod, its arithmetic is not the VM's", Path);
+    }
+    if(!vmValidate(Code, Size, &ParamCount)) {
+        fatalError("%s is not a valid program", Path);
+    }
+
+    peepholeInit();
+    peephole_rule *Rules = 0;
+    if(DbPath) {
+        Rules = superLoadRules(DbPath);
+    } else {
+        for(int Index = 0; Index < (int)arrayCount(PeepholeRules); ++Index) {
+            bufPush(Rules, PeepholeRules[Index]);
+        }
+    }
+
+    FILE *Db = DbPath ? fopen(DbPath, "a") : 0;
+    if(DbPath && !Db) {
+        fatalError("Could not open %s for appending", DbPath);
+    }
+
+    peephole_insn *Insns = peepholeDecode(Code);
+    int InsnCount = bufLength(Insns) - 1;
+    if(WindowStart >= 0 && WindowStart + WindowLength > InsnCount) {
+        fatalError("%s only has %d instructions", Path, InsnCount);
+    }
+
+    static super_test Tests[SuperTests];
+    int Found = 0, Searched = 0;
+    // NOTE: Shorter windows first, the rules they give cover the longer windows around them
+    for(int Length = 2; Length <= SuperMaxWindow; ++Length) {
+        for(int Start = 0; Start + Length <= InsnCount; ++Start) {
+            if(WindowStart >= 0 && (Start != WindowStart || Length != WindowLength)) {
+                continue;
+            }
+
+            super_window Window;
+            if(!superWindow(Insns + Start, Length, &Window) || superInputCount(&Window) == 0 ||
+               superCovered(Rules, Insns + Start, Length))
+            {
+                if(WindowStart >= 0) {
+                    fatalError("Instructions %d..%d are no window that can be searched or are already covered",
+                               Start, Start + Length - 1);
+                }
+                continue;
+            }
+
+            super_search Search = {.Window = &Window, .Tests = Tests, .TestCount = SuperTests};
+            superMakeTests(&Window, Tests, SuperTests);
+            superBuildAlphabet(&Search);
+            if(Iterations) {
+                superStochastic(&Search, Iterations);
+            } else {
+                for(int Candidate = 0; Candidate <= min(MaxLength, Window.Count) && !Search.Found; ++Candidate) {
+                    superEnumerate(&Search, Candidate, 0, Window.Inputs, Window.Inputs);
+                }
+            }
+            ++Searched;
+
+            char From[512], To[512];
+            superFormat(Window.Insns, Window.Count, From, sizeof(From));
+            if(!Search.Found) {
+                if(WindowStart >= 0) {
+                    printf("%s: nothing cheaper among %llu candidates\n", From, (unsigned long long)Search.Tried);
+                }
+                continue;
+            }
+
+            superFormat(Search.Best, Search.BestCount, To, sizeof(To));
+            printf("%d..%d, %d input%s: %s\n  => %s\n", Start, Start + Length - 1, Window.Inputs,
+                   Window.Inputs == 1 ? "" : "s", From, Search.BestCount ? To : "(nothing)");
+            ++Found;
+
+            peephole_rule Rule = {.Inputs = Window.Inputs, .From = strdup(From), .To = strdup(To)};
+            Rule.FromCount = peepholeParse(Rule.From, Rule.From_);
+            Rule.ToCount = peepholeParse(Rule.To, Rule.To_);
+            bufPush(Rules, Rule);
+            if(Db) {
+                fprintf(Db, "Rewrite(%d, \"%s\", \"%s\")\n", Window.Inputs, From, To);
+            }
+        }
+    }
+
+    printf("%d window%s searched, %d rewrite%s found\n", Searched, Searched == 1 ? "" : "s", Found,
+           Found == 1 ? "" : "s");
+    if(Db) {
+        fclose(Db);
+    }
+    bufFree(Insns);
+    free(Code);
+    return 0;
+}
@@ -0,0 +1,403 @@
+// Batch mode: runs every program named in a list file and streams one line per program,
+// "PATH: RESULT" or "PATH: error: MESSAGE".
+//
+// Files are opened, read and closed through io_uring with BatchQueueDepth files in flight, each
+// reading into its own slot of a registered buffer pool. A program runs as soon as its read
+// completes, so results come out in completion order. Where io_uring is unavailable a thread pool
+// reads BatchChunk files at a time and the results keep the order of the list.
+//
+// Programs are untrusted, so they are validated before running and any failure only costs its
+// own line.
+
+enum {
+    BatchQueueDepth = 64,
+    BatchBufferSize = 64 << 10,
+    BatchChunk = 256,
+    BatchDefaultThreads = 16,
+    BatchLineSize = PATH_MAX + 64,
+};
+
+typedef enum batch_reader {
+    BatchReader_Auto,
+    BatchReader_Uring,
+    BatchReader_Threads,
+} batch_reader;
+
+typedef struct batch_stats {
+    size_t Files;
+    size_t Failed;
+    char *Reader;
+} batch_stats;
+
+// NOTE: Validates and executes Size bytes of Code, formatting the result line into Line
+static int batchExecute(char *Path, uint8_t *Code, size_t Size, int32_t *Params, char *Line, bool *Failed) {
+    int ParamCount;
+    if(!vmValidate(Code, Size, &ParamCount)) {
+        *Failed = true;
+        return snprintf(Line, BatchLineSize, "%s: error: Invalid bytecode.\n", Path);
+    }
+
+    vm_context Context;
+    vmInit(&Context, Code, Params);
+    while(!vmRun(&Context, UINT32_MAX)) {}
+
+    *Failed = Context.Error != VmError_None;
+    if(*Failed) {
+        return snprintf(Line, BatchLineSize, "%s: error: %s\n", Path, VmErrorMessages[Context.Error]);
+    }
+    return snprintf(Line, BatchLineSize, "%s: %d\n", Path, Context.Result);
+}
+
+static int batchError(char *Path, int Error, char *Line) {
+    return snprintf(Line, BatchLineSize, "%s: error: %s\n", Path, strerror(Error));
+}
+
+// NOTE: Splits the list in place, one path per line, empty lines are skipped. The paths point
+// into *List, which the caller frees.
+static char **batchReadList(char *ListPath, char **List) {
+    *List = (char *)readEntireFile(ListPath, 0);
+    char **Paths = 0;
+    for(char *Line = *List; *Line;) {
+        char *End = Line + strcspn(Line, "\r\n");
+        char *Next = End + (*End != 0);
+        *End = 0;
+        if(End > Line) {
+            bufPush(Paths, Line);
+        }
+        Line = Next;
+    }
+
+    return Paths;
+}
+
+// io_uring, set up through the raw system calls
+
+typedef struct batch_ring {
+    int File;
+    uint32_t Entries;
+
+    _Atomic uint32_t *SqHead;
+    _Atomic uint32_t *SqTail;
+    uint32_t SqMask;
+    uint32_t *SqArray;
+    struct io_uring_sqe *Sqes;
+    uint32_t Unsubmitted;
+
+    _Atomic uint32_t *CqHead;
+    _Atomic uint32_t *CqTail;
+    uint32_t CqMask;
+    struct io_uring_cqe *Cqes;
+
+    bool FixedBuffers;
+} batch_ring;
+
+typedef enum batch_stage {
+    BatchStage_Open,
+    BatchStage_Read,
+    BatchStage_Close,
+} batch_stage;
+
+typedef struct batch_slot {
+    char *Path;
+    int File;
+    uint8_t *Buffer;
+} batch_slot;
+
+static bool batchRingInit(batch_ring *Ring, uint32_t Entries) {
+    struct io_uring_params Params = {};
+    long File = syscall(__NR_io_uring_setup, Entries, &Params);
+    if(File < 0) {
+        return false;
+    }
+
+    *Ring = (batch_ring){.File = File, .Entries = Params.sq_entries};
+    size_t SqSize = Params.sq_off.array + Params.sq_entries*sizeof(uint32_t);
+    size_t CqSize = Params.cq_off.cqes + Params.cq_entries*sizeof(struct io_uring_cqe);
+    bool Single = Params.features & IORING_FEAT_SINGLE_MMAP;
+    if(Single) {
+        SqSize = CqSize = max(SqSize, CqSize);
+    }
+
+    uint8_t *Sq = mmap(0, SqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, File, IORING_OFF_SQ_RING);
+    uint8_t *Cq = Single ? Sq : mmap(0, CqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, File, IORING_OFF_CQ_RING);
+    Ring->Sqes = mmap(0, Params.sq_entries*sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, File, IORING_OFF_SQES);
+    if(Sq == MAP_FAILED || Cq == MAP_FAILED || Ring->Sqes == MAP_FAILED) {
+        close(File);
+        return false;
+    }
+
+    Ring->SqHead = (_Atomic uint32_t *)(Sq + Params.sq_off.head);
+    Ring->SqTail = (_Atomic uint32_t *)(Sq + Params.sq_off.tail);
+    Ring->SqMask = *(uint32_t *)(Sq + Params.sq_off.ring_mask);
+    Ring->SqArray = (uint32_t *)(Sq + Params.sq_off.array);
+    Ring->CqHead = (_Atomic uint32_t *)(Cq + Params.cq_off.head);
+    Ring->CqTail = (_Atomic uint32_t *)(Cq + Params.cq_off.tail);
+    Ring->CqMask = *(uint32_t *)(Cq + Params.cq_off.ring_mask);
+    Ring->Cqes = (struct io_uring_cqe *)(Cq + Params.cq_off.cqes);
+    return true;
+}
+
+// NOTE: Submits everything queued and waits for at least MinComplete completions
+static void batchRingEnter(batch_ring *Ring, uint32_t MinComplete) {
+    for(;;) {
+        long Result = syscall(__NR_io_uring_enter, Ring->File, Ring->Unsubmitted, MinComplete,
+                              MinComplete ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+        if(Result >= 0) {
+            Ring->Unsubmitted -= Result;
+            return;
+        }
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            fatalError("io_uring_enter failed: %s", strerror(errno));
+        }
+    }
+}
+
+static struct io_uring_sqe *batchRingSqe(batch_ring *Ring) {
+    uint32_t Tail = atomic_load_explicit(Ring->SqTail, memory_order_relaxed);
+    if(Tail - atomic_load_explicit(Ring->SqHead, memory_order_acquire) == Ring->Entries) {
+        batchRingEnter(Ring, 0);
+    }
+
+    uint32_t Index = Tail & Ring->SqMask;
+    struct io_uring_sqe *Sqe = Ring->Sqes + Index;
+    memset(Sqe, 0, sizeof(*Sqe));
+    Ring->SqArray[Index] = Index;
+    return Sqe;
+}
+
+static void batchRingPush(batch_ring *Ring) {
+    atomic_fetch_add_explicit(Ring->SqTail, 1, memory_order_release);
+    ++Ring->Unsubmitted;
+}
+
+static void batchSubmitOpen(batch_ring *Ring, batch_slot *Slots, int Slot) {
+    struct io_uring_sqe *Sqe = batchRingSqe(Ring);
+    Sqe->opcode = IORING_OP_OPENAT;
+    Sqe->fd = AT_FDCWD;
+    Sqe->addr = (uintptr_t)Slots[Slot].Path;
+    Sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    Sqe->user_data = (uint64_t)BatchStage_Open << 32 | Slot;
+    batchRingPush(Ring);
+}
+
+static void batchSubmitRead(batch_ring *Ring, batch_slot *Slots, int Slot) {
+    struct io_uring_sqe *Sqe = batchRingSqe(Ring);
+    Sqe->opcode = Ring->FixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    Sqe->fd = Slots[Slot].File;
+    Sqe->addr = (uintptr_t)Slots[Slot].Buffer;
+    Sqe->len = BatchBufferSize;
+    Sqe->buf_index = Slot;
+    Sqe->user_data = (uint64_t)BatchStage_Read << 32 | Slot;
+    batchRingPush(Ring);
+}
+
+static void batchSubmitClose(batch_ring *Ring, int File) {
+    struct io_uring_sqe *Sqe = batchRingSqe(Ring);
+    Sqe->opcode = IORING_OP_CLOSE;
+    Sqe->fd = File;
+    Sqe->user_data = (uint64_t)BatchStage_Close << 32;
+    batchRingPush(Ring);
+}
+
+// NOTE: Files that fill their whole buffer may be larger, the rest is read synchronously
+static uint8_t *batchReadRest(int File, uint8_t *Buffer, size_t *Size) {
+    struct stat Info;
+    if(fstat(File, &Info) != 0 || (size_t)Info.st_size <= *Size) {
+        return Buffer;
+    }
+
+    uint8_t *Whole = xMalloc(Info.st_size);
+    memcpy(Whole, Buffer, *Size);
+    while(*Size < (size_t)Info.st_size) {
+        ssize_t Read = pread(File, Whole + *Size, Info.st_size - *Size, *Size);
+        if(Read == 0 || (Read < 0 && errno != EINTR)) {
+            break;
+        }
+        *Size += max(Read, 0);
+    }
+
+    return Whole;
+}
+
+static bool batchRunUring(char **Paths, int32_t *Params, FILE *Output, batch_stats *Stats) {
+    batch_ring Ring;
+    if(!batchRingInit(&Ring, 2*BatchQueueDepth)) {
+        return false;
+    }
+
+    uint8_t *Pool = aligned_alloc(4096, BatchQueueDepth*BatchBufferSize);
+    if(!Pool) {
+        fatalError("Insufficient space available");
+    }
+
+    // NOTE: Registering pins the pool once instead of on every read, RLIMIT_MEMLOCK may forbid it
+    struct iovec Buffers[BatchQueueDepth];
+    batch_slot Slots[BatchQueueDepth];
+    for(int Slot = 0; Slot < BatchQueueDepth; ++Slot) {
+        Slots[Slot] = (batch_slot){.Buffer = Pool + Slot*BatchBufferSize, .File = -1};
+        Buffers[Slot] = (struct iovec){Slots[Slot].Buffer, BatchBufferSize};
+    }
+    Ring.FixedBuffers = syscall(__NR_io_uring_register, Ring.File, IORING_REGISTER_BUFFERS, Buffers, BatchQueueDepth) == 0;
+    Stats->Reader = Ring.FixedBuffers ? "io_uring, fixed buffers" : "io_uring";
+
+    size_t Next = 0, InFlight = 0;
+    for(int Slot = 0; Slot < BatchQueueDepth && Next < bufLength(Paths); ++Slot) {
+        Slots[Slot].Path = Paths[Next++];
+        batchSubmitOpen(&Ring, Slots, Slot);
+        ++InFlight;
+    }
+
+    char Line[BatchLineSize];
+    while(InFlight) {
+        batchRingEnter(&Ring, 1);
+
+        uint32_t Head = atomic_load_explicit(Ring.CqHead, memory_order_relaxed);
+        uint32_t Tail = atomic_load_explicit(Ring.CqTail, memory_order_acquire);
+        for(; Head != Tail; ++Head) {
+            struct io_uring_cqe *Cqe = Ring.Cqes + (Head & Ring.CqMask);
+            batch_stage Stage = Cqe->user_data >> 32;
+            int Slot = (uint32_t)Cqe->user_data;
+            int Result = Cqe->res;
+            --InFlight;
+
+            if(Stage == BatchStage_Close) {
+                continue;
+            }
+
+            batch_slot *Entry = Slots + Slot;
+            if(Stage == BatchStage_Open && Result >= 0) {
+                Entry->File = Result;
+                batchSubmitRead(&Ring, Slots, Slot);
+                ++InFlight;
+                continue;
+            }
+
+            bool Failed = true;
+            int Length;
+            if(Result < 0) {
+                Length = batchError(Entry->Path, -Result, Line);
+            } else {
+                size_t Size = Result;
+                uint8_t *Code = Size == BatchBufferSize ? batchReadRest(Entry->File, Entry->Buffer, &Size) : Entry->Buffer;
+                Length = batchExecute(Entry->Path, Code, Size, Params, Line, &Failed);
+                if(Code != Entry->Buffer) {
+                    free(Code);
+                }
+            }
+            fwrite(Line, 1, min(Length, BatchLineSize - 1), Output);
+            ++Stats->Files;
+            Stats->Failed += Failed;
+
+            if(Entry->File >= 0) {
+                batchSubmitClose(&Ring, Entry->File);
+                ++InFlight;
+                Entry->File = -1;
+            }
+            if(Next < bufLength(Paths)) {
+                Entry->Path = Paths[Next++];
+                batchSubmitOpen(&Ring, Slots, Slot);
+                ++InFlight;
+            }
+        }
+        atomic_store_explicit(Ring.CqHead, Head, memory_order_release);
+    }
+
+    close(Ring.File);
+    free(Pool);
+    return true;
+}
+
+// Thread pool fallback
+
+typedef struct batch_job {
+    char **Paths;
+    int32_t *Params;
+    uint8_t *Buffers;
+    char (*Lines)[BatchLineSize];
+    bool Failed[BatchChunk];
+} batch_job;
+
+static void batchReadTask(void *Data, size_t Index) {
+    batch_job *Job = Data;
+    char *Path = Job->Paths[Index];
+    char *Line = Job->Lines[Index];
+    Job->Failed[Index] = true;
+
+    int File = open(Path, O_RDONLY | O_CLOEXEC);
+    if(File < 0) {
+        batchError(Path, errno, Line);
+        return;
+    }
+
+    uint8_t *Buffer = Job->Buffers + Index*BatchBufferSize;
+    ssize_t Read;
+    do {
+        Read = read(File, Buffer, BatchBufferSize);
+    } while(Read < 0 && errno == EINTR);
+
+    if(Read < 0) {
+        batchError(Path, errno, Line);
+    } else {
+        size_t Size = Read;
+        uint8_t *Code = Size == BatchBufferSize ? batchReadRest(File, Buffer, &Size) : Buffer;
+        batchExecute(Path, Code, Size, Job->Params, Line, Job->Failed + Index);
+        if(Code != Buffer) {
+            free(Code);
+        }
+    }
+
+    close(File);
+}
+
+static void batchRunThreads(char **Paths, int32_t *Params, int ThreadCount, FILE *Output, batch_stats *Stats) {
+    thread_pool Pool;
+    threadPoolInit(&Pool, ThreadCount);
+    Stats->Reader = "thread pool";
+
+    static batch_job Job;
+    Job.Params = Params;
+    Job.Buffers = xMalloc((size_t)BatchChunk*BatchBufferSize);
+    Job.Lines = xMalloc(BatchChunk*sizeof(*Job.Lines));
+
+    for(size_t First = 0; First < bufLength(Paths); First += BatchChunk) {
+        size_t Count = min(BatchChunk, bufLength(Paths) - First);
+        Job.Paths = Paths + First;
+        threadPoolRun(&Pool, batchReadTask, &Job, Count);
+
+        for(size_t Index = 0; Index < Count; ++Index) {
+            fputs(Job.Lines[Index], Output);
+            Stats->Failed += Job.Failed[Index];
+        }
+        Stats->Files += Count;
+    }
+
+    free(Job.Lines);
+    free(Job.Buffers);
+    threadPoolFree(&Pool);
+}
+
+static void batchRun(char *ListPath, int32_t *Params, batch_reader Reader, int ThreadCount) {
+    char *List;
+    char **Paths = batchReadList(ListPath, &List);
+
+    static char OutputBuffer[1 << 16];
+    setvbuf(stdout, OutputBuffer, _IOFBF, sizeof(OutputBuffer));
+
+    batch_stats Stats = {};
+    double Start = perfSeconds();
+    if(Reader == BatchReader_Threads || !batchRunUring(Paths, Params, stdout, &Stats)) {
+        if(Reader == BatchReader_Uring) {
+            fatalError("io_uring is not available: %s", strerror(errno));
+        }
+        batchRunThreads(Paths, Params, ThreadCount, stdout, &Stats);
+    }
+    double Seconds = perfSeconds() - Start;
+    fflush(stdout);
+
+    fprintf(stderr, "%zu files, %zu failed, %.3f s, %.0f files/s (%s)\n", Stats.Files, Stats.Failed, Seconds,
+            Stats.Files/Seconds, Stats.Reader);
+
+    bufFree(Paths);
+    free(List);
+}
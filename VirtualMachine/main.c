@@ -1,107 +1,422 @@
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
 
 #include <instruction_table.h>
 #include <common.c>
+#include <bits.c>
+#include <stretchy.c>
+#include <memory.c>
+#include <vm.c>
+#include <bigint.c>
+#include <bigvm.c>
+#include <montgomery.c>
+#include <modvm.c>
+#include <widevm.c>
+#include <debug.c>
+#include <perf.c>
+#include <threadpool.c>
+#include <module.c>
 
-#define push(x) *Top++ = (x)
-#define pop() *--Top
-#define pushes(x) assert(Top+(x) - Stack <= StackSize)
-#define pops(x) assert(Top - (x) >= Stack)
-
-#define unaOpCase(M, Op)                        \
-    case M: {                                   \
-        pops(1);                                \
-        int32_t val = pop();                    \
-        pushes(1);                              \
-        push(Op val);                           \
-    } break
-
-#define binOpCase(M, Op)                        \
-    case M: {                                   \
-        pops(2);                                \
-        int32_t rhs = pop();                    \
-        int32_t lhs = pop();                    \
-        pushes(1);                              \
-        push(lhs Op rhs);                       \
-    } break
-
-#define binFnCase(M, Fun)                       \
-    case M: {                                   \
-        pops(2);                                \
-        int32_t rhs = pop();                    \
-        int32_t lhs = pop();                    \
-        pushes(1);                              \
-        push(Fun(lhs, rhs));                    \
-    } break
-
-
-static int32_t executeVm(uint8_t *Code) {
-    enum { StackSize = 1<<10 };
-    int32_t Stack[StackSize];
-    int32_t *Top = Stack;
-
-    for(;;) {
-        mnemonic Op = *Code++;
-        switch(Op) {
-            case HALT:
-            {
-                pops(1);
-                return pop();
-            } break;
-
-            case LIT:
-            {
-                pushes(1);
-                int32_t Value;
-                Value  = (*Code++) <<  0;
-                Value |= (*Code++) <<  8;
-                Value |= (*Code++) << 16;
-                Value |= (*Code++) << 24;
-                push(Value);
-            } break;
-
-            binOpCase(ADD,  +);
-            binOpCase(SUB,  -);
-            binOpCase(MUL,  *);
-            binOpCase(DIV,  /);
-            binOpCase(OR,   |);
-            binOpCase(XOR,  ^);
-            binOpCase(AND,  &);
-            unaOpCase(NOT,  ~);
-            binOpCase(LSH, <<);
-            binOpCase(RSH, >>);
-            binOpCase(MOD,  %);
-            unaOpCase(SYM,  -);
-            binFnCase(POW, pow);
-
-            case NOP: {} break;
-
-            default:
-            {
-                fatalError("Illegal opcode.");
-                break;
-            } break;
+#include "batch.c"
+
+enum {
+    HotSpanRows = 10,
+    AnnotateWidth = 100,
+};
+
+typedef struct hot_span {
+    source_span Span;
+    uint64_t Self;
+    uint64_t Inclusive;
+    uint64_t Count;
+} hot_span;
+
+static int compareHotSpans(const void *A, const void *B) {
+    uint64_t Lhs = ((hot_span *)A)->Inclusive, Rhs = ((hot_span *)B)->Inclusive;
+    return (Lhs < Rhs) - (Lhs > Rhs);
+}
+
+static bool spanContains(source_span Outer, source_span Inner) {
+    return Outer.Start <= Inner.Start && Inner.End <= Outer.End;
+}
+
+// NOTE: Prints Length bytes of source on one line, the expression may span several
+static void printSourceLine(FILE *File, char *Source, size_t Length) {
+    for(size_t Index = 0; Index < Length; ++Index) {
+        fputc(Source[Index] == '\n' || Source[Index] == '\t' || Source[Index] == '\r' ? ' ' : Source[Index], File);
+    }
+}
+
+static void printMarker(FILE *File, source_span Span, uint32_t From, uint32_t To) {
+    for(uint32_t At = From; At < To; ++At) {
+        fputc(At < Span.Start || At >= Span.End ? ' ' : At == Span.Start ? '^' : '~', File);
+    }
+}
+
+// NOTE: Code is emitted in post-order, so the instructions of a subexpression directly precede
+// its own. A stack of pending children turns per-instruction samples into inclusive totals.
+static void reportHotSpans(FILE *File, debug_info *Debug, vm_profile *Profile) {
+    uint64_t *Samples = Profile->OffsetCycles;
+    uint64_t Total = 0;
+    for(size_t Index = 0; Index < bufLength(Debug->Spans); ++Index) {
+        Total += Samples[Debug->Spans[Index].Offset];
+    }
+
+    // NOTE: Without a timestamp counter the report falls back to execution counts
+    char *Metric = "cycles";
+    if(!Total) {
+        Samples = Profile->OffsetCounts;
+        Metric = "executions";
+        for(size_t Index = 0; Index < bufLength(Debug->Spans); ++Index) {
+            Total += Samples[Debug->Spans[Index].Offset];
         }
     }
+    if(!Total) {
+        return;
+    }
 
-    return 0;
+    hot_span *Spans = 0;
+    hot_span *Pending = 0;
+    for(size_t Index = 0; Index < bufLength(Debug->Spans); ++Index) {
+        debug_span *Entry = Debug->Spans + Index;
+        hot_span Hot = {
+            .Span = Entry->Span,
+            .Self = Samples[Entry->Offset],
+            .Count = Profile->OffsetCounts[Entry->Offset],
+        };
+
+        Hot.Inclusive = Hot.Self;
+        while(bufLength(Pending) && spanContains(Hot.Span, Pending[bufLength(Pending) - 1].Span)) {
+            Hot.Inclusive += Pending[--bufHeader_(Pending)->Length].Inclusive;
+        }
+
+        bufPush(Pending, Hot);
+        bufPush(Spans, Hot);
+    }
+
+    qsort(Spans, bufLength(Spans), sizeof(*Spans), compareHotSpans);
+
+    fprintf(File, "\nhot subexpressions (%% of %s, inclusive / self, executions):\n", Metric);
+    bool Fits = Debug->SourceLength <= AnnotateWidth;
+    if(Fits) {
+        fprintf(File, "  ");
+        printSourceLine(File, Debug->Source, Debug->SourceLength);
+        fprintf(File, "\n");
+    }
+
+    int Rows = 0;
+    for(size_t Index = 0; Index < bufLength(Spans) && Rows < HotSpanRows; ++Index) {
+        hot_span *Hot = Spans + Index;
+        // NOTE: The whole expression is always 100%
+        if(Hot->Inclusive == Total && bufLength(Spans) > 1) {
+            continue;
+        }
+
+        uint32_t From = 0, To = Debug->SourceLength;
+        if(!Fits) {
+            From = Hot->Span.Start > 10 ? Hot->Span.Start - 10 : 0;
+            From = min(From, Debug->SourceLength - AnnotateWidth);
+            To = From + AnnotateWidth;
+            fprintf(File, "  %s", From ? "..." : "");
+            printSourceLine(File, Debug->Source + From, To - From);
+            fprintf(File, "%s\n", To < Debug->SourceLength ? "..." : "");
+        }
+
+        fprintf(File, "  %s", From ? "   " : "");
+        printMarker(File, Hot->Span, From, To);
+        fprintf(File, "  %6.2f%% / %6.2f%% %12llu\n", 100.0*Hot->Inclusive/Total, 100.0*Hot->Self/Total,
+                (unsigned long long)Hot->Count);
+        ++Rows;
+    }
+
+    bufFree(Spans);
+    bufFree(Pending);
+}
+
+
+// NOTE: Every run starts from an empty arena, only the parameters are kept across runs
+static void executeBig(uint8_t *Code, char **Args, int ArgCount, long Repeat) {
+    arena ParamArena = {}, Arena = {};
+    bigint Params[MaxParamCount] = {};
+    for(int Index = 0; Index < ArgCount && Index < MaxParamCount; ++Index) {
+        if(!bigParse(&ParamArena, Args[Index], strlen(Args[Index]), Params + Index)) {
+            fatalError("Invalid integer parameter: %s", Args[Index]);
+        }
+    }
+
+    perfBegin(Phase_Execute);
+    bigint Result = {};
+    for(long Run = 0; Run < Repeat; ++Run) {
+        arenaFree(&Arena);
+        Result = executeBigVm(&Arena, Code, Params);
+    }
+    perfEnd(Phase_Execute);
+
+    char *Text = 0;
+    bigFormat(&Text, Result);
+    bufPush(Text, 0);
+    printf("Result: %s\n", Text);
+    perfReport();
+
+    bufFree(Text);
+    arenaFree(&Arena);
+    arenaFree(&ParamArena);
+}
+
+static void executeMod(uint8_t *Code, uint32_t Modulus, int32_t *Params, long Repeat) {
+    montgomery Mont;
+    if(!montInit(&Mont, Modulus)) {
+        fatalError("Invalid modulus %u", Modulus);
+    }
+
+    perfBegin(Phase_Execute);
+    uint32_t Result = 0;
+    for(long Run = 0; Run < Repeat; ++Run) {
+        Result = executeModVm(&Mont, Code, Params);
+    }
+    perfEnd(Phase_Execute);
+
+    printf("Result: %u\n", Result);
+    perfReport();
+}
+
+static void executeWide(uint8_t *Code, char **Args, int ArgCount, long Repeat) {
+    int64_t Params[MaxParamCount] = {};
+    for(int Index = 0; Index < ArgCount && Index < MaxParamCount; ++Index) {
+        Params[Index] = strtoll(Args[Index], 0, 0);
+    }
+
+    perfBegin(Phase_Execute);
+    int64_t Result = 0;
+    for(long Run = 0; Run < Repeat; ++Run) {
+        Result = executeWideVm(Code, Params);
+    }
+    perfEnd(Phase_Execute);
+
+    printf("Result: %lld\n", (long long)Result);
+    perfReport();
+}
+
+static void usage(char *Program) {
+    fprintf(stderr, "Usage: %s [--perf-counters[=json]] [--profile | --bigint | --mod P] [--repeat N]\n"
+                    "          [--entry N] FILE [PARAM...]\n",
+            Program);
+    fprintf(stderr, "       %s [--perf-counters[=json]] [--reader uring|threads] [--threads N]\n"
+                    "          --batch LISTFILE [PARAM...]\n", Program);
+    fprintf(stderr, "  --perf-counters  Print hardware counters per phase to stderr as a table or JSON\n");
+    fprintf(stderr, "  --profile        Print opcode and opcode pair frequencies, cycles per opcode and\n");
+    fprintf(stderr, "                   the maximum stack depth to stderr. Programs compiled with --debug\n");
+    fprintf(stderr, "                   also get their source annotated with the hottest subexpressions\n");
+    fprintf(stderr, "  --bigint         Evaluate with arbitrary precision integers, parameters may have any\n");
+    fprintf(stderr, "                   size. The program must be compiled with the same --bigint\n");
+    fprintf(stderr, "  --mod P          Evaluate modulo P, the program must be compiled with the same --mod P\n");
+    fprintf(stderr, "  --repeat N       Execute the program N times\n");
+    fprintf(stderr, "  --entry N        Run entry N of a module written by compiler --batch\n");
+    fprintf(stderr, "  --batch LISTFILE Run every program listed in LISTFILE, one path per line, and print\n");
+    fprintf(stderr, "                   a \"PATH: RESULT\" line each as it completes\n");
+    fprintf(stderr, "  --reader R       Read batches through io_uring or a thread pool (default: io_uring\n");
+    fprintf(stderr, "                   where available)\n");
+    fprintf(stderr, "  --threads N      Threads of the thread pool reader (default %d)\n", BatchDefaultThreads);
+    fprintf(stderr, "Programs compiled with --wide run on 64 bits and take 64-bit parameters.\n");
+    exit(1);
 }
 
 int main(int ArgCount, char *ArgVal[]) {
-    if(ArgCount < 2) {
-        fprintf(stderr, "Usage: %s FILE\n", ArgVal[0]);
-        exit(1);
+    bool Profiling = false;
+    bool Big = false;
+    uint32_t Modulus = 0;
+    long Repeat = 1;
+    long Entry = -1;
+    char *BatchList = 0;
+    batch_reader Reader = BatchReader_Auto;
+    int ThreadCount = BatchDefaultThreads;
+
+    int First = 1;
+    for(; First < ArgCount; ++First) {
+        if(strcmp(ArgVal[First], "--profile") == 0) {
+            Profiling = true;
+        }
+        else if(strcmp(ArgVal[First], "--bigint") == 0) {
+            Big = true;
+        }
+        else if(strcmp(ArgVal[First], "--mod") == 0 && First+1 < ArgCount) {
+            char *End;
+            unsigned long long Value = strtoull(ArgVal[++First], &End, 0);
+            if(*End || Value == 0 || Value > UINT32_MAX) {
+                usage(ArgVal[0]);
+            }
+            Modulus = Value;
+        }
+        else if(strcmp(ArgVal[First], "--repeat") == 0 && First+1 < ArgCount) {
+            Repeat = strtol(ArgVal[++First], 0, 0);
+            if(Repeat < 1) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[First], "--entry") == 0 && First+1 < ArgCount) {
+            char *End;
+            Entry = strtol(ArgVal[++First], &End, 0);
+            if(*End || Entry < 0 || Entry > UINT32_MAX) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[First], "--batch") == 0 && First+1 < ArgCount) {
+            BatchList = ArgVal[++First];
+        }
+        else if(strcmp(ArgVal[First], "--reader") == 0 && First+1 < ArgCount) {
+            char *Name = ArgVal[++First];
+            if(strcmp(Name, "uring") == 0) {
+                Reader = BatchReader_Uring;
+            } else if(strcmp(Name, "threads") == 0) {
+                Reader = BatchReader_Threads;
+            } else {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(strcmp(ArgVal[First], "--threads") == 0 && First+1 < ArgCount) {
+            ThreadCount = atoi(ArgVal[++First]);
+            if(ThreadCount < 1) {
+                usage(ArgVal[0]);
+            }
+        }
+        else if(!perfParseOption(ArgVal[First])) {
+            break;
+        }
+    }
+
+    if((First >= ArgCount && !BatchList) || ((Big || Modulus) && (Profiling || BatchList)) || (Big && Modulus)) {
+        usage(ArgVal[0]);
+    }
+
+    perfInit();
+
+    // NOTE: In batch mode all remaining arguments are parameters shared by every program
+    if(BatchList) {
+        if(Profiling) {
+            usage(ArgVal[0]);
+        }
+
+        int32_t Params[MaxParamCount] = {};
+        for(int Index = First; Index < ArgCount && Index-First < MaxParamCount; ++Index) {
+            Params[Index-First] = strtol(ArgVal[Index], 0, 0);
+        }
+
+        perfBegin(Phase_Execute);
+        batchRun(BatchList, Params, Reader, ThreadCount);
+        perfEnd(Phase_Execute);
+        perfReport();
+        return 0;
     }
 
-    uint8_t *Code = readEntireFile(ArgVal[1]);
+    size_t CodeSize;
+    perfBegin(Phase_Load);
+    uint8_t *Code = readEntireFile(ArgVal[First], &CodeSize);
+    // NOTE: An entry is an ordinary program, everything below works on it unchanged
+    if(moduleIs(Code, CodeSize)) {
+        if(Entry < 0) {
+            fatalError("%s is a module of %u programs, pick one with --entry N", ArgVal[First],
+                       moduleEntryCount(Code));
+        }
+        if(!moduleEntry(Code, CodeSize, Entry, &Code, &CodeSize)) {
+            fatalError("%s has no entry %ld", ArgVal[First], Entry);
+        }
+        if(!Code) {
+            fatalError("Entry %ld of %s did not compile", Entry, ArgVal[First]);
+        }
+    } else if(Entry >= 0) {
+        fatalError("%s is a single program, not a module", ArgVal[First]);
+    }
+    perfEnd(Phase_Load);
+
+    // NOTE: Wide programs carry their own header, the other modes have nothing to run them with
+    if(wideProgram(Code, CodeSize)) {
+        if(Big || Modulus || Profiling) {
+            fatalError("%s was compiled with --wide, run it without --profile, --bigint or --mod", ArgVal[First]);
+        }
+        executeWide(Code, ArgVal + First + 1, ArgCount - First - 1, Repeat);
+        return 0;
+    }
+
+    // NOTE: Only bytecode compiled for arbitrary precision computes the same value with it
+    if(bigProgram(Code, CodeSize) != Big) {
+        if(Big) {
+            fatalError("%s was not compiled with --bigint", ArgVal[First]);
+        }
+        fatalError("%s was compiled with --bigint, run it with the same option", ArgVal[First]);
+    }
+    if(Big) {
+        executeBig(Code, ArgVal + First + 1, ArgCount - First - 1, Repeat);
+        return 0;
+    }
+
+    int32_t Params[MaxParamCount] = {};
+    for(int Index = First+1; Index < ArgCount && Index-First-1 < MaxParamCount; ++Index) {
+        Params[Index-First-1] = strtol(ArgVal[Index], 0, 0);
+    }
+
+    // NOTE: Modular bytecode only makes sense for the modulus its literals were converted for
+    uint32_t Compiled = 0;
+    modProgramModulus(Code, CodeSize, &Compiled);
+    if(Compiled != Modulus) {
+        if(Compiled) {
+            fatalError("%s was compiled with --mod %u, run it with the same option", ArgVal[First], Compiled);
+        }
+        fatalError("%s was not compiled with --mod", ArgVal[First]);
+    }
+    if(Modulus) {
+        executeMod(Code, Modulus, Params, Repeat);
+        return 0;
+    }
+
+    // NOTE: Profiling runs a separately compiled loop, executeVm() stays uninstrumented
+    static vm_profile Profile;
+    vmProfileInit(&Profile);
 
-    printf("Result: %d\n", executeVm(Code));
+    debug_info Debug;
+    bool HasDebug = Profiling && debugSectionRead(Code, CodeSize, &Debug);
+    if(HasDebug) {
+        Profile.Base = Code;
+        Profile.OffsetCounts = xMalloc(Debug.CodeSize*sizeof(uint64_t));
+        Profile.OffsetCycles = xMalloc(Debug.CodeSize*sizeof(uint64_t));
+        memset(Profile.OffsetCounts, 0, Debug.CodeSize*sizeof(uint64_t));
+        memset(Profile.OffsetCycles, 0, Debug.CodeSize*sizeof(uint64_t));
+    }
+
+    perfBegin(Phase_Execute);
+    int32_t Result = 0;
+    for(long Run = 0; Run < Repeat; ++Run) {
+        Result = Profiling ? executeVmProfiled(Code, Params, &Profile) : executeVm(Code, Params);
+    }
+    perfEnd(Phase_Execute);
+
+    printf("Result: %d\n", Result);
+    perfReport();
+    if(Profiling) {
+        vmProfileReport(stderr, &Profile, 20);
+    }
+    if(HasDebug) {
+        reportHotSpans(stderr, &Debug, &Profile);
+    }
 
     return 0;
 }